@@ -0,0 +1,76 @@
+#ifndef BIT_SLICED_COUNTER_H_INCLUDED
+#define BIT_SLICED_COUNTER_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Contadores de Bits bits, uno por cada bit de Word, almacenados por
+ * planos: el plano b contiene el bit b de todos los contadores. Cada
+ * operacion sobre todos ellos cuesta Bits operaciones de palabra, sin
+ * importar cuantos contadores haya.
+ * \tparam Word: Tipo de palabra. Un contador por bit
+ * \tparam Bits: Bits de cada contador
+ */
+template<typename Word, size_t Bits>
+class BitSlicedCounter {
+	public:
+		static const uint32_t MAX = (1U << Bits) - 1; ///<Valor maximo de cada contador
+
+		BitSlicedCounter() {
+			clear(~Word(0));
+		}
+
+		/**
+		 * \brief Incrementa los contadores seleccionados. Se saturan en MAX
+		 */
+		void increment(Word mask) {
+			Word carry = mask & ~equals(MAX);
+			for(size_t b = 0; b < Bits && carry; ++b) {
+				const Word plane = m_planes[b];
+				m_planes[b] = plane ^ carry;
+				carry &= plane;
+			}
+		}
+
+		/**
+		 * \brief Pone a cero los contadores seleccionados
+		 */
+		void clear(Word mask) {
+			for(size_t b = 0; b < Bits; ++b) {
+				m_planes[b] &= ~mask;
+			}
+		}
+
+		/**
+		 * \brief Carga un valor en los contadores seleccionados
+		 */
+		void load(Word mask, uint32_t value) {
+			for(size_t b = 0; b < Bits; ++b) {
+				if((value >> b) & 1) {
+					m_planes[b] |= mask;
+				} else {
+					m_planes[b] &= ~mask;
+				}
+			}
+		}
+
+		/**
+		 * \brief Devuelve los contadores que valen value
+		 */
+		Word equals(uint32_t value) const {
+			Word result = ~Word(0);
+			for(size_t b = 0; b < Bits; ++b) {
+				result &= ((value >> b) & 1) ? m_planes[b] : ~m_planes[b];
+			}
+			return result;
+		}
+
+
+
+	private:
+		Word		m_planes[Bits];
+
+};
+
+#endif //BIT_SLICED_COUNTER_H_INCLUDED
@@ -0,0 +1,428 @@
+#ifndef BLACK_BOX_H_INCLUDED
+#define BLACK_BOX_H_INCLUDED
+
+#include "mbed.h"
+#include "GestureRecognizer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+
+/**
+ * \brief Caja negra: graba siempre las tramas de botones que cambian y los
+ * eventos del panel, con marca de tiempo en microsegundos, para poder
+ * reconstruir despues lo que vio el panel.
+ *
+ * El anillo se divide en bloques de BLOCK_SIZE bytes. Cada bloque empieza con
+ * un registro SYNC con el tiempo absoluto, el estado de los botones y el
+ * contexto (p.e. el estado del mezclador), por lo que se decodifica sin los
+ * anteriores; al llenarse el anillo se pierde el bloque mas antiguo entero.
+ * El resto de registros guardan el tiempo desde el anterior (LEB128):
+ *   - TOGGLE: 0b000iiiii, dt. Ha cambiado solo el boton i
+ *   - FRAME: 0b0010000g, dt, xor (4 bytes LE). Si g, siguen los gestos:
+ *     longPress, repeat y doubleTap (4 bytes LE cada uno)
+ *   - EVENT: 0b010ccccc, dt, arg. Evento c (Event)
+ *   - SYNC: 0b01100000, sequence, time, state, context (4 bytes LE cada uno)
+ *   - 0xFF: fin del bloque
+ * Cada TOGGLE o FRAME es una llamada a MixerController::process(), por lo que
+ * un volcado puede reproducirse bit a bit (sim/BlackBoxReplay.cpp). Una trama
+ * sin cambios ni gestos no se graba.
+ *
+ * Los datos (Storage) no tienen constructor, para poder ubicarlos en memoria
+ * que no se inicializa al arrancar (AHB_BANK1_NOINIT): tras un reinicio sin
+ * perdida de alimentacion start() conserva la grabacion anterior.
+ */
+class BlackBox {
+	public:
+		///Eventos grabados. arg = senal (0xFF = ninguna) o boton
+		enum Event {
+			EVENT_BOOT,
+			EVENT_PROGRAM,
+			EVENT_PREVIEW,
+			EVENT_CUT,
+			EVENT_TRANSITION,
+			EVENT_PIN,
+			EVENT_MACRO_PROGRAM, ///<Paso de macro. Se reproduce con selectProgram()
+			EVENT_MACRO_PREVIEW, ///<Paso de macro. Se reproduce con selectPreview()
+			EVENT_MACRO_CUT, ///<Paso de macro. Se reproduce con cut()
+			EVENT_MACRO_TRANSITION, ///<Paso de macro. Se reproduce con transition()
+			EVENT_CHAIN_FAULT,
+			EVENT_CHAIN_OK,
+			EVENT_MASK,
+			EVENT_UNMASK,
+			EVENT_LINK_PROGRAM, ///<Accion de un enlace. Se reproduce con selectProgram()
+			EVENT_LINK_PREVIEW, ///<Accion de un enlace. Se reproduce con selectPreview()
+			EVENT_LINK_CUT, ///<Accion de un enlace. Se reproduce con cut()
+			EVENT_LINK_TRANSITION, ///<Accion de un enlace. Se reproduce con transition()
+			EVENT_LINK_STATE, ///<Estado impuesto por un enlace (stateArg()). Se reproduce con setState()
+
+			//Add here
+
+			EVENT_COUNT
+		};
+
+		///Tipos de registro, en los 3 bits altos de su primer byte
+		enum Kind {
+			KIND_TOGGLE = 0x00,
+			KIND_FRAME = 0x20,
+			KIND_EVENT = 0x40,
+			KIND_SYNC = 0x60,
+			KIND_END = 0xE0 ///<Byte 0xFF
+		};
+
+		static const size_t BLOCK_SIZE = 256;
+		static const size_t BLOCKS = 31; ///<8KB con la cabecera
+		static const uint8_t KIND_MASK = 0xE0; ///<Bits del tipo en el primer byte
+		static const uint8_t FRAME_GESTURES = 0x01; ///<Bit g de FRAME
+		static const size_t SYNC_LENGTH = 17;
+
+		typedef ButtonGestures<uint32_t> Gestures;
+
+		///Datos de la caja negra. Sin constructor
+		struct Storage {
+			uint32_t	magic;
+			uint32_t	sequence; ///<Numero del bloque actual
+			uint32_t	offset; ///<Siguiente byte del bloque actual
+			uint8_t		blocks[BLOCKS][BLOCK_SIZE]; ///<El bloque n esta en n % BLOCKS
+		};
+
+		///Registro decodificado
+		struct Record {
+			uint8_t		kind; ///<Kind
+			uint8_t		index; ///<TOGGLE: boton. EVENT: Event
+			uint32_t	time; ///<Tiempo desde el registro anterior. SYNC: tiempo absoluto
+			uint32_t	value; ///<FRAME: botones que cambian. EVENT: arg. SYNC: estado
+			uint32_t	sequence; ///<SYNC: bloque
+			uint32_t	context; ///<SYNC: contexto
+			Gestures	gestures; ///<FRAME
+		};
+
+		///Trozo de un volcado. Apunta a los datos grabados
+		struct Chunk {
+			uint32_t				sequence; ///<Bloque
+			size_t					offset; ///<Posicion en el bloque. 0 = comienzo
+			const uint8_t*	data;
+			size_t					length;
+		};
+
+		/**
+		 * \brief Constructor
+		 * \param storage: Datos. Deben sobrevivir al objeto
+		 */
+		explicit BlackBox(Storage& storage)
+			: m_storage(storage)
+			, m_state(0)
+			, m_context(0)
+			, m_lastUs(0)
+			, m_started(false)
+			, m_dumping(false)
+			, m_dumpSequence(0)
+			, m_dumpOffset(0)
+		{
+		}
+
+		/**
+		 * \brief Comienza a grabar. Si los datos son validos se conservan y se
+		 * empieza un bloque nuevo con un evento EVENT_BOOT. Hasta entonces no
+		 * se graba nada
+		 * \param state: Estado inicial de los botones
+		 * \param context: Contexto inicial
+		 */
+		void start(uint32_t state, uint32_t context) {
+			m_state = state;
+			m_context = context;
+
+			const bool valid =	m_storage.magic == MAGIC &&
+													m_storage.offset >= SYNC_LENGTH &&
+													m_storage.offset <= BLOCK_SIZE;
+			const uint32_t now = us_ticker_read();
+			if(valid) {
+				openBlock(m_storage.sequence + 1, now);
+			} else {
+				m_storage.magic = MAGIC;
+				openBlock(0, now);
+			}
+			m_started = true;
+			recordEvent(EVENT_BOOT, 0);
+		}
+
+		/**
+		 * \brief Devuelve el argumento de EVENT_LINK_STATE: el programa en los 4
+		 * bits bajos y el previo en los altos. 0xF = ninguna
+		 * \param program: Senal en programa. 0xFF = ninguna
+		 * \param preview: Senal en previo. 0xFF = ninguna
+		 */
+		static uint8_t stateArg(uint8_t program, uint8_t preview) {
+			return static_cast<uint8_t>((program & 0x0F) | (preview << 4));
+		}
+
+		/**
+		 * \brief Anota el contexto que se guardara en los siguientes SYNC
+		 */
+		void setContext(uint32_t context) {
+			m_context = context;
+		}
+
+		/**
+		 * \brief Graba una trama si ha cambiado o trae gestos. Una trama sin
+		 * cambios solo cuesta la comparacion
+		 * \param state: Botones, como los recibe el destino de la grabacion
+		 * \param gestures: Gestos de la trama
+		 */
+		void recordFrame(uint32_t state, const Gestures& gestures) {
+			const uint32_t changed = state ^ m_state;
+			const uint32_t gesture = gestures.longPress | gestures.repeat | gestures.doubleTap;
+			if(!(changed | gesture) || !m_started) {
+				return;
+			}
+
+			const uint32_t now = us_ticker_read();
+			if(!gesture && !(changed & (changed - 1))) {
+				//Un solo boton: 1 byte mas el tiempo
+				uint8_t* p = reserve(1 + VARINT_MAX, now);
+				*p++ = static_cast<uint8_t>(KIND_TOGGLE | (31 - __CLZ(changed)));
+				p = putVarint(p, now - m_lastUs);
+				commit(p, now);
+			} else {
+				uint8_t* p = reserve(1 + VARINT_MAX + 4*4, now);
+				*p++ = static_cast<uint8_t>(KIND_FRAME | (gesture ? FRAME_GESTURES : 0));
+				p = putVarint(p, now - m_lastUs);
+				p = putWord(p, changed);
+				if(gesture) {
+					p = putWord(p, gestures.longPress);
+					p = putWord(p, gestures.repeat);
+					p = putWord(p, gestures.doubleTap);
+				}
+				commit(p, now);
+			}
+			m_state = state;
+		}
+
+		/**
+		 * \brief Graba un evento
+		 */
+		void recordEvent(Event event, uint8_t arg) {
+			if(!m_started) {
+				return;
+			}
+
+			const uint32_t now = us_ticker_read();
+			uint8_t* p = reserve(2 + VARINT_MAX, now);
+			*p++ = static_cast<uint8_t>(KIND_EVENT | event);
+			p = putVarint(p, now - m_lastUs);
+			*p++ = arg;
+			commit(p, now);
+		}
+
+		/**
+		 * \brief Comienza un volcado desde el bloque mas antiguo. Si ya hay uno
+		 * en marcha no hace nada
+		 */
+		void startDump() {
+			if(!m_dumping) {
+				m_dumping = true;
+				m_dumpSequence = getOldest();
+				m_dumpOffset = 0;
+			}
+		}
+
+		bool isDumping() const {
+			return m_dumping;
+		}
+
+		/**
+		 * \brief Devuelve el siguiente trozo del volcado, que nunca pasa de un
+		 * bloque a otro. Llamar desde el mismo contexto que la grabacion. Si la
+		 * grabacion alcanza al volcado, este salta al bloque mas antiguo: el
+		 * bloque que se estaba volcando queda incompleto
+		 * \param max: Bytes maximos del trozo
+		 * \returns false si el volcado ha terminado
+		 */
+		bool readDump(Chunk& chunk, size_t max) {
+			if(!m_dumping) {
+				return false;
+			}
+
+			const uint32_t oldest = getOldest();
+			if(m_dumpSequence < oldest) {
+				m_dumpSequence = oldest;
+				m_dumpOffset = 0;
+			}
+
+			//Los bloques completos se vuelcan enteros y el actual hasta donde se ha escrito
+			size_t end = (m_dumpSequence == m_storage.sequence) ? m_storage.offset : BLOCK_SIZE;
+			if(m_dumpOffset == end) {
+				if(m_dumpSequence == m_storage.sequence) {
+					m_dumping = false;
+					return false;
+				}
+				++m_dumpSequence;
+				m_dumpOffset = 0;
+				end = (m_dumpSequence == m_storage.sequence) ? m_storage.offset : BLOCK_SIZE;
+			}
+
+			chunk.sequence = m_dumpSequence;
+			chunk.offset = m_dumpOffset;
+			chunk.data = m_storage.blocks[m_dumpSequence % BLOCKS] + m_dumpOffset;
+			chunk.length = (end - m_dumpOffset < max) ? end - m_dumpOffset : max;
+			m_dumpOffset += chunk.length;
+			return true;
+		}
+
+
+
+		/**
+		 * \brief Decodifica el registro que empieza en data, p.e. al reproducir
+		 * un volcado en el ordenador
+		 * \param length: Bytes disponibles
+		 * \returns Bytes del registro. 0 al final del bloque o si esta incompleto
+		 */
+		static size_t decode(const uint8_t* data, size_t length, Record& record) {
+			const uint8_t* p = data;
+			const uint8_t* const end = data + length;
+			if(p == end || *p == 0xFF) {
+				return 0;
+			}
+
+			record = Record();
+			const uint8_t head = *p++;
+			record.kind = head & KIND_MASK;
+			record.index = head & ~KIND_MASK;
+			if(record.kind == KIND_SYNC) {
+				if(!getWord(p, end, record.sequence) || !getWord(p, end, record.time) ||
+					 !getWord(p, end, record.value) || !getWord(p, end, record.context)) {
+					return 0;
+				}
+				return p - data;
+			}
+
+			if(!getVarint(p, end, record.time)) {
+				return 0;
+			}
+			switch(record.kind) {
+				case KIND_TOGGLE:
+					break;
+				case KIND_FRAME:
+					if(!getWord(p, end, record.value)) {
+						return 0;
+					}
+					if((record.index & FRAME_GESTURES) &&
+						 (!getWord(p, end, record.gestures.longPress) || !getWord(p, end, record.gestures.repeat) ||
+							!getWord(p, end, record.gestures.doubleTap))) {
+						return 0;
+					}
+					break;
+				case KIND_EVENT:
+					if(p == end) {
+						return 0;
+					}
+					record.value = *p++;
+					break;
+				default:
+					return 0;
+			}
+			return p - data;
+		}
+
+
+
+	private:
+		static const uint32_t MAGIC = 0x58424B42; //"BKBX"
+		static const size_t VARINT_MAX = 5; ///<Bytes de un uint32_t en LEB128
+
+		Storage&	m_storage;
+		uint32_t	m_state; ///<Ultima trama grabada
+		uint32_t	m_context;
+		uint32_t	m_lastUs; ///<Instante del ultimo registro
+		bool			m_started;
+
+		bool			m_dumping;
+		uint32_t	m_dumpSequence; ///<Bloque que se esta volcando
+		size_t		m_dumpOffset; ///<Siguiente byte a volcar del bloque
+
+		/**
+		 * \brief Devuelve el bloque grabado mas antiguo
+		 */
+		uint32_t getOldest() const {
+			return (m_storage.sequence >= BLOCKS - 1) ? m_storage.sequence - (BLOCKS - 1) : 0;
+		}
+
+		/**
+		 * \brief Comienza un bloque con su registro SYNC. El resto queda a 0xFF
+		 */
+		void openBlock(uint32_t sequence, uint32_t now) {
+			uint8_t* block = m_storage.blocks[sequence % BLOCKS];
+			std::memset(block, 0xFF, BLOCK_SIZE);
+
+			uint8_t* p = block;
+			*p++ = KIND_SYNC;
+			p = putWord(p, sequence);
+			p = putWord(p, now);
+			p = putWord(p, m_state);
+			p = putWord(p, m_context);
+
+			m_storage.sequence = sequence;
+			m_storage.offset = SYNC_LENGTH;
+			m_lastUs = now;
+		}
+
+		/**
+		 * \brief Devuelve donde escribir un registro de como mucho length bytes.
+		 * Si no cabe en el bloque actual, comienza otro
+		 */
+		uint8_t* reserve(size_t length, uint32_t now) {
+			if(m_storage.offset + length > BLOCK_SIZE) {
+				openBlock(m_storage.sequence + 1, now);
+			}
+			return m_storage.blocks[m_storage.sequence % BLOCKS] + m_storage.offset;
+		}
+
+		/**
+		 * \brief Cierra el registro que termina en end
+		 */
+		void commit(const uint8_t* end, uint32_t now) {
+			m_storage.offset = end - m_storage.blocks[m_storage.sequence % BLOCKS];
+			m_lastUs = now;
+		}
+
+		static uint8_t* putVarint(uint8_t* p, uint32_t value) {
+			while(value >= 0x80) {
+				*p++ = static_cast<uint8_t>(value | 0x80);
+				value >>= 7;
+			}
+			*p++ = static_cast<uint8_t>(value);
+			return p;
+		}
+
+		static uint8_t* putWord(uint8_t* p, uint32_t value) {
+			p[0] = static_cast<uint8_t>(value);
+			p[1] = static_cast<uint8_t>(value >> 8);
+			p[2] = static_cast<uint8_t>(value >> 16);
+			p[3] = static_cast<uint8_t>(value >> 24);
+			return p + 4;
+		}
+
+		static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+			value = 0;
+			for(size_t shift = 0; p != end && shift < 7*VARINT_MAX; shift += 7) {
+				const uint8_t byte = *p++;
+				value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+				if(!(byte & 0x80)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static bool getWord(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+			if(end - p < 4) {
+				return false;
+			}
+			value = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+			p += 4;
+			return true;
+		}
+
+};
+
+#endif //BLACK_BOX_H_INCLUDED
@@ -0,0 +1,97 @@
+#ifndef BOOT_PROBE_H_INCLUDED
+#define BOOT_PROBE_H_INCLUDED
+
+#include "CycleCounter.h"
+
+#include <stdint.h>
+
+/**
+ * \brief Marcas de tiempo de cada etapa del arranque, para medir cuanto
+ * tiempo esta el panel sin atender a los botones tras un reinicio. Los
+ * tiempos se cuentan desde la construccion del objeto, que debe ser el
+ * primer objeto estatico del programa. Lo que ocurre antes (SystemInit,
+ * inicializacion de la biblioteca de C) no se mide
+ */
+class BootProbe {
+	public:
+		///Etapas del arranque, en el orden en el que deberian ocurrir
+		enum Stage {
+			BOOT_STAGE_CONSTRUCTORS, ///<Comienzo de los constructores estaticos
+			BOOT_STAGE_MAIN, ///<Entrada a main()
+			BOOT_STAGE_RESTORED, ///<Estado recuperado de la flash
+			BOOT_STAGE_FIRST_INPUT, ///<Primera trama leida (leds actualizados)
+			BOOT_STAGE_HOST_READY, ///<USART configurada y estado anunciado
+			BOOT_STAGE_RUNNING, ///<Resto de relojes configurados
+
+			//Add here
+
+			BOOT_STAGE_COUNT
+		};
+
+		BootProbe()
+			: m_start(0)
+		{
+			CycleCounter::enable();
+			m_start = CycleCounter::read();
+			for(size_t i = 0; i < BOOT_STAGE_COUNT; ++i) {
+				m_cycles[i] = UNSET;
+			}
+			mark(BOOT_STAGE_CONSTRUCTORS);
+		}
+
+		/**
+		 * \brief Marca el final de una etapa. Solo cuenta la primera vez
+		 */
+		void mark(Stage stage) {
+			if(m_cycles[stage] == UNSET) {
+				m_cycles[stage] = CycleCounter::read() - m_start;
+			}
+		}
+
+		/**
+		 * \brief Devuelve si se ha alcanzado una etapa
+		 */
+		bool isMarked(Stage stage) const {
+			return m_cycles[stage] != UNSET;
+		}
+
+		/**
+		 * \brief Devuelve los ciclos transcurridos hasta una etapa
+		 */
+		uint32_t getCycles(Stage stage) const {
+			return m_cycles[stage];
+		}
+
+		/**
+		 * \brief Devuelve los microsegundos transcurridos hasta una etapa
+		 */
+		uint32_t getMicroseconds(Stage stage) const {
+			return CycleCounter::toMicroseconds(m_cycles[stage]);
+		}
+
+		/**
+		 * \brief Devuelve el nombre de una etapa
+		 */
+		static const char* getName(Stage stage) {
+			static const char* const NAMES[BOOT_STAGE_COUNT] = {
+				"ctors",
+				"main",
+				"restored",
+				"input",
+				"host",
+				"running"
+			};
+			return NAMES[stage];
+		}
+
+
+
+	private:
+		static const uint32_t UNSET = 0xFFFFFFFF;
+
+		uint32_t	m_start;
+		uint32_t	m_cycles[BOOT_STAGE_COUNT];
+
+};
+
+#endif //BOOT_PROBE_H_INCLUDED
@@ -0,0 +1,139 @@
+#ifndef BUTTON_HEALTH_H_INCLUDED
+#define BUTTON_HEALTH_H_INCLUDED
+
+#include <bitset>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Detecta botones averiados y los enmascara. Un boton se considera
+ * averiado si cambia demasiadas veces en una ventana (cortocircuito que
+ * rebota) o si no se suelta durante demasiadas ventanas seguidas (linea
+ * pellizcada). Mientras esta enmascarado se lee como soltado, y se
+ * desenmascara cuando pasa varias ventanas seguidas sin fallar.
+ *
+ * sample() se llama en cada trama y solo recorre los bits que cambian;
+ * evaluate() se llama al final de cada ventana, fuera del camino critico.
+ * Las entradas son activas a nivel bajo, como las lee la cadena.
+ * \tparam Cnt: Numero de botones
+ */
+template<size_t Cnt>
+class ButtonHealth {
+	public:
+		typedef std::bitset<Cnt> ButtonState; ///<Tipo que representa el estado de los botones
+
+		/**
+		 * \brief Constructor
+		 * \param maxToggles: Cambios por ventana a partir de los cuales el boton
+		 * se considera averiado. Depende de las tramas por ventana: la entrada
+		 * se anota sin filtrar, y cuantas mas tramas, mas rebotes se ven
+		 * \param stuckWindows: Ventanas seguidas sin soltarse a partir de las
+		 * cuales el boton se considera averiado
+		 * \param healthyWindows: Ventanas seguidas sin fallos para desenmascarar
+		 */
+		ButtonHealth(uint16_t maxToggles, uint8_t stuckWindows, uint8_t healthyWindows)
+			: m_maxToggles(maxToggles)
+			, m_stuckWindows(stuckWindows)
+			, m_healthyWindows(healthyWindows)
+			, m_last(~ButtonState()) //Todos soltados
+		{
+			for(size_t i = 0; i < Cnt; ++i) {
+				m_toggles[i] = 0;
+				m_held[i] = 0;
+				m_healthy[i] = 0;
+			}
+		}
+
+		/**
+		 * \brief Anota una trama leida
+		 * \param raw: Estado de los botones, activo a nivel bajo
+		 */
+		void sample(const ButtonState& raw) {
+			m_released |= raw;
+
+			const ButtonState changed = raw ^ m_last;
+			m_last = raw;
+			if(changed.any()) {
+				for(size_t i = 0; i < Cnt; ++i) {
+					if(changed.test(i) && m_toggles[i] < UINT16_LIMIT) {
+						++m_toggles[i];
+					}
+				}
+			}
+		}
+
+		/**
+		 * \brief Aplica la mascara: los botones enmascarados se leen como
+		 * soltados. Una operacion por trama
+		 */
+		ButtonState apply(const ButtonState& raw) const {
+			return raw | m_mask;
+		}
+
+		/**
+		 * \brief Cierra la ventana actual y actualiza la mascara
+		 * \returns Botones cuya mascara ha cambiado
+		 */
+		ButtonState evaluate() {
+			ButtonState faulty;
+			for(size_t i = 0; i < Cnt; ++i) {
+				//Pulsado durante toda la ventana
+				if(m_released.test(i)) {
+					m_held[i] = 0;
+				} else if(m_held[i] < UINT8_LIMIT) {
+					++m_held[i];
+				}
+
+				const bool fault = m_toggles[i] >= m_maxToggles || m_held[i] >= m_stuckWindows;
+				faulty.set(i, fault);
+
+				if(fault) {
+					m_healthy[i] = 0;
+				} else if(m_healthy[i] < UINT8_LIMIT) {
+					++m_healthy[i];
+				}
+				m_toggles[i] = 0;
+			}
+
+			//Enmascarar los averiados y desenmascarar los que llevan tiempo bien
+			ButtonState mask = m_mask | faulty;
+			for(size_t i = 0; i < Cnt; ++i) {
+				if(mask.test(i) && m_healthy[i] >= m_healthyWindows) {
+					mask.reset(i);
+				}
+			}
+
+			m_released = m_last;
+			const ButtonState changed = mask ^ m_mask;
+			m_mask = mask;
+			return changed;
+		}
+
+		/**
+		 * \brief Devuelve los botones enmascarados
+		 */
+		const ButtonState& getMask() const {
+			return m_mask;
+		}
+
+
+
+	private:
+		static const uint8_t UINT8_LIMIT = 0xFF;
+		static const uint16_t UINT16_LIMIT = 0xFFFF;
+
+		uint16_t			m_maxToggles;
+		uint8_t				m_stuckWindows;
+		uint8_t				m_healthyWindows;
+
+		ButtonState		m_last; ///<Ultima trama
+		ButtonState		m_released; ///<Botones soltados en algun momento de la ventana
+		ButtonState		m_mask; ///<Botones enmascarados
+
+		uint16_t			m_toggles[Cnt]; ///<Cambios en la ventana actual
+		uint8_t				m_held[Cnt]; ///<Ventanas seguidas sin soltarse
+		uint8_t				m_healthy[Cnt]; ///<Ventanas seguidas sin fallos
+
+};
+
+#endif //BUTTON_HEALTH_H_INCLUDED
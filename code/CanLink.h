@@ -0,0 +1,409 @@
+#ifndef CAN_LINK_H_INCLUDED
+#define CAN_LINK_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Trama y acciones del enlace CAN. No dependen del destino de los
+ * cambios, por lo que pueden utilizarse sin instanciar el enlace
+ */
+class CanLinkBase {
+	public:
+		///Accion que origino un estado
+		enum Action {
+			ACTION_NONE, ///<Latido o respuesta, sin accion
+			ACTION_PROGRAM,
+			ACTION_PREVIEW,
+			ACTION_CUT,
+			ACTION_TRANSITION,
+
+			//Add here
+
+			ACTION_COUNT
+		};
+
+		static const size_t NODE_MAX = 16; ///<Nodos direccionables
+		static const uint32_t ID_BASE = 0x100; ///<Identificador de la trama de estado del nodo 0
+		static const uint32_t BITRATE = 500000; ///<Velocidad del bus
+		static const uint8_t NO_SIGNAL = 0xFF; ///<Ninguna senal en el bus
+
+		///Disposicion de la trama de estado
+		enum FrameField {
+			FIELD_VERSION_LOW,
+			FIELD_VERSION_HIGH,
+			FIELD_ORIGIN, ///<Nodo que realizo la accion
+			FIELD_PROGRAM,
+			FIELD_PREVIEW,
+			FIELD_FLAGS, ///<Action en los 4 bits bajos y FLAG_FRESH
+
+			FRAME_LENGTH
+		};
+
+		static const uint8_t FLAG_FRESH = 0x80; ///<Estado de un panel que aun no se ha sincronizado
+		static const uint8_t ACTION_MASK = 0x0F;
+};
+
+/**
+ * \brief Enlace de varios paneles por CAN con un estado de programa/previo
+ * compartido.
+ *
+ * Cada panel difunde una trama de estado (identificador ID_BASE + nodo) al
+ * realizar una accion y, como latido, cada heartbeatTicks llamadas a tick().
+ * La trama lleva el estado completo con una version, por lo que una trama
+ * perdida se corrige con la siguiente y el estado no depende del orden de
+ * llegada. Un estado es mas nuevo si su version lo es (aritmetica modulo
+ * 2^16); con la misma version gana el nodo de menor numero. Un panel recien
+ * arrancado marca su estado como FLAG_FRESH, que pierde ante cualquier otro,
+ * para no imponer el estado recuperado de la flash a los demas.
+ *
+ * Al recibir un estado mas antiguo que el propio, el nodo que hizo la ultima
+ * accion y el agregador responden en seguida, por lo que un panel que se une
+ * converge en lo que tarda una trama. Sin tramas
+ * perdidas, todos convergen en lo que tardan en salir las tramas en cola
+ * (como mucho una por nodo) mas una vuelta del bucle principal; con perdidas,
+ * como mucho un latido despues.
+ *
+ * El panel vivo de menor numero es el agregador: el unico que envia al host
+ * los eventos del mezclador. Un nodo esta vivo si se ha oido en las ultimas
+ * timeoutTicks llamadas a tick(). Al arrancar se escucha ese mismo tiempo
+ * antes de elegirlo, por lo que hasta entonces ningun panel es agregador.
+ *
+ * La interrupcion de recepcion solo vacia el buffer del controlador (uno en
+ * el LPC1768) en un anillo; las tramas se aplican en el bucle principal con
+ * process().
+ *
+ * \tparam Sink: Destino de los cambios. Debe proporcionar los metodos
+ * void onLinkState(CanLinkBase::Action action, size_t program, size_t preview)
+ * (senales, 0xFF = ninguna) y void onAggregator(bool aggregator), que se
+ * resuelven en tiempo de compilacion
+ */
+template<typename Sink>
+class CanLink : public CanLinkBase {
+	public:
+		static const size_t RX_SIZE = 8; ///<Tramas recibidas pendientes de aplicar. Potencia de 2
+
+		/**
+		 * \brief Constructor
+		 * \param can: Controlador CAN. Debe sobrevivir al enlace
+		 * \param node: Numero de este panel. [0, NODE_MAX)
+		 * \param sink: Destino de los cambios. Debe sobrevivir al enlace
+		 * \param heartbeatTicks: Llamadas a tick() entre latidos
+		 * \param timeoutTicks: Llamadas a tick() sin oir a un nodo para darlo por muerto
+		 */
+		CanLink(CAN& can, uint8_t node, Sink& sink, size_t heartbeatTicks, size_t timeoutTicks)
+			: m_can(can)
+			, m_sink(sink)
+			, m_node(node)
+			, m_heartbeatTicks(heartbeatTicks)
+			, m_timeoutTicks(timeoutTicks)
+			, m_started(false)
+			, m_version(0)
+			, m_origin(node)
+			, m_fresh(true)
+			, m_program(NO_SIGNAL)
+			, m_preview(NO_SIGNAL)
+			, m_action(ACTION_NONE)
+			, m_txPending(false)
+			, m_heartbeat(0)
+			, m_aggregator(NODE_MAX)
+			, m_settle(timeoutTicks)
+			, m_rxHead(0)
+			, m_rxTail(0)
+			, m_sent(0)
+			, m_received(0)
+			, m_dropped(0)
+		{
+			for(size_t i = 0; i < NODE_MAX; ++i) {
+				m_age[i] = static_cast<uint16_t>(timeoutTicks);
+			}
+		}
+
+		/**
+		 * \brief Configura el controlador, comienza a recibir y envia el
+		 * estado actual. Hasta entonces publish() solo actualiza el estado
+		 */
+		void start() {
+			m_can.frequency(BITRATE);
+			m_can.attach(callback(this, &CanLink::onReceive), CAN::RxIrq);
+			m_started = true;
+			m_txPending = true;
+			send();
+		}
+
+		/**
+		 * \brief Difunde una accion local y el estado resultante
+		 * \param program: Senal en programa. NO_SIGNAL = ninguna
+		 * \param preview: Senal en previo. NO_SIGNAL = ninguna
+		 */
+		void publish(Action action, uint8_t program, uint8_t preview) {
+			m_program = program;
+			m_preview = preview;
+			if(!m_started) {
+				return;
+			}
+
+			++m_version;
+			m_origin = m_node;
+			m_fresh = false;
+			m_action = action;
+			m_txPending = true;
+			send();
+		}
+
+		/**
+		 * \brief Interrupcion de recepcion. Copia las tramas de estado al anillo
+		 */
+		void onReceive() {
+			CANMessage msg;
+			while(m_can.read(msg)) {
+				if(msg.format != CANStandard || msg.type != CANData || msg.len != FRAME_LENGTH
+						|| msg.id < ID_BASE || msg.id >= ID_BASE + NODE_MAX) {
+					continue;
+				}
+
+				const size_t next = (m_rxHead + 1) & (RX_SIZE - 1);
+				if(next == m_rxTail) {
+					++m_dropped; //El siguiente latido lo corrige
+					continue;
+				}
+				Frame& frame = m_rx[m_rxHead];
+				frame.node = static_cast<uint8_t>(msg.id - ID_BASE);
+				for(size_t i = 0; i < FRAME_LENGTH; ++i) {
+					frame.data[i] = msg.data[i];
+				}
+				m_rxHead = next;
+			}
+		}
+
+		/**
+		 * \brief Indica si hay tramas recibidas pendientes de process(). Un
+		 * envio pendiente no cuenta: sin nadie en el bus no llegaria a salir, y
+		 * tick() lo reintenta
+		 */
+		bool hasReceived() const {
+			return m_rxHead != m_rxTail;
+		}
+
+		/**
+		 * \brief Aplica las tramas recibidas y reintenta el envio pendiente.
+		 * Debe llamarse desde el bucle principal
+		 */
+		void process() {
+			while(m_rxTail != m_rxHead) {
+				apply(m_rx[m_rxTail]);
+				m_rxTail = (m_rxTail + 1) & (RX_SIZE - 1);
+			}
+			if(m_txPending) {
+				send();
+			}
+		}
+
+		/**
+		 * \brief Avanza el reloj del enlace: envia el latido y elige el
+		 * agregador. Debe llamarse periodicamente desde el bucle principal
+		 */
+		void tick() {
+			if(!m_started) {
+				return;
+			}
+
+			for(size_t i = 0; i < NODE_MAX; ++i) {
+				if(m_age[i] < m_timeoutTicks) {
+					++m_age[i];
+				}
+			}
+			if(++m_heartbeat >= m_heartbeatTicks) {
+				m_heartbeat = 0;
+				m_txPending = true;
+			}
+			if(m_txPending) {
+				send();
+			}
+			if(m_settle) {
+				--m_settle;
+			}
+			elect();
+		}
+
+		/**
+		 * \brief Indica si este panel es el agregador
+		 */
+		bool isAggregator() const {
+			return m_aggregator == m_node;
+		}
+
+		/**
+		 * \brief Devuelve el numero del agregador. NODE_MAX mientras arranca
+		 */
+		uint8_t getAggregator() const {
+			return m_aggregator;
+		}
+
+		uint8_t getNode() const {
+			return m_node;
+		}
+
+		uint16_t getVersion() const {
+			return m_version;
+		}
+
+		/**
+		 * \brief Devuelve el numero de nodos vivos, incluido este
+		 */
+		size_t getAlive() const {
+			size_t alive = 1;
+			for(size_t i = 0; i < NODE_MAX; ++i) {
+				if(i != m_node && isAlive(i)) {
+					++alive;
+				}
+			}
+			return alive;
+		}
+
+		uint32_t getSent() const {
+			return m_sent;
+		}
+
+		uint32_t getReceived() const {
+			return m_received;
+		}
+
+		/**
+		 * \brief Devuelve las tramas perdidas por llenarse el anillo
+		 */
+		uint32_t getDropped() const {
+			return m_dropped;
+		}
+
+	private:
+		///Trama de estado recibida
+		struct Frame {
+			uint8_t		node;
+			uint8_t		data[FRAME_LENGTH];
+		};
+
+		CAN&							m_can;
+		Sink&							m_sink;
+		const uint8_t			m_node;
+		const size_t			m_heartbeatTicks;
+		const size_t			m_timeoutTicks;
+		bool							m_started;
+
+		//Estado compartido
+		uint16_t					m_version;
+		uint8_t						m_origin; ///<Nodo que realizo la ultima accion
+		bool							m_fresh; ///<No se ha sincronizado con ningun otro panel
+		uint8_t						m_program;
+		uint8_t						m_preview;
+		Action						m_action; ///<Accion del envio pendiente
+
+		bool							m_txPending; ///<El estado no ha entrado en el controlador
+		size_t						m_heartbeat; ///<Llamadas a tick() desde el ultimo latido
+		uint16_t					m_age[NODE_MAX]; ///<Llamadas a tick() desde que se oyo a cada nodo
+		uint8_t						m_aggregator; ///<NODE_MAX = ninguno
+		size_t						m_settle; ///<Llamadas a tick() que faltan para elegir el agregador
+
+		Frame							m_rx[RX_SIZE];
+		volatile size_t		m_rxHead; ///<Lo escribe la interrupcion
+		volatile size_t		m_rxTail; ///<Lo escribe el bucle principal
+
+		uint32_t					m_sent;
+		uint32_t					m_received;
+		volatile uint32_t	m_dropped;
+
+		typedef char RxSizeCheck[(RX_SIZE & (RX_SIZE - 1)) == 0 ? 1 : -1];
+
+		bool isAlive(size_t node) const {
+			return m_age[node] < m_timeoutTicks;
+		}
+
+		/**
+		 * \brief Indica si un estado recibido es mas nuevo que el propio
+		 */
+		bool isNewer(uint16_t version, uint8_t origin, bool fresh) const {
+			if(fresh != m_fresh) {
+				return m_fresh;
+			}
+			const int16_t age = static_cast<int16_t>(version - m_version);
+			return age > 0 || (age == 0 && origin < m_origin);
+		}
+
+		/**
+		 * \brief Aplica una trama recibida
+		 */
+		void apply(const Frame& frame) {
+			if(frame.node >= NODE_MAX || frame.node == m_node) {
+				return;
+			}
+			++m_received;
+			m_age[frame.node] = 0;
+			elect();
+
+			const uint16_t version = frame.data[FIELD_VERSION_LOW] | (frame.data[FIELD_VERSION_HIGH] << 8);
+			const uint8_t origin = frame.data[FIELD_ORIGIN];
+			const bool fresh = (frame.data[FIELD_FLAGS] & FLAG_FRESH) != 0;
+			if(isNewer(version, origin, fresh)) {
+				m_version = version;
+				m_origin = origin;
+				m_fresh = fresh;
+				m_program = frame.data[FIELD_PROGRAM];
+				m_preview = frame.data[FIELD_PREVIEW];
+				const uint8_t action = frame.data[FIELD_FLAGS] & ACTION_MASK;
+				m_sink.onLinkState(action < ACTION_COUNT ? static_cast<Action>(action) : ACTION_NONE, m_program, m_preview);
+			} else if((version != m_version || origin != m_origin || fresh != m_fresh) && (m_origin == m_node || isAggregator())) {
+				//Quien envia va atrasado: responder sin esperar al latido. Solo
+				//responden quien hizo la accion y el agregador, no todo el bus
+				m_txPending = true;
+			}
+		}
+
+		/**
+		 * \brief Intenta dejar el estado en el controlador. Si sus buffers de
+		 * transmision estan llenos, se reintenta desde process() o tick()
+		 */
+		void send() {
+			char data[FRAME_LENGTH];
+			data[FIELD_VERSION_LOW] = static_cast<char>(m_version & 0xFF);
+			data[FIELD_VERSION_HIGH] = static_cast<char>(m_version >> 8);
+			data[FIELD_ORIGIN] = static_cast<char>(m_origin);
+			data[FIELD_PROGRAM] = static_cast<char>(m_program);
+			data[FIELD_PREVIEW] = static_cast<char>(m_preview);
+			data[FIELD_FLAGS] = static_cast<char>(m_action | (m_fresh ? FLAG_FRESH : 0));
+
+			if(m_can.write(CANMessage(ID_BASE + m_node, data, FRAME_LENGTH))) {
+				m_txPending = false;
+				m_action = ACTION_NONE;
+				m_heartbeat = 0; //Cualquier trama sirve de latido
+				++m_sent;
+			}
+		}
+
+		/**
+		 * \brief Elige como agregador al nodo vivo de menor numero
+		 */
+		void elect() {
+			if(m_settle) {
+				return;
+			}
+			uint8_t aggregator = m_node;
+			for(uint8_t i = 0; i < m_node; ++i) {
+				if(isAlive(i)) {
+					aggregator = i;
+					break;
+				}
+			}
+			if(aggregator != m_aggregator) {
+				const bool was = isAggregator();
+				m_aggregator = aggregator;
+				if(was != isAggregator()) {
+					m_sink.onAggregator(isAggregator());
+				}
+			}
+		}
+
+};
+
+#endif //CAN_LINK_H_INCLUDED
@@ -0,0 +1,88 @@
+#ifndef CYCLE_COUNTER_H_INCLUDED
+#define CYCLE_COUNTER_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+
+/**
+ * \brief Contador de ciclos del nucleo (DWT->CYCCNT del Cortex-M3). Sirve
+ * para medir tiempos cortos con resolucion de un ciclo sin ocupar ningun
+ * temporizador. Desborda cada 2^32 ciclos (~44s a 96MHz)
+ */
+class CycleCounter {
+	public:
+		/**
+		 * \brief Habilita el contador. Puede llamarse mas de una vez
+		 */
+		static void enable() {
+			CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+			DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		}
+
+		/**
+		 * \brief Devuelve el numero de ciclos actual
+		 */
+		static uint32_t read() {
+			return DWT->CYCCNT;
+		}
+
+		/**
+		 * \brief Convierte ciclos a microsegundos
+		 */
+		static uint32_t toMicroseconds(uint32_t cycles) {
+			return cycles / (SystemCoreClock / 1000000);
+		}
+
+};
+
+/**
+ * \brief Minimo y maximo de una serie de medidas en ciclos, p.e. la duracion
+ * de una rutina o el intervalo entre interrupciones (su diferencia es el jitter)
+ */
+class CycleStats {
+	public:
+		CycleStats() {
+			reset();
+		}
+
+		/**
+		 * \brief Anade una medida
+		 */
+		void add(uint32_t cycles) {
+			if(cycles < m_min) m_min = cycles;
+			if(cycles > m_max) m_max = cycles;
+			++m_count;
+		}
+
+		/**
+		 * \brief Descarta las medidas
+		 */
+		void reset() {
+			m_min = 0xFFFFFFFF;
+			m_max = 0;
+			m_count = 0;
+		}
+
+		uint32_t getMin() const {
+			return m_min;
+		}
+
+		uint32_t getMax() const {
+			return m_max;
+		}
+
+		uint32_t getCount() const {
+			return m_count;
+		}
+
+
+
+	private:
+		uint32_t	m_min;
+		uint32_t	m_max;
+		uint32_t	m_count;
+
+};
+
+#endif //CYCLE_COUNTER_H_INCLUDED
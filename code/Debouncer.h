@@ -0,0 +1,71 @@
+#ifndef DEBOUNCER_H_INCLUDED
+#define DEBOUNCER_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "BitSlicedCounter.h"
+
+/**
+ * \brief Filtro antirrebote de todos los botones a la vez. Un bit solo cambia
+ * cuando la entrada lleva el valor nuevo durante varias tramas seguidas; un
+ * rebote a mitad vuelve a empezar la cuenta. Las tramas de cada bit se
+ * cuentan con contadores por planos (BitSlicedCounter), por lo que el coste
+ * no depende del numero de botones.
+ *
+ * Con tramas lentas (modo TICK, 25ms) basta una trama, y el filtro deja pasar
+ * la entrada tal cual; con las rapidas (BCM, TIMER) el rebote de los
+ * contactos dura varias tramas.
+ * \tparam Word: Tipo de palabra. Un boton por bit
+ * \tparam Bits: Bits de los contadores. Deben caber las tramas del filtro
+ */
+template<typename Word, size_t Bits = 5>
+class Debouncer {
+	public:
+		/**
+		 * \brief Constructor
+		 * \param frames: Tramas seguidas con el valor nuevo para aceptarlo.
+		 * [1, 2^Bits)
+		 * \param initial: Estado inicial
+		 */
+		Debouncer(uint32_t frames, Word initial)
+			: m_frames(frames)
+			, m_stable(initial)
+		{
+		}
+
+		/**
+		 * \brief Evalua una trama
+		 * \param raw: Entrada leida
+		 * \returns Entrada filtrada
+		 */
+		Word update(Word raw) {
+			//Los bits que vuelven al valor estable empiezan de nuevo
+			const Word diff = raw ^ m_stable;
+			m_count.clear(~diff);
+			m_count.increment(diff);
+
+			//Aceptar los que llevan las tramas necesarias
+			const Word accepted = diff & m_count.equals(m_frames);
+			m_stable ^= accepted;
+			m_count.clear(accepted);
+			return m_stable;
+		}
+
+		/**
+		 * \brief Devuelve la entrada filtrada
+		 */
+		Word getStable() const {
+			return m_stable;
+		}
+
+
+
+	private:
+		uint32_t									m_frames;
+		Word											m_stable; ///<Ultimo valor aceptado
+		BitSlicedCounter<Word, Bits>	m_count; ///<Tramas seguidas distintas de m_stable
+
+};
+
+#endif //DEBOUNCER_H_INCLUDED
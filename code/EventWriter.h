@@ -0,0 +1,254 @@
+#ifndef EVENT_WRITER_H_INCLUDED
+#define EVENT_WRITER_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Envia lineas de texto de formato fijo ("pgm 3\n") sin printf.
+ * Cada linea se compone con una conversion entero -> ASCII propia y se
+ * copia en un anillo que vacia la interrupcion de transmision, por lo que
+ * escribir un evento nunca espera a la USART ni reserva memoria.
+ * \tparam Uart: Puerto serie. Debe proporcionar writeable(), putc() y
+ * attach(Callback<void()>, SerialBase::IrqType), como RawSerial
+ * \tparam Size: Tamano del anillo en bytes. Potencia de 2
+ */
+template<typename Uart, size_t Size = 256>
+class EventWriter {
+	public:
+		static const size_t LINE_LENGTH = 32; ///<Longitud maxima de una linea
+
+		/**
+		 * \brief Constructor
+		 * \param uart: Puerto serie. Debe sobrevivir al objeto
+		 */
+		explicit EventWriter(Uart& uart)
+			: m_uart(uart)
+			, m_head(0)
+			, m_tail(0)
+			, m_txActive(false)
+			, m_muted(false)
+			, m_dropped(0)
+		{
+		}
+
+		/**
+		 * \brief Engancha la interrupcion de transmision. Llamar una vez
+		 * configurado el puerto
+		 */
+		void start() {
+			m_uart.attach(callback(this, &EventWriter::onTxEmpty), SerialBase::TxIrq);
+		}
+
+		/**
+		 * \brief Descarta las lineas en lugar de enviarlas, p.e. cuando el
+		 * puerto habla otro protocolo
+		 */
+		void setMuted(bool muted) {
+			m_muted = muted;
+		}
+
+		/**
+		 * \brief Escribe "name\n"
+		 */
+		void writeLine(const char* name) {
+			char line[LINE_LENGTH];
+			size_t len = putString(line, 0, name, 1);
+			line[len++] = '\n';
+			commit(line, len);
+		}
+
+		/**
+		 * \brief Escribe "name text\n". El texto puede ocupar el resto de la linea
+		 */
+		void writeText(const char* name, const char* text) {
+			char line[LINE_LENGTH];
+			size_t len = putString(line, 0, name, 2);
+			line[len++] = ' ';
+			while(*text && len < LINE_LENGTH - 1) {
+				line[len++] = *text++;
+			}
+			line[len++] = '\n';
+			commit(line, len);
+		}
+		
+		/**
+		 * \brief Escribe "name value\n"
+		 */
+		void writeLine(const char* name, uint32_t value) {
+			char line[LINE_LENGTH];
+			size_t len = putString(line, 0, name, DIGITS_MAX + 2);
+			line[len++] = ' ';
+			len = putUnsigned(line, len, value);
+			line[len++] = '\n';
+			commit(line, len);
+		}
+
+		/**
+		 * \brief Escribe "name arg value\n"
+		 */
+		void writeLine(const char* name, const char* arg, uint32_t value) {
+			char line[LINE_LENGTH];
+			size_t len = putString(line, 0, name, DIGITS_MAX + 3);
+			line[len++] = ' ';
+			len = putString(line, len, arg, DIGITS_MAX + 2);
+			line[len++] = ' ';
+			len = putUnsigned(line, len, value);
+			line[len++] = '\n';
+			commit(line, len);
+		}
+
+		/**
+		 * \brief Escribe "name value0 value1\n"
+		 */
+		void writeLine(const char* name, uint32_t value0, uint32_t value1) {
+			char line[LINE_LENGTH];
+			size_t len = putString(line, 0, name, 2 * DIGITS_MAX + 3);
+			line[len++] = ' ';
+			len = putUnsigned(line, len, value0);
+			line[len++] = ' ';
+			len = putUnsigned(line, len, value1);
+			line[len++] = '\n';
+			commit(line, len);
+		}
+
+		/**
+		 * \brief Escribe "name" y los bytes en hexadecimal ("bb 0a1f\n"). Los
+		 * que no quepan en la linea se descartan: con un nombre de 2 letras caben 14
+		 */
+		void writeHex(const char* name, const uint8_t* data, size_t count) {
+			static const char HEX[] = "0123456789abcdef";
+			char line[LINE_LENGTH];
+			size_t len = putString(line, 0, name, 2);
+			line[len++] = ' ';
+			for(size_t i = 0; i < count && len + 2 < LINE_LENGTH; ++i) {
+				line[len++] = HEX[data[i] >> 4];
+				line[len++] = HEX[data[i] & 0x0F];
+			}
+			line[len++] = '\n';
+			commit(line, len);
+		}
+
+		/**
+		 * \brief Devuelve el numero de lineas descartadas por falta de espacio
+		 */
+		uint32_t getDropped() const {
+			return m_dropped;
+		}
+
+		/**
+		 * \brief Devuelve los bytes pendientes de enviar
+		 */
+		size_t getPending() const {
+			return m_head - m_tail;
+		}
+
+		/**
+		 * \brief Devuelve los bytes libres del anillo
+		 */
+		size_t getFree() const {
+			return Size - getPending();
+		}
+
+
+
+	private:
+		static const size_t MASK = Size - 1;
+		static const size_t DIGITS_MAX = 10; ///<Digitos de un uint32_t
+
+		typedef char SizeCheck[((Size & MASK) == 0) ? 1 : -1];
+
+		Uart&							m_uart;
+		char							m_ring[Size];
+		volatile size_t		m_head; ///<Siguiente byte a escribir. Solo lo modifica commit()
+		volatile size_t		m_tail; ///<Siguiente byte a enviar. Solo lo modifica fill()
+		volatile bool			m_txActive; ///<La interrupcion de transmision vaciara el anillo
+		bool							m_muted;
+		uint32_t					m_dropped;
+
+		/**
+		 * \brief Copia una cadena. Se trunca para dejar sitio a lo que la sigue
+		 * \param reserve: Bytes que aun debe admitir la linea: separadores,
+		 * valores de hasta DIGITS_MAX digitos y el salto de linea
+		 */
+		static size_t putString(char* line, size_t len, const char* str, size_t reserve) {
+			while(*str && len < LINE_LENGTH - reserve) {
+				line[len++] = *str++;
+			}
+			return len;
+		}
+
+		/**
+		 * \brief Convierte un entero sin signo a decimal, igual que %u
+		 */
+		static size_t putUnsigned(char* line, size_t len, uint32_t value) {
+			char digits[DIGITS_MAX];
+			size_t count = 0;
+			do {
+				digits[count++] = '0' + (value % 10);
+				value /= 10;
+			} while(value);
+
+			while(count) {
+				line[len++] = digits[--count];
+			}
+			return len;
+		}
+
+		/**
+		 * \brief Copia una linea completa al anillo y arranca la transmision.
+		 * Si no cabe se descarta entera, para no partir el protocolo
+		 */
+		void commit(const char* line, size_t len) {
+			if(m_muted) {
+				return;
+			}
+
+			const size_t head = m_head;
+			if(len > Size - (head - m_tail)) {
+				++m_dropped;
+				return;
+			}
+
+			for(size_t i = 0; i < len; ++i) {
+				m_ring[(head + i) & MASK] = line[i];
+			}
+			m_head = head + len;
+
+			//Si la interrupcion no esta en marcha, cargar el primer byte
+			core_util_critical_section_enter();
+			if(!m_txActive) {
+				m_txActive = true;
+				fill();
+			}
+			core_util_critical_section_exit();
+		}
+
+		/**
+		 * \brief Pasa al puerto los bytes que admita
+		 */
+		void fill() {
+			size_t tail = m_tail;
+			while(tail != m_head && m_uart.writeable()) {
+				m_uart.putc(m_ring[tail & MASK]);
+				++tail;
+			}
+			m_tail = tail;
+
+			if(tail == m_head) {
+				m_txActive = false;
+			}
+		}
+
+		/**
+		 * \brief Interrupcion de transmisor vacio
+		 */
+		void onTxEmpty() {
+			fill();
+		}
+
+};
+
+#endif //EVENT_WRITER_H_INCLUDED
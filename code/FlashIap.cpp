@@ -0,0 +1,75 @@
+#include "FlashIap.h"
+
+#include "mbed.h"
+
+//Comandos IAP de la ROM del LPC17xx (UM10360, capitulo 32)
+enum IapCommand {
+	IAP_PREPARE = 50,
+	IAP_COPY_RAM_TO_FLASH = 51,
+	IAP_ERASE = 52,
+	IAP_BLANK_CHECK = 53
+};
+
+enum IapStatus {
+	IAP_CMD_SUCCESS = 0,
+	IAP_SECTOR_NOT_BLANK = 8
+};
+
+typedef void (*IapEntry)(uint32_t* command, uint32_t* result);
+static const IapEntry iapEntry = reinterpret_cast<IapEntry>(0x1FFF1FF1);
+
+
+/**
+ * \brief Ejecuta un comando IAP. Mientras se programa no puede leerse la
+ * flash, por lo que las interrupciones permanecen deshabilitadas
+ * \returns Codigo de estado
+ */
+static uint32_t iap(uint32_t* command) {
+	uint32_t result[5];
+	core_util_critical_section_enter();
+	iapEntry(command, result);
+	core_util_critical_section_exit();
+	return result[0];
+}
+
+/**
+ * \brief Prepara los sectores para escribirlos o borrarlos
+ */
+static bool iapPrepare(uint32_t sector) {
+	uint32_t command[5] = { IAP_PREPARE, sector, sector, 0, 0 };
+	return iap(command) == IAP_CMD_SUCCESS;
+}
+
+
+
+bool FlashIap::eraseSector(uint32_t sector, bool& erased) {
+	//Evitar el borrado (~100ms) si ya esta en blanco
+	erased = false;
+	uint32_t blank[5] = { IAP_BLANK_CHECK, sector, sector, 0, 0 };
+	if(iap(blank) == IAP_CMD_SUCCESS) {
+		return true;
+	}
+
+	if(!iapPrepare(sector)) {
+		return false;
+	}
+
+	uint32_t erase[5] = { IAP_ERASE, sector, sector, SystemCoreClock / 1000, 0 };
+	erased = iap(erase) == IAP_CMD_SUCCESS;
+	return erased;
+}
+
+bool FlashIap::programPage(uint32_t sector, uint32_t address, const uint32_t* data) {
+	if(!iapPrepare(sector)) {
+		return false;
+	}
+
+	uint32_t copy[5] = {
+		IAP_COPY_RAM_TO_FLASH,
+		address,
+		static_cast<uint32_t>(reinterpret_cast<uintptr_t>(data)),
+		PAGE_SIZE,
+		SystemCoreClock / 1000
+	};
+	return iap(copy) == IAP_CMD_SUCCESS;
+}
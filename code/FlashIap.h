@@ -0,0 +1,38 @@
+#ifndef FLASH_IAP_H_INCLUDED
+#define FLASH_IAP_H_INCLUDED
+
+#include <stdint.h>
+
+/**
+ * \brief Acceso a la flash interna mediante las rutinas IAP de la ROM del
+ * LPC17xx (UM10360, capitulo 32). Mientras se borra o programa no puede
+ * leerse la flash, por lo que las interrupciones permanecen deshabilitadas:
+ * una pagina tarda ~1ms y un sector de 32KB ~100ms.
+ *
+ * Los sectores que se escriben deben excluirse del programa en el fichero
+ * scatter.
+ */
+class FlashIap {
+	public:
+		static const uint32_t PAGE_SIZE = 256; ///<Unidad de escritura
+
+		/**
+		 * \brief Borra un sector, salvo que ya este en blanco
+		 * \param sector: Numero de sector fisico
+		 * \param erased: Se pone a true si ha sido necesario borrarlo
+		 * \returns true si el sector queda en blanco
+		 */
+		static bool eraseSector(uint32_t sector, bool& erased);
+
+		/**
+		 * \brief Programa una pagina
+		 * \param sector: Numero de sector fisico que contiene la pagina
+		 * \param address: Direccion de la pagina. Alineada a PAGE_SIZE
+		 * \param data: PAGE_SIZE bytes alineados a palabra, en RAM
+		 * \returns true si se ha escrito
+		 */
+		static bool programPage(uint32_t sector, uint32_t address, const uint32_t* data);
+
+};
+
+#endif //FLASH_IAP_H_INCLUDED
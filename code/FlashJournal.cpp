@@ -0,0 +1,190 @@
+#include "FlashJournal.h"
+#include "FlashIap.h"
+
+FlashJournal::FlashJournal()
+	: m_count(0)
+	, m_sequence(0)
+	, m_headSector(0)
+	, m_headPage(0)
+	, m_headErased(false)
+	, m_nextErased(false)
+	, m_pageWrites(0)
+	, m_sectorErases(0)
+{
+	m_last.type = RECORD_NONE;
+}
+
+
+
+bool FlashJournal::restore(Record& last) {
+	//Buscar el sector cuya primera pagina es la mas reciente
+	bool found = false;
+	for(uint32_t sector = 0; sector < SECTOR_COUNT; ++sector) {
+		const FlashPage::Header* first = pageAt(sector, 0);
+		if(isValid(first) && (!found || first->sequence > m_sequence)) {
+			found = true;
+			m_sequence = first->sequence;
+			m_headSector = sector;
+		}
+	}
+
+	if(!found) {
+		//Diario vacio. El primer sector se borrara en la primera escritura
+		m_sequence = 0;
+		m_headSector = 0;
+		m_headPage = 0;
+		m_headErased = false;
+		m_nextErased = false;
+		return false;
+	}
+
+	//Las paginas se escriben en orden, por lo que las escritas forman un
+	//prefijo del sector. Busqueda binaria de la primera no escrita
+	uint32_t lo = 1, hi = PAGES_PER_SECTOR;
+	while(lo < hi) {
+		const uint32_t mid = (lo + hi) / 2;
+		if(FlashPage::isWritten(pageAt(m_headSector, mid))) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	m_headPage = lo;
+	m_headErased = true;
+	m_nextErased = false;
+
+	//Retroceder sobre las paginas incompletas (corte durante la escritura)
+	uint32_t page = m_headPage;
+	const FlashPage::Header* header;
+	do {
+		header = pageAt(m_headSector, --page);
+	} while(!isValid(header) && page > 0);
+
+	m_sequence = header->sequence;
+	if(header->count == 0) {
+		return false;
+	}
+
+	const Record* recs = reinterpret_cast<const Record*>(header + 1);
+	m_last = recs[header->count - 1];
+	last = m_last;
+	return true;
+}
+
+
+
+void FlashJournal::append(uint8_t type, uint8_t a, uint8_t b) {
+	Record* recs = records();
+
+	//Descartar si no cambia nada respecto a lo escrito
+	if(m_count == 0 && m_last.type == type && m_last.a == a && m_last.b == b) {
+		return;
+	}
+
+	//Agrupar con el anterior si es del mismo tipo o si no caben mas
+	if(m_count > 0 && (recs[m_count - 1].type == type || m_count == RECORDS_PER_PAGE)) {
+		--m_count;
+	}
+
+	Record& rec = recs[m_count++];
+	rec.type = type;
+	rec.a = a;
+	rec.b = b;
+	rec.reserved = 0xFF;
+}
+
+
+
+bool FlashJournal::flush(bool idle) {
+	const uint32_t next = (m_headSector + 1) % SECTOR_COUNT;
+
+	if(m_count == 0) {
+		//Sin nada que escribir. Aprovechar la inactividad para borrar el siguiente sector
+		if(idle && m_headErased && !m_nextErased) {
+			m_nextErased = eraseSector(next);
+		}
+		return false;
+	}
+
+	//Avanzar de sector si el actual esta lleno
+	if(m_headPage == PAGES_PER_SECTOR) {
+		m_headSector = next;
+		m_headPage = 0;
+		m_headErased = m_nextErased;
+		m_nextErased = false;
+	}
+
+	if(!m_headErased) {
+		m_headErased = eraseSector(m_headSector);
+		if(!m_headErased) {
+			return false;
+		}
+	}
+
+	//Completar la pagina. Los registros sin usar quedan a 0xFF
+	FlashPage::seal(m_page, MAGIC, m_sequence + 1, m_count, sizeof(Record));
+
+	//Aunque falle, la pagina no puede volver a escribirse
+	const bool written = programPage(m_headSector, m_headPage);
+	++m_headPage;
+	if(written) {
+		++m_sequence;
+		m_last = records()[m_count - 1];
+		m_count = 0;
+	}
+	return written;
+}
+
+
+
+bool FlashJournal::isPending() const {
+	return m_count > 0;
+}
+
+uint32_t FlashJournal::getPageWrites() const {
+	return m_pageWrites;
+}
+
+uint32_t FlashJournal::getSectorErases() const {
+	return m_sectorErases;
+}
+
+
+
+FlashPage::Header* FlashJournal::header() {
+	return reinterpret_cast<FlashPage::Header*>(m_page);
+}
+
+FlashJournal::Record* FlashJournal::records() {
+	return reinterpret_cast<Record*>(header() + 1);
+}
+
+
+
+const FlashPage::Header* FlashJournal::pageAt(uint32_t sector, uint32_t page) {
+	return reinterpret_cast<const FlashPage::Header*>(BASE_ADDRESS + sector*SECTOR_SIZE + page*PAGE_SIZE);
+}
+
+bool FlashJournal::isValid(const FlashPage::Header* page) {
+	return FlashPage::isValid(page, MAGIC, RECORDS_PER_PAGE);
+}
+
+
+
+bool FlashJournal::eraseSector(uint32_t sector) {
+	bool erased = false;
+	const bool blank = FlashIap::eraseSector(SECTOR_FIRST + sector, erased);
+	if(erased) {
+		++m_sectorErases;
+	}
+	return blank;
+}
+
+bool FlashJournal::programPage(uint32_t sector, uint32_t page) {
+	const uint32_t address = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pageAt(sector, page)));
+	const bool written = FlashIap::programPage(SECTOR_FIRST + sector, address, m_page);
+	if(written) {
+		++m_pageWrites;
+	}
+	return written;
+}
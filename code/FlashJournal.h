@@ -0,0 +1,127 @@
+#ifndef FLASH_JOURNAL_H_INCLUDED
+#define FLASH_JOURNAL_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "FlashPage.h"
+
+/**
+ * \brief Diario de solo adicion en los sectores reservados de la flash, para
+ * recuperar el estado tras un corte de alimentacion.
+ *
+ * Los registros se acumulan en RAM y se escriben por paginas de 256 bytes
+ * (la unidad minima de escritura por IAP), como mucho una por llamada a
+ * flush(), por lo que el ritmo de escritura lo limita quien lo llama. Las
+ * paginas se escriben en orden a lo largo de todos los sectores reservados,
+ * rotando entre ellos para repartir el desgaste. Al arrancar, restore()
+ * localiza la ultima pagina valida leyendo la cabecera de cada sector y
+ * haciendo una busqueda binaria dentro del ultimo, por lo que solo lee unas
+ * pocas palabras.
+ *
+ * Los sectores reservados (26 a 29, 0x60000 a 0x7FFFF) se excluyen del
+ * programa en el fichero scatter.
+ */
+class FlashJournal {
+	public:
+		///Tipos de registro
+		enum RecordType {
+			RECORD_NONE,
+			RECORD_STATE, ///<a = programa, b = previo
+
+			//Add here
+
+			RECORD_COUNT
+		};
+
+		///Registro del diario. Ocupa una palabra
+		struct Record {
+			uint8_t		type; ///<RecordType
+			uint8_t		a;
+			uint8_t		b;
+			uint8_t		reserved;
+		};
+
+		static const uint32_t SECTOR_FIRST = 26; ///<Primer sector reservado
+		static const uint32_t SECTOR_COUNT = 4; ///<Numero de sectores reservados
+		static const uint32_t SECTOR_SIZE = 0x8000; ///<Tamano de los sectores reservados (32KB)
+		static const uint32_t BASE_ADDRESS = 0x60000; ///<Direccion del primer sector reservado
+		static const uint32_t PAGE_SIZE = FlashPage::SIZE; ///<Unidad de escritura
+		static const uint32_t PAGES_PER_SECTOR = SECTOR_SIZE / PAGE_SIZE;
+
+		FlashJournal();
+
+		/**
+		 * \brief Localiza el final del diario. Debe llamarse una vez antes de
+		 * append() y flush()
+		 * \param last: Ultimo registro escrito. Sin modificar si el diario esta vacio
+		 * \returns true si se ha encontrado algun registro
+		 */
+		bool restore(Record& last);
+
+		/**
+		 * \brief Anade un registro. Solo se escribe en RAM. Los registros
+		 * consecutivos del mismo tipo se agrupan, ya que cada uno representa
+		 * el estado completo, y se descartan los que repiten el ultimo escrito
+		 */
+		void append(uint8_t type, uint8_t a, uint8_t b);
+
+		/**
+		 * \brief Escribe los registros pendientes en una pagina, si los hay
+		 * \param idle: El panel esta inactivo. En ese caso, y si no hay nada
+		 * que escribir, se borra por adelantado el siguiente sector, para no
+		 * bloquear la entrada cuando haga falta
+		 * \returns true si se ha escrito una pagina
+		 */
+		bool flush(bool idle);
+
+		/**
+		 * \brief Devuelve si hay registros pendientes de escribir
+		 */
+		bool isPending() const;
+
+		/**
+		 * \brief Devuelve el numero de paginas escritas desde el arranque
+		 */
+		uint32_t getPageWrites() const;
+
+		/**
+		 * \brief Devuelve el numero de sectores borrados desde el arranque
+		 */
+		uint32_t getSectorErases() const;
+
+
+
+	private:
+		//Paginas en formato FlashPage. La secuencia es el numero de pagina
+		//desde el inicio del diario
+		static const uint32_t MAGIC = 0x4C4E524A; //"JRNL"
+		static const uint32_t PAGE_WORDS = FlashPage::WORDS;
+		static const uint32_t RECORDS_PER_PAGE = FlashPage::DATA_SIZE / sizeof(Record);
+
+		///Pagina en construccion. Alineada a palabra, como exige IAP
+		uint32_t			m_page[PAGE_WORDS];
+		uint32_t			m_count; ///<Registros pendientes en m_page
+		Record				m_last; ///<Ultimo registro escrito
+
+		uint32_t			m_sequence; ///<Secuencia de la ultima pagina escrita
+		uint32_t			m_headSector; ///<Sector donde se escribe. [0, SECTOR_COUNT)
+		uint32_t			m_headPage; ///<Siguiente pagina libre del sector. [0, PAGES_PER_SECTOR]
+		bool					m_headErased; ///<El sector actual puede escribirse
+		bool					m_nextErased; ///<El siguiente sector ya esta borrado
+
+		uint32_t			m_pageWrites;
+		uint32_t			m_sectorErases;
+
+		FlashPage::Header* header();
+		Record* records();
+
+		static const FlashPage::Header* pageAt(uint32_t sector, uint32_t page);
+		static bool isValid(const FlashPage::Header* page);
+
+		bool eraseSector(uint32_t sector);
+		bool programPage(uint32_t sector, uint32_t page);
+
+};
+
+#endif //FLASH_JOURNAL_H_INCLUDED
@@ -0,0 +1,79 @@
+#ifndef FLASH_PAGE_H_INCLUDED
+#define FLASH_PAGE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+
+#include "FlashIap.h"
+
+/**
+ * \brief Formato comun de las paginas que se guardan en la flash (diario y
+ * macros): una cabecera con la marca del tipo de pagina, su numero de
+ * secuencia, los elementos validos y una suma de comprobacion, seguida de
+ * los elementos. Los elementos sin usar quedan a 0xFF, como la flash
+ * borrada.
+ */
+class FlashPage {
+	public:
+		///Cabecera de cada pagina
+		struct Header {
+			uint32_t	magic; ///<Tipo de pagina. 0xFFFFFFFF = sin escribir
+			uint32_t	sequence; ///<Numero de secuencia, creciente
+			uint32_t	count; ///<Elementos validos
+			uint32_t	checksum; ///<Complemento de la suma de las palabras de la pagina
+		};
+
+		static const uint32_t SIZE = FlashIap::PAGE_SIZE;
+		static const uint32_t WORDS = SIZE / sizeof(uint32_t);
+		static const uint32_t DATA_SIZE = SIZE - sizeof(Header); ///<Bytes para los elementos
+
+		/**
+		 * \brief Completa la cabecera de una pagina en RAM y rellena los
+		 * elementos sin usar
+		 * \param page: WORDS palabras. Los elementos van tras la cabecera
+		 * \param itemSize: Tamano de cada elemento
+		 */
+		static void seal(uint32_t* page, uint32_t magic, uint32_t sequence, uint32_t count, size_t itemSize) {
+			Header* hdr = reinterpret_cast<Header*>(page);
+			hdr->magic = magic;
+			hdr->sequence = sequence;
+			hdr->count = count;
+			hdr->checksum = 0;
+			const size_t used = sizeof(Header) + count * itemSize;
+			std::memset(reinterpret_cast<uint8_t*>(page) + used, 0xFF, SIZE - used);
+			hdr->checksum = checksum(page);
+		}
+
+		/**
+		 * \brief Devuelve si una pagina se ha empezado a escribir
+		 */
+		static bool isWritten(const Header* page) {
+			return page->magic != 0xFFFFFFFF;
+		}
+
+		/**
+		 * \brief Devuelve si una pagina esta completa y es del tipo indicado
+		 * \param countMax: Elementos que caben en la pagina
+		 */
+		static bool isValid(const Header* page, uint32_t magic, uint32_t countMax) {
+			return	page->magic == magic &&
+							page->count <= countMax &&
+							checksum(reinterpret_cast<const uint32_t*>(page)) == 0;
+		}
+
+
+
+	private:
+		static uint32_t checksum(const uint32_t* words) {
+			//Complemento de la suma. Al incluir el propio campo, una pagina valida suma 0
+			uint32_t sum = 0;
+			for(uint32_t i = 0; i < WORDS; ++i) {
+				sum += words[i];
+			}
+			return ~sum + 1;
+		}
+
+};
+
+#endif //FLASH_PAGE_H_INCLUDED
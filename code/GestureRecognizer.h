@@ -0,0 +1,129 @@
+#ifndef GESTURE_RECOGNIZER_H_INCLUDED
+#define GESTURE_RECOGNIZER_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "BitSlicedCounter.h"
+
+/**
+ * \brief Gestos de los botones
+ */
+template<typename Word>
+struct ButtonGestures {
+	Word	longPress; ///<Botones que llevan pulsados el tiempo de pulsacion larga
+	Word	repeat; ///<Repeticiones de los botones que siguen pulsados tras la pulsacion larga
+	Word	doubleTap; ///<Botones pulsados por segunda vez poco despues de una pulsacion corta
+
+	ButtonGestures()
+		: longPress(0)
+		, repeat(0)
+		, doubleTap(0)
+	{
+	}
+};
+
+
+
+/**
+ * \brief Reconoce pulsaciones largas, dobles pulsaciones y repeticiones de
+ * todos los botones a la vez. Los tiempos se cuentan con contadores por
+ * planos (BitSlicedCounter), por lo que el coste no depende del numero de
+ * botones, sino del ancho de palabra.
+ *
+ * Los tiempos avanzan con age(), llamado con un periodo fijo, y no con las
+ * tramas, ya que su duracion depende del modo y del ritmo de refresco. Los
+ * flancos se evaluan en update(), que se llama con cada trama.
+ * \tparam Word: Tipo de palabra. uint32_t hasta 32 botones, uint64_t hasta 64
+ * \tparam Bits: Bits de los contadores. Deben caber todos los tiempos
+ */
+template<typename Word, size_t Bits = 7>
+class GestureRecognizer {
+	public:
+		typedef ButtonGestures<Word> Gestures;
+
+		/**
+		 * \brief Constructor. Los tiempos se expresan en llamadas a age()
+		 * \param longTicks: Duracion de la pulsacion larga
+		 * \param repeatTicks: Periodo de repeticion tras la pulsacion larga
+		 * \param doubleTapTicks: Tiempo maximo entre soltar y volver a pulsar
+		 */
+		GestureRecognizer(uint32_t longTicks, uint32_t repeatTicks, uint32_t doubleTapTicks)
+			: m_longTicks(longTicks)
+			, m_repeatTicks(repeatTicks)
+			, m_doubleTapTicks(doubleTapTicks)
+			, m_held(0)
+			, m_longFired(0)
+			, m_armed(0)
+			, m_doubled(0)
+		{
+		}
+
+		/**
+		 * \brief Avanza el tiempo de todos los botones
+		 */
+		void age() {
+			//Tiempo pulsado
+			m_hold.increment(m_held);
+			const Word longPress = m_held & ~m_longFired & m_hold.equals(m_longTicks);
+			m_longFired |= longPress;
+			m_pending.longPress |= longPress;
+
+			const Word repeat = m_longFired & m_hold.equals(m_longTicks + m_repeatTicks);
+			m_hold.load(repeat, m_longTicks);
+			m_pending.repeat |= repeat;
+
+			//Tiempo soltado tras una pulsacion corta
+			m_gap.increment(m_armed);
+			m_armed &= ~m_gap.equals(m_doubleTapTicks);
+		}
+
+		/**
+		 * \brief Evalua una trama
+		 * \param held: Botones pulsados, activo alto
+		 * \returns Gestos desde la ultima trama
+		 */
+		Gestures update(Word held) {
+			const Word rising = held & ~m_held;
+			const Word released = m_held & ~held;
+			m_held = held;
+
+			Gestures result = m_pending;
+			m_pending = Gestures();
+
+			//Segunda pulsacion dentro de plazo. No cuenta como primera de otra
+			result.doubleTap = rising & m_armed;
+			m_doubled |= result.doubleTap;
+			m_armed &= ~rising;
+
+			//Al soltar una pulsacion corta empieza el plazo de la segunda
+			const Word tap = released & ~m_longFired & ~m_doubled;
+			m_armed |= tap;
+			m_gap.clear(tap);
+			m_doubled &= ~released;
+
+			//Los botones soltados vuelven a empezar
+			m_hold.clear(~held);
+			m_longFired &= held;
+
+			return result;
+		}
+
+
+
+	private:
+		uint32_t									m_longTicks;
+		uint32_t									m_repeatTicks;
+		uint32_t									m_doubleTapTicks;
+
+		Word											m_held; ///<Botones pulsados en la ultima trama
+		Word											m_longFired; ///<Ya se ha notificado su pulsacion larga
+		Word											m_armed; ///<Pulsacion corta reciente, esperando la segunda
+		Word											m_doubled; ///<La pulsacion actual es la segunda de una doble
+		BitSlicedCounter<Word, Bits>	m_hold; ///<Tiempo pulsado
+		BitSlicedCounter<Word, Bits>	m_gap; ///<Tiempo desde la pulsacion corta
+		Gestures									m_pending; ///<Gestos de age() aun no entregados
+
+};
+
+#endif //GESTURE_RECOGNIZER_H_INCLUDED
@@ -0,0 +1,207 @@
+#ifndef LED_DIMMER_H_INCLUDED
+#define LED_DIMMER_H_INCLUDED
+
+#include "mbed.h"
+#include "RamPlacement.h"
+
+#include <bitset>
+#include <stdint.h>
+
+/**
+ * \brief Atenuacion de leds por modulacion de codigo binario (BCM) sobre la
+ * cadena de 74HC595. Cada trama se descompone en Bits planos, y el plano b se
+ * mantiene en la salida durante baseUs * 2^b microsegundos, por lo que cada
+ * led puede tener 2^Bits niveles de brillo. Los planos se calculan solo cuando
+ * cambia la trama o los niveles; la interrupcion unicamente los transmite.
+ * \tparam Driver: Salida de la cadena. Debe proporcionar el tipo OutputData,
+ * la constante OUTPUT_COUNT y los metodos setOutputData(const OutputData&) y
+ * burst() (trama completa en rafaga)
+ * \tparam Bits: Numero de bits de brillo
+ */
+template<typename Driver, size_t Bits>
+class LedDimmer {
+	public:
+		typedef typename Driver::OutputData LedState; ///<Tipo que representa el estado de los leds
+
+		static const size_t LED_COUNT = Driver::OUTPUT_COUNT; ///<Numero de leds
+		static const uint8_t LEVEL_MAX = (1 << Bits) - 1; ///<Nivel de brillo maximo
+
+		///Medidas del refresco, para comprobar que no hay parpadeo
+		struct Stats {
+			uint32_t	refreshCount; ///<Planos transmitidos
+			uint32_t	cycleCount; ///<Ciclos BCM completos (todos los planos)
+			uint32_t	maxBurstUs; ///<Duracion maxima de la transmision de un plano
+			uint32_t	maxLatencyUs; ///<Retraso maximo de la interrupcion respecto a lo previsto
+		};
+
+		/**
+		 * \brief Constructor
+		 * \param driver: Salida de la cadena. Debe sobrevivir al objeto
+		 * \param baseUs: Duracion del plano de menor peso
+		 * \param blinkCycles: Ciclos BCM que dura cada fase del parpadeo. Mayor que 0
+		 */
+		LedDimmer(Driver& driver, uint32_t baseUs, uint32_t blinkCycles)
+			: m_driver(driver)
+			, m_baseUs(baseUs)
+			, m_blinkCycles(blinkCycles)
+			, m_front(0)
+			, m_plane(Bits - 1)
+			, m_cycle(0)
+			, m_deadline(0)
+		{
+			for(size_t i = 0; i < LED_COUNT; ++i) {
+				setLevels(i, LEVEL_MAX, 0);
+			}
+			resetStats();
+			render();
+		}
+
+		/**
+		 * \brief Establece el brillo de un led
+		 * \param index: Indice del led
+		 * \param onLevel: Brillo cuando esta activo en la trama
+		 * \param offLevel: Brillo cuando esta inactivo en la trama (p.e. "disponible")
+		 * Los planos no se recalculan hasta llamar a update()
+		 */
+		void setLevels(size_t index, uint8_t onLevel, uint8_t offLevel) {
+			for(size_t b = 0; b < Bits; ++b) {
+				m_onMasks[b].set(index, (onLevel >> b) & 1);
+				m_offMasks[b].set(index, (offLevel >> b) & 1);
+			}
+		}
+
+		/**
+		 * \brief Establece los leds que parpadean entre su nivel activo e inactivo
+		 */
+		void setBlink(const LedState& blink) {
+			m_blink = blink;
+			render();
+		}
+
+		/**
+		 * \brief Establece la trama a mostrar
+		 */
+		void setFrame(const LedState& frame) {
+			m_frame = frame;
+			render();
+		}
+
+		/**
+		 * \brief Recalcula los planos tras modificar los niveles
+		 */
+		void update() {
+			render();
+		}
+
+		/**
+		 * \brief Comienza a refrescar la salida
+		 */
+		void start() {
+			m_deadline = us_ticker_read();
+			refresh();
+		}
+
+		/**
+		 * \brief Detiene el refresco. La salida mantiene el ultimo plano
+		 */
+		void stop() {
+			m_timeout.detach();
+		}
+
+		/**
+		 * \brief Devuelve las medidas del refresco
+		 */
+		Stats getStats() const {
+			core_util_critical_section_enter();
+			const Stats result = m_stats;
+			core_util_critical_section_exit();
+			return result;
+		}
+
+		/**
+		 * \brief Reinicia las medidas del refresco
+		 */
+		void resetStats() {
+			core_util_critical_section_enter();
+			m_stats.refreshCount = 0;
+			m_stats.cycleCount = 0;
+			m_stats.maxBurstUs = 0;
+			m_stats.maxLatencyUs = 0;
+			core_util_critical_section_exit();
+		}
+
+
+
+	private:
+		Driver&				m_driver; ///<Salida de la cadena
+		Timeout				m_timeout; ///<Fin del plano actual
+
+		uint32_t			m_baseUs; ///<Duracion del plano de menor peso
+		uint32_t			m_blinkCycles; ///<Ciclos BCM que dura cada fase del parpadeo
+
+		LedState			m_onMasks[Bits]; ///<Bit b del nivel activo de cada led
+		LedState			m_offMasks[Bits]; ///<Bit b del nivel inactivo de cada led
+		LedState			m_frame; ///<Trama a mostrar
+		LedState			m_blink; ///<Leds que parpadean
+
+		///Planos de cada fase de parpadeo, con doble buffer. La interrupcion
+		///solo lee m_planes[m_front], el bucle principal escribe el otro
+		LedState			m_planes[2][2][Bits];
+		volatile size_t	m_front;
+
+		size_t				m_plane; ///<Plano en la salida
+		uint32_t			m_cycle; ///<Numero de ciclo BCM
+		uint32_t			m_deadline; ///<Instante previsto de la siguiente interrupcion
+		Stats					m_stats;
+
+		/**
+		 * \brief Calcula los planos de ambas fases en el buffer trasero y los publica
+		 */
+		void render() {
+			const size_t back = m_front ^ 1;
+
+			const LedState lit[2] = { m_frame, m_frame & ~m_blink };
+			for(size_t phase = 0; phase < 2; ++phase) {
+				for(size_t b = 0; b < Bits; ++b) {
+					m_planes[back][phase][b] = (lit[phase] & m_onMasks[b]) | (~lit[phase] & m_offMasks[b]);
+				}
+			}
+
+			m_front = back;
+		}
+
+		/**
+		 * \brief Interrupcion de fin de plano. Programa el siguiente y lo transmite
+		 */
+		RAM_FUNC void refresh() {
+			const uint32_t start = us_ticker_read();
+
+			//Avanzar al siguiente plano
+			if(++m_plane >= Bits) {
+				m_plane = 0;
+				++m_cycle;
+				++m_stats.cycleCount;
+			}
+
+			//Programar el fin de este plano antes de transmitirlo, para que la
+			//duracion de la rafaga no se sume a su peso
+			const uint32_t durationUs = m_baseUs << m_plane;
+			m_timeout.attach_us(callback(this, &LedDimmer::refresh), durationUs);
+
+			const uint32_t latency = start - m_deadline;
+			m_deadline = start + durationUs;
+			if(latency > m_stats.maxLatencyUs) m_stats.maxLatencyUs = latency;
+
+			//Transmitir el plano de la fase de parpadeo actual
+			const size_t phase = (m_cycle / m_blinkCycles) & 1;
+			m_driver.setOutputData(m_planes[m_front][phase][m_plane]);
+			m_driver.burst();
+
+			++m_stats.refreshCount;
+			const uint32_t burstUs = us_ticker_read() - start;
+			if(burstUs > m_stats.maxBurstUs) m_stats.maxBurstUs = burstUs;
+		}
+
+};
+
+#endif //LED_DIMMER_H_INCLUDED
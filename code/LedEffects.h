@@ -0,0 +1,198 @@
+#ifndef LED_EFFECTS_H_INCLUDED
+#define LED_EFFECTS_H_INCLUDED
+
+#include <bitset>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Efectos de leds (parpadeos, persecuciones...) planificados sobre una
+ * rueda de temporizadores. Cada led animado tiene un periodo, un ciclo de
+ * trabajo y una fase en cuadros, y solo se visita en el cuadro en el que
+ * cambia, por lo que el coste de cada cuadro es proporcional a los leds que
+ * cambian en el, no al numero de leds animados.
+ * \tparam LedCnt: Numero de leds. Menor que 255
+ * \tparam WheelSize: Numero de ranuras de la rueda. Potencia de 2. Los periodos
+ * mayores que la rueda son validos pero se revisitan cada WheelSize cuadros
+ */
+template<size_t LedCnt, size_t WheelSize = 32>
+class LedEffects {
+	public:
+		typedef std::bitset<LedCnt> LedState; ///<Tipo que representa el estado de los leds
+
+		LedEffects()
+			: m_now(0)
+		{
+			clearAll();
+		}
+
+		/**
+		 * \brief Anima un led. Se enciende en los cuadros t en los que
+		 * (t + phase) % period < duty
+		 * \param index: Indice del led
+		 * \param period: Periodo en cuadros. Mayor que 0
+		 * \param duty: Cuadros encendido en cada periodo
+		 * \param phase: Desfase en cuadros, p.e. para persecuciones
+		 */
+		void setEffect(size_t index, uint16_t period, uint16_t duty, uint16_t phase) {
+			unschedule(index);
+			m_animated.set(index);
+
+			Entry& entry = m_entries[index];
+			if(duty >= period || duty == 0) {
+				//Encendido o apagado fijo. No hay cambios que planificar
+				m_lit.set(index, duty != 0);
+				return;
+			}
+
+			entry.onFrames = duty;
+			entry.offFrames = period - duty;
+
+			const uint32_t pos = (m_now + phase) % period;
+			if(pos < duty) {
+				m_lit.set(index);
+				schedule(index, m_now + (duty - pos));
+			} else {
+				m_lit.reset(index);
+				schedule(index, m_now + (period - pos));
+			}
+		}
+
+		/**
+		 * \brief Deja de animar un led. Vuelve a mostrar la trama estatica
+		 */
+		void clearEffect(size_t index) {
+			unschedule(index);
+			m_animated.reset(index);
+			m_lit.reset(index);
+		}
+
+		/**
+		 * \brief Deja de animar todos los leds
+		 */
+		void clearAll() {
+			for(size_t i = 0; i < WheelSize; ++i) {
+				m_slots[i] = NONE;
+			}
+			for(size_t i = 0; i < LedCnt; ++i) {
+				m_entries[i].slotted = false;
+			}
+			m_animated.reset();
+			m_lit.reset();
+		}
+
+		/**
+		 * \brief Avanza un cuadro
+		 * \returns true si ha cambiado algun led animado
+		 */
+		bool advance() {
+			++m_now;
+
+			//Extraer de la ranura los leds que cambian en este cuadro. Los que
+			//pertenecen a otra vuelta de la rueda se mantienen
+			uint8_t due = NONE;
+			uint8_t* link = &m_slots[m_now & WHEEL_MASK];
+			while(*link != NONE) {
+				const uint8_t index = *link;
+				Entry& entry = m_entries[index];
+				if(entry.deadline == m_now) {
+					*link = entry.next;
+					entry.next = due;
+					due = index;
+				} else {
+					link = &entry.next;
+				}
+			}
+
+			//Cambiar su estado y volver a planificarlos
+			const bool changed = (due != NONE);
+			while(due != NONE) {
+				const uint8_t index = due;
+				Entry& entry = m_entries[index];
+				due = entry.next;
+				entry.slotted = false;
+
+				m_lit.flip(index);
+				schedule(index, m_now + (m_lit.test(index) ? entry.onFrames : entry.offFrames));
+			}
+
+			return changed;
+		}
+
+		/**
+		 * \brief Combina los efectos con la trama estatica. Los leds animados
+		 * sustituyen a los de la trama
+		 */
+		LedState compose(const LedState& frame) const {
+			return (frame & ~m_animated) | m_lit;
+		}
+
+		/**
+		 * \brief Devuelve los leds animados
+		 */
+		const LedState& getAnimated() const {
+			return m_animated;
+		}
+
+		/**
+		 * \brief Devuelve el cuadro actual
+		 */
+		uint32_t getFrame() const {
+			return m_now;
+		}
+
+
+
+	private:
+		static const uint8_t NONE = 0xFF;
+		static const size_t WHEEL_MASK = WheelSize - 1;
+
+		typedef char WheelSizeCheck[((WheelSize & WHEEL_MASK) == 0) ? 1 : -1];
+		typedef char LedCountCheck[(LedCnt < NONE) ? 1 : -1];
+
+		struct Entry {
+			uint32_t	deadline; ///<Cuadro del siguiente cambio
+			uint16_t	onFrames; ///<Cuadros encendido
+			uint16_t	offFrames; ///<Cuadros apagado
+			uint8_t		next; ///<Siguiente led de la misma ranura
+			bool			slotted; ///<Pertenece a alguna ranura
+		};
+
+		Entry			m_entries[LedCnt];
+		uint8_t		m_slots[WheelSize]; ///<Primer led de cada ranura
+		LedState	m_animated; ///<Leds animados
+		LedState	m_lit; ///<Estado de los leds animados
+		uint32_t	m_now; ///<Cuadro actual
+
+		/**
+		 * \brief Inserta un led en la ranura de su siguiente cambio
+		 */
+		void schedule(size_t index, uint32_t deadline) {
+			Entry& entry = m_entries[index];
+			uint8_t& slot = m_slots[deadline & WHEEL_MASK];
+			entry.deadline = deadline;
+			entry.next = slot;
+			entry.slotted = true;
+			slot = static_cast<uint8_t>(index);
+		}
+
+		/**
+		 * \brief Retira un led de su ranura, si pertenece a alguna
+		 */
+		void unschedule(size_t index) {
+			Entry& entry = m_entries[index];
+			if(!entry.slotted) {
+				return;
+			}
+
+			uint8_t* link = &m_slots[entry.deadline & WHEEL_MASK];
+			while(*link != index) {
+				link = &m_entries[*link].next;
+			}
+			*link = entry.next;
+			entry.slotted = false;
+		}
+
+};
+
+#endif //LED_EFFECTS_H_INCLUDED
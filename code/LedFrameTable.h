@@ -0,0 +1,58 @@
+#ifndef LED_FRAME_TABLE_H_INCLUDED
+#define LED_FRAME_TABLE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+///Mascara de un unico led dentro de la palabra de leds
+#define LED_FRAME_BIT(i) (static_cast<uint32_t>(1) << (i))
+
+/**
+ * \brief Palabra que contiene una trama de leds. Se construyen tramas de
+ * hasta 32 leds, el tamano de palabra del Cortex-M3
+ */
+typedef uint32_t LedFrameWord;
+
+/**
+ * \brief Tabla de tramas de una fila de leds (un 74HC595), indexada por la
+ * senal seleccionada. El indice COUNT corresponde a ninguna senal (fila apagada).
+ * Se genera en tiempo de compilacion, por lo que se almacena en flash y la
+ * conversion senal -> trama se reduce a una carga
+ * \tparam First: Indice del primer led de la fila
+ */
+template<size_t First>
+struct LedRow {
+	static const size_t COUNT = 8; ///<Numero de leds de la fila
+	static const LedFrameWord FRAMES[COUNT + 1]; ///<Trama de cada senal. [COUNT] = ninguna
+};
+
+template<size_t First>
+const LedFrameWord LedRow<First>::FRAMES[LedRow<First>::COUNT + 1] = {
+	LED_FRAME_BIT(First + 0),
+	LED_FRAME_BIT(First + 1),
+	LED_FRAME_BIT(First + 2),
+	LED_FRAME_BIT(First + 3),
+	LED_FRAME_BIT(First + 4),
+	LED_FRAME_BIT(First + 5),
+	LED_FRAME_BIT(First + 6),
+	LED_FRAME_BIT(First + 7),
+	0
+};
+
+/**
+ * \brief Tabla de tramas de un led individual (corte, transicion, AUX...),
+ * indexada por su estado. 0 = apagado, 1 = encendido
+ * \tparam Index: Indice del led
+ */
+template<size_t Index>
+struct LedFlag {
+	static const LedFrameWord FRAMES[2]; ///<Trama de cada estado
+};
+
+template<size_t Index>
+const LedFrameWord LedFlag<Index>::FRAMES[2] = {
+	0,
+	LED_FRAME_BIT(Index)
+};
+
+#endif //LED_FRAME_TABLE_H_INCLUDED
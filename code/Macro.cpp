@@ -0,0 +1,176 @@
+#include "Macro.h"
+#include "FlashIap.h"
+
+#include <cstring>
+
+Macro::Macro()
+	: m_count(0)
+	, m_sequence(0)
+	, m_nextPage(0)
+	, m_recording(false)
+	, m_lastUs(0)
+	, m_due(false)
+	, m_playing(false)
+	, m_index(0)
+	, m_startUs(0)
+	, m_offsetUs(0)
+{
+}
+
+
+
+void Macro::startRecording() {
+	stop();
+	m_count = 0;
+	m_recording = true;
+	m_lastUs = us_ticker_read();
+}
+
+void Macro::stopRecording() {
+	m_recording = false;
+}
+
+void Macro::record(Action action, uint8_t arg) {
+	if(!m_recording || m_count == STEP_MAX) {
+		return;
+	}
+
+	//Los retrasos mayores que 65s se recortan
+	const uint32_t now = us_ticker_read();
+	const uint32_t delayMs = (now - m_lastUs) / 1000;
+	m_lastUs = now;
+
+	Step& step = steps()[m_count++];
+	step.action = static_cast<uint8_t>(action);
+	step.arg = arg;
+	step.delayMs = static_cast<uint16_t>(delayMs < 0xFFFF ? delayMs : 0xFFFF);
+}
+
+
+
+void Macro::play() {
+	stop();
+	if(m_recording || m_count == 0) {
+		return;
+	}
+
+	m_playing = true;
+	m_index = 0;
+	m_startUs = us_ticker_read();
+	m_offsetUs = 0;
+	schedule();
+}
+
+void Macro::stop() {
+	m_timeout.detach();
+	m_playing = false;
+	m_due = false;
+}
+
+bool Macro::next(Step& step) {
+	if(!m_due) {
+		return false;
+	}
+
+	m_due = false;
+	step = steps()[m_index++];
+	if(m_index < m_count) {
+		schedule();
+	} else {
+		m_playing = false;
+	}
+	return true;
+}
+
+bool Macro::isDue() const {
+	return m_due;
+}
+
+bool Macro::isRecording() const {
+	return m_recording;
+}
+
+bool Macro::isPlaying() const {
+	return m_playing;
+}
+
+size_t Macro::getStepCount() const {
+	return m_count;
+}
+
+
+
+bool Macro::save() {
+	//Sector lleno: borrarlo y volver a empezar
+	if(m_nextPage == PAGES) {
+		bool erased;
+		if(!FlashIap::eraseSector(SECTOR, erased)) {
+			return false;
+		}
+		m_nextPage = 0;
+	}
+
+	//Completar la pagina. Los pasos sin usar quedan a 0xFF
+	FlashPage::seal(m_page, MAGIC, m_sequence + 1, m_count, sizeof(Step));
+
+	//Aunque falle, la pagina no puede volver a escribirse
+	const uint32_t address = BASE_ADDRESS + m_nextPage * PAGE_SIZE;
+	const bool written = FlashIap::programPage(SECTOR, address, m_page);
+	++m_nextPage;
+	if(written) {
+		++m_sequence;
+	}
+	return written;
+}
+
+bool Macro::load() {
+	//Las paginas se escriben en orden, y la ultima valida es la mas reciente
+	const FlashPage::Header* last = 0;
+	m_nextPage = 0;
+	for(uint32_t page = 0; page < PAGES; ++page) {
+		const FlashPage::Header* hdr = pageAt(page);
+		if(!FlashPage::isWritten(hdr)) {
+			break;
+		}
+		if(FlashPage::isValid(hdr, MAGIC, STEP_MAX)) {
+			last = hdr;
+		}
+		m_nextPage = page + 1;
+	}
+
+	if(!last) {
+		return false;
+	}
+
+	m_sequence = last->sequence;
+	m_count = last->count;
+	std::memcpy(m_page, last, PAGE_SIZE);
+	return true;
+}
+
+
+
+FlashPage::Header* Macro::header() {
+	return reinterpret_cast<FlashPage::Header*>(m_page);
+}
+
+Macro::Step* Macro::steps() {
+	return reinterpret_cast<Step*>(header() + 1);
+}
+
+const FlashPage::Header* Macro::pageAt(uint32_t page) {
+	return reinterpret_cast<const FlashPage::Header*>(BASE_ADDRESS + page*PAGE_SIZE);
+}
+
+
+
+void Macro::schedule() {
+	//Instante absoluto del paso, para que los retrasos no se acumulen
+	m_offsetUs += steps()[m_index].delayMs * 1000;
+	const int32_t remaining = static_cast<int32_t>(m_startUs + m_offsetUs - us_ticker_read());
+	m_timeout.attach_us(callback(this, &Macro::onTimeout), remaining > 0 ? remaining : 0);
+}
+
+void Macro::onTimeout() {
+	m_due = true;
+}
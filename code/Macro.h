@@ -0,0 +1,150 @@
+#ifndef MACRO_H_INCLUDED
+#define MACRO_H_INCLUDED
+
+#include "mbed.h"
+#include "FlashPage.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Grabacion y reproduccion de una secuencia de acciones del mezclador
+ * (programa, previo, corte, transicion) con sus tiempos relativos.
+ *
+ * La grabacion se guarda en un buffer fijo en RAM y puede guardarse en el
+ * sector 25 de la flash (0x58000, excluido del programa en el fichero
+ * scatter). Cada guardado ocupa la siguiente pagina del sector, por lo que
+ * solo se borra una vez cada 128 guardados.
+ *
+ * La reproduccion no bloquea: un Timeout marca cada paso en su instante y
+ * el bucle principal lo ejecuta con next(). Los instantes se calculan desde
+ * el comienzo de la reproduccion, por lo que los retrasos del bucle no se
+ * acumulan.
+ */
+class Macro {
+	public:
+		///Acciones grabadas
+		enum Action {
+			ACTION_PROGRAM, ///<arg = senal
+			ACTION_PREVIEW, ///<arg = senal
+			ACTION_CUT,
+			ACTION_TRANSITION,
+
+			//Add here
+
+			ACTION_COUNT
+		};
+
+		///Paso de la macro. Ocupa una palabra
+		struct Step {
+			uint8_t		action; ///<Action
+			uint8_t		arg; ///<Senal. 0xFF = ninguna
+			uint16_t	delayMs; ///<Tiempo desde el paso anterior
+		};
+
+		static const uint32_t SECTOR = 25; ///<Sector de la flash reservado
+		static const uint32_t BASE_ADDRESS = 0x58000; ///<Direccion del sector reservado
+		static const uint32_t SECTOR_SIZE = 0x8000; ///<Tamano del sector reservado (32KB)
+
+		Macro();
+
+		/**
+		 * \brief Comienza a grabar. Descarta la macro anterior
+		 */
+		void startRecording();
+
+		/**
+		 * \brief Termina de grabar
+		 */
+		void stopRecording();
+
+		/**
+		 * \brief Anade una accion a la grabacion, si se esta grabando. Si el
+		 * buffer esta lleno se descarta
+		 */
+		void record(Action action, uint8_t arg);
+
+		/**
+		 * \brief Comienza a reproducir. El primer paso llega tras su retraso
+		 */
+		void play();
+
+		/**
+		 * \brief Detiene la reproduccion
+		 */
+		void stop();
+
+		/**
+		 * \brief Devuelve el siguiente paso si ha llegado su instante, y
+		 * programa el siguiente. Debe llamarse desde el bucle principal
+		 * \returns true si hay un paso que ejecutar
+		 */
+		bool next(Step& step);
+
+		/**
+		 * \brief Devuelve si hay un paso esperando a next()
+		 */
+		bool isDue() const;
+
+		bool isRecording() const;
+		bool isPlaying() const;
+
+		/**
+		 * \brief Devuelve el numero de pasos grabados
+		 */
+		size_t getStepCount() const;
+
+		/**
+		 * \brief Guarda la macro en la flash. Bloquea ~1ms, o ~100ms si hay
+		 * que borrar el sector, por lo que no debe llamarse al procesar los
+		 * botones
+		 */
+		bool save();
+
+		/**
+		 * \brief Recupera la ultima macro guardada
+		 * \returns true si habia alguna
+		 */
+		bool load();
+
+
+
+	private:
+		//Paginas en formato FlashPage. La secuencia es el numero de guardado
+		static const uint32_t MAGIC = 0x4F52434D; //"MCRO"
+		static const uint32_t PAGE_SIZE = FlashPage::SIZE;
+		static const uint32_t PAGE_WORDS = FlashPage::WORDS;
+		static const uint32_t PAGES = SECTOR_SIZE / PAGE_SIZE;
+
+	public:
+		static const size_t STEP_MAX = FlashPage::DATA_SIZE / sizeof(Step); ///<Pasos que caben en una macro
+
+	private:
+		///Pagina con la macro. Alineada a palabra, como exige IAP
+		uint32_t			m_page[PAGE_WORDS];
+		size_t				m_count; ///<Pasos grabados
+
+		uint32_t			m_sequence; ///<Numero del ultimo guardado
+		uint32_t			m_nextPage; ///<Siguiente pagina libre del sector. [0, PAGES]
+
+		bool					m_recording;
+		uint32_t			m_lastUs; ///<Instante del ultimo paso grabado
+
+		Timeout				m_timeout; ///<Instante del siguiente paso
+		volatile bool	m_due; ///<Ha llegado el instante del paso m_index
+		bool					m_playing;
+		size_t				m_index; ///<Siguiente paso a reproducir
+		uint32_t			m_startUs; ///<Comienzo de la reproduccion
+		uint32_t			m_offsetUs; ///<Instante del paso m_index desde el comienzo
+
+		FlashPage::Header* header();
+		Step* steps();
+
+		static const FlashPage::Header* pageAt(uint32_t page);
+
+		void schedule();
+		void onTimeout();
+
+};
+
+#endif //MACRO_H_INCLUDED
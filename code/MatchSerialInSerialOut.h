@@ -0,0 +1,269 @@
+#ifndef MATCH_SERIAL_IN_SERIAL_OUT_H_INCLUDED
+#define MATCH_SERIAL_IN_SERIAL_OUT_H_INCLUDED
+
+#include "mbed.h"
+#include "pinmap.h"
+#include "RamPlacement.h"
+
+#include <bitset>
+#include <stdint.h>
+
+/**
+ * \brief E/S en serie mediante registros de desplazamiento (74HC165 + 74HC595)
+ * con el reloj generado por el TIMER2. Las salidas de coincidencia del
+ * temporizador generan los flancos de CLK, LOAD y LATCH, por lo que la
+ * temporizacion la fija el cristal y no depende de la latencia de ninguna
+ * interrupcion. La interrupcion de cada flanco de subida solo mueve datos:
+ * lee el bit de entrada, escribe el siguiente bit de salida y programa los
+ * cambios de LOAD y LATCH del siguiente flanco de bajada.
+ *
+ * La trama es la misma que la de SerialInSerialOut, pero LOAD y LATCH
+ * cambian medio periodo despues del flanco de subida en lugar de justo
+ * despues, y los pines son fijos:
+ * - CLK: MAT2.0 (p8)
+ * - LOAD: MAT2.1 (p7). Activo a nivel bajo
+ * - LATCH: MAT2.2 (p6)
+ *
+ * Solo puede existir una instancia, ya que el TIMER2 es unico. El TIMER3 lo
+ * ocupa el us_ticker de mbed.
+ * \tparam Sink: Destino de las palabras leidas. Debe proporcionar el metodo
+ * void onInput(const InputData&), que se llama desde la interrupcion
+ */
+template<size_t InCnt, size_t OutCnt, typename Sink>
+class MatchSerialInSerialOut {
+	public:
+		typedef std::bitset<InCnt> InputData; ///<Tipo de datos que representa una palabra a la entrada
+		typedef std::bitset<OutCnt> OutputData; ///<Tipo de datos que representa una palabra a la salida
+
+		static const size_t INPUT_COUNT = InCnt; ///<Numero de bits a la entrada
+		static const size_t OUTPUT_COUNT = OutCnt; ///<Numero de bits a la salida
+
+		/**
+		 * \brief Constructor. No arranca el reloj
+		 * \param dataIn: Pin que se utiliza para la entrada de datos en serie
+		 * \param dataOut: Pin que se utiliza para la salida de datos en serie
+		 * \param sink: Destino de las palabras leidas. Debe sobrevivir al objeto
+		 */
+		MatchSerialInSerialOut(PinName dataIn,
+													 PinName dataOut,
+													 Sink& sink,
+													 OutputData outData = 0 )
+			: m_din(dataIn) //No necesita pullup ni pulldown
+			, m_dout(dataOut, 0)
+			, m_sink(sink)
+			, m_dataIn(0)
+			, m_dataOut(outData)
+			, m_frameOut(outData)
+			, m_pendingOut(~OutputData()) //Transmitir la primera palabra en cualquier caso
+			, m_refreshOut(false)
+			, m_iteration(0)
+			, m_frames(0)
+		{
+			s_instance = this;
+		}
+
+		/**
+		 * \brief Establece la siguiente palabra a transmitir
+		 */
+		void setOutputData(const OutputData& d) {
+			setOutputData(d, d ^ m_dataOut);
+		}
+
+		/**
+		 * \brief Establece la siguiente palabra a transmitir
+		 * \param d: Palabra a transmitir
+		 * \param changed: Bits que difieren de la palabra anterior. Si no hay
+		 * ninguno, la cadena de salida no se vuelve a desplazar ni a cargar
+		 */
+		void setOutputData(const OutputData& d, const OutputData& changed) {
+			//La interrupcion toma la palabra y borra los bits pendientes
+			core_util_critical_section_enter();
+			m_dataOut = d;
+			m_pendingOut |= changed;
+			core_util_critical_section_exit();
+		}
+
+		/**
+		 * \brief Devuelve la siguiente palabra a transmitir
+		 */
+		const OutputData& getOutputData() const {
+			return m_dataOut;
+		}
+
+		/**
+		 * \brief Devuelve los bits modificados que aun no se han cargado en los registros de salida
+		 */
+		const OutputData& getPendingOutput() const {
+			return m_pendingOut;
+		}
+
+		/**
+		 * \brief Devuelve el destino de las palabras leidas
+		 */
+		Sink& getSink() const {
+			return m_sink;
+		}
+
+		/**
+		 * \brief Devuelve el numero de tramas completas desde el arranque
+		 */
+		uint32_t getFrameCount() const {
+			return m_frames;
+		}
+
+		/**
+		 * \brief Configura el TIMER2 y arranca el reloj
+		 * \param halfPeriodTicks: Semiperiodo del reloj en ciclos de CPU. La
+		 * interrupcion debe terminar antes del siguiente flanco
+		 */
+		void start(uint32_t halfPeriodTicks) {
+			LPC_SC->PCONP |= PCONP_PCTIM2;
+			LPC_SC->PCLKSEL1 = (LPC_SC->PCLKSEL1 & ~PCLKSEL1_TIMER2_MASK) | PCLKSEL1_TIMER2_CCLK;
+
+			LPC_TIM2->TCR = TCR_RESET;
+			LPC_TIM2->PR = 0;
+			LPC_TIM2->CTCR = 0;
+
+			//Las tres coincidencias ocurren en cada flanco. MR0 reinicia la
+			//cuenta e interrumpe, MR1 y MR2 solo mueven LOAD y LATCH
+			LPC_TIM2->MR0 = halfPeriodTicks - 1;
+			LPC_TIM2->MR1 = halfPeriodTicks - 1;
+			LPC_TIM2->MR2 = halfPeriodTicks - 1;
+			LPC_TIM2->MCR = MCR_MR0I | MCR_MR0R;
+
+			//CLK bajo y conmutando, LOAD alto y LATCH bajo, sin cambios
+			LPC_TIM2->EMR = EMR_LOAD | (EMC_TOGGLE << EMC_SHIFT_CLK);
+			m_iteration = 0;
+
+			pin_function(P0_6, PIN_FUNCTION_MAT); //MAT2.0
+			pin_function(P0_7, PIN_FUNCTION_MAT); //MAT2.1
+			pin_function(P0_8, PIN_FUNCTION_MAT); //MAT2.2
+
+			LPC_TIM2->IR = IR_MR0;
+			NVIC_SetVector(TIMER2_IRQn, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&MatchSerialInSerialOut::irq)));
+			NVIC_EnableIRQ(TIMER2_IRQn);
+			LPC_TIM2->TCR = TCR_ENABLE;
+		}
+
+		/**
+		 * \brief Detiene el reloj. Los pines mantienen su estado
+		 */
+		void stop() {
+			LPC_TIM2->TCR = 0;
+			NVIC_DisableIRQ(TIMER2_IRQn);
+		}
+
+
+
+	private:
+		static const uint32_t PCONP_PCTIM2 = 1 << 22;
+		static const uint32_t PCLKSEL1_TIMER2_MASK = 3 << 12;
+		static const uint32_t PCLKSEL1_TIMER2_CCLK = 1 << 12;
+		static const uint32_t TCR_ENABLE = 1 << 0;
+		static const uint32_t TCR_RESET = 1 << 1;
+		static const uint32_t MCR_MR0I = 1 << 0;
+		static const uint32_t MCR_MR0R = 1 << 1;
+		static const uint32_t IR_MR0 = 1 << 0;
+		static const uint32_t EMR_CLK = 1 << 0;
+		static const uint32_t EMR_LOAD = 1 << 1;
+		static const uint32_t EMC_SHIFT_CLK = 4;
+		static const uint32_t EMC_SHIFT_LOAD = 6;
+		static const uint32_t EMC_SHIFT_LATCH = 8;
+		static const uint32_t EMC_CLEAR = 1;
+		static const uint32_t EMC_SET = 2;
+		static const uint32_t EMC_TOGGLE = 3;
+		static const uint32_t EMC_PENDING_MASK = (3 << EMC_SHIFT_LOAD) | (3 << EMC_SHIFT_LATCH);
+		static const int PIN_FUNCTION_MAT = 3;
+
+		static MatchSerialInSerialOut* s_instance; ///<Instancia que atiende la interrupcion
+
+		DigitalIn			m_din; ///<Datos de entrada en serie
+		DigitalOut		m_dout; ///<Datos de salida en serie
+
+		Sink&					m_sink; ///<Destino de las palabras leidas
+
+		InputData			m_dataIn;	///<Palabra que se esta leyendo
+		OutputData 		m_dataOut; ///<Siguiente palabra a transmitir
+		OutputData		m_frameOut; ///<Palabra que se esta desplazando
+		OutputData		m_pendingOut; ///<Bits modificados pendientes de desplazar
+		bool					m_refreshOut; ///<Se esta desplazando una palabra nueva, cargarla al final de la trama
+
+		size_t				m_iteration; ///<Indice de la iteracion. [0, ITERATION_COUNT)
+		volatile uint32_t	m_frames; ///<Tramas completas
+
+		///Igual que en SerialInSerialOut. +1 para contar el pulso del latch
+		static const size_t ITERATION_COUNT = (InCnt > OutCnt ? InCnt : OutCnt) + 1;
+		static const size_t ITERATION_OFFSET_OUT = ITERATION_COUNT - OutCnt;
+
+		static void irq() {
+			s_instance->onMatch();
+		}
+
+		/**
+		 * \brief Interrupcion de cada flanco del reloj. En los de bajada no hay nada que hacer
+		 */
+		RAM_FUNC void onMatch() {
+			LPC_TIM2->IR = IR_MR0;
+			if(LPC_TIM2->EMR & EMR_CLK) {
+				onRisingEdge();
+			}
+		}
+
+		/**
+		 * \brief Mueve los datos tras el flanco de subida de la iteracion actual
+		 */
+		void onRisingEdge() {
+			uint32_t emc = 0;
+			if(m_iteration == 0) {
+				//Cargar la entrada y, si se ha desplazado una palabra nueva, la salida
+				emc = (EMC_CLEAR << EMC_SHIFT_LOAD) | ((m_refreshOut ? EMC_SET : EMC_CLEAR) << EMC_SHIFT_LATCH);
+
+			} else {
+				if(m_iteration == 1) {
+					//Dejar de cargar en el siguiente flanco de bajada
+					emc = (EMC_SET << EMC_SHIFT_LOAD) | (EMC_CLEAR << EMC_SHIFT_LATCH);
+					m_refreshOut = false;
+				}
+
+				//Durante las iteraciones [1 ... InCnt], leer los datos a la entrada
+				if(m_iteration <= InCnt) {
+					m_dataIn <<= 1;
+					m_dataIn.set(0, static_cast<bool>(m_din));
+					if(m_iteration == InCnt) {
+						m_sink.onInput(m_dataIn);
+					}
+				}
+
+				//Al comenzar la salida, tomar la palabra a transmitir solo si ha cambiado
+				if(m_iteration == ITERATION_OFFSET_OUT && m_pendingOut.any()) {
+					m_frameOut = m_dataOut;
+					m_pendingOut.reset();
+					m_refreshOut = true;
+				}
+
+				//Durante los ultimos OutCnt sacar los valores a la salida, de MSB hacia LSB
+				if(m_iteration >= ITERATION_OFFSET_OUT && m_refreshOut) {
+					m_dout = m_frameOut.test(OutCnt - (m_iteration - ITERATION_OFFSET_OUT) - 1);
+				}
+			}
+
+			//Programar LOAD y LATCH. Si no cambian se repite la ultima accion,
+			//que no tiene efecto al haberse aplicado ya. Al escribir EMR tambien
+			//se escribe el estado de los pines, por lo que no puede coincidir
+			//con un flanco: de ahi que la interrupcion deba durar menos de medio periodo
+			if(emc) {
+				LPC_TIM2->EMR = (LPC_TIM2->EMR & ~EMC_PENDING_MASK) | emc;
+			}
+
+			if(++m_iteration >= ITERATION_COUNT) {
+				m_iteration = 0;
+				++m_frames;
+			}
+		}
+
+};
+
+template<size_t InCnt, size_t OutCnt, typename Sink>
+MatchSerialInSerialOut<InCnt, OutCnt, Sink>* MatchSerialInSerialOut<InCnt, OutCnt, Sink>::s_instance = 0;
+
+#endif //MATCH_SERIAL_IN_SERIAL_OUT_H_INCLUDED
@@ -0,0 +1,367 @@
+#ifndef MIDI_LINK_H_INCLUDED
+#define MIDI_LINK_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Correspondencia entre las acciones del mezclador y los mensajes MIDI,
+ * comun al envio y a la recepcion.
+ *
+ * Cada accion se traduce con una fila de la tabla: tipo de mensaje, nota (o
+ * controlador) base a la que se suma la senal, y velocidad (o valor). Por
+ * defecto todas son Note On, para que el estado en curso (running status) se
+ * mantenga y cada evento ocupe 2 bytes en lugar de 3; una fila con
+ * CONTROL_CHANGE tambien es valida, a costa de repetir el estado al alternar.
+ * Solo se envia Note On: los mezcladores por software disparan con la
+ * pulsacion.
+ */
+class MidiLinkBase {
+	public:
+		///Acciones del mezclador
+		enum Action {
+			ACTION_PROGRAM,
+			ACTION_PREVIEW,
+			ACTION_CUT,
+			ACTION_TRANSITION,
+
+			ACTION_COUNT
+		};
+
+		//Tipos de mensaje (sin canal)
+		static const uint8_t NOTE_OFF = 0x80;
+		static const uint8_t NOTE_ON = 0x90;
+		static const uint8_t CONTROL_CHANGE = 0xB0;
+		static const uint8_t PROGRAM_CHANGE = 0xC0;
+		static const uint8_t CHANNEL_PRESSURE = 0xD0;
+
+		static const int BAUD = 31250;
+		static const size_t SIGNAL_MAX = 12; ///<Senales por accion: una octava
+		static const size_t MESSAGE_MAX = 3; ///<Bytes de un mensaje de canal
+		static const size_t STATUS_REFRESH_TICKS = 10; ///<Segundos entre repeticiones del estado
+
+		///Fila de la tabla de correspondencia
+		struct Mapping {
+			uint8_t	status; ///<Tipo de mensaje, sin canal
+			uint8_t	data1; ///<Nota o controlador. Se le suma la senal si hasSignal
+			uint8_t	data2; ///<Velocidad o valor
+			bool		hasSignal; ///<La accion lleva senal (programa y previo)
+		};
+
+		/**
+		 * \brief Devuelve la fila de una accion
+		 */
+		static const Mapping& getMapping(Action action) {
+			static const Mapping MAPPINGS[ACTION_COUNT] = {
+				{NOTE_ON, 36, 127, true},  //Programa: C2 + senal
+				{NOTE_ON, 48, 127, true},  //Previo: C3 + senal
+				{NOTE_ON, 60, 127, false}, //Corte: C4
+				{NOTE_ON, 61, 127, false}  //Transicion: C#4
+			};
+			return MAPPINGS[action];
+		}
+
+		/**
+		 * \brief Codifica una accion en un mensaje de canal
+		 * \param message: Destino. Al menos MESSAGE_MAX bytes; el primero es el estado
+		 * \param channel: Canal. [0, 16)
+		 * \returns Bytes del mensaje. 0 si la senal no tiene nota
+		 */
+		static size_t encode(uint8_t* message, Action action, size_t sig, uint8_t channel) {
+			const Mapping& mapping = getMapping(action);
+			if(mapping.hasSignal && sig >= SIGNAL_MAX) {
+				return 0;
+			}
+			message[0] = mapping.status | (channel & 0x0F);
+			message[1] = (mapping.data1 + (mapping.hasSignal ? sig : 0)) & 0x7F;
+			if(dataLength(mapping.status) == 1) {
+				return 2;
+			}
+			message[2] = mapping.data2 & 0x7F;
+			return 3;
+		}
+
+		/**
+		 * \brief Busca en la tabla la accion de un mensaje de canal. Un Note On
+		 * con velocidad 0 equivale a un Note Off y no corresponde a ninguna
+		 * \param status: Estado, con el canal
+		 * \returns false si el mensaje no corresponde a ninguna accion
+		 */
+		static bool decode(uint8_t status, uint8_t data1, uint8_t data2, Action& action, size_t& sig) {
+			const uint8_t type = status & 0xF0;
+			if(type == NOTE_ON && data2 == 0) {
+				return false;
+			}
+			for(size_t i = 0; i < ACTION_COUNT; ++i) {
+				const Mapping& mapping = getMapping(static_cast<Action>(i));
+				if(mapping.status != type) {
+					continue;
+				}
+				const size_t count = mapping.hasSignal ? SIGNAL_MAX : 1;
+				if(data1 >= mapping.data1 && data1 < mapping.data1 + count) {
+					action = static_cast<Action>(i);
+					sig = mapping.hasSignal ? data1 - mapping.data1 : 0;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/**
+		 * \brief Devuelve los bytes de datos de un mensaje de canal
+		 */
+		static size_t dataLength(uint8_t status) {
+			const uint8_t type = status & 0xF0;
+			return (type == PROGRAM_CHANGE || type == CHANNEL_PRESSURE) ? 1 : 2;
+		}
+};
+
+
+
+/**
+ * \brief Transporte MIDI sobre una USART: envia las acciones del mezclador con
+ * estado en curso y recibe la senalizacion (tally) del mezclador por software.
+ * El envio usa un anillo que vacia la interrupcion de transmision, como
+ * EventWriter; la recepcion se analiza byte a byte en la interrupcion y solo
+ * guarda la ultima senal de programa y de previo, que se entregan con
+ * process(). No reserva memoria.
+ * \tparam Uart: Puerto serie, como RawSerial
+ * \tparam Sink: Destino de la senalizacion. Debe proporcionar el metodo
+ * void onMidiTally(MidiLinkBase::Action action, size_t sig) (programa o
+ * previo), que se resuelve en tiempo de compilacion
+ * \tparam Size: Tamano del anillo en bytes. Potencia de 2
+ */
+template<typename Uart, typename Sink, size_t Size = 64>
+class MidiLink : public MidiLinkBase {
+	public:
+		/**
+		 * \brief Constructor
+		 * \param uart: Puerto serie. Debe sobrevivir al objeto
+		 * \param channel: Canal MIDI. [1, 16]
+		 * \param sink: Destino de la senalizacion. Debe sobrevivir al objeto
+		 */
+		MidiLink(Uart& uart, uint8_t channel, Sink& sink)
+			: m_uart(uart)
+			, m_sink(sink)
+			, m_channel((channel - 1) & 0x0F)
+			, m_head(0)
+			, m_tail(0)
+			, m_txActive(false)
+			, m_txStatus(0)
+			, m_ticks(0)
+			, m_dropped(0)
+			, m_rxStatus(0)
+			, m_rxCount(0)
+			, m_tallyFlags(0)
+		{
+		}
+
+		/**
+		 * \brief Configura el puerto y engancha sus interrupciones
+		 */
+		void start() {
+			m_uart.baud(BAUD);
+			m_uart.format(8, SerialBase::None, 1);
+			m_uart.attach(callback(this, &MidiLink::onTxEmpty), SerialBase::TxIrq);
+			m_uart.attach(callback(this, &MidiLink::onReceive), SerialBase::RxIrq);
+		}
+
+		/**
+		 * \brief Envia una accion. Omite el estado si coincide con el del
+		 * mensaje anterior
+		 * \returns false si la accion no tiene mensaje o no cabe en el anillo
+		 */
+		bool write(Action action, size_t sig) {
+			uint8_t message[MESSAGE_MAX];
+			const size_t length = encode(message, action, sig, m_channel);
+			if(!length) {
+				return false;
+			}
+
+			const size_t skip = (message[0] == m_txStatus) ? 1 : 0;
+			if(!commit(message + skip, length - skip)) {
+				m_txStatus = 0; //El siguiente mensaje debe llevar el estado
+				return false;
+			}
+			m_txStatus = message[0];
+			return true;
+		}
+
+		/**
+		 * \brief Llamar cada segundo. Cada STATUS_REFRESH_TICKS el siguiente
+		 * mensaje lleva el estado, para que un receptor conectado a mitad de
+		 * la transmision se sincronice
+		 */
+		void tick() {
+			if(++m_ticks >= STATUS_REFRESH_TICKS) {
+				m_ticks = 0;
+				m_txStatus = 0;
+			}
+		}
+
+		/**
+		 * \brief Indica si ha llegado senalizacion nueva
+		 */
+		bool hasTally() const {
+			return m_tallyFlags != 0;
+		}
+
+		/**
+		 * \brief Entrega la ultima senal recibida de programa y de previo.
+		 * Debe llamarse desde el bucle principal
+		 */
+		void process() {
+			core_util_critical_section_enter();
+			const uint8_t flags = m_tallyFlags;
+			const uint8_t program = m_tally[ACTION_PROGRAM];
+			const uint8_t preview = m_tally[ACTION_PREVIEW];
+			m_tallyFlags = 0;
+			core_util_critical_section_exit();
+
+			if(flags & (1 << ACTION_PROGRAM)) {
+				m_sink.onMidiTally(ACTION_PROGRAM, program);
+			}
+			if(flags & (1 << ACTION_PREVIEW)) {
+				m_sink.onMidiTally(ACTION_PREVIEW, preview);
+			}
+		}
+
+		/**
+		 * \brief Devuelve los mensajes descartados por falta de espacio
+		 */
+		uint32_t getDropped() const {
+			return m_dropped;
+		}
+
+		/**
+		 * \brief Devuelve los bytes pendientes de enviar
+		 */
+		size_t getPending() const {
+			return m_head - m_tail;
+		}
+
+	private:
+		static const size_t MASK = Size - 1;
+
+		typedef char SizeCheck[((Size & MASK) == 0) ? 1 : -1];
+
+		Uart&							m_uart;
+		Sink&							m_sink;
+		const uint8_t			m_channel;
+
+		//Envio
+		uint8_t						m_ring[Size];
+		volatile size_t		m_head; ///<Siguiente byte a escribir. Solo lo modifica commit()
+		volatile size_t		m_tail; ///<Siguiente byte a enviar. Solo lo modifica fill()
+		volatile bool			m_txActive; ///<La interrupcion de transmision vaciara el anillo
+		uint8_t						m_txStatus; ///<Estado en curso del envio. 0 = ninguno
+		size_t						m_ticks;
+		uint32_t					m_dropped;
+
+		//Recepcion
+		uint8_t						m_rxStatus; ///<Estado en curso de la recepcion. 0 = ninguno
+		uint8_t						m_rxData[2];
+		size_t						m_rxCount;
+		volatile uint8_t	m_tally[ACTION_PREVIEW + 1]; ///<Ultima senal de programa y de previo
+		volatile uint8_t	m_tallyFlags; ///<Bit (1 << Action) = senal nueva
+
+		/**
+		 * \brief Copia un mensaje al anillo y arranca la transmision. Si no
+		 * cabe se descarta entero
+		 */
+		bool commit(const uint8_t* data, size_t count) {
+			const size_t head = m_head;
+			if(count > Size - (head - m_tail)) {
+				++m_dropped;
+				return false;
+			}
+
+			for(size_t i = 0; i < count; ++i) {
+				m_ring[(head + i) & MASK] = data[i];
+			}
+			m_head = head + count;
+
+			//Si la interrupcion no esta en marcha, cargar el primer byte
+			core_util_critical_section_enter();
+			if(!m_txActive) {
+				m_txActive = true;
+				fill();
+			}
+			core_util_critical_section_exit();
+			return true;
+		}
+
+		/**
+		 * \brief Pasa al puerto los bytes que admita
+		 */
+		void fill() {
+			size_t tail = m_tail;
+			while(tail != m_head && m_uart.writeable()) {
+				m_uart.putc(m_ring[tail & MASK]);
+				++tail;
+			}
+			m_tail = tail;
+
+			if(tail == m_head) {
+				m_txActive = false;
+			}
+		}
+
+		/**
+		 * \brief Interrupcion de transmisor vacio
+		 */
+		void onTxEmpty() {
+			fill();
+		}
+
+		/**
+		 * \brief Interrupcion de recepcion: analiza los mensajes de canal,
+		 * con estado en curso
+		 */
+		void onReceive() {
+			while(m_uart.readable()) {
+				const uint8_t c = static_cast<uint8_t>(m_uart.getc());
+				if(c >= 0xF8) {
+					continue; //Tiempo real: no interrumpe el mensaje en curso
+				}
+				if(c >= 0xF0) {
+					m_rxStatus = 0; //Exclusivo o comun: anula el estado en curso
+					continue;
+				}
+				if(c & 0x80) {
+					m_rxStatus = c;
+					m_rxCount = 0;
+					continue;
+				}
+				if(!m_rxStatus) {
+					continue;
+				}
+
+				m_rxData[m_rxCount++] = c;
+				const size_t length = dataLength(m_rxStatus);
+				if(m_rxCount == length) {
+					m_rxCount = 0;
+					onMessage(m_rxStatus, m_rxData[0], length == 2 ? m_rxData[1] : 0);
+				}
+			}
+		}
+
+		/**
+		 * \brief Guarda la senal de un mensaje de programa o previo de este canal
+		 */
+		void onMessage(uint8_t status, uint8_t data1, uint8_t data2) {
+			Action action;
+			size_t sig;
+			if((status & 0x0F) != m_channel || !decode(status, data1, data2, action, sig)) {
+				return;
+			}
+			if(action == ACTION_PROGRAM || action == ACTION_PREVIEW) {
+				m_tally[action] = static_cast<uint8_t>(sig);
+				m_tallyFlags |= 1 << action;
+			}
+		}
+};
+
+#endif //MIDI_LINK_H_INCLUDED
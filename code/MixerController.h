@@ -2,9 +2,18 @@
 #define MIXER_CONTROLLER_H_INCLUDED
 
 #include <bitset>
+#include <algorithm>
 #include <stdint.h>
 
-class MixerController {
+#include "LedFrameTable.h"
+#include "GestureRecognizer.h"
+
+/**
+ * \brief Distribucion de botones y leds del mezclador. No depende del
+ * destino de los eventos, por lo que puede utilizarse sin instanciar
+ * el controlador
+ */
+class MixerControllerBase {
 	public:
 		///Correspondencia entre los bits y botones. LSB a MSB
 		enum ButtonIndices {
@@ -16,7 +25,7 @@ class MixerController {
 			BUTTON_INDEX_PROGRAM5,
 			BUTTON_INDEX_PROGRAM6,
 			BUTTON_INDEX_PROGRAM7,
-			
+
 			BUTTON_INDEX_PREVIEW0,
 			BUTTON_INDEX_PREVIEW1,
 			BUTTON_INDEX_PREVIEW2,
@@ -25,21 +34,21 @@ class MixerController {
 			BUTTON_INDEX_PREVIEW5,
 			BUTTON_INDEX_PREVIEW6,
 			BUTTON_INDEX_PREVIEW7,
-			
-			BUTTON_INDEX_RESERVED0,
-			BUTTON_INDEX_RESERVED1,
+
+			BUTTON_INDEX_MACRO_RECORD,
+			BUTTON_INDEX_MACRO_PLAY,
 			BUTTON_INDEX_TRANSITION,
 			BUTTON_INDEX_CUT,
 			BUTTON_INDEX_RESERVED4,
 			BUTTON_INDEX_RESERVED5,
 			BUTTON_INDEX_RESERVED6,
 			BUTTON_INDEX_RESERVED7,
-			
+
 			//Add here
-			
+
 			BUTTON_INDEX_COUNT
 		};
-		
+
 		///Correspondencia entre los bits y leds. LSB a MSB
 		enum LedIndices {
 			LED_INDEX_PREVIEW0,
@@ -50,7 +59,7 @@ class MixerController {
 			LED_INDEX_PREVIEW5,
 			LED_INDEX_PREVIEW6,
 			LED_INDEX_PREVIEW7,
-			
+
 			LED_INDEX_PROGRAM0,
 			LED_INDEX_PROGRAM1,
 			LED_INDEX_PROGRAM2,
@@ -59,171 +68,411 @@ class MixerController {
 			LED_INDEX_PROGRAM5,
 			LED_INDEX_PROGRAM6,
 			LED_INDEX_PROGRAM7,
-			
+
 			//Add here
-			
+
 			LED_INDEX_COUNT
 		};
-		
+
 		static const size_t PROGRAM_CNT = BUTTON_INDEX_PROGRAM7 - BUTTON_INDEX_PROGRAM0 + 1; //8
 		static const size_t PREVIEW_CNT = BUTTON_INDEX_PREVIEW7 - BUTTON_INDEX_PREVIEW0 + 1; //8
 		static const size_t NO_SIGNAL = 0xFFFF;
-		
+
+		///Resolucion de varias pulsaciones de un mismo bus en la misma trama
+		enum ChordPolicy {
+			CHORD_LOWEST_WINS, ///<Gana el boton de menor indice
+			CHORD_HIGHEST_WINS, ///<Gana el boton de mayor indice
+			CHORD_REJECT ///<Se ignoran todas
+		};
+
 		typedef std::bitset<BUTTON_INDEX_COUNT> ButtonState; ///<Tipo que representa el estado ede los botones
 		typedef std::bitset<LED_INDEX_COUNT> LedState; ///<Tipo que representa el estado ede los leds
-		
-		typedef void (*LedStateCallback)(void*, LedState); ///<Prototipo de la funcion a llamar cuando cambie el estado de los leds
-		typedef void (*BusCallback)(void*, size_t); ///<Prototipo de la funcion a llamar cuando cambie el estado de uno de los buses
-		typedef void (*ActionCallback)(void*); ///<Prototipo de la funcion a llamar cuando haya un evento
-	
+
+		typedef LedRow<LED_INDEX_PROGRAM0> ProgramLeds; ///<Tramas de la fila de programa
+		typedef LedRow<LED_INDEX_PREVIEW0> PreviewLeds; ///<Tramas de la fila de previo
+
+		typedef ButtonGestures<uint32_t> Gestures; ///<Gestos de los botones, un bit por boton
+
+	protected:
+		///Las tramas se indexan por la senal seleccionada, siendo COUNT ninguna.
+		///Ambos buses deben compartir ese valor ya que se intercambian en los cortes
+		typedef char BusSizeCheck[(PROGRAM_CNT == ProgramLeds::COUNT && PREVIEW_CNT == PreviewLeds::COUNT && PROGRAM_CNT == PREVIEW_CNT) ? 1 : -1];
+		typedef char LedWordCheck[(LED_INDEX_COUNT <= 32) ? 1 : -1];
+		typedef char ButtonWordCheck[(BUTTON_INDEX_COUNT <= 32) ? 1 : -1];
+
+		static const uint32_t BANK_MASK = (1 << PROGRAM_CNT) - 1; ///<Botones de un bus, desplazados al LSB
+		static const uint32_t CUT_BIT = 1 << BUTTON_INDEX_CUT;
+		static const uint32_t TRANSITION_BIT = 1 << BUTTON_INDEX_TRANSITION;
+		static const uint32_t MACRO_RECORD_BIT = 1 << BUTTON_INDEX_MACRO_RECORD;
+		static const uint32_t MACRO_PLAY_BIT = 1 << BUTTON_INDEX_MACRO_PLAY;
+
 		/**
-		 * \brief Constructor
+		 * \brief Convierte el indice interno de un bus a la senal notificada
+		 * \param index: indice interno. [0, cnt]
+		 * \param cnt: numero de senales del bus
+		 * \returns index si es una senal valida, NO_SIGNAL en caso contrario
 		 */
-		MixerController(	void* ledUsrPtr = NULL,
-											LedStateCallback ledCbk = NULL,
-											void*	pgmUsrPtr = NULL,
-											BusCallback pgmCbk = NULL,
-											void*	pvwUsrPtr = NULL,
-											BusCallback pvwCbk = NULL,
-											void*	cutUsrPtr = NULL,
-											ActionCallback cutCbk = NULL,
-											void*	transUsrPtr = NULL,
-											ActionCallback transCbk = NULL );
-			
-			
+		static size_t toSignal(size_t index, size_t cnt) {
+			return (index < cnt) ? index : NO_SIGNAL;
+		}
+
 		/**
-	   * \brief Establece el puntero que acompaa a las llamadas de cambio de estado de leds
+		 * \brief Conforma los pulsos de entrada
+		 * \param prev: Estado antiguo de las senhales
+		 * \param next: Siguiente estado de las senhales
+		 * \returns Los bits que hayan cambiado de 0 a 1
 		 */
-		void setLedUserPointer(void* usrPtr);
-		
+		static uint32_t getRisingEdge(uint32_t prev, uint32_t next) {
+			return ~prev & next;
+		}
+
 		/**
-	   * \brief Devuelve el puntero que acompaa a las llamadas de cambio de estado de leds
+		 * \brief Devuelve el indice de una palabra con un unico bit a uno, sin
+		 * recorrerla (multiplicacion de De Bruijn)
 		 */
-		void* getLedUserPointer() const;
-			
+		static size_t bitIndex(uint32_t bit) {
+			static const uint8_t TABLE[32] = {
+				0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+				31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+			};
+			return TABLE[static_cast<uint32_t>(bit * 0x077CB531U) >> 27];
+		}
+
 		/**
-	   * \brief Establece la funcion a llamar cuando exista un nuevo dato a la entrada
+		 * \brief Elige un boton de un bus segun la politica
+		 * \param bank: Botones pulsados del bus, desplazados al LSB
+		 * \param cnt: Numero de botones del bus
+		 * \returns Indice del boton elegido, cnt si no hay ninguno
 		 */
-		void setLedCallback(LedStateCallback cbk);
-		
+		static size_t resolve(uint32_t bank, size_t cnt, ChordPolicy policy) {
+			if(!bank) {
+				return cnt;
+			}
+
+			switch(policy) {
+				case CHORD_HIGHEST_WINS:
+					//Extender el bit mas alto hacia la derecha y quedarse con el
+					bank |= bank >> 1;
+					bank |= bank >> 2;
+					bank |= bank >> 4;
+					bank |= bank >> 8;
+					bank |= bank >> 16;
+					return bitIndex(bank ^ (bank >> 1));
+
+				case CHORD_REJECT:
+					return (bank & (bank - 1)) ? cnt : bitIndex(bank);
+
+				default: //CHORD_LOWEST_WINS
+					return bitIndex(bank & (0U - bank));
+			}
+		}
+
+};
+
+
+
+/**
+ * \brief Controlador del mezclador
+ * \tparam Sink: Destino de los eventos. Se conoce en tiempo de compilacion,
+ * por lo que las llamadas se resuelven estaticamente y pueden integrarse
+ * en process(). Debe proporcionar los metodos:
+ *   - void onLedState(const LedState& leds, const LedState& changed): Ha
+ *     cambiado el estado de los leds. changed contiene los bits que difieren
+ *     de la trama anterior y nunca esta vacio
+ *   - void onProgram(size_t): Nueva senal en programa
+ *   - void onPreview(size_t): Nueva senal en previo
+ *   - void onCut(): Se ha producido un corte
+ *   - void onTransition(): Se ha producido una transicion
+ *   - void onPin(size_t): Nueva senal fijada en previo. NO_SIGNAL = ninguna
+ *   - void onMacroRecord(): Se ha pulsado el boton de grabar macro
+ *   - void onMacroPlay(): Se ha pulsado el boton de reproducir macro
+ *
+ * Los botones pulsados en la misma trama se evaluan juntos. Si se pulsan
+ * varios de un mismo bus, la politica (setChordPolicy()) decide cual vale.
+ * CUT con un boton de previo pulsado es una toma directa: esa senal pasa
+ * a programa, notificandose como un cambio de previo seguido de un corte.
+ *
+ * Gestos:
+ *   - Pulsacion larga de un boton de previo: fija esa senal en previo. Tras
+ *     cada corte o transicion el previo vuelve a ella, salvo que este en
+ *     programa. Otra pulsacion larga del mismo boton la libera
+ *   - Las dobles pulsaciones y las repeticiones se reconocen, pero ningun
+ *     control las usa. Una doble pulsacion de CUT no lanza una transicion:
+ *     la primera ya ha cortado, ya que los cortes nunca se retrasan, y la
+ *     transicion devolveria a programa la senal que acaba de salir. Cada
+ *     pulsacion de CUT es un corte
+ */
+template<typename Sink>
+class MixerController : public MixerControllerBase {
+	public:
 		/**
-	   * \brief Devuelve la funcion que se llama cuando hay un nuevo dato a la entrada
+		 * \brief Constructor
+		 * \param sink: Destino de los eventos. Debe sobrevivir al controlador
 		 */
-		LedStateCallback getLedCallback() const;
-											
-											
+		explicit MixerController(Sink& sink)
+			: m_sink(sink)
+			, m_lastState(0)
+			, m_program(PROGRAM_CNT)
+			, m_preview(PREVIEW_CNT)
+			, m_pinned(PREVIEW_CNT)
+			, m_chordPolicy(CHORD_LOWEST_WINS)
+		{
+		}
+
 		/**
-	   * \brief Establece el puntero que acompaa a las llamadas de nueva senal en programa
+	   * \brief Devuelve el destino de los eventos
 		 */
-		void setProgramUserPointer(void* usrPtr);
-		
+		Sink& getSink() const {
+			return m_sink;
+		}
+
 		/**
-	   * \brief Devuelve el puntero que acompaa a las llamadas de nueva senal en programa
+	   * \brief Devuelve la senal en programa. NO_SIGNAL si no hay ninguna
 		 */
-		void* getProgramUserPointer() const;
-		
+		size_t getProgram() const {
+			return toSignal(m_program, PROGRAM_CNT);
+		}
+
 		/**
-	   * \brief Establece la funcion a llamar cuando exista un nuevo dato a la entrada
+	   * \brief Devuelve la senal en previo. NO_SIGNAL si no hay ninguna
 		 */
-		void setProgramCallback(BusCallback cbk);
-		
+		size_t getPreview() const {
+			return toSignal(m_preview, PREVIEW_CNT);
+		}
+
 		/**
-	   * \brief Devuelve la funcion que se llama cuando hay un nuevo dato a la entrada
+	   * \brief Establece el estado de ambos buses, p.e. al recuperarlo tras un
+	   * reinicio. Se notifica como si se hubieran pulsado los botones
+	   * \param program: Senal en programa. Fuera de rango = ninguna
+	   * \param preview: Senal en previo. Fuera de rango = ninguna
 		 */
-		BusCallback getProgramCallback() const;
-		
-		
+		void setState(size_t program, size_t preview) {
+			m_program = (program < PROGRAM_CNT) ? program : PROGRAM_CNT;
+			m_preview = (preview < PREVIEW_CNT) ? preview : PREVIEW_CNT;
+			m_sink.onProgram(toSignal(m_program, PROGRAM_CNT));
+			m_sink.onPreview(toSignal(m_preview, PREVIEW_CNT));
+			updateLedState();
+		}
+
 		/**
-	   * \brief Establece el puntero que acompaa a las llamadas de nueva senal en previo
+	   * \brief Restaura el estado completo sin notificar nada, p.e. para
+	   * reproducir una grabacion de la caja negra desde uno de sus bloques
+	   * \param held: Botones pulsados en la ultima trama, activo alto
+	   * \param program: Senal en programa. Fuera de rango = ninguna
+	   * \param preview: Senal en previo. Fuera de rango = ninguna
+	   * \param pinned: Senal fijada en previo. Fuera de rango = ninguna
 		 */
-		void setPreviewUserPointer(void* usrPtr);
-		
+		void restore(uint32_t held, size_t program, size_t preview, size_t pinned) {
+			m_lastState = held;
+			m_program = (program < PROGRAM_CNT) ? program : PROGRAM_CNT;
+			m_preview = (preview < PREVIEW_CNT) ? preview : PREVIEW_CNT;
+			m_pinned = (pinned < PREVIEW_CNT) ? pinned : PREVIEW_CNT;
+			m_ledState = LedState(ProgramLeds::FRAMES[m_program] | PreviewLeds::FRAMES[m_preview]);
+		}
+
 		/**
-	   * \brief Devuelve el puntero que acompaa a las llamadas de nueva senal en previo
+	   * \brief Establece la resolucion de pulsaciones simultaneas de un bus
 		 */
-		void* getPreviewUserPointer() const;
-							
+		void setChordPolicy(ChordPolicy policy) {
+			m_chordPolicy = policy;
+		}
+
 		/**
-	   * \brief Establece la funcion a llamar cuando exista un nuevo dato a la entrada
+	   * \brief Devuelve la ultima trama de leds notificada
 		 */
-		void setPreviewCallback(BusCallback cbk);
-		
+		const LedState& getLedState() const {
+			return m_ledState;
+		}
+
+
+
 		/**
-	   * \brief Devuelve la funcion que se llama cuando hay un nuevo dato a la entrada
+	   * \brief Pone una senal en programa, como lo haria su boton pero sin
+	   * conmutar. Fuera de rango = ninguna
 		 */
-		BusCallback getPreviewCallback() const;
+		void selectProgram(size_t program) {
+			m_program = (program < PROGRAM_CNT) ? program : PROGRAM_CNT;
+			m_sink.onProgram(toSignal(m_program, PROGRAM_CNT));
+			updateLedState();
+		}
 
+		/**
+	   * \brief Pone una senal en previo, como lo haria su boton pero sin
+	   * conmutar. Fuera de rango = ninguna
+		 */
+		void selectPreview(size_t preview) {
+			m_preview = (preview < PREVIEW_CNT) ? preview : PREVIEW_CNT;
+			m_sink.onPreview(toSignal(m_preview, PREVIEW_CNT));
+			updateLedState();
+		}
 
 		/**
-	   * \brief Establece el puntero que acompaa a las llamadas de corte
+	   * \brief Realiza un corte, como el boton CUT
 		 */
-		void setCutUserPointer(void* usrPtr);
-		
+		void cut() {
+			doCut();
+			updateLedState();
+		}
+
 		/**
-	   * \brief Devuelve el puntero que acompaa a las llamadas de corte
+	   * \brief Realiza una transicion, como el boton de transicion
 		 */
-		void* getCutUserPointer() const;
-							
+		void transition() {
+			doTransition();
+			updateLedState();
+		}
+
 		/**
-	   * \brief Establece la funcion a llamar cuando hay corte
+		 * \brief Devuelve la senal fijada en previo. NO_SIGNAL si no hay ninguna
 		 */
-		void setCutCallback(ActionCallback cbk);
-		
+		size_t getPinned() const {
+			return toSignal(m_pinned, PREVIEW_CNT);
+		}
+
 		/**
-	   * \brief Devuelve la funcion que se llama cuando hay corte
+		 * \brief Procesa el nuevo estado de los botones, sin gestos
 		 */
-		ActionCallback getCutCallback() const;	
-		
-		
+		void process(const ButtonState& buttonState) {
+			process(buttonState, Gestures());
+		}
+
 		/**
-	   * \brief Establece el puntero que acompaa a las llamadas de transicion
+		 * \brief Procesa el nuevo estado de los botones
+		 * \param gestures: Gestos reconocidos en esta trama
 		 */
-		void setTransitionUserPointer(void* usrPtr);
-		
+		void process(ButtonState buttonState, const Gestures& gestures) {
+			//La entrada se encuentra en activo bajo por las resistencias pullup
+			buttonState.flip(); //Cambia a activo alto (negar)
+			const uint32_t held = buttonState.to_ulong();
+
+			//Obtiene los botones que estan en flanco de subida
+			const uint32_t risingEdge = getRisingEdge(m_lastState, held);
+			m_lastState = held;
+			if(!risingEdge && !gestures.longPress) {
+				return;
+			}
+
+
+			//Obtine los nuevos indices de toda la trama a la vez
+			const size_t newPgm = resolve((risingEdge >> BUTTON_INDEX_PROGRAM0) & BANK_MASK, PROGRAM_CNT, m_chordPolicy);
+			size_t newPvw = resolve((risingEdge >> BUTTON_INDEX_PREVIEW0) & BANK_MASK, PREVIEW_CNT, m_chordPolicy);
+
+			//CUT + PVWn: toma directa. El boton de previo no conmuta el previo
+			size_t take = PREVIEW_CNT;
+			if(risingEdge & CUT_BIT) {
+				take = resolve((held >> BUTTON_INDEX_PREVIEW0) & BANK_MASK, PREVIEW_CNT, m_chordPolicy);
+				if(take < PREVIEW_CNT) {
+					newPvw = PREVIEW_CNT;
+				}
+			}
+
+
+			//Si ha cambiado alguno de ellos llamar a la rutina correspondiente
+			bool updateLeds = false;
+			if(newPgm < PROGRAM_CNT) {
+				//Se ha pulsado algun boton de programa. Si es el mismo desactivar, si no, cambiar
+				updateLeds = true;
+				m_program = (m_program != newPgm) ? newPgm : PROGRAM_CNT;
+				m_sink.onProgram(toSignal(m_program, PROGRAM_CNT));
+			}
+			if(newPvw < PREVIEW_CNT) {
+				//Se ha pulsado algun boton de previo. Si es el mismo desactivar, si no, cambiar
+				updateLeds = true;
+				m_preview = (m_preview != newPvw) ? newPvw : PREVIEW_CNT;
+				m_sink.onPreview(toSignal(m_preview, PREVIEW_CNT));
+			}
+			if(take < PREVIEW_CNT && take != m_preview) {
+				m_preview = take;
+				m_sink.onPreview(toSignal(m_preview, PREVIEW_CNT));
+			}
+			if(risingEdge & CUT_BIT) {
+				updateLeds = true;
+				doCut();
+			}
+			if(risingEdge & TRANSITION_BIT) {
+				updateLeds = true;
+				doTransition();
+			}
+			if(risingEdge & MACRO_RECORD_BIT) {
+				m_sink.onMacroRecord();
+			}
+			if(risingEdge & MACRO_PLAY_BIT) {
+				m_sink.onMacroPlay();
+			}
+
+			//Pulsacion larga de previo: fijar o liberar
+			const size_t pin = resolve((gestures.longPress >> BUTTON_INDEX_PREVIEW0) & BANK_MASK, PREVIEW_CNT, m_chordPolicy);
+			if(pin < PREVIEW_CNT) {
+				m_pinned = (m_pinned != pin) ? pin : PREVIEW_CNT;
+				m_sink.onPin(toSignal(m_pinned, PREVIEW_CNT));
+				if(m_preview != pin) {
+					updateLeds = true;
+					m_preview = pin;
+					m_sink.onPreview(toSignal(m_preview, PREVIEW_CNT));
+				}
+			}
+
+
+			//Si el estado de los leds cambia, calcular los nuevos
+			if(updateLeds) {
+				updateLedState();
+			}
+		}
+
+
+
+	private:
+		Sink&							m_sink; ///<Destino de los eventos
+
+		uint32_t					m_lastState; ///<Botones pulsados en la trama anterior, activo alto
+		LedState					m_ledState; ///<Ultima trama de leds notificada
+		size_t						m_program; ///<Senal en programa. [0, PROGRAM_CNT], PROGRAM_CNT = ninguna
+		size_t						m_preview; ///<Senal en previo. [0, PREVIEW_CNT], PREVIEW_CNT = ninguna
+		size_t						m_pinned; ///<Senal fijada en previo. [0, PREVIEW_CNT], PREVIEW_CNT = ninguna
+		ChordPolicy				m_chordPolicy; ///<Resolucion de pulsaciones simultaneas
+
 		/**
-	   * \brief Devuelve el puntero que acompaa a las llamadas de transicion
+		 * \brief Intercambia los buses y notifica el corte
 		 */
-		void* getTransitionUserPointer() const;
-							
+		void doCut() {
+			std::swap(m_program, m_preview);
+			m_sink.onCut();
+			restorePinned();
+		}
+
 		/**
-	   * \brief Establece la funcion a llamar cuando hay transicion
+		 * \brief Intercambia los buses y notifica la transicion
 		 */
-		void setTransitionCallback(ActionCallback cbk);
-		
+		void doTransition() {
+			std::swap(m_program, m_preview); //TODO llamar cuando se complete la transicion
+			m_sink.onTransition();
+			restorePinned();
+		}
+
 		/**
-	   * \brief Devuelve la funcion que se llama cuando hay transicion
+		 * \brief Tras un corte o transicion, devuelve el previo a la senal fijada,
+		 * salvo que esta haya pasado a programa
 		 */
-		ActionCallback getTransitionCallback() const;	
-											
-											
-			
+		void restorePinned() {
+			if(m_pinned < PREVIEW_CNT && m_preview != m_pinned && m_program != m_pinned) {
+				m_preview = m_pinned;
+				m_sink.onPreview(toSignal(m_preview, PREVIEW_CNT));
+			}
+		}
+
 		/**
-		 * \brief Procesa el nuevo estado de los botones
+		 * \brief Obtiene la trama de leds de las tablas y la notifica solo
+		 * si difiere de la anterior
 		 */
-		void process(ButtonState buttonState);
-		
-		
-		
-	private:		
-		void*							m_ledUserPtr;
-		LedStateCallback	m_ledCallback;
-	
-		void*							m_programUserPtr;
-		BusCallback				m_programCallback;
-	
-		void*							m_previewUserPtr;
-		BusCallback				m_previewCallback;
-	
-		void*							m_cutUserPtr;
-		ActionCallback		m_cutCallback;
-	
-		void*							m_transitionUserPtr;
-		ActionCallback		m_transitionCallback;
-	
-		ButtonState				m_lastState;
-		size_t						m_program;
-		size_t						m_preview;
-	
+		void updateLedState() {
+			const LedState ledState(ProgramLeds::FRAMES[m_program] | PreviewLeds::FRAMES[m_preview]);
+			const LedState changed = ledState ^ m_ledState;
+			if(changed.any()) {
+				m_ledState = ledState;
+				m_sink.onLedState(ledState, changed);
+			}
+		}
+
 };
 
 #endif //MIXER_CONTROLLER_H_INCLUDED
@@ -0,0 +1,208 @@
+#include "PinTrace.h"
+#include "RamPlacement.h"
+
+PinTrace::Edge PinTrace::s_edges[CAPACITY] AHB_BANK1;
+size_t PinTrace::s_head = 0;
+size_t PinTrace::s_count = 0;
+volatile bool PinTrace::s_frozen = false;
+
+PinName PinTrace::s_pins[CHANNEL_MAX];
+const char* PinTrace::s_names[CHANNEL_MAX];
+uint8_t PinTrace::s_level[CHANNEL_MAX];
+uint8_t PinTrace::s_channels = 0;
+
+PinTrace::Section PinTrace::s_section = SECTION_DONE;
+size_t PinTrace::s_index = 0;
+uint64_t PinTrace::s_time = 0;
+uint64_t PinTrace::s_timeWritten = 0;
+bool PinTrace::s_timePending = false;
+
+//Comprobar que el anillo puede recorrerse con una mascara
+typedef char PinTraceCapacityCheck[(PinTrace::CAPACITY & (PinTrace::CAPACITY - 1)) == 0 ? 1 : -1];
+
+
+/**
+ * \brief Copia una cadena y devuelve la nueva longitud
+ */
+static size_t putString(char* line, size_t len, const char* str) {
+	while(*str && len < PinTrace::LINE_LENGTH - 1) {
+		line[len++] = *str++;
+	}
+	line[len] = '\0';
+	return len;
+}
+
+/**
+ * \brief Escribe un numero en decimal y devuelve la nueva longitud
+ */
+static size_t putUnsigned(char* line, size_t len, uint64_t value) {
+	char digits[20];
+	size_t count = 0;
+	do {
+		digits[count++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while(value);
+	while(count && len < PinTrace::LINE_LENGTH - 1) {
+		line[len++] = digits[--count];
+	}
+	line[len] = '\0';
+	return len;
+}
+
+/**
+ * \brief Identificador de un canal en el VCD: un caracter imprimible
+ */
+static char channelId(size_t channel) {
+	return static_cast<char>('a' + channel);
+}
+
+
+
+uint8_t PinTrace::attach(PinName pin, int level) {
+	for(uint8_t i = 0; i < s_channels; ++i) {
+		if(s_pins[i] == pin) {
+			return i;
+		}
+	}
+	if(s_channels == CHANNEL_MAX) {
+		return CHANNEL_MAX;
+	}
+
+	CycleCounter::enable();
+	s_pins[s_channels] = pin;
+	s_names[s_channels] = 0;
+	s_level[s_channels] = static_cast<uint8_t>(level ? 1 : 0);
+	return s_channels++;
+}
+
+void PinTrace::setName(PinName pin, const char* name) {
+	for(uint8_t i = 0; i < s_channels; ++i) {
+		if(s_pins[i] == pin) {
+			s_names[i] = name;
+		}
+	}
+}
+
+void PinTrace::startExport() {
+	s_frozen = true;
+	s_section = SECTION_TIMESCALE;
+	s_index = 0;
+	s_time = 0;
+	s_timeWritten = 0;
+	s_timePending = false;
+}
+
+int PinTrace::initialLevel(uint8_t channel) {
+	for(size_t i = 0; i < s_count; ++i) {
+		const Edge& edge = edgeAt(i);
+		if(edge.channel == channel) {
+			return !edge.level;
+		}
+	}
+	return s_level[channel];
+}
+
+bool PinTrace::readLine(char* line) {
+	size_t len = 0;
+	line[0] = '\0';
+
+	switch(s_section) {
+		case SECTION_TIMESCALE:
+			putString(line, 0, "$timescale 1ns $end");
+			s_section = SECTION_SCOPE;
+			return true;
+
+		case SECTION_SCOPE:
+			putString(line, 0, "$scope module sio $end");
+			s_section = s_channels ? SECTION_VARS : SECTION_UPSCOPE;
+			return true;
+
+		case SECTION_VARS: {
+			const char id[] = {channelId(s_index), ' ', '\0'};
+			len = putString(line, 0, "$var wire 1 ");
+			len = putString(line, len, id);
+			if(s_names[s_index]) {
+				len = putString(line, len, s_names[s_index]);
+			} else {
+				len = putString(line, len, "ch");
+				len = putUnsigned(line, len, s_index);
+			}
+			putString(line, len, " $end");
+			if(++s_index == s_channels) {
+				s_section = SECTION_UPSCOPE;
+			}
+			return true;
+		}
+
+		case SECTION_UPSCOPE:
+			putString(line, 0, "$upscope $end");
+			s_section = SECTION_END_DEFINITIONS;
+			return true;
+
+		case SECTION_END_DEFINITIONS:
+			putString(line, 0, "$enddefinitions $end");
+			s_section = SECTION_DUMPVARS;
+			return true;
+
+		case SECTION_DUMPVARS:
+			//El flanco mas antiguo marca el instante 0
+			putString(line, 0, "#0 $dumpvars");
+			s_index = 0;
+			s_section = s_channels ? SECTION_INITIAL : SECTION_END_DUMPVARS;
+			return true;
+
+		case SECTION_INITIAL: {
+			const uint8_t channel = static_cast<uint8_t>(s_index);
+			const char value[] = {static_cast<char>('0' + initialLevel(channel)), channelId(channel), '\0'};
+			putString(line, 0, value);
+			if(++s_index == s_channels) {
+				s_section = SECTION_END_DUMPVARS;
+			}
+			return true;
+		}
+
+		case SECTION_END_DUMPVARS:
+			putString(line, 0, "$end");
+			s_index = 0;
+			s_section = SECTION_EDGES;
+			return true;
+
+		case SECTION_EDGES:
+			if(s_index < s_count) {
+				const Edge& edge = edgeAt(s_index);
+
+				//Los instantes se acumulan para no desbordar con el contador
+				if(!s_timePending) {
+					if(s_index) {
+						s_time += static_cast<uint32_t>(edge.cycles - edgeAt(s_index - 1).cycles);
+					}
+					s_timePending = true;
+				}
+
+				//Varios flancos en el mismo instante comparten la linea del tiempo
+				const uint64_t ns = s_time * 1000 / (SystemCoreClock / 1000000);
+				if(ns != s_timeWritten) {
+					s_timeWritten = ns;
+					len = putString(line, 0, "#");
+					putUnsigned(line, len, ns);
+					return true;
+				}
+
+				const char value[] = {static_cast<char>('0' + edge.level), channelId(edge.channel), '\0'};
+				putString(line, 0, value);
+				s_timePending = false;
+				++s_index;
+				return true;
+			}
+
+			//Reanudar el registro desde cero
+			s_count = 0;
+			s_section = SECTION_DONE;
+			s_frozen = false;
+			return false;
+
+		case SECTION_DONE:
+			break;
+	}
+	return false;
+}
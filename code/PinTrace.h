@@ -0,0 +1,211 @@
+#ifndef PIN_TRACE_H_INCLUDED
+#define PIN_TRACE_H_INCLUDED
+
+#include "mbed.h"
+#include "CycleCounter.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Registro de los flancos de los pines de la E/S en serie, para ver
+ * CLK, LOAD, LATCH, DIN y DOUT como formas de onda y medir los margenes de
+ * setup y hold y la duracion de las tramas.
+ *
+ * Cada flanco se guarda con el contador de ciclos (resolucion de ~10ns a
+ * 96MHz) en un anillo que conserva los CAPACITY ultimos. La exportacion
+ * congela el anillo y lo entrega linea a linea en formato VCD, que se abre
+ * con GTKWave. Las entradas solo se conocen cuando se leen, por lo que sus
+ * flancos tienen el instante de la lectura que los observa.
+ *
+ * El anillo se escribe desde la interrupcion del refresco y se exporta desde
+ * el bucle principal. Mientras esta congelado no se registra nada, asi que
+ * no se necesitan secciones criticas.
+ */
+class PinTrace {
+	public:
+		static const size_t CAPACITY = 512; ///<Flancos que se conservan. Potencia de 2
+		static const size_t CHANNEL_MAX = 8; ///<Pines que pueden registrarse
+		static const size_t LINE_LENGTH = 28; ///<Longitud maxima de una linea VCD
+
+		/**
+		 * \brief Asigna un canal a un pin. Un pin ya registrado conserva su canal
+		 * \param level: Nivel actual del pin
+		 * \returns Canal, o CHANNEL_MAX si no quedan libres
+		 */
+		static uint8_t attach(PinName pin, int level);
+
+		/**
+		 * \brief Da nombre a la senal de un pin en el VCD. Sin nombre se usa "chN"
+		 * \param name: Cadena constante, sin espacios
+		 */
+		static void setName(PinName pin, const char* name);
+
+		/**
+		 * \brief Registra un cambio de nivel de un canal
+		 */
+		static void record(uint8_t channel, int level) {
+			if(s_frozen || channel >= CHANNEL_MAX) {
+				return;
+			}
+			s_level[channel] = static_cast<uint8_t>(level);
+
+			Edge& edge = s_edges[s_head];
+			edge.cycles = CycleCounter::read();
+			edge.channel = channel;
+			edge.level = static_cast<uint8_t>(level);
+			s_head = (s_head + 1) & (CAPACITY - 1);
+			if(s_count < CAPACITY) {
+				++s_count;
+			}
+		}
+
+		/**
+		 * \brief Congela el anillo y comienza a exportarlo
+		 */
+		static void startExport();
+
+		/**
+		 * \brief Indica si hay una exportacion en curso
+		 */
+		static bool isExporting() {
+			return s_frozen;
+		}
+
+		/**
+		 * \brief Escribe la siguiente linea del VCD, sin salto de linea. Al
+		 * terminar se descartan los flancos exportados y se reanuda el registro
+		 * \param line: Destino de al menos LINE_LENGTH caracteres
+		 * \returns false si ya se ha exportado todo
+		 */
+		static bool readLine(char* line);
+
+		/**
+		 * \brief Devuelve el numero de flancos guardados
+		 */
+		static size_t getCount() {
+			return s_count;
+		}
+
+	private:
+		struct Edge {
+			uint32_t	cycles; ///<Contador de ciclos en el flanco
+			uint8_t		channel;
+			uint8_t		level;
+		};
+
+		///Partes del VCD, en el orden en que se exportan
+		enum Section {
+			SECTION_TIMESCALE,
+			SECTION_SCOPE,
+			SECTION_VARS,
+			SECTION_UPSCOPE,
+			SECTION_END_DEFINITIONS,
+			SECTION_DUMPVARS,
+			SECTION_INITIAL,
+			SECTION_END_DUMPVARS,
+			SECTION_EDGES,
+			SECTION_DONE
+		};
+
+		static Edge								s_edges[CAPACITY];
+		static size_t							s_head; ///<Siguiente posicion a escribir
+		static size_t							s_count; ///<Flancos guardados
+		static volatile bool			s_frozen;
+
+		static PinName						s_pins[CHANNEL_MAX];
+		static const char*				s_names[CHANNEL_MAX];
+		static uint8_t						s_level[CHANNEL_MAX]; ///<Ultimo nivel registrado
+		static uint8_t						s_channels;
+
+		//Estado de la exportacion
+		static Section						s_section;
+		static size_t							s_index; ///<Canal o flanco dentro de la seccion
+		static uint64_t						s_time; ///<Ciclos desde el flanco mas antiguo
+		static uint64_t						s_timeWritten; ///<Ultimo instante escrito
+		static bool								s_timePending; ///<Falta escribir el instante del flanco actual
+
+		/**
+		 * \brief Devuelve el flanco i-esimo, del mas antiguo al mas reciente
+		 */
+		static const Edge& edgeAt(size_t i) {
+			return s_edges[(s_head - s_count + i) & (CAPACITY - 1)];
+		}
+
+		/**
+		 * \brief Devuelve el nivel de un canal antes del flanco mas antiguo
+		 */
+		static int initialLevel(uint8_t channel);
+
+};
+
+
+
+/**
+ * \brief Salida digital que registra sus flancos en PinTrace. Sustituye a
+ * DigitalOut
+ */
+class TracedOut {
+	public:
+		explicit TracedOut(PinName pin, int value = 0)
+			: m_out(pin, value)
+			, m_value(value ? 1 : 0)
+			, m_channel(PinTrace::attach(pin, m_value))
+		{
+		}
+
+		TracedOut& operator=(int value) {
+			value = value ? 1 : 0;
+			m_out = value;
+			if(value != m_value) {
+				m_value = value;
+				PinTrace::record(m_channel, value);
+			}
+			return *this;
+		}
+
+		operator int() const {
+			return m_value;
+		}
+
+	private:
+		DigitalOut	m_out;
+		int					m_value;
+		uint8_t			m_channel;
+};
+
+
+
+/**
+ * \brief Entrada digital que registra en PinTrace los cambios entre lecturas.
+ * Sustituye a DigitalIn
+ */
+class TracedIn {
+	public:
+		explicit TracedIn(PinName pin)
+			: m_in(pin)
+			, m_value(m_in.read() ? 1 : 0)
+			, m_channel(PinTrace::attach(pin, m_value))
+		{
+		}
+
+		int read() {
+			const int value = m_in.read() ? 1 : 0;
+			if(value != m_value) {
+				m_value = value;
+				PinTrace::record(m_channel, value);
+			}
+			return value;
+		}
+
+		operator int() {
+			return read();
+		}
+
+	private:
+		DigitalIn		m_in;
+		int					m_value;
+		uint8_t			m_channel;
+};
+
+#endif //PIN_TRACE_H_INCLUDED
@@ -0,0 +1,631 @@
+#ifndef POLL_LINK_H_INCLUDED
+#define POLL_LINK_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Sondeo por ranuras de tiempo de varios paneles en un bus RS-485
+ * semiduplex. Formato de las tramas y tiempos, comunes al maestro y a los
+ * esclavos.
+ *
+ * El maestro abre una ranura de slotUs() cada vez y sondea a un esclavo:
+ *   - Sondeo: [POLL_FLAG | ACK | direccion] [programa] [previo] [suma]. Lleva
+ *     el estado del maestro, que los esclavos muestran en sus leds
+ *   - Sin cambios: [REPLY_IDLE | direccion]
+ *   - Cambios: [REPLY_DELTA | direccion] [seq << 4 | n] [n acciones] [suma]
+ * Solo el sondeo tiene el bit 7 a 1, por lo que un esclavo reconoce el
+ * comienzo de cada sondeo aunque haya oido las respuestas de los demas.
+ * Cada accion ocupa un byte: Action en los bits 5-6 y la senal en los bits
+ * 0-4 (NO_SIGNAL = ninguna).
+ *
+ * Las acciones se confirman con un bit alterno por esclavo: el sondeo lleva
+ * el seq del ultimo lote aplicado, y el esclavo repite su lote hasta verlo
+ * confirmado. Sin lote pendiente el esclavo toma el seq del sondeo, por lo
+ * que el siguiente lote es nuevo para el maestro aunque este haya reiniciado.
+ * Como cada esclavo se sondea una vez por ciclo, una accion llega
+ * al maestro como mucho en un ciclo (nodos x ranura) mas una ranura.
+ */
+class PollLinkBase {
+	public:
+		///Acciones de un panel
+		enum Action {
+			ACTION_PROGRAM,
+			ACTION_PREVIEW,
+			ACTION_CUT,
+			ACTION_TRANSITION,
+
+			ACTION_COUNT
+		};
+
+		static const uint8_t ADDRESS_MAX = 31; ///<Esclavos direccionables: [0, ADDRESS_MAX)
+		static const uint8_t NO_SIGNAL = 0x1F; ///<Ninguna senal en el bus
+
+		static const uint8_t POLL_FLAG = 0x80;
+		static const uint8_t ACK_FLAG = 0x20;
+		static const uint8_t ADDRESS_MASK = 0x1F;
+		static const uint8_t REPLY_IDLE = 0x40;
+		static const uint8_t REPLY_DELTA = 0x60;
+
+		static const size_t POLL_LENGTH = 4; ///<Bytes del sondeo
+		static const size_t EVENT_MAX = 8; ///<Acciones en una respuesta
+		static const size_t REPLY_MAX = 3 + EVENT_MAX; ///<Bytes de la respuesta mas larga
+
+		static const uint32_t REPLY_DELAY_US = 30; ///<Espera del esclavo a que el maestro suelte el bus
+		static const uint32_t RELEASE_US = 10; ///<Margen tras el bit de parada antes de soltar el bus
+		static const uint32_t GUARD_US = 60; ///<Margen al final de cada ranura
+
+		/**
+		 * \brief Devuelve la duracion de un byte (8N1) en microsegundos
+		 */
+		static uint32_t byteUs(int baud) {
+			return (10 * 1000000 + baud - 1) / baud;
+		}
+
+		/**
+		 * \brief Devuelve la duracion de una ranura: el sondeo, la respuesta
+		 * mas larga y los cambios de sentido del bus
+		 */
+		static uint32_t slotUs(int baud) {
+			return (POLL_LENGTH + REPLY_MAX) * byteUs(baud) + REPLY_DELAY_US + 2 * RELEASE_US + GUARD_US;
+		}
+
+		/**
+		 * \brief Codifica una senal. Fuera de rango = ninguna
+		 */
+		static uint8_t toSignal(size_t sig) {
+			return sig < NO_SIGNAL ? static_cast<uint8_t>(sig) : NO_SIGNAL;
+		}
+
+		/**
+		 * \brief Suma de comprobacion de un sondeo o una respuesta, en 7 bits
+		 */
+		static uint8_t checksum(const uint8_t* data, size_t count) {
+			uint8_t sum = 0;
+			for(size_t i = 0; i < count; ++i) {
+				sum += data[i];
+			}
+			return sum & 0x7F;
+		}
+};
+
+
+
+/**
+ * \brief Esclavo del sondeo. Las acciones se encolan desde el bucle principal;
+ * la interrupcion de recepcion reconoce su sondeo y responde, tras
+ * REPLY_DELAY_US, con la respuesta ya preparada. El estado de los sondeos se
+ * entrega con process() solo cuando no quedan acciones propias por confirmar,
+ * para no volver a un estado anterior a ellas.
+ * \tparam Sink: Destino del estado. Debe proporcionar el metodo
+ * void onPollState(size_t program, size_t preview) (NO_SIGNAL = ninguna),
+ * que se resuelve en tiempo de compilacion
+ */
+template<typename Sink>
+class PollSlave : public PollLinkBase {
+	public:
+		static const size_t QUEUE_SIZE = 16; ///<Acciones pendientes de enviar. Potencia de 2
+
+		/**
+		 * \brief Constructor
+		 * \param uart: Puerto del bus. Debe sobrevivir al objeto
+		 * \param de: Pin que habilita el transmisor RS-485 (y deshabilita el receptor)
+		 * \param address: Direccion de este panel. [0, ADDRESS_MAX)
+		 * \param sink: Destino del estado. Debe sobrevivir al objeto
+		 */
+		PollSlave(RawSerial& uart, PinName de, uint8_t address, Sink& sink)
+			: m_uart(uart)
+			, m_de(de, 0)
+			, m_sink(sink)
+			, m_address(address)
+			, m_byteUs(0)
+			, m_pollIndex(0)
+			, m_seq(0)
+			, m_batchCount(0)
+			, m_batchSent(false)
+			, m_replyLength(0)
+			, m_queueHead(0)
+			, m_queueTail(0)
+			, m_program(STATE_UNKNOWN)
+			, m_preview(STATE_UNKNOWN)
+			, m_stateFlag(false)
+			, m_polls(0)
+			, m_retries(0)
+			, m_dropped(0)
+		{
+		}
+
+		/**
+		 * \brief Configura el puerto y comienza a atender los sondeos
+		 */
+		void start(int baud) {
+			m_byteUs = byteUs(baud);
+			m_uart.baud(baud);
+			m_uart.attach(callback(this, &PollSlave::onReceive), SerialBase::RxIrq);
+		}
+
+		/**
+		 * \brief Encola una accion para el maestro
+		 * \returns false si la cola esta llena
+		 */
+		bool queue(Action action, size_t sig) {
+			const size_t head = m_queueHead;
+			if(head - m_queueTail >= QUEUE_SIZE) {
+				++m_dropped;
+				return false;
+			}
+			m_queue[head & (QUEUE_SIZE - 1)] = static_cast<uint8_t>((action << 5) | toSignal(sig));
+			m_queueHead = head + 1;
+			return true;
+		}
+
+		/**
+		 * \brief Indica si hay un estado nuevo del maestro
+		 */
+		bool hasState() const {
+			return m_stateFlag;
+		}
+
+		/**
+		 * \brief Entrega el estado nuevo. Debe llamarse desde el bucle principal.
+		 * Si entretanto se ha encolado una accion, el estado ya es antiguo: se
+		 * descarta y se entregara el del sondeo que la confirme
+		 */
+		void process() {
+			core_util_critical_section_enter();
+			const uint8_t program = m_program;
+			const uint8_t preview = m_preview;
+			const bool pending = m_batchCount || m_queueTail != m_queueHead;
+			if(pending) {
+				m_program = STATE_UNKNOWN;
+			}
+			m_stateFlag = false;
+			core_util_critical_section_exit();
+
+			if(!pending) {
+				m_sink.onPollState(program, preview);
+			}
+		}
+
+		/**
+		 * \brief Devuelve los sondeos recibidos
+		 */
+		uint32_t getPolls() const {
+			return m_polls;
+		}
+
+		/**
+		 * \brief Devuelve las respuestas repetidas por falta de confirmacion
+		 */
+		uint32_t getRetries() const {
+			return m_retries;
+		}
+
+		/**
+		 * \brief Devuelve las acciones descartadas por llenarse la cola
+		 */
+		uint32_t getDropped() const {
+			return m_dropped;
+		}
+
+	private:
+		static const uint8_t STATE_UNKNOWN = 0xFF; ///<Nunca llega en un sondeo: el siguiente se entrega
+
+		RawSerial&				m_uart;
+		DigitalOut				m_de;
+		Sink&							m_sink;
+		const uint8_t			m_address;
+		uint32_t					m_byteUs;
+		Timeout						m_replyDelay; ///<Espera a que el maestro suelte el bus
+		Timeout						m_release; ///<Fin de la respuesta
+
+		//Sondeo en curso
+		uint8_t						m_poll[POLL_LENGTH];
+		size_t						m_pollIndex; ///<Bytes recibidos del sondeo. 0 = esperando uno
+
+		//Lote de acciones sin confirmar
+		uint8_t						m_seq; ///<Bit alterno del lote. Sin lote, el confirmado por el maestro
+		volatile size_t		m_batchCount; ///<Acciones del lote. 0 = ninguno
+		bool							m_batchSent; ///<El lote ya se ha enviado alguna vez
+		uint8_t						m_reply[REPLY_MAX];
+		size_t						m_replyLength;
+
+		//Cola de acciones. La escribe el bucle principal y la vacia la interrupcion
+		uint8_t						m_queue[QUEUE_SIZE];
+		volatile size_t		m_queueHead;
+		volatile size_t		m_queueTail;
+
+		//Estado del maestro
+		volatile uint8_t	m_program;
+		volatile uint8_t	m_preview;
+		volatile bool			m_stateFlag;
+
+		uint32_t					m_polls;
+		uint32_t					m_retries;
+		uint32_t					m_dropped;
+
+		typedef char QueueSizeCheck[(QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0 ? 1 : -1];
+
+		/**
+		 * \brief Interrupcion de recepcion: reconoce los sondeos dirigidos a este panel
+		 */
+		void onReceive() {
+			while(m_uart.readable()) {
+				const uint8_t c = static_cast<uint8_t>(m_uart.getc());
+				if(c & POLL_FLAG) {
+					m_pollIndex = 0;
+				} else if(m_pollIndex == 0) {
+					continue; //Respuesta de otro esclavo
+				}
+
+				m_poll[m_pollIndex++] = c;
+				if(m_pollIndex == POLL_LENGTH) {
+					m_pollIndex = 0;
+					if((m_poll[0] & ADDRESS_MASK) == m_address && checksum(m_poll, POLL_LENGTH - 1) == m_poll[POLL_LENGTH - 1]) {
+						onPoll();
+					}
+				}
+			}
+		}
+
+		/**
+		 * \brief Prepara la respuesta a un sondeo
+		 */
+		void onPoll() {
+			++m_polls;
+			const uint8_t ack = (m_poll[0] & ACK_FLAG) ? 1 : 0;
+			if(m_batchCount && ack == m_seq) {
+				m_batchCount = 0;
+			}
+			if(!m_batchCount) {
+				//Sin lote pendiente, el siguiente debe parecerle nuevo al maestro,
+				//tambien si este ha reiniciado y ya no recuerda el ultimo seq
+				m_seq = ack;
+			}
+
+			//Tomar un lote nuevo de la cola
+			if(!m_batchCount && m_queueTail != m_queueHead) {
+				m_seq ^= 1;
+				m_batchSent = false;
+				size_t tail = m_queueTail;
+				while(tail != m_queueHead && m_batchCount < EVENT_MAX) {
+					m_reply[2 + m_batchCount++] = m_queue[tail & (QUEUE_SIZE - 1)];
+					++tail;
+				}
+				m_queueTail = tail;
+			}
+
+			if(m_batchCount) {
+				if(m_batchSent) {
+					++m_retries;
+				}
+				m_batchSent = true;
+				m_reply[0] = REPLY_DELTA | m_address;
+				m_reply[1] = static_cast<uint8_t>((m_seq << 4) | m_batchCount);
+				m_reply[2 + m_batchCount] = checksum(m_reply, 2 + m_batchCount);
+				m_replyLength = 3 + m_batchCount;
+			} else {
+				m_reply[0] = REPLY_IDLE | m_address;
+				m_replyLength = 1;
+
+				//Sin acciones propias pendientes, el estado del maestro ya las incluye
+				if(m_queueTail == m_queueHead && (m_poll[1] != m_program || m_poll[2] != m_preview)) {
+					m_program = m_poll[1];
+					m_preview = m_poll[2];
+					m_stateFlag = true;
+				}
+			}
+			m_replyDelay.attach_us(callback(this, &PollSlave::transmit), REPLY_DELAY_US);
+		}
+
+		/**
+		 * \brief Toma el bus y envia la respuesta. Cabe entera en la FIFO
+		 */
+		void transmit() {
+			m_de = 1;
+			for(size_t i = 0; i < m_replyLength; ++i) {
+				m_uart.putc(m_reply[i]);
+			}
+			m_release.attach_us(callback(this, &PollSlave::release), m_replyLength * m_byteUs + RELEASE_US);
+		}
+
+		void release() {
+			m_de = 0;
+		}
+};
+
+
+
+/**
+ * \brief Maestro del sondeo. Un Ticker abre cada ranura y envia el sondeo; la
+ * interrupcion de recepcion valida la respuesta y guarda los lotes nuevos,
+ * que se aplican con process(). Un lote solo se confirma una vez aplicado,
+ * por lo que el sondeo que lo confirma ya lleva el estado resultante.
+ * \tparam Sink: Destino de las acciones. Debe proporcionar el metodo
+ * void onPollEvent(uint8_t node, PollLinkBase::Action action, size_t sig)
+ * (NO_SIGNAL = ninguna), que se resuelve en tiempo de compilacion
+ */
+template<typename Sink>
+class PollMaster : public PollLinkBase {
+	public:
+		static const size_t BATCH_MAX = 4; ///<Lotes recibidos pendientes de aplicar. Potencia de 2
+
+		/**
+		 * \brief Constructor
+		 * \param uart: Puerto del bus. Debe sobrevivir al objeto
+		 * \param de: Pin que habilita el transmisor RS-485 (y deshabilita el receptor)
+		 * \param nodes: Esclavos a sondear, con direcciones [0, nodes). Como mucho ADDRESS_MAX
+		 * \param sink: Destino de las acciones. Debe sobrevivir al objeto
+		 */
+		PollMaster(RawSerial& uart, PinName de, size_t nodes, Sink& sink)
+			: m_uart(uart)
+			, m_de(de, 0)
+			, m_sink(sink)
+			, m_nodes(nodes < ADDRESS_MAX ? nodes : ADDRESS_MAX)
+			, m_byteUs(0)
+			, m_slotUs(0)
+			, m_current(0)
+			, m_replyIndex(REPLY_DONE)
+			, m_program(NO_SIGNAL)
+			, m_preview(NO_SIGNAL)
+			, m_batchHead(0)
+			, m_batchTail(0)
+			, m_polls(0)
+			, m_idle(0)
+			, m_deltas(0)
+			, m_errors(0)
+			, m_silent(0)
+			, m_busBytes(0)
+		{
+			for(size_t i = 0; i < ADDRESS_MAX; ++i) {
+				m_ack[i] = 1; //El primer lote de cada esclavo lleva seq 0
+				m_applying[i] = false;
+			}
+		}
+
+		/**
+		 * \brief Configura el puerto y comienza a sondear
+		 */
+		void start(int baud) {
+			m_byteUs = byteUs(baud);
+			m_slotUs = slotUs(baud);
+			m_uart.baud(baud);
+			m_uart.attach(callback(this, &PollMaster::onReceive), SerialBase::RxIrq);
+			m_current = m_nodes - 1; //La primera ranura sondea el nodo 0
+			m_slotClk.attach_us(callback(this, &PollMaster::onSlot), m_slotUs);
+		}
+
+		/**
+		 * \brief Establece el estado que se envia en los sondeos
+		 */
+		void setState(size_t program, size_t preview) {
+			m_program = toSignal(program);
+			m_preview = toSignal(preview);
+		}
+
+		/**
+		 * \brief Indica si hay lotes recibidos pendientes de process()
+		 */
+		bool hasEvents() const {
+			return m_batchHead != m_batchTail;
+		}
+
+		/**
+		 * \brief Aplica los lotes recibidos. Debe llamarse desde el bucle principal
+		 */
+		void process() {
+			while(m_batchTail != m_batchHead) {
+				const Batch& batch = m_batches[m_batchTail & (BATCH_MAX - 1)];
+				for(size_t i = 0; i < batch.count; ++i) {
+					const uint8_t event = batch.events[i];
+					m_sink.onPollEvent(batch.node, static_cast<Action>((event >> 5) & 0x03), event & ADDRESS_MASK);
+				}
+				m_ack[batch.node] = batch.seq;
+				m_applying[batch.node] = false;
+				++m_batchTail;
+			}
+		}
+
+		/**
+		 * \brief Devuelve la duracion de una ranura
+		 */
+		uint32_t getSlotUs() const {
+			return m_slotUs;
+		}
+
+		/**
+		 * \brief Devuelve la duracion de un ciclo de sondeo. Una accion llega
+		 * al maestro como mucho un ciclo y una ranura despues
+		 */
+		uint32_t getCycleUs() const {
+			return m_nodes * m_slotUs;
+		}
+
+		size_t getNodes() const {
+			return m_nodes;
+		}
+
+		uint32_t getPolls() const {
+			return m_polls;
+		}
+
+		/**
+		 * \brief Devuelve las respuestas "sin cambios"
+		 */
+		uint32_t getIdle() const {
+			return m_idle;
+		}
+
+		/**
+		 * \brief Devuelve los lotes nuevos recibidos
+		 */
+		uint32_t getDeltas() const {
+			return m_deltas;
+		}
+
+		/**
+		 * \brief Devuelve las respuestas incorrectas o incompletas
+		 */
+		uint32_t getErrors() const {
+			return m_errors;
+		}
+
+		/**
+		 * \brief Devuelve los sondeos sin respuesta
+		 */
+		uint32_t getSilent() const {
+			return m_silent;
+		}
+
+		/**
+		 * \brief Devuelve los bytes que han ocupado el bus (sondeos y respuestas)
+		 */
+		uint32_t getBusBytes() const {
+			return m_busBytes;
+		}
+
+	private:
+		static const size_t REPLY_DONE = ~size_t(0); ///<La ranura ya no espera bytes
+
+		///Lote de acciones de un esclavo
+		struct Batch {
+			uint8_t		node;
+			uint8_t		seq;
+			uint8_t		count;
+			uint8_t		events[EVENT_MAX];
+		};
+
+		RawSerial&				m_uart;
+		DigitalOut				m_de;
+		Sink&							m_sink;
+		const size_t			m_nodes;
+		uint32_t					m_byteUs;
+		uint32_t					m_slotUs;
+		Ticker						m_slotClk;
+		Timeout						m_release;
+
+		//Ranura en curso
+		uint8_t						m_current; ///<Esclavo sondeado
+		size_t						m_replyIndex; ///<Bytes recibidos de la respuesta. REPLY_DONE = terminada
+		uint8_t						m_reply[REPLY_MAX];
+
+		//Estado que se envia
+		volatile uint8_t	m_program;
+		volatile uint8_t	m_preview;
+
+		//Bit alterno de cada esclavo
+		uint8_t						m_ack[ADDRESS_MAX]; ///<seq del ultimo lote aplicado
+		volatile bool			m_applying[ADDRESS_MAX]; ///<Hay un lote suyo pendiente de process()
+
+		Batch							m_batches[BATCH_MAX];
+		volatile size_t		m_batchHead; ///<Lo escribe la interrupcion
+		volatile size_t		m_batchTail; ///<Lo escribe el bucle principal
+
+		uint32_t					m_polls;
+		uint32_t					m_idle;
+		uint32_t					m_deltas;
+		uint32_t					m_errors;
+		uint32_t					m_silent;
+		uint32_t					m_busBytes;
+
+		typedef char BatchSizeCheck[(BATCH_MAX & (BATCH_MAX - 1)) == 0 ? 1 : -1];
+
+		/**
+		 * \brief Comienzo de ranura: cierra la anterior y sondea al siguiente esclavo
+		 */
+		void onSlot() {
+			if(m_replyIndex == 0) {
+				++m_silent;
+			} else if(m_replyIndex != REPLY_DONE) {
+				++m_errors;
+			}
+
+			m_current = (m_current + 1) % m_nodes;
+			m_replyIndex = 0;
+			++m_polls;
+
+			uint8_t poll[POLL_LENGTH];
+			poll[0] = POLL_FLAG | (m_ack[m_current] ? ACK_FLAG : 0) | m_current;
+			poll[1] = m_program;
+			poll[2] = m_preview;
+			poll[3] = checksum(poll, POLL_LENGTH - 1);
+			m_de = 1;
+			for(size_t i = 0; i < POLL_LENGTH; ++i) {
+				m_uart.putc(poll[i]);
+			}
+			m_busBytes += POLL_LENGTH;
+			m_release.attach_us(callback(this, &PollMaster::release), POLL_LENGTH * m_byteUs + RELEASE_US);
+		}
+
+		void release() {
+			m_de = 0;
+		}
+
+		/**
+		 * \brief Interrupcion de recepcion: valida la respuesta del esclavo sondeado
+		 */
+		void onReceive() {
+			while(m_uart.readable()) {
+				const uint8_t c = static_cast<uint8_t>(m_uart.getc());
+				++m_busBytes;
+				if(m_replyIndex == REPLY_DONE) {
+					continue;
+				}
+
+				m_reply[m_replyIndex++] = c;
+				if(m_replyIndex == 1) {
+					if(c == (REPLY_IDLE | m_current)) {
+						++m_idle;
+						m_replyIndex = REPLY_DONE;
+					} else if(c != (REPLY_DELTA | m_current)) {
+						++m_errors;
+						m_replyIndex = REPLY_DONE;
+					}
+				} else if(m_replyIndex == 2) {
+					const size_t count = c & 0x0F;
+					if(count == 0 || count > EVENT_MAX || (c & ~0x1F)) {
+						++m_errors;
+						m_replyIndex = REPLY_DONE;
+					}
+				} else if(m_replyIndex == 3 + static_cast<size_t>(m_reply[1] & 0x0F)) {
+					m_replyIndex = REPLY_DONE;
+					onDelta();
+				}
+			}
+		}
+
+		/**
+		 * \brief Guarda un lote completo si es correcto y nuevo
+		 */
+		void onDelta() {
+			const size_t count = m_reply[1] & 0x0F;
+			if(checksum(m_reply, 2 + count) != m_reply[2 + count]) {
+				++m_errors;
+				return;
+			}
+
+			//Repetido: aun sin aplicar, o ya aplicado pero el esclavo no vio la confirmacion
+			const uint8_t seq = (m_reply[1] >> 4) & 1;
+			if(m_applying[m_current] || seq == m_ack[m_current]) {
+				return;
+			}
+			if(m_batchHead - m_batchTail >= BATCH_MAX) {
+				return; //Sin confirmar: el esclavo lo repetira
+			}
+
+			Batch& batch = m_batches[m_batchHead & (BATCH_MAX - 1)];
+			batch.node = m_current;
+			batch.seq = seq;
+			batch.count = static_cast<uint8_t>(count);
+			for(size_t i = 0; i < count; ++i) {
+				batch.events[i] = m_reply[2 + i];
+			}
+			m_applying[m_current] = true;
+			++m_deltas;
+			++m_batchHead;
+		}
+};
+
+#endif //POLL_LINK_H_INCLUDED
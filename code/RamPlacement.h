@@ -0,0 +1,52 @@
+#ifndef RAM_PLACEMENT_H_INCLUDED
+#define RAM_PLACEMENT_H_INCLUDED
+
+/**
+ * \file
+ * \brief Ubicacion en memoria del codigo y los datos mas usados.
+ *
+ * A 96MHz la flash del LPC1768 necesita ciclos de espera, y el acelerador
+ * de flash solo los oculta en el codigo lineal. El codigo del refresco de
+ * la E/S en serie se ejecuta cada 500us, por lo que se copia a la SRAM local
+ * (seccion .ramfunc, en RW_IRAM1 del fichero scatter), de donde se lee sin
+ * esperas. Solo se copia el desplazamiento de cada bit: el trabajo de cada
+ * trama (botones, mezclador, eventos) se queda en la flash, ya que llama a su
+ * vez a codigo de la flash y ocuparia varios KB de SRAM. Con GCC la seccion
+ * no se aplica a los metodos de plantillas, que quedan en la flash.
+ * Los buffers grandes se llevan a los bancos de SRAM AHB, que de
+ * otro modo no se usan, para dejar la SRAM local a la pila y a ese codigo.
+ */
+
+#if defined(__CC_ARM) || defined(__GNUC__)
+	///Ejecuta una funcion desde la SRAM local. No se integra en quien la llama,
+	///ya que entonces se ejecutaria desde la flash
+	#define RAM_FUNC __attribute__((section(".ramfunc"), noinline))
+
+	///Mantiene una funcion en la flash aunque la llame una RAM_FUNC. Para el
+	///trabajo de cada trama, que no debe integrarse y ocupar la SRAM local
+	#define FLASH_FUNC __attribute__((noinline))
+
+	///Ubica un objeto en el banco 0 de SRAM AHB (0x2007C000, 16KB)
+	#define AHB_BANK0 __attribute__((section("AHBSRAM0")))
+
+	///Ubica un objeto en el banco 1 de SRAM AHB (0x20080000, 8KB)
+	#define AHB_BANK1 __attribute__((section("AHBSRAM1")))
+#else
+	#define RAM_FUNC
+	#define FLASH_FUNC
+	#define AHB_BANK0
+	#define AHB_BANK1
+#endif
+
+///Ubica un objeto en la mitad alta del banco 1 de SRAM AHB (0x20082000, 8KB),
+///que no se inicializa al arrancar y conserva su contenido tras un reinicio.
+///El objeto no debe tener constructor
+#if defined(__CC_ARM)
+	#define AHB_BANK1_NOINIT __attribute__((section("AHBSRAM1_NOINIT"), zero_init))
+#elif defined(__GNUC__)
+	#define AHB_BANK1_NOINIT __attribute__((section("AHBSRAM1_NOINIT")))
+#else
+	#define AHB_BANK1_NOINIT
+#endif
+
+#endif //RAM_PLACEMENT_H_INCLUDED
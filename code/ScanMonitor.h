@@ -0,0 +1,115 @@
+#ifndef SCAN_MONITOR_H_INCLUDED
+#define SCAN_MONITOR_H_INCLUDED
+
+#include "CycleCounter.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Vigila la temporizacion del refresco. Guarda un histograma del
+ * intervalo real entre llamadas sucesivas a tick(), el peor intervalo y el
+ * numero de interrupciones perdidas (la bandera seguia activa cuando llego
+ * la siguiente). Si el bucle principal se retrasa, los semiperiodos del reloj
+ * de los registros se alargan sin que nada falle: esto permite detectarlo.
+ * \tparam Bins: Numero de barras del histograma. La ultima acumula los
+ * intervalos mayores
+ */
+template<size_t Bins = 16>
+class ScanMonitor {
+	public:
+		static const size_t BIN_COUNT = Bins; ///<Numero de barras
+
+		/**
+		 * \brief Constructor
+		 * \param binUs: Anchura de cada barra en microsegundos. La barra i
+		 * cuenta los intervalos de [i*binUs, (i+1)*binUs)
+		 */
+		explicit ScanMonitor(uint32_t binUs)
+			: m_binCycles(binUs * (SystemCoreClock / 1000000))
+			, m_binUs(binUs)
+			, m_last(0)
+			, m_started(false)
+			, m_overruns(0)
+		{
+			reset();
+		}
+
+		/**
+		 * \brief Anota una llamada a tick(). Llamar justo antes de ella
+		 */
+		void onTick() {
+			const uint32_t now = CycleCounter::read();
+			if(m_started) {
+				const uint32_t interval = now - m_last;
+				const uint32_t bin = interval / m_binCycles;
+				++m_bins[bin < Bins ? bin : Bins - 1];
+				if(interval > m_worst) m_worst = interval;
+			}
+			m_last = now;
+			m_started = true;
+		}
+
+		/**
+		 * \brief Anota una interrupcion perdida. Se llama desde la interrupcion
+		 * cuando la bandera aun no se ha atendido
+		 */
+		void onOverrun() {
+			++m_overruns;
+		}
+
+		/**
+		 * \brief Descarta las medidas. El siguiente tick() no cuenta, ya que
+		 * no se conoce el anterior
+		 */
+		void reset() {
+			for(size_t i = 0; i < Bins; ++i) {
+				m_bins[i] = 0;
+			}
+			m_worst = 0;
+			m_started = false;
+			m_overruns = 0;
+		}
+
+		/**
+		 * \brief Devuelve el numero de intervalos de una barra
+		 */
+		uint32_t getBin(size_t index) const {
+			return m_bins[index];
+		}
+
+		/**
+		 * \brief Devuelve el inicio de una barra en microsegundos
+		 */
+		uint32_t getBinStartUs(size_t index) const {
+			return index * m_binUs;
+		}
+
+		/**
+		 * \brief Devuelve el peor intervalo en microsegundos
+		 */
+		uint32_t getWorstUs() const {
+			return CycleCounter::toMicroseconds(m_worst);
+		}
+
+		/**
+		 * \brief Devuelve el numero de interrupciones perdidas
+		 */
+		uint32_t getOverruns() const {
+			return m_overruns;
+		}
+
+
+
+	private:
+		uint32_t					m_binCycles; ///<Anchura de cada barra en ciclos
+		uint32_t					m_binUs; ///<Anchura de cada barra en microsegundos
+		uint32_t					m_bins[Bins];
+		uint32_t					m_worst; ///<Peor intervalo en ciclos
+		uint32_t					m_last; ///<Ultima llamada a tick()
+		bool							m_started; ///<m_last es valido
+		volatile uint32_t	m_overruns; ///<Lo incrementa la interrupcion
+
+};
+
+#endif //SCAN_MONITOR_H_INCLUDED
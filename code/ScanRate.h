@@ -0,0 +1,100 @@
+#ifndef SCAN_RATE_H_INCLUDED
+#define SCAN_RATE_H_INCLUDED
+
+#include "CycleCounter.h"
+
+#include <stdint.h>
+
+/**
+ * \brief Ritmo de refresco adaptativo. Mientras nadie toca el panel el
+ * semiperiodo del reloj se duplica cada idleFrames tramas sin cambios hasta
+ * llegar a slowUs, y vuelve de golpe a fastUs con la primera trama que trae
+ * un cambio. slowUs fija la peor latencia de entrada aceptada: una trama en
+ * reposo dura (InCnt + 1) * 2 * slowUs.
+ *
+ * Solo decide el ritmo; quien lo usa debe reprogramar su reloj cuando
+ * onFrame() lo indica.
+ */
+class ScanRate {
+	public:
+		/**
+		 * \brief Constructor
+		 * \param fastUs: Semiperiodo con actividad
+		 * \param slowUs: Semiperiodo maximo en reposo
+		 * \param idleFrames: Tramas sin cambios antes de cada paso hacia slowUs
+		 */
+		ScanRate(uint32_t fastUs, uint32_t slowUs, uint32_t idleFrames)
+			: m_fastUs(fastUs)
+			, m_slowUs(slowUs)
+			, m_idleFrames(idleFrames)
+			, m_periodUs(fastUs)
+			, m_idle(0)
+			, m_lastFrame(CycleCounter::read())
+			, m_rampUpCycles(0)
+		{
+		}
+
+		/**
+		 * \brief Anota una trama completa
+		 * \param activity: La trama trae algun cambio
+		 * \returns true si ha cambiado el semiperiodo
+		 */
+		bool onFrame(bool activity) {
+			const uint32_t now = CycleCounter::read();
+			bool changed = false;
+
+			if(activity) {
+				m_idle = 0;
+				if(m_periodUs != m_fastUs) {
+					//Lo que ha tardado en verse el cambio: como mucho una trama lenta
+					m_rampUpCycles = now - m_lastFrame;
+					m_periodUs = m_fastUs;
+					changed = true;
+				}
+			} else if(m_periodUs < m_slowUs && ++m_idle >= m_idleFrames) {
+				m_idle = 0;
+				m_periodUs = (m_periodUs * 2 < m_slowUs) ? m_periodUs * 2 : m_slowUs;
+				changed = true;
+			}
+
+			m_lastFrame = now;
+			return changed;
+		}
+
+		/**
+		 * \brief Devuelve el semiperiodo actual
+		 */
+		uint32_t getPeriodUs() const {
+			return m_periodUs;
+		}
+
+		/**
+		 * \brief Devuelve si se refresca al ritmo maximo
+		 */
+		bool isFast() const {
+			return m_periodUs == m_fastUs;
+		}
+
+		/**
+		 * \brief Devuelve el tiempo entre la ultima trama en reposo y la que
+		 * trajo el cambio en la ultima vuelta al ritmo maximo
+		 */
+		uint32_t getRampUpUs() const {
+			return CycleCounter::toMicroseconds(m_rampUpCycles);
+		}
+
+
+
+	private:
+		uint32_t	m_fastUs;
+		uint32_t	m_slowUs;
+		uint32_t	m_idleFrames;
+
+		uint32_t	m_periodUs; ///<Semiperiodo actual
+		uint32_t	m_idle; ///<Tramas sin cambios desde el ultimo paso
+		uint32_t	m_lastFrame; ///<Ciclo de la ultima trama
+		uint32_t	m_rampUpCycles;
+
+};
+
+#endif //SCAN_RATE_H_INCLUDED
@@ -2,6 +2,10 @@
 #define SERIAL_IN_SERIAL_OUT_H_INCLUDED
 
 #include "mbed.h"
+#include "RamPlacement.h"
+#ifdef PIN_TRACE
+	#include "PinTrace.h"
+#endif
 
 #include <bitset>
 #include <cassert>
@@ -11,12 +15,21 @@
 	#define MAX(X,Y) ((X) > (Y) ? (X) : (Y))
 #endif
 
-template<size_t InCnt, size_t OutCnt>
+/**
+ * \brief E/S en serie mediante registros de desplazamiento (74HC165 + 74HC595)
+ * \tparam Sink: Destino de las palabras leidas. Debe proporcionar los metodos
+ * void onInput(const InputData&) y void onChainCheck(bool ok), que se resuelven
+ * en tiempo de compilacion
+ */
+template<size_t InCnt, size_t OutCnt, typename Sink>
 class SerialInSerialOut {
 	public:
 		typedef std::bitset<InCnt> InputData; ///<Tipo de datos que representa una palabra a la entrada
 		typedef std::bitset<OutCnt> OutputData; ///<Tipo de datos que representa una palabra a la salida
-		typedef void (*InputCallback)(void*, InputData); ///<Prototipo de la funcion a llamar cuando exista un nuevo dato
+		
+		static const size_t INPUT_COUNT = InCnt; ///<Numero de bits a la entrada
+		static const size_t OUTPUT_COUNT = OutCnt; ///<Numero de bits a la salida
+		static const size_t CHECK_BITS = 4; ///<Pulsos adicionales de las tramas de comprobacion de la cadena
 	
 		/**
 	   * \brief Constructor
@@ -24,26 +37,43 @@ class SerialInSerialOut {
 	   * \param clk: Pin que indica la carga/descarga de los datos en el registro de desplazamiento
 	   * \param clk: Pin que se utiliza para la entrada de datos en serie
 	   * \param clk: Pin que se utiliza para la salida de datos en serie
+	   * \param sink: Destino de las palabras leidas. Debe sobrevivir al objeto
 		 */
 		SerialInSerialOut(PinName clk,
 											PinName latch,
 											PinName load,
 											PinName dataIn,
 											PinName dataOut,
-											void* usrPtr = NULL,
-											InputCallback inputCbk = NULL,
+											Sink& sink,
 											OutputData outData = 0 )
 			: m_clk(clk, 0)
 			, m_latch(latch, 0)
 			, m_load(load, 1)
 			, m_din(dataIn) //No necesita pullup ni pulldown
 			, m_dout(dataOut, 0)
-			, m_userPtr(usrPtr)	
-			, m_inputCallback(inputCbk)
+			, m_sink(sink)
 			, m_dataIn(0)
 			, m_dataOut(outData)
+			, m_frameOut(outData)
+			, m_pendingOut(~OutputData()) //Transmitir la primera palabra en cualquier caso
+			, m_refreshOut(false)
+			, m_expediteOut(false)
 			, m_iteration(0)
+			, m_frameLength(ITERATION_COUNT)
+			, m_offsetOut(ITERATION_OFFSET_OUT)
+			, m_checkPeriod(0)
+			, m_checkFrame(0)
+			, m_checking(false)
+			, m_tailLevel(false)
+			, m_tailOk(true)
 		{
+#ifdef PIN_TRACE
+			PinTrace::setName(clk, "clk");
+			PinTrace::setName(latch, "latch");
+			PinTrace::setName(load, "load");
+			PinTrace::setName(dataIn, "din");
+			PinTrace::setName(dataOut, "dout");
+#endif
 		}
 	
 	
@@ -53,44 +83,70 @@ class SerialInSerialOut {
 	   * \brief Establece la siguiente palabra a transmitir
 		 */
 		void setOutputData(const OutputData& d) {
-			m_dataOut = d;
+			setOutputData(d, d ^ m_dataOut);
 		}
 		
 		/**
-	   * \brief Devuelve la siguiente palabra a transmitir
+	   * \brief Establece la siguiente palabra a transmitir
+	   * \param d: Palabra a transmitir
+	   * \param changed: Bits que difieren de la palabra anterior. Si no hay
+	   * ninguno, la cadena de salida no se vuelve a desplazar ni a cargar
 		 */
-		const InputData& getOutputData() const {
-			return m_dataOut;
+		void setOutputData(const OutputData& d, const OutputData& changed) {
+			m_dataOut = d;
+			m_pendingOut |= changed;
 		}
 		
-
+		/**
+	   * \brief Carga la palabra pendiente cuanto antes: empieza a desplazarse
+	   * en la siguiente iteracion y se carga en cuanto esta entera, a mitad de
+	   * trama si hace falta, por lo que los leds cambian como mucho OutCnt + 1
+	   * iteraciones despues, menos que una trama. Si no cabe antes del final,
+	   * la trama se alarga y retrasa la lectura de la siguiente, por lo que
+	   * solo debe usarse con los cambios que no pueden esperar
+		 */
+		void expediteOutput() {
+			if(m_pendingOut.any()) {
+				m_expediteOut = true;
+			}
+		}
 		
 		/**
-	   * \brief Establece el puntero que acompaa a las llamadas de nuevo dato a la entrada
+	   * \brief Devuelve la siguiente palabra a transmitir
 		 */
-		void setUserPointer(void* usrPtr) {
-			m_userPtr = usrPtr;
+		const OutputData& getOutputData() const {
+			return m_dataOut;
 		}
 		
 		/**
-	   * \brief Devuelve el puntero que acompaa a las llamadas de nuevo dato a la entrada
+	   * \brief Devuelve los bits modificados que aun no se han cargado en los registros de salida
 		 */
-		void* getUserPointer() const {
-			return m_userPtr;
+		const OutputData& getPendingOutput() const {
+			return m_pendingOut;
 		}
 		
+
+		
 		/**
-	   * \brief Establece la funcion a llamar cuando exista un nuevo dato a la entrada
+	   * \brief Devuelve el destino de las palabras leidas
 		 */
-		void setInputCallback(InputCallback cbk) {
-			m_inputCallback = cbk;
+		Sink& getSink() const {
+			return m_sink;
 		}
 		
 		/**
-	   * \brief Devuelve la funcion que se llama cuando hay un nuevo dato a la entrada
+	   * \brief Activa la comprobacion de la cadena de entrada. Una de cada
+	   * period tramas se alarga CHECK_BITS pulsos, y los bits que salen tras los
+	   * InCnt de los botones deben valer lo que la entrada serie (SER) del
+	   * ultimo 74HC165. Un cable roto (entrada con pullup) o un integrado
+	   * muerto cambian esos bits, y se notifica con onChainCheck(false)
+	   * \param period: Tramas entre comprobaciones. 0 para desactivarla
+	   * \param tailLevel: Nivel de SER en el ultimo 74HC165
 		 */
-		InputCallback getInputCallback() const {
-			return m_inputCallback;
+		void setChainCheck(size_t period, bool tailLevel) {
+			m_checkPeriod = period;
+			m_checkFrame = 0;
+			m_tailLevel = tailLevel;
 		}
 		
 		
@@ -98,7 +154,7 @@ class SerialInSerialOut {
 		/**
 	   * \brief Avanza al siguiente estado
 		 */
-		void tick() {
+		RAM_FUNC void tick() {
 			//La configuracion de los pines se realiza en el pulso de bajada
 			if(m_clk){ 
 				//Pulso de bajada
@@ -110,15 +166,32 @@ class SerialInSerialOut {
 				
 				//Configurar los pines de salida y leer a la entrada
 				if(m_iteration == 0) {
-					//En la primera iteracion cargar los valores en el registro de desplazamiento
-					m_latch = 1;
+					//En la primera iteracion cargar los valores en el registro de desplazamiento.
+					//La salida solo se carga si se ha desplazado una palabra nueva
+					m_latch = m_refreshOut;
 					m_load = 0;
 					
+					//Decidir si esta trama comprueba la cadena
+					m_frameLength = ITERATION_COUNT;
+					m_checking = m_checkPeriod && ++m_checkFrame >= m_checkPeriod;
+					if(m_checking) {
+						m_checkFrame = 0;
+						m_frameLength += CHECK_BITS;
+						m_tailOk = true;
+					}
+					
+					//Las tramas de comprobacion desplazan la salida mas tarde
+					m_offsetOut = m_frameLength - OutCnt;
+					
 				} else {
 					//Dejar de cargar los valores
 					if(m_iteration == 1) {
 						m_latch = 0;
 						m_load = 1;
+						m_refreshOut = false;
+					} else if(m_latch) {
+						//Fin de la carga de una palabra urgente a mitad de trama
+						m_latch = 0;
 					}
 					assert(!static_cast<bool>(m_latch)); //Asegurarse de que la carga este desactivada
 					assert(static_cast<bool>(m_load)); //Asegurarse de que la carga este desactivada
@@ -131,49 +204,119 @@ class SerialInSerialOut {
 						//Escribe el dato a la entrada en el LSB (posicion 0)
 						m_dataIn.set(0, static_cast<bool>(m_din));
 						
-						//Si se trata del ultimo valor, llamar a la funcion de atencion
-						if(m_iteration == m_dataIn.size() && m_inputCallback) {
-							m_inputCallback(m_userPtr, m_dataIn);
+						//Si se trata del ultimo valor, entregar la palabra leida
+						if(m_iteration == m_dataIn.size()) {
+							m_sink.onInput(m_dataIn);
+						}
+					} else if(m_checking && m_iteration <= m_dataIn.size() + CHECK_BITS) {
+						//Bits de comprobacion tras los de los botones
+						m_tailOk &= (static_cast<bool>(m_din) == m_tailLevel);
+						if(m_iteration == m_dataIn.size() + CHECK_BITS) {
+							m_sink.onChainCheck(m_tailOk);
 						}
 					}
 					
-					//Durante los ultimos OutCnt sacar los valores a la salida
-					const int outIndex = static_cast<int>(m_iteration) - static_cast<int>(ITERATION_OFFSET_OUT);
-					if(outIndex >= 0) {
-						//Asegurarse de que el indice es valido
-						assert(outIndex < m_dataOut.size());
-						
-						//Sacar el valor correspondiente a este indice,
-						//de MSB hacia LSB
-						m_dout = m_dataOut.test(m_dataOut.size() - outIndex - 1);
+					//Una palabra urgente empieza a desplazarse ahora. Si no cabe
+					//antes del final, la trama se alarga
+					if(m_expediteOut) {
+						m_offsetOut = m_iteration;
+						if(m_offsetOut + OutCnt > m_frameLength) {
+							m_frameLength = m_offsetOut + OutCnt;
+						}
+					}
+					
+					//Al comenzar la salida, tomar la palabra a transmitir solo si ha cambiado.
+					//Se copia para que no se mezclen dos palabras si cambia a mitad de trama
+					if(m_iteration == m_offsetOut && m_pendingOut.any()) {
+						m_frameOut = m_dataOut;
+						m_pendingOut.reset();
+						m_refreshOut = true;
+						m_expediteOut = false;
+					}
+					
+					//Durante OutCnt iteraciones sacar los valores a la salida
+					const int outIndex = static_cast<int>(m_iteration) - static_cast<int>(m_offsetOut);
+					if(outIndex >= 0 && m_refreshOut) {
+						if(outIndex < static_cast<int>(m_frameOut.size())) {
+							//Sacar el valor correspondiente a este indice,
+							//de MSB hacia LSB
+							m_dout = m_frameOut.test(m_frameOut.size() - outIndex - 1);
+						} else {
+							//Palabra urgente ya desplazada antes del final de la
+							//trama: cargarla sin esperar
+							m_latch = 1;
+							m_refreshOut = false;
+						}
 					}
 				}
 				
 				//Siguiente iteracion
-				m_iteration = m_iteration < (ITERATION_COUNT-1) ? m_iteration + 1 : 0;
-				assert(m_iteration < ITERATION_COUNT); //Nunca puede ser mayor o igual que el maximo
+				m_iteration = m_iteration < (m_frameLength-1) ? m_iteration + 1 : 0;
+				assert(m_iteration < m_frameLength); //Nunca puede ser mayor o igual que el maximo
 				
 			}
 		}
 		
+		/**
+	   * \brief Realiza una trama completa de una vez (modo rafaga), desde
+	   * cualquier iteracion: termina la trama en curso o, recien construido,
+	   * la primera (carga, lectura de la entrada y desplazamiento de la salida).
+	   * A diferencia de tick(), la palabra de salida queda cargada en los
+	   * registros al terminar, ya que tambien se ejecuta la primera iteracion de
+	   * la siguiente trama (carga de la entrada y de la salida). La siguiente
+	   * rafaga comienza por la segunda iteracion
+		 */
+		RAM_FUNC void burst() {
+			//Hasta dar la vuelta tras la ultima iteracion de una trama y volver
+			//a cargar
+			bool wrapped = false;
+			do {
+				tick();
+				wrapped = wrapped || (m_iteration == 0 && m_clk);
+			} while(!(wrapped && m_iteration == 1 && m_clk));
+
+			//Pulso de bajada
+			tick();
+		}
+		
 		
 		
 		
 	
 	private:
-		DigitalOut		m_clk; ///<Pin que gobierna el reloj de los registros de desplazamiento
-		DigitalOut		m_latch; ///<Pin que carga los datos en los registros de salida
-		DigitalOut		m_load; ///<Pin que carga los datos en los registros de desplazamiento de entrada. Activo a nivel bajo
-		DigitalIn			m_din; ///<Datos de entrada en serie
-		DigitalOut		m_dout; ///<Datos de salida en serie
+		//Con PIN_TRACE los flancos de los pines se registran en PinTrace
+#ifdef PIN_TRACE
+		typedef TracedOut	OutPin;
+		typedef TracedIn	InPin;
+#else
+		typedef DigitalOut	OutPin;
+		typedef DigitalIn		InPin;
+#endif
 	
-		void*					m_userPtr; ///<Puntero que acompaa a las llamadas de entrada
-		InputCallback	m_inputCallback; ///<Funcion a llamar cuando exista un nuevo dato a la entrada
+		OutPin				m_clk; ///<Pin que gobierna el reloj de los registros de desplazamiento
+		OutPin				m_latch; ///<Pin que carga los datos en los registros de salida
+		OutPin				m_load; ///<Pin que carga los datos en los registros de desplazamiento de entrada. Activo a nivel bajo
+		InPin					m_din; ///<Datos de entrada en serie
+		OutPin				m_dout; ///<Datos de salida en serie
+	
+		Sink&					m_sink; ///<Destino de las palabras leidas
 
 		InputData			m_dataIn;	///<Ultima palabra leida
 		OutputData 		m_dataOut; ///<Siguiente palabra a transmitir
+		OutputData		m_frameOut; ///<Palabra que se esta desplazando
+		OutputData		m_pendingOut; ///<Bits modificados pendientes de desplazar
+		bool					m_refreshOut; ///<Se esta desplazando una palabra nueva, cargarla al final de la trama
+		bool					m_expediteOut; ///<La palabra pendiente no espera a la siguiente trama
 	
-		size_t				m_iteration; //Indice de la iteracion. [0, ITERATION_COUNT)
+		size_t				m_iteration; //Indice de la iteracion. [0, m_frameLength)
+		size_t				m_frameLength; ///<Iteraciones de la trama actual
+		size_t				m_offsetOut; ///<Iteracion en la que empieza a desplazarse la salida
+		
+		size_t				m_checkPeriod; ///<Tramas entre comprobaciones de la cadena. 0 = desactivada
+		size_t				m_checkFrame; ///<Tramas desde la ultima comprobacion
+		bool					m_checking; ///<La trama en curso comprueba la cadena
+		bool					m_tailLevel; ///<Valor esperado de los bits de comprobacion
+		bool					m_tailOk; ///<Los bits de comprobacion leidos son correctos
 	
 	
 		///El numero de iteraciones que se van a realizar para introducir/sacar
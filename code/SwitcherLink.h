@@ -0,0 +1,425 @@
+#ifndef SWITCHER_LINK_H_INCLUDED
+#define SWITCHER_LINK_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Protocolo binario de mezclador de video al estilo GVG-100, para
+ * enviarle las acciones del panel sin pasar por el PC. Formato de las tramas,
+ * comun al panel y al emulador de la simulacion.
+ *
+ * Trama: [n] [direccion de efectos] [orden] [datos...] [suma]. n cuenta los
+ * bytes que siguen, suma incluida; la suma es el complemento a 2 de la suma
+ * de la direccion, la orden y los datos, de modo que todos ellos suman 0. El
+ * mezclador responde a cada trama con ACK, o con NAK si es erronea, y no se
+ * envia la siguiente hasta recibir respuesta. La USART va a 38400 baudios,
+ * 8 bits, paridad impar y 1 bit de parada.
+ *
+ * Los codigos de orden dependen del mezclador y no tienen valor por defecto:
+ * se pasan en una tabla, tomada de su manual, con uno por Action.
+ */
+class SwitcherLinkBase {
+	public:
+		///Acciones del mezclador
+		enum Action {
+			ACTION_PROGRAM,
+			ACTION_PREVIEW,
+			ACTION_CUT,
+			ACTION_TRANSITION,
+
+			ACTION_COUNT
+		};
+
+		static const uint8_t ACK = 0x84;
+		static const uint8_t NAK = 0x85;
+		static const uint8_t EFFECTS_ADDRESS = 0x00; ///<Mezcla principal (programa y preseleccion)
+		static const uint8_t SOURCE_MAX = 0x7F; ///<Fuentes del mezclador: [0, SOURCE_MAX)
+
+		static const int BAUD = 38400;
+		static const size_t BYTE_BITS = 11; ///<Arranque, 8 bits, paridad y parada
+		static const size_t FRAME_MAX = 5; ///<Bytes de la trama mas larga
+		static const size_t COUNT_MAX = FRAME_MAX - 1;
+
+		/**
+		 * \brief Indica si la orden de una accion lleva la fuente como dato
+		 */
+		static bool hasSource(Action action) {
+			return action == ACTION_PROGRAM || action == ACTION_PREVIEW;
+		}
+
+		/**
+		 * \brief Devuelve el complemento a 2 de la suma de los bytes
+		 */
+		static uint8_t checksum(const uint8_t* data, size_t count) {
+			uint8_t sum = 0;
+			for(size_t i = 0; i < count; ++i) {
+				sum += data[i];
+			}
+			return static_cast<uint8_t>(-sum);
+		}
+
+		/**
+		 * \brief Codifica una accion
+		 * \param frame: Destino. Al menos FRAME_MAX bytes
+		 * \param codes: Codigo de orden de cada Action
+		 * \returns Bytes de la trama. 0 si la fuente esta fuera de rango
+		 */
+		static size_t encode(uint8_t* frame, const uint8_t* codes, Action action, size_t source, uint8_t address) {
+			if(hasSource(action) && source >= SOURCE_MAX) {
+				return 0;
+			}
+			size_t length = 1;
+			frame[length++] = address;
+			frame[length++] = codes[action];
+			if(hasSource(action)) {
+				frame[length++] = static_cast<uint8_t>(source);
+			}
+			frame[length] = checksum(frame + 1, length - 1);
+			++length;
+			frame[0] = static_cast<uint8_t>(length - 1);
+			return length;
+		}
+
+		/**
+		 * \brief Decodifica una trama completa
+		 * \param codes: Codigo de orden de cada Action
+		 * \returns false si la suma, la longitud o la orden no son validas
+		 */
+		static bool decode(const uint8_t* frame, size_t length, const uint8_t* codes, uint8_t& address, Action& action, size_t& source) {
+			if(length < 4 || frame[0] != length - 1 || checksum(frame + 1, length - 2) != frame[length - 1]) {
+				return false;
+			}
+			for(size_t i = 0; i < ACTION_COUNT; ++i) {
+				const Action candidate = static_cast<Action>(i);
+				if(codes[i] == frame[2] && length == (hasSource(candidate) ? 5U : 4U)) {
+					address = frame[1];
+					action = candidate;
+					source = hasSource(candidate) ? frame[3] : 0;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/**
+		 * \brief Devuelve la duracion de una trama en microsegundos
+		 */
+		static uint32_t frameUs(size_t length) {
+			return (length * BYTE_BITS * 1000000 + BAUD - 1) / BAUD;
+		}
+};
+
+
+
+/**
+ * \brief Envio de las acciones al mezclador con confirmacion. Las tramas
+ * esperan en una cola acotada y se envian de una en una: la interrupcion de
+ * recepcion avanza con ACK, y un NAK o la falta de respuesta en ACK_TIMEOUT_US
+ * repiten la trama hasta RETRY_MAX veces antes de descartarla. Una fuente de
+ * programa o preseleccion que aun no se ha enviado se sustituye por la nueva
+ * en lugar de encolarla, por lo que la cola nunca lleva estados intermedios.
+ *
+ * Un corte o una transicion sin ACK no se repite, ya que si solo se ha
+ * perdido o corrompido el ACK (un bit lo convierte en NAK) se ejecutaria dos
+ * veces. En ese caso, y si se descarta una accion por agotar los intentos o
+ * por estar llena la cola, el estado del mezclador es desconocido: cuando se
+ * vacia la cola se pide al destino que vuelva a enviar programa y
+ * preseleccion, que si pueden repetirse.
+ * \tparam Uart: Puerto serie, como RawSerial
+ * \tparam Sink: Destino de los avisos. Debe proporcionar los metodos
+ * void onSwitcherFail(SwitcherLinkBase::Action action) y
+ * void onSwitcherResync(), que se resuelven en tiempo de compilacion
+ */
+template<typename Uart, typename Sink>
+class SwitcherLink : public SwitcherLinkBase {
+	public:
+		static const size_t QUEUE_SIZE = 8; ///<Potencia de 2
+		static const uint32_t ACK_TIMEOUT_US = 10000; ///<Desde el final de la trama
+		static const size_t RETRY_MAX = 3;
+
+		/**
+		 * \brief Constructor
+		 * \param uart: Puerto serie. Debe sobrevivir al objeto
+		 * \param sink: Destino de los fallos. Debe sobrevivir al objeto
+		 * \param codes: Codigo de orden de cada Action, del manual del
+		 * mezclador. Debe sobrevivir al objeto
+		 * \param address: Direccion de efectos de las ordenes
+		 */
+		SwitcherLink(Uart& uart, Sink& sink, const uint8_t* codes, uint8_t address = EFFECTS_ADDRESS)
+			: m_uart(uart)
+			, m_sink(sink)
+			, m_codes(codes)
+			, m_address(address)
+			, m_head(0)
+			, m_tail(0)
+			, m_busy(false)
+			, m_attempts(0)
+			, m_sentUs(0)
+			, m_failHead(0)
+			, m_failTail(0)
+			, m_resyncFlag(false)
+			, m_stale(false)
+			, m_acked(0)
+			, m_retries(0)
+			, m_coalesced(0)
+			, m_dropped(0)
+			, m_resyncs(0)
+			, m_roundTripUs(0)
+			, m_roundTripMaxUs(0)
+		{
+		}
+
+		/**
+		 * \brief Configura el puerto y engancha la recepcion
+		 */
+		void start() {
+			m_uart.baud(BAUD);
+			m_uart.format(8, SerialBase::Odd, 1);
+			m_uart.attach(callback(this, &SwitcherLink::onReceive), SerialBase::RxIrq);
+		}
+
+		/**
+		 * \brief Encola una accion y, si no hay ninguna en curso, la envia
+		 * \returns false si la fuente no es valida o la cola esta llena
+		 */
+		bool queue(Action action, size_t source) {
+			if(hasSource(action) && source >= SOURCE_MAX) {
+				return false;
+			}
+
+			bool queued = true;
+			core_util_critical_section_enter();
+			//Buscar desde la mas reciente hasta un corte o una transicion, que
+			//no pueden adelantarse. La trama en curso no se toca
+			bool coalesced = false;
+			if(hasSource(action)) {
+				const size_t first = m_busy ? m_tail + 1 : m_tail;
+				for(size_t i = m_head; i != first && !coalesced; --i) {
+					Entry& entry = m_queue[(i - 1) & (QUEUE_SIZE - 1)];
+					if(!hasSource(entry.action)) {
+						break;
+					}
+					if(entry.action == action) {
+						entry.source = static_cast<uint8_t>(source);
+						++m_coalesced;
+						coalesced = true;
+					}
+				}
+			}
+			if(!coalesced) {
+				if(m_head - m_tail >= QUEUE_SIZE) {
+					++m_dropped;
+					m_stale = true;
+					queued = false;
+				} else {
+					Entry& entry = m_queue[m_head & (QUEUE_SIZE - 1)];
+					entry.action = action;
+					entry.source = static_cast<uint8_t>(source);
+					++m_head;
+					if(!m_busy) {
+						send();
+					}
+				}
+			}
+			core_util_critical_section_exit();
+			return queued;
+		}
+
+		/**
+		 * \brief Indica si hay avisos pendientes de process()
+		 */
+		bool hasEvents() const {
+			return m_failHead != m_failTail || m_resyncFlag;
+		}
+
+		/**
+		 * \brief Entrega las tramas descartadas y las peticiones de
+		 * resincronizacion. Debe llamarse desde el bucle principal
+		 */
+		void process() {
+			while(m_failTail != m_failHead) {
+				m_sink.onSwitcherFail(m_failed[m_failTail & (QUEUE_SIZE - 1)]);
+				++m_failTail;
+			}
+			if(m_resyncFlag) {
+				m_resyncFlag = false;
+				m_sink.onSwitcherResync();
+			}
+		}
+
+		/**
+		 * \brief Devuelve las tramas confirmadas
+		 */
+		uint32_t getAcked() const {
+			return m_acked;
+		}
+
+		/**
+		 * \brief Devuelve las repeticiones por NAK o falta de respuesta
+		 */
+		uint32_t getRetries() const {
+			return m_retries;
+		}
+
+		/**
+		 * \brief Devuelve las fuentes sustituidas en la cola antes de enviarse
+		 */
+		uint32_t getCoalesced() const {
+			return m_coalesced;
+		}
+
+		/**
+		 * \brief Devuelve las acciones descartadas por llenarse la cola
+		 */
+		uint32_t getDropped() const {
+			return m_dropped;
+		}
+
+		/**
+		 * \brief Devuelve los cortes y transiciones sin respuesta
+		 */
+		uint32_t getResyncs() const {
+			return m_resyncs;
+		}
+
+		/**
+		 * \brief Devuelve el tiempo desde el envio de la ultima trama
+		 * confirmada hasta su ACK
+		 */
+		uint32_t getRoundTripUs() const {
+			return m_roundTripUs;
+		}
+
+		uint32_t getRoundTripMaxUs() const {
+			return m_roundTripMaxUs;
+		}
+
+	private:
+		///Accion encolada
+		struct Entry {
+			Action	action;
+			uint8_t	source;
+		};
+
+		typedef char QueueSizeCheck[(QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0 ? 1 : -1];
+
+		Uart&							m_uart;
+		Sink&							m_sink;
+		const uint8_t*		m_codes; ///<Codigo de orden de cada Action
+		const uint8_t			m_address;
+		Timeout						m_ackTimeout;
+
+		//Cola. La trama en curso es la de m_tail
+		Entry							m_queue[QUEUE_SIZE];
+		volatile size_t		m_head;
+		volatile size_t		m_tail;
+		volatile bool			m_busy; ///<Se espera la respuesta a la trama de m_tail
+		size_t						m_attempts; ///<Envios de la trama en curso
+		uint32_t					m_sentUs;
+
+		//Tramas descartadas. Las escriben las interrupciones
+		Action						m_failed[QUEUE_SIZE];
+		volatile size_t		m_failHead;
+		volatile size_t		m_failTail;
+		volatile bool			m_resyncFlag;
+		bool							m_stale; ///<Hay que resincronizar al vaciarse la cola
+
+		uint32_t					m_acked;
+		uint32_t					m_retries;
+		uint32_t					m_coalesced;
+		uint32_t					m_dropped;
+		uint32_t					m_resyncs;
+		uint32_t					m_roundTripUs;
+		uint32_t					m_roundTripMaxUs;
+
+		/**
+		 * \brief Envia la trama de m_tail. Cabe entera en la FIFO
+		 */
+		void send() {
+			const Entry& entry = m_queue[m_tail & (QUEUE_SIZE - 1)];
+			uint8_t frame[FRAME_MAX];
+			const size_t length = encode(frame, m_codes, entry.action, entry.source, m_address);
+			m_busy = true;
+			++m_attempts;
+			m_sentUs = us_ticker_read();
+			for(size_t i = 0; i < length; ++i) {
+				m_uart.putc(frame[i]);
+			}
+			m_ackTimeout.attach_us(callback(this, &SwitcherLink::onTimeout), frameUs(length) + ACK_TIMEOUT_US);
+		}
+
+		/**
+		 * \brief Termina con la trama en curso y envia la siguiente
+		 */
+		void next() {
+			m_ackTimeout.detach();
+			m_attempts = 0;
+			++m_tail;
+			m_busy = false;
+			if(m_tail != m_head) {
+				send();
+			} else if(m_stale) {
+				m_stale = false;
+				m_resyncFlag = true;
+			}
+		}
+
+		/**
+		 * \brief Repite la trama en curso, o la descarta si se han agotado los intentos
+		 */
+		void retry() {
+			if(m_attempts > RETRY_MAX) {
+				if(m_failHead - m_failTail < QUEUE_SIZE) {
+					m_failed[m_failHead & (QUEUE_SIZE - 1)] = m_queue[m_tail & (QUEUE_SIZE - 1)].action;
+					++m_failHead;
+				}
+				m_stale = true;
+				next();
+			} else {
+				++m_retries;
+				send();
+			}
+		}
+
+		/**
+		 * \brief Interrupcion de recepcion: respuesta del mezclador
+		 */
+		void onReceive() {
+			while(m_uart.readable()) {
+				const uint8_t c = static_cast<uint8_t>(m_uart.getc());
+				if(!m_busy) {
+					continue;
+				}
+				if(c == ACK) {
+					m_roundTripUs = us_ticker_read() - m_sentUs;
+					if(m_roundTripUs > m_roundTripMaxUs) {
+						m_roundTripMaxUs = m_roundTripUs;
+					}
+					++m_acked;
+					next();
+				} else if(c == NAK) {
+					m_ackTimeout.detach();
+					onTimeout();
+				}
+			}
+		}
+
+		/**
+		 * \brief Sin ACK del mezclador. Un corte o una transicion puede
+		 * haberse ejecutado: no se repite
+		 */
+		void onTimeout() {
+			if(hasSource(m_queue[m_tail & (QUEUE_SIZE - 1)].action)) {
+				retry();
+			} else {
+				++m_resyncs;
+				m_stale = true;
+				next();
+			}
+		}
+};
+
+#endif //SWITCHER_LINK_H_INCLUDED
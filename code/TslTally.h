@@ -0,0 +1,232 @@
+#ifndef TSL_TALLY_H_INCLUDED
+#define TSL_TALLY_H_INCLUDED
+
+#include "mbed.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * \brief Protocolo de senalizacion (tally) TSL UMD v3.1 por RS-422. Formato
+ * de los mensajes, comun al receptor y a la simulacion.
+ *
+ * Mensaje de 18 bytes: [0x80 + direccion] [control] [16 caracteres]. Solo la
+ * cabecera lleva el bit 7 a 1, por lo que marca el comienzo de cada mensaje.
+ * Los bits 0 a 3 del control son las senalizaciones 1 a 4 de la fuente, los
+ * bits 4 y 5 el brillo y los bits 6 y 7 valen 0; los caracteres son ASCII
+ * imprimibles. La USART va a 38400 baudios, 8 bits, paridad par y 1 bit de
+ * parada.
+ */
+class TslTallyBase {
+	public:
+		static const int BAUD = 38400;
+		static const size_t BYTE_BITS = 11; ///<Arranque, 8 bits, paridad y parada
+		static const size_t MESSAGE_LENGTH = 18;
+		static const size_t DISPLAY_LENGTH = 16;
+
+		static const uint8_t HEADER_FLAG = 0x80;
+		static const uint8_t ADDRESS_MASK = 0x7F;
+		static const uint8_t ADDRESS_MAX = 126;
+		static const uint8_t CONTROL_RESERVED = 0xC0; ///<Bits del control que deben valer 0
+		static const uint8_t BRIGHTNESS_SHIFT = 4;
+		static const uint8_t BRIGHTNESS_MAX = 3;
+		static const char DISPLAY_MIN = 0x20;
+		static const char DISPLAY_MAX = 0x7E;
+
+		static const size_t TALLY_COUNT = 4;
+		static const size_t PROGRAM_TALLY = 0; ///<Senalizacion 1 (roja): en programa
+		static const size_t PREVIEW_TALLY = 1; ///<Senalizacion 2 (verde): en previo
+
+		/**
+		 * \brief Codifica un mensaje
+		 * \param message: Destino. Al menos MESSAGE_LENGTH bytes
+		 * \param address: Direccion de la fuente. [0, ADDRESS_MAX]
+		 * \param tallies: Senalizaciones, una por bit. [0, 1 << TALLY_COUNT)
+		 * \param brightness: [0, BRIGHTNESS_MAX]
+		 * \param text: Texto de la fuente. Se rellena con espacios hasta
+		 * DISPLAY_LENGTH caracteres
+		 */
+		static void encode(uint8_t* message, uint8_t address, uint8_t tallies, uint8_t brightness, const char* text) {
+			message[0] = static_cast<uint8_t>(HEADER_FLAG | (address & ADDRESS_MASK));
+			message[1] = static_cast<uint8_t>((tallies & ((1 << TALLY_COUNT) - 1)) | ((brightness & BRIGHTNESS_MAX) << BRIGHTNESS_SHIFT));
+			size_t i = 0;
+			for(; i < DISPLAY_LENGTH && text[i]; ++i) {
+				message[2 + i] = (text[i] >= DISPLAY_MIN && text[i] <= DISPLAY_MAX) ? text[i] : ' ';
+			}
+			for(; i < DISPLAY_LENGTH; ++i) {
+				message[2 + i] = ' ';
+			}
+		}
+
+		/**
+		 * \brief Devuelve la duracion de un mensaje en microsegundos
+		 */
+		static uint32_t messageUs() {
+			return (MESSAGE_LENGTH * BYTE_BITS * 1000000 + BAUD - 1) / BAUD;
+		}
+};
+
+
+
+/**
+ * \brief Receptor de la senalizacion TSL UMD v3.1. La interrupcion de
+ * recepcion analiza cada byte segun llega, sin guardar el mensaje: de la
+ * cabecera se queda la direccion y del control las senalizaciones, y el
+ * texto solo se comprueba. Con el ultimo byte actualiza los bits de la
+ * fuente, un bit por fuente en cada senalizacion, y avisa al bucle principal
+ * si alguno ha cambiado. Un mensaje cortado por otra cabecera o con un byte
+ * invalido se descarta entero.
+ *
+ * El brillo y el texto no se usan: el panel no tiene pantallas.
+ * \tparam Uart: Puerto serie, como RawSerial
+ * \tparam Sink: Destino de la senalizacion. Debe proporcionar el metodo
+ * void onTslTally(uint32_t program, uint32_t preview), con un bit por
+ * fuente, que se resuelve en tiempo de compilacion
+ * \tparam SourceCnt: Fuentes del panel. Hasta 32
+ */
+template<typename Uart, typename Sink, size_t SourceCnt>
+class TslTally : public TslTallyBase {
+	public:
+		/**
+		 * \brief Constructor
+		 * \param uart: Puerto serie. Debe sobrevivir al objeto
+		 * \param sink: Destino de la senalizacion. Debe sobrevivir al objeto
+		 * \param firstAddress: Direccion de la fuente 0. Las demas son consecutivas
+		 */
+		TslTally(Uart& uart, Sink& sink, uint8_t firstAddress = 0)
+			: m_uart(uart)
+			, m_sink(sink)
+			, m_firstAddress(firstAddress)
+			, m_index(0)
+			, m_address(0)
+			, m_control(0)
+			, m_changed(false)
+			, m_messages(0)
+			, m_errors(0)
+		{
+			for(size_t i = 0; i < TALLY_COUNT; ++i) {
+				m_tally[i] = 0;
+			}
+		}
+
+		/**
+		 * \brief Configura el puerto y engancha la recepcion
+		 */
+		void start() {
+			m_uart.baud(BAUD);
+			m_uart.format(8, SerialBase::Even, 1);
+			m_uart.attach(callback(this, &TslTally::onReceive), SerialBase::RxIrq);
+		}
+
+		/**
+		 * \brief Indica si ha cambiado alguna senalizacion desde el ultimo process()
+		 */
+		bool hasTally() const {
+			return m_changed;
+		}
+
+		/**
+		 * \brief Entrega la senalizacion de programa y previo. Debe llamarse
+		 * desde el bucle principal
+		 */
+		void process() {
+			core_util_critical_section_enter();
+			m_changed = false;
+			const uint32_t program = m_tally[PROGRAM_TALLY];
+			const uint32_t preview = m_tally[PREVIEW_TALLY];
+			core_util_critical_section_exit();
+			m_sink.onTslTally(program, preview);
+		}
+
+		/**
+		 * \brief Devuelve las fuentes con una senalizacion activa, un bit por fuente
+		 * \param tally: [0, TALLY_COUNT)
+		 */
+		uint32_t getTally(size_t tally) const {
+			return m_tally[tally];
+		}
+
+		/**
+		 * \brief Devuelve los mensajes completos recibidos, de cualquier direccion
+		 */
+		uint32_t getMessages() const {
+			return m_messages;
+		}
+
+		/**
+		 * \brief Devuelve los mensajes descartados por cortados o invalidos
+		 */
+		uint32_t getErrors() const {
+			return m_errors;
+		}
+
+	private:
+		typedef char SourceCntCheck[(SourceCnt > 0 && SourceCnt <= 32) ? 1 : -1];
+
+		Uart&							m_uart;
+		Sink&							m_sink;
+		const uint8_t			m_firstAddress;
+
+		//Mensaje en curso. Solo se usan en la interrupcion
+		size_t						m_index; ///<Siguiente byte del mensaje. 0 = esperando la cabecera
+		uint8_t						m_address;
+		uint8_t						m_control;
+
+		volatile uint32_t	m_tally[TALLY_COUNT]; ///<Un bit por fuente
+		volatile bool			m_changed;
+		uint32_t					m_messages;
+		uint32_t					m_errors;
+
+		/**
+		 * \brief Interrupcion de recepcion
+		 */
+		void onReceive() {
+			while(m_uart.readable()) {
+				const uint8_t c = static_cast<uint8_t>(m_uart.getc());
+				if(c & HEADER_FLAG) {
+					if(m_index) {
+						++m_errors;
+					}
+					m_address = c & ADDRESS_MASK;
+					m_index = 1;
+					continue;
+				}
+				if(!m_index) {
+					continue;
+				}
+				if(m_index == 1 ? (c & CONTROL_RESERVED) != 0 : (c < DISPLAY_MIN || c > DISPLAY_MAX)) {
+					++m_errors;
+					m_index = 0;
+					continue;
+				}
+				if(m_index == 1) {
+					m_control = c;
+				}
+				if(++m_index == MESSAGE_LENGTH) {
+					m_index = 0;
+					apply();
+				}
+			}
+		}
+
+		/**
+		 * \brief Aplica las senalizaciones del mensaje completo a su fuente
+		 */
+		void apply() {
+			++m_messages;
+			const size_t source = static_cast<size_t>(m_address) - m_firstAddress;
+			if(m_address < m_firstAddress || source >= SourceCnt) {
+				return;
+			}
+			const uint32_t bit = static_cast<uint32_t>(1) << source;
+			for(size_t i = 0; i < TALLY_COUNT; ++i) {
+				const uint32_t tally = (m_control & (1 << i)) ? (m_tally[i] | bit) : (m_tally[i] & ~bit);
+				if(tally != m_tally[i]) {
+					m_tally[i] = tally;
+					m_changed = true;
+				}
+			}
+		}
+};
+
+#endif //TSL_TALLY_H_INCLUDED
@@ -2,6 +2,25 @@
 
 #include "MixerController.h"
 #include "SerialInSerialOut.h"
+#include "MatchSerialInSerialOut.h"
+#include "LedDimmer.h"
+#include "LedEffects.h"
+#include "FlashJournal.h"
+#include "Macro.h"
+#include "BlackBox.h"
+#include "BootProbe.h"
+#include "EventWriter.h"
+#include "ButtonHealth.h"
+#include "Debouncer.h"
+#include "CycleCounter.h"
+#include "ScanMonitor.h"
+#include "ScanRate.h"
+#include "CanLink.h"
+#include "PollLink.h"
+#include "MidiLink.h"
+#include "SwitcherLink.h"
+#include "TslTally.h"
+#include "RamPlacement.h"
 
 #include <cassert>
 
@@ -11,107 +30,1215 @@
 #define ever (;;)
 
 
+//Modos de refresco de los registros de desplazamiento
+#define SCAN_MODE_TICK	0 ///<Un semiperiodo de reloj por interrupcion, atendido en el bucle principal
+#define SCAN_MODE_BCM		1 ///<Tramas en rafaga desde la interrupcion, con brillo de leds por BCM
+#define SCAN_MODE_TIMER	2 ///<Reloj, carga y latch generados por el TIMER2. CLK = p8, Load = p7, Latch = p6
+
+#ifndef SCAN_MODE
+	#define SCAN_MODE SCAN_MODE_TICK
+#endif
+
+//Definir BOOT_PROBE_REPORT para enviar por la USART los tiempos de arranque
+//Definir SCAN_TIMING_REPORT para enviar cada segundo las medidas del refresco
+//Definir PIN_TRACE para registrar los flancos de la cadena (modos TICK y BCM)
+//y enviarlos en formato VCD al recibir 'v' del host
+//Definir CAN_LINK para compartir el estado con otros paneles por CAN (p30 = RD,
+//p29 = TD). CAN_NODE_ID (0-15) es el numero de este panel; el menor vivo
+//es el que envia al host los eventos del mezclador
+#if defined(CAN_LINK) && !defined(CAN_NODE_ID)
+	#define CAN_NODE_ID 0
+#endif
+//Definir RS485_NODE_ID (0-30) para que este panel responda al sondeo de un
+//maestro por RS-485 (UART3: p9 = TX, p10 = RX, p15 = DE), o RS485_NODES (1-31)
+//para que sondee a los paneles 0..RS485_NODES-1 y aplique sus acciones
+#if defined(RS485_NODE_ID) && defined(RS485_NODES)
+	#error "Un panel es esclavo (RS485_NODE_ID) o maestro (RS485_NODES) del sondeo"
+#endif
+//Definir MIDI_OUTPUT para que la USART del host hable MIDI a 31250 baudios en
+//lugar de texto: las acciones se envian como notas del canal MIDI_CHANNEL
+//(1-16) y las notas de programa y previo recibidas encienden sus leds
+#if defined(MIDI_OUTPUT) && !defined(MIDI_CHANNEL)
+	#define MIDI_CHANNEL 1
+#endif
+//Definir SWITCHER_LINK para enviar las acciones directamente a un mezclador de
+//video por RS-422 (UART2: p28 = TX, p27 = RX), con el protocolo binario al
+//estilo GVG-100 de SwitcherLink.h. Los codigos de orden no tienen valor por
+//defecto: SWITCHER_CODE_PROGRAM, SWITCHER_CODE_PREVIEW, SWITCHER_CODE_CUT y
+//SWITCHER_CODE_TRANSITION deben tomarse del manual del mezclador
+#if defined(SWITCHER_LINK) && !(defined(SWITCHER_CODE_PROGRAM) && defined(SWITCHER_CODE_PREVIEW) \
+		&& defined(SWITCHER_CODE_CUT) && defined(SWITCHER_CODE_TRANSITION))
+	#error "SWITCHER_LINK necesita los codigos de orden del manual del mezclador (SWITCHER_CODE_*)"
+#endif
+//Definir TSL_TALLY para que los leds de programa y previo muestren la
+//senalizacion TSL UMD v3.1 del mezclador de video (UART1: p25 = RX) en lugar
+//de las pulsaciones. TSL_ADDRESS es la direccion TSL de la senal 0
+#if defined(TSL_TALLY) && !defined(TSL_ADDRESS)
+	#define TSL_ADDRESS 0
+#endif
+
+
+
+//Destino de los eventos del panel. Enlaza los modulos entre si
+class Panel;
 
 ///Tipo que representa la interfaz de E/S en serie utilizado
-typedef SerialInSerialOut<MixerController::BUTTON_INDEX_COUNT, 
-													MixerController::LED_INDEX_COUNT > SerialInterface;
+#if SCAN_MODE == SCAN_MODE_TIMER
+typedef MatchSerialInSerialOut<MixerControllerBase::BUTTON_INDEX_COUNT,
+															 MixerControllerBase::LED_INDEX_COUNT,
+															 Panel > SerialInterface;
+#else
+typedef SerialInSerialOut<MixerControllerBase::BUTTON_INDEX_COUNT, 
+													MixerControllerBase::LED_INDEX_COUNT,
+													Panel > SerialInterface;
+#endif
+
+///Tipo que representa el estado del mezclador
+typedef MixerController<Panel> Mixer;
+
+///Tipo que representa la atenuacion de los leds. 3 bits = 8 niveles
+typedef LedDimmer<SerialInterface, 3> Dimmer;
+
+///Tipo que representa los efectos (parpadeos, persecuciones) de los leds
+typedef LedEffects<MixerControllerBase::LED_INDEX_COUNT> Effects;
 
 
-//Interfaz USART
-static Serial pc(USBTX, USBRX); // tx, rx
+/**
+ * \brief Enlaza los modulos. Las llamadas se resuelven en tiempo de compilacion,
+ * por lo que se integran en SerialInterface::tick() y Mixer::process()
+ */
+class Panel {
+	public:
+		void onInput(const SerialInterface::InputData& but);
+		void onChainCheck(bool ok);
+		void onLedState(const Mixer::LedState& led, const Mixer::LedState& changed);
+		void onProgram(size_t sig);
+		void onPreview(size_t sig);
+		void onCut();
+		void onTransition();
+		void onPin(size_t sig);
+		void onMacroRecord();
+		void onMacroPlay();
+#ifdef CAN_LINK
+		void onLinkState(CanLinkBase::Action action, size_t program, size_t preview);
+		void onAggregator(bool aggregator);
+#endif
+#ifdef RS485_NODE_ID
+		void onPollState(size_t program, size_t preview);
+#elif defined(RS485_NODES)
+		void onPollEvent(uint8_t node, PollLinkBase::Action action, size_t sig);
+#endif
+#ifdef MIDI_OUTPUT
+		void onMidiTally(MidiLinkBase::Action action, size_t sig);
+#endif
+#ifdef SWITCHER_LINK
+		void onSwitcherFail(SwitcherLinkBase::Action action);
+		void onSwitcherResync();
+#endif
+#ifdef TSL_TALLY
+		void onTslTally(uint32_t program, uint32_t preview);
+#endif
+};
+
+
+
+//Tiempos de arranque. Debe ser el primer objeto estatico
+static BootProbe bootProbe;
+
+//Interfaz USART. Es lo mas lento de inicializar, por lo que se construye
+//despues de la primera trama. Hasta entonces no se envian los eventos.
+//Los eventos se formatean sin printf y se envian desde la interrupcion
+static bool hostReady = false;
+static RawSerial& host() {
+	static RawSerial pc(USBTX, USBRX, 9600); // tx, rx, baud
+	return pc;
+}
+static EventWriter<RawSerial>& events() {
+	static EventWriter<RawSerial> writer AHB_BANK0 (host());
+	return writer;
+}
+
+//Enlace entre modulos
+static Panel panel;
 
 //Modulo que representa el estado del mezclador
-static MixerController mixer;
+static Mixer mixer(panel);
+
+#ifdef MIDI_OUTPUT
+//Transporte MIDI por la USART del host. Sustituye a las lineas de texto
+static MidiLink<RawSerial, Panel>& midi() {
+	static MidiLink<RawSerial, Panel> link AHB_BANK0 (host(), MIDI_CHANNEL, panel);
+	return link;
+}
+static bool midiApplying = false; //Las acciones en curso vienen del host
+#endif
 
 //Modulo que realiza E/S en serie 
 //por registros de desplazamiento
+#if SCAN_MODE == SCAN_MODE_TIMER
+static SerialInterface serialIO(
+	p11, //Din
+	p12, //Dout
+	panel
+);
+#else
 static SerialInterface serialIO(
 	p14, //CLK
 	p13, //Latch
 	p8, //Load
 	p11, //Din
-	p12 //Dout
+	p12, //Dout
+	panel
 );
+#endif
+
+//Efectos de los leds. Avanzan un cuadro cada 10ms
+static const uint32_t T_EFFECTS = 10000;
+static Effects effects;
+static Ticker effectsClk;
+static volatile bool effectsEventFlag = false;
+static void effectsEvent() {
+	effectsEventFlag = true;
+}
+
+//Diario del estado en flash. Se escribe como mucho una pagina por segundo
+static const uint32_t T_JOURNAL = 1000000;
+static FlashJournal journal AHB_BANK0;
+static Ticker journalClk;
+static volatile bool journalEventFlag = false;
+static bool journalActivity = false; //Ha habido cambios desde la ultima escritura
+static void journalEvent() {
+	journalEventFlag = true;
+}
+
+#ifdef CAN_LINK
+//Enlace con los demas paneles. Latido cada 100ms (10 cuadros de los efectos);
+//un panel callado durante 350ms se da por muerto
+static CAN canBus(p30, p29); //rd, td
+static CanLink<Panel> panelLink(canBus, CAN_NODE_ID, panel, 10, 35);
+static bool linkApplying = false; //Las acciones en curso vienen de otro panel
+#endif
+
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+//Sondeo de los paneles por RS-485. Con 16 paneles a 115200 baudios una
+//accion llega al maestro en unos 24ms como mucho
+static const int RS485_BAUD = 115200;
+static RawSerial rs485(p9, p10); //tx, rx
+static bool pollApplying = false; //Las acciones en curso vienen del sondeo
+#ifdef RS485_NODE_ID
+static PollSlave<Panel> pollSlave(rs485, p15, RS485_NODE_ID, panel);
+#else
+static PollMaster<Panel> pollMaster(rs485, p15, RS485_NODES, panel);
+#endif
+#endif
+
+#ifdef SWITCHER_LINK
+//Mezclador de video. Las ordenes se confirman de una en una
+static const uint8_t SWITCHER_CODES[SwitcherLinkBase::ACTION_COUNT] = {
+	SWITCHER_CODE_PROGRAM, SWITCHER_CODE_PREVIEW, SWITCHER_CODE_CUT, SWITCHER_CODE_TRANSITION
+};
+static RawSerial switcherPort(p28, p27); //tx, rx
+static SwitcherLink<RawSerial, Panel> switcher(switcherPort, panel, SWITCHER_CODES);
+#endif
+
+#ifdef TSL_TALLY
+//Senalizacion del mezclador de video. Desde el primer mensaje sustituye a las
+//filas de programa y previo del estado local
+static RawSerial tslPort(p26, p25); //tx (sin uso), rx
+static TslTally<RawSerial, Panel, MixerControllerBase::PROGRAM_CNT> tslTally(tslPort, panel, TSL_ADDRESS);
+static Mixer::LedState tallyLeds;
+static bool tallyActive = false;
+#endif
+
+//Macro de acciones del mezclador. Sus pasos se ejecutan en el bucle principal
+static Macro macro AHB_BANK0;
+static bool macroReplaying = false; //Las acciones en curso vienen de la macro
+static bool macroSavePending = false; //Grabacion terminada, por guardar con el reloj del diario
 
+//Caja negra de la entrada. Conserva la grabacion tras un reinicio. Se vuelca
+//al recibir 'd' del host o al detectar un fallo de la cadena o de un boton
+static const size_t DUMP_LINE_BYTES = 12;
+static BlackBox::Storage blackBoxStorage AHB_BANK1_NOINIT;
+static BlackBox blackBox(blackBoxStorage);
+static volatile bool dumpRequestFlag = false;
+
+//Exportacion del registro de flancos de la cadena. Cada linea del VCD va
+//precedida de "vcd ", para separarla de los eventos:
+//grep '^vcd ' captura.txt | cut -c5- > cadena.vcd
+static volatile bool traceRequestFlag = false;
+
+#ifndef MIDI_OUTPUT
+//Ordenes del host. Con MIDI_OUTPUT la recepcion la atiende MidiLink
+static void hostRxEvent() {
+	switch(host().getc()) {
+		case 'd':
+			dumpRequestFlag = true;
+			break;
+#ifdef PIN_TRACE
+		case 'v':
+			traceRequestFlag = true;
+			break;
+#endif
+		default:
+			break;
+	}
+}
+#endif
+
+#if SCAN_MODE == SCAN_MODE_TICK
 //Ticker
 static Ticker serialIOClk;
 static volatile bool serialIOClkEventFlag = false;
-static void serialIOClkEvent() {
+
+#ifdef SCAN_TIMING_REPORT
+//Medidas del refresco, en ciclos. El jitter es la diferencia entre el
+//intervalo maximo y el minimo
+static CycleStats scanPeriod; //Intervalo entre interrupciones
+static CycleStats scanLatency; //Desde la interrupcion hasta tick()
+static CycleStats scanWork; //Duracion de tick()
+static volatile uint32_t scanLast = 0; //Ultima interrupcion
+
+//Histograma del intervalo entre llamadas a tick(), en barras de 50us.
+//El nominal es de 500us
+static ScanMonitor<> scanMonitor(50);
+#endif
+
+RAM_FUNC static void serialIOClkEvent() {
+#ifdef SCAN_TIMING_REPORT
+	const uint32_t now = CycleCounter::read();
+	scanPeriod.add(now - scanLast);
+	scanLast = now;
+
+	//El bucle principal no ha atendido el semiperiodo anterior
+	if(serialIOClkEventFlag) {
+		scanMonitor.onOverrun();
+	}
+#endif
 	serialIOClkEventFlag = true;
 }
 
+//Ritmo de refresco adaptativo: 1ms de periodo de reloj con actividad, y tras
+//un segundo sin cambios se duplica a 2ms (tramas de 50ms). No se baja mas:
+//la pulsacion mas corta del operador (unos 60ms) debe caer en alguna trama
+//para que el antirrebote la vea. El primer cambio lo devuelve al maximo
+static const uint32_t T_CLK = 1000;
+static ScanRate scanRate(T_CLK/2, T_CLK, 40);
+
+//Tramas de 25 ciclos de reloj: 40 por segundo con actividad
+static const uint32_t INPUT_FRAMES_PER_S = 40;
+static SerialInterface::InputData lastInput;
+
+static void adaptScanRate(const SerialInterface::InputData& but) {
+	const bool activity = (but != lastInput);
+	lastInput = but;
+
+	if(scanRate.onFrame(activity)) {
+		serialIOClk.attach_us(serialIOClkEvent, scanRate.getPeriodUs());
+		if(hostReady) {
+			events().writeLine("rate", scanRate.getPeriodUs());
+			if(scanRate.isFast()) {
+				events().writeLine("rampup_us", scanRate.getRampUpUs());
+			}
+		}
+	}
+}
+
+#elif SCAN_MODE == SCAN_MODE_BCM
+//Atenuacion de los leds. El plano de menor peso dura 250us, por lo que
+//un ciclo completo dura 1.75ms (~570Hz). Cada fase del parpadeo dura 64 ciclos
+static Dimmer dimmer AHB_BANK0 (serialIO, 250, 64);
+
+//Cada plano es una trama completa: 3 cada 1.75ms
+static const uint32_t INPUT_FRAMES_PER_S = 1714;
+
+//Niveles de brillo: apagado = disponible (tenue), encendido = en uso
+static const uint8_t LED_LEVEL_AVAILABLE = 1;
+static const uint8_t LED_LEVEL_LIVE = Dimmer::LEVEL_MAX;
+
+#elif SCAN_MODE == SCAN_MODE_TIMER
+//Reloj de 100kHz: una trama cada 250us. El semiperiodo (480 ciclos a 96MHz)
+//acota la duracion de la interrupcion de cada flanco
+static const uint32_t F_CLK = 100000;
+
+//Tramas de 25 ciclos de reloj
+static const uint32_t INPUT_FRAMES_PER_S = F_CLK / 25;
+
+#endif
+
+//Estado de la cadena de entrada. Una de cada 8 tramas comprueba que los bits
+//que siguen a los botones sean 0 (SER del ultimo 74HC165 a masa). Con la cadena
+//rota los botones no son fiables, por lo que se ignoran
+static const size_t CHAIN_CHECK_PERIOD = 8;
+static volatile bool chainOk = true;
+static bool chainReported = true; //Ultimo estado anunciado
+
+//Botones averiados. Se evaluan cada segundo: cambiar en 3 de cada 4 tramas
+//(30 a 40 tramas/s) o 20s sin soltarse los enmascaran, y 5s sin fallos los
+//desenmascaran. Los cambios se cuentan antes del antirrebote, por lo que el
+//umbral sigue a las tramas por segundo de cada modo
+static ButtonHealth<MixerControllerBase::BUTTON_INDEX_COUNT> buttonHealth(INPUT_FRAMES_PER_S * 3 / 4, 20, 5);
+
+//Gestos: pulsacion larga de 600ms, repeticion cada 200ms y doble pulsacion
+//en menos de 300ms. El tiempo avanza con el reloj de los efectos (10ms)
+static GestureRecognizer<uint32_t> gestures(60, 20, 30);
+
+//Antirrebote: un cambio debe durar 5ms. Con las tramas de 25ms del modo TICK
+//basta una; las tramas que el bucle principal no llega a atender alargan el
+//plazo. La entrada se filtra en activo bajo, todos soltados al arrancar
+static const uint32_t DEBOUNCE_MS = 5;
+static Debouncer<uint32_t> debouncer(INPUT_FRAMES_PER_S * DEBOUNCE_MS / 1000 + 1, (~Mixer::ButtonState()).to_ulong());
+
+//Procesa una trama de botones sin los enmascarados. En el modo TICK se llama
+//desde tick(), en la SRAM, pero se queda en la flash
+FLASH_FUNC static void processInput(const SerialInterface::InputData& but) {
+	buttonHealth.sample(but);
+#if SCAN_MODE == SCAN_MODE_TICK
+	adaptScanRate(but);
+#endif
+	const Mixer::ButtonState stable(debouncer.update(but.to_ulong()));
+	const Mixer::ButtonState buttons = buttonHealth.apply(stable);
+	const uint32_t held = (~buttons).to_ulong(); //Activo alto
+	const Mixer::Gestures frameGestures = gestures.update(held);
+	blackBox.recordFrame(held, frameGestures);
+	mixer.process(buttons, frameGestures);
+}
+
+#if SCAN_MODE != SCAN_MODE_TICK
+//Ultima palabra leida por la interrupcion de refresco
+static SerialInterface::InputData inputData;
+static volatile bool inputEventFlag = false;
+#endif
+
+
+//Convierte una senal al argumento de un registro. NO_SIGNAL = 0xFF
+static uint8_t toArg(size_t sig) {
+	return static_cast<uint8_t>(sig < 0xFF ? sig : 0xFF);
+}
+
+//Estado del mezclador para los bloques de la caja negra
+static uint32_t mixerContext() {
+	return toArg(mixer.getProgram()) | (toArg(mixer.getPreview()) << 8) | (toArg(mixer.getPinned()) << 16);
+}
+
+//Indica si los eventos del mezclador se envian al host. Con varios paneles
+//solo los envia el agregador
+static bool reportsMixer() {
+#ifdef CAN_LINK
+	return hostReady && panelLink.isAggregator();
+#else
+	return hostReady;
+#endif
+}
+
+//Indica si hay tramas de otros paneles o del host por aplicar
+static bool linkPending() {
+	bool pending = false;
+#ifdef MIDI_OUTPUT
+	pending = pending || midi().hasTally();
+#endif
+#ifdef SWITCHER_LINK
+	pending = pending || switcher.hasEvents();
+#endif
+#ifdef TSL_TALLY
+	pending = pending || tslTally.hasTally();
+#endif
+#ifdef CAN_LINK
+	pending = pending || panelLink.hasReceived();
+#endif
+#ifdef RS485_NODE_ID
+	pending = pending || pollSlave.hasState();
+#elif defined(RS485_NODES)
+	pending = pending || pollMaster.hasEvents();
+#endif
+	return pending;
+}
+
+//Aplica las tramas de otros paneles y del host
+static void processLinks() {
+#ifdef MIDI_OUTPUT
+	if(midi().hasTally()) {
+		midi().process();
+	}
+#endif
+#ifdef SWITCHER_LINK
+	if(switcher.hasEvents()) {
+		switcher.process();
+	}
+#endif
+#ifdef TSL_TALLY
+	if(tslTally.hasTally()) {
+		tslTally.process();
+	}
+#endif
+#ifdef CAN_LINK
+	if(panelLink.hasReceived()) {
+		panelLink.process();
+	}
+#endif
+#ifdef RS485_NODE_ID
+	if(pollSlave.hasState()) {
+		pollSlave.process();
+	}
+#elif defined(RS485_NODES)
+	if(pollMaster.hasEvents()) {
+		pollMaster.process();
+	}
+#endif
+}
+
+#ifdef CAN_LINK
+//Difunde una accion local y el estado resultante a los demas paneles
+static void linkAction(CanLinkBase::Action action) {
+	if(!linkApplying) {
+		panelLink.publish(action, toArg(mixer.getProgram()), toArg(mixer.getPreview()));
+	}
+}
+#endif
+
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+//El esclavo envia las acciones locales al maestro; el maestro difunde en los
+//sondeos el estado resultante de todas
+static void pollAction(PollLinkBase::Action action, size_t sig) {
+#ifdef RS485_NODE_ID
+	if(!pollApplying) {
+		pollSlave.queue(action, sig);
+	}
+#else
+	(void)action;
+	(void)sig;
+	pollMaster.setState(mixer.getProgram(), mixer.getPreview());
+#endif
+}
+#endif
+
+#ifdef SWITCHER_LINK
+//Envia una accion al mezclador de video. Con varios paneles solo la envia el
+//agregador, como los eventos al host
+static void switcherAction(SwitcherLinkBase::Action action, size_t sig) {
+	if(reportsMixer()) {
+		switcher.queue(action, sig);
+	}
+}
+#endif
+
+//Trama de leds que se muestra: la del mezclador o, si llega senalizacion del
+//mezclador de video, la suya en las filas de programa y previo
+static Mixer::LedState displayedLeds(const Mixer::LedState& led) {
+#ifdef TSL_TALLY
+	if(tallyActive) {
+		static const uint32_t ROW = (1UL << MixerControllerBase::PROGRAM_CNT) - 1;
+		const Mixer::LedState rows((ROW << MixerControllerBase::LED_INDEX_PROGRAM0) | (ROW << MixerControllerBase::LED_INDEX_PREVIEW0));
+		return (led & ~rows) | tallyLeds;
+	}
+#endif
+	return led;
+}
+
+#ifdef SCAN_TIMING_REPORT
+//Coste de los eventos del mezclador: formato y copia al anillo, en ciclos
+static CycleStats eventWork;
+#endif
+
+#ifndef MIDI_OUTPUT
+//Envia un evento del mezclador al host: "name\n" o "name sig\n"
+static void writeEvent(const char* name, bool hasSig, size_t sig) {
+#ifdef SCAN_TIMING_REPORT
+	const uint32_t start = CycleCounter::read();
+#endif
+	if(hasSig) {
+		events().writeLine(name, sig);
+	} else {
+		events().writeLine(name);
+	}
+#ifdef SCAN_TIMING_REPORT
+	eventWork.add(CycleCounter::read() - start);
+#endif
+}
+#endif
+
+#ifdef MIDI_OUTPUT
+//Envia una accion al mezclador por software. La senalizacion recibida de el
+//no se le devuelve
+static void reportMidi(MidiLinkBase::Action action, size_t sig) {
+	if(!midiApplying) {
+		midi().write(action, sig);
+	}
+}
+#endif
+
 
 //Funciones que enlazan modulos
-static void mixerButCallback(void* usrPtr, MixerController::ButtonState but) {
-	assert(usrPtr);
-	static_cast<MixerController*>(usrPtr)->process(but);
+inline void Panel::onInput(const SerialInterface::InputData& but) {
+	if(!chainOk) {
+		return;
+	}
+
+#if SCAN_MODE != SCAN_MODE_TICK
+	//Se llama desde la interrupcion de refresco. Procesar en el bucle principal
+	inputData = but;
+	inputEventFlag = true;
+#else
+	processInput(but);
+#endif
+}
+
+inline void Panel::onLedState(const Mixer::LedState& led, const Mixer::LedState& changed) {
+	//Los leds animados no dependen de la trama estatica
+	const Mixer::LedState leds = effects.compose(displayedLeds(led));
+#if SCAN_MODE == SCAN_MODE_BCM
+	//Los planos se transmiten siempre enteros
+	(void)changed;
+	dimmer.setFrame(leds);
+#else
+	serialIO.setOutputData(leds, changed & ~effects.getAnimated());
+#endif
+
+	//La trama de leds solo cambia cuando lo hace el estado. Anotarlo en el diario
+	journal.append(FlashJournal::RECORD_STATE, mixer.getProgram(), mixer.getPreview());
+	journalActivity = true;
+	blackBox.setContext(mixerContext());
+}
+
+inline void Panel::onChainCheck(bool ok) {
+	chainOk = ok;
+}
+
+//Comienza un volcado de la caja negra, si no hay otro en marcha
+static void startDump() {
+	if(!blackBox.isDumping()) {
+		blackBox.startDump();
+		events().writeLine("bb begin");
+	}
+}
+
+//Envia el volcado de la caja negra sin llenar el anillo de eventos
+static void pumpDump() {
+	BlackBox::Chunk chunk;
+	while(events().getFree() >= 2 * EventWriter<RawSerial>::LINE_LENGTH) {
+		if(!blackBox.readDump(chunk, DUMP_LINE_BYTES)) {
+			events().writeLine("bb end");
+			return;
+		}
+		if(chunk.offset == 0) {
+			events().writeLine("bb blk", chunk.sequence);
+		}
+		events().writeHex("bb", chunk.data, chunk.length);
+	}
+}
+
+#ifdef PIN_TRACE
+//Envia el VCD de los flancos registrados sin llenar el anillo de eventos
+static void pumpTrace() {
+	char line[PinTrace::LINE_LENGTH];
+	while(events().getFree() >= 2 * EventWriter<RawSerial>::LINE_LENGTH) {
+		if(!PinTrace::readLine(line)) {
+			return;
+		}
+		events().writeText("vcd", line);
+	}
 }
+#endif
 
-static void mixerLedCallback(void* usrPtr, MixerController::LedState led) {
-	assert(usrPtr);
-	static_cast<SerialInterface*>(usrPtr)->setOutputData(led);
+//Anuncia los cambios del estado de la cadena de entrada. Un fallo vuelca la caja negra
+static void reportChain() {
+	const bool ok = chainOk;
+	if(ok != chainReported) {
+		events().writeLine(ok ? "chain ok" : "chain fault");
+		blackBox.recordEvent(ok ? BlackBox::EVENT_CHAIN_OK : BlackBox::EVENT_CHAIN_FAULT, 0);
+		if(!ok) {
+			startDump();
+		}
+		chainReported = ok;
+	}
+}
+
+//Actualiza la mascara de botones averiados y anuncia sus cambios. Un boton
+//enmascarado vuelca la caja negra
+static void checkButtons() {
+	const Mixer::ButtonState changed = buttonHealth.evaluate();
+	if(changed.none()) {
+		return;
+	}
+
+	for(size_t i = 0; i < changed.size(); ++i) {
+		if(changed.test(i)) {
+			const bool masked = buttonHealth.getMask().test(i);
+			events().writeLine(masked ? "mask" : "unmask", i);
+			blackBox.recordEvent(masked ? BlackBox::EVENT_MASK : BlackBox::EVENT_UNMASK, static_cast<uint8_t>(i));
+			if(masked) {
+				startDump();
+			}
+		}
+	}
+}
+
+//Graba una accion en la macro. Una accion manual detiene la reproduccion
+static void macroAction(Macro::Action action, size_t arg) {
+#ifdef CAN_LINK
+	//Las acciones de otros paneles ni se graban ni detienen la macro
+	if(linkApplying) {
+		return;
+	}
+#endif
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+	if(pollApplying) {
+		return;
+	}
+#endif
+#ifdef MIDI_OUTPUT
+	if(midiApplying) {
+		return;
+	}
+#endif
+	if(macro.isRecording()) {
+		macro.record(action, toArg(arg));
+	} else if(macro.isPlaying() && !macroReplaying) {
+		macro.stop();
+		events().writeLine("macro", "stop", 0);
+	}
+}
+
+//Los eventos de la caja negra de cada origen siguen el orden de Macro::Action
+typedef char RemoteEventCheck[(BlackBox::EVENT_MACRO_TRANSITION - BlackBox::EVENT_MACRO_PROGRAM == Macro::ACTION_TRANSITION
+	&& BlackBox::EVENT_LINK_TRANSITION - BlackBox::EVENT_LINK_PROGRAM == Macro::ACTION_TRANSITION) ? 1 : -1];
+
+//Repite una accion de la macro o de otro panel para que se anuncie igual que
+//una local. Se graba antes en la caja negra para poder reproducirla, como
+//eventBase + action (EVENT_MACRO_PROGRAM o EVENT_LINK_PROGRAM)
+static void applyRemoteAction(Macro::Action action, size_t sig, BlackBox::Event eventBase) {
+	const BlackBox::Event event = static_cast<BlackBox::Event>(eventBase + action);
+	switch(action) {
+		case Macro::ACTION_PROGRAM:
+			blackBox.recordEvent(event, toArg(sig));
+			mixer.selectProgram(sig);
+			break;
+		case Macro::ACTION_PREVIEW:
+			blackBox.recordEvent(event, toArg(sig));
+			mixer.selectPreview(sig);
+			break;
+		case Macro::ACTION_CUT:
+			blackBox.recordEvent(event, 0);
+			mixer.cut();
+			break;
+		case Macro::ACTION_TRANSITION:
+			blackBox.recordEvent(event, 0);
+			mixer.transition();
+			break;
+		default:
+			break;
+	}
+}
+
+//Ejecuta el paso de la macro que ha llegado a su instante
+static void runMacroStep() {
+	Macro::Step step;
+	if(!macro.next(step)) {
+		return;
+	}
+
+	macroReplaying = true;
+	applyRemoteAction(static_cast<Macro::Action>(step.action), step.arg, BlackBox::EVENT_MACRO_PROGRAM);
+	macroReplaying = false;
+
+	if(!macro.isPlaying()) {
+		events().writeLine("macro", "end", macro.getStepCount());
+	}
+}
+
+//Combina la trama del mezclador con los efectos y la muestra
+static void showLeds() {
+	const Mixer::LedState leds = effects.compose(displayedLeds(mixer.getLedState()));
+#if SCAN_MODE == SCAN_MODE_BCM
+	dimmer.setFrame(leds);
+#else
+	serialIO.setOutputData(leds);
+#endif
+}
+
+//Avanza los efectos y actualiza la salida si alguno de ellos cambia
+static void advanceEffects() {
+	if(effects.advance()) {
+		showLeds();
+	}
+}
+
+//Escribe el diario. Si no ha habido cambios, aprovecha para preparar el siguiente sector
+static void flushJournal() {
+	journal.flush(!journalActivity);
+	journalActivity = false;
+}
+
+//Guarda la ultima macro grabada, si no se ha guardado ya
+static void saveMacro() {
+	if(!macroSavePending) {
+		return;
+	}
+	macroSavePending = false;
+	const bool saved = macro.save();
+	events().writeLine("macro", saved ? "save" : "save fail", macro.getStepCount());
+}
+
+#ifdef SCAN_TIMING_REPORT
+//Envia y reinicia las medidas del refresco
+static void reportScanTiming() {
+	if(eventWork.getCount()) {
+		events().writeLine("scan", "event_max", eventWork.getMax());
+		eventWork.reset();
+	}
+#if SCAN_MODE == SCAN_MODE_TICK
+	core_util_critical_section_enter();
+	const CycleStats period = scanPeriod;
+	scanPeriod.reset();
+	core_util_critical_section_exit();
+
+	events().writeLine("scan", "period_min", period.getMin());
+	events().writeLine("scan", "period_max", period.getMax());
+	events().writeLine("scan", "latency_max", scanLatency.getMax());
+	events().writeLine("scan", "work_max", scanWork.getMax());
+	scanLatency.reset();
+	scanWork.reset();
+
+	//Histograma: solo las barras con algun intervalo
+	for(size_t i = 0; i < ScanMonitor<>::BIN_COUNT; ++i) {
+		if(scanMonitor.getBin(i)) {
+			events().writeLine("hist", scanMonitor.getBinStartUs(i), scanMonitor.getBin(i));
+		}
+	}
+	events().writeLine("scan", "worst_us", scanMonitor.getWorstUs());
+	events().writeLine("scan", "overruns", scanMonitor.getOverruns());
+	core_util_critical_section_enter();
+	scanMonitor.reset();
+	core_util_critical_section_exit();
+#elif SCAN_MODE == SCAN_MODE_BCM
+	const Dimmer::Stats stats = dimmer.getStats();
+	dimmer.resetStats();
+
+	events().writeLine("scan", "latency_us", stats.maxLatencyUs);
+	events().writeLine("scan", "burst_us", stats.maxBurstUs);
+#elif SCAN_MODE == SCAN_MODE_TIMER
+	static uint32_t lastFrames = 0;
+	const uint32_t frames = serialIO.getFrameCount();
+	events().writeLine("scan", "frames", frames - lastFrames);
+	lastFrames = frames;
+#endif
+}
+#endif
+
+inline void Panel::onProgram(size_t sig) {
+	blackBox.recordEvent(BlackBox::EVENT_PROGRAM, toArg(sig));
+	macroAction(Macro::ACTION_PROGRAM, sig);
+#ifdef CAN_LINK
+	linkAction(CanLinkBase::ACTION_PROGRAM);
+#endif
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+	pollAction(PollLinkBase::ACTION_PROGRAM, sig);
+#endif
+#ifdef SWITCHER_LINK
+	switcherAction(SwitcherLinkBase::ACTION_PROGRAM, sig);
+#endif
+	if(reportsMixer()) {
+#ifdef MIDI_OUTPUT
+		reportMidi(MidiLinkBase::ACTION_PROGRAM, sig);
+#else
+		writeEvent("pgm", true, sig);
+#endif
+	}
+}
+
+inline void Panel::onPreview(size_t sig) {
+	blackBox.recordEvent(BlackBox::EVENT_PREVIEW, toArg(sig));
+	macroAction(Macro::ACTION_PREVIEW, sig);
+#ifdef CAN_LINK
+	linkAction(CanLinkBase::ACTION_PREVIEW);
+#endif
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+	pollAction(PollLinkBase::ACTION_PREVIEW, sig);
+#endif
+#ifdef SWITCHER_LINK
+	switcherAction(SwitcherLinkBase::ACTION_PREVIEW, sig);
+#endif
+	if(reportsMixer()) {
+#ifdef MIDI_OUTPUT
+		reportMidi(MidiLinkBase::ACTION_PREVIEW, sig);
+#else
+		writeEvent("pvw", true, sig);
+#endif
+	}
+}
+
+inline void Panel::onCut() {
+	blackBox.recordEvent(BlackBox::EVENT_CUT, 0);
+	macroAction(Macro::ACTION_CUT, 0);
+#ifdef CAN_LINK
+	linkAction(CanLinkBase::ACTION_CUT);
+#endif
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+	pollAction(PollLinkBase::ACTION_CUT, MixerControllerBase::NO_SIGNAL);
+#endif
+#ifdef SWITCHER_LINK
+	switcherAction(SwitcherLinkBase::ACTION_CUT, 0);
+#endif
+	if(reportsMixer()) {
+#ifdef MIDI_OUTPUT
+		reportMidi(MidiLinkBase::ACTION_CUT, 0);
+#else
+		writeEvent("cut", false, 0);
+#endif
+	}
+}
+
+inline void Panel::onTransition() {
+	blackBox.recordEvent(BlackBox::EVENT_TRANSITION, 0);
+	macroAction(Macro::ACTION_TRANSITION, 0);
+#ifdef CAN_LINK
+	linkAction(CanLinkBase::ACTION_TRANSITION);
+#endif
+#if defined(RS485_NODE_ID) || defined(RS485_NODES)
+	pollAction(PollLinkBase::ACTION_TRANSITION, MixerControllerBase::NO_SIGNAL);
+#endif
+#ifdef SWITCHER_LINK
+	switcherAction(SwitcherLinkBase::ACTION_TRANSITION, 0);
+#endif
+	if(reportsMixer()) {
+#ifdef MIDI_OUTPUT
+		reportMidi(MidiLinkBase::ACTION_TRANSITION, 0);
+#else
+		writeEvent("trans", false, 0);
+#endif
+	}
+}
+
+inline void Panel::onPin(size_t sig) {
+	blackBox.recordEvent(BlackBox::EVENT_PIN, toArg(sig));
+	blackBox.setContext(mixerContext());
+
+	//El led de previo de la senal fijada parpadea (1s de periodo)
+	for(size_t i = 0; i < MixerControllerBase::PREVIEW_CNT; ++i) {
+		effects.clearEffect(MixerControllerBase::LED_INDEX_PREVIEW0 + i);
+	}
+	if(sig != MixerControllerBase::NO_SIGNAL) {
+		effects.setEffect(MixerControllerBase::LED_INDEX_PREVIEW0 + sig, 100, 50, 0);
+	}
+	showLeds();
+
+	if(hostReady) {
+		events().writeLine("pin", sig);
+	}
 }
 
-static void mixerPgmCallback(void* usrPtr, size_t sig) {
-	assert(usrPtr);
-	static_cast<Serial*>(usrPtr)->printf("pgm %u\n", sig);
+inline void Panel::onMacroRecord() {
+	//Al terminar la grabacion se guarda en la flash con el reloj del diario
+	if(macro.isRecording()) {
+		macro.stopRecording();
+		macroSavePending = true;
+	} else if(macroSavePending) {
+		//Una grabacion nueva reutiliza el buffer, y la anterior aun no se ha
+		//guardado. Aqui no se puede escribir la flash: se esta dentro de
+		//process(), en el modo TICK dentro de tick(). Hay que volver a pulsar
+		//tras el siguiente reloj del diario
+		events().writeLine("macro", "busy", 0);
+	} else {
+		macro.startRecording();
+		events().writeLine("macro", "rec", 0);
+	}
 }
 
-static void mixerPvwCallback(void* usrPtr, size_t sig) {
-	assert(usrPtr);
-	static_cast<Serial*>(usrPtr)->printf("pvw %u\n", sig);
+#ifdef CAN_LINK
+typedef char CanActionCheck[(CanLinkBase::ACTION_TRANSITION - CanLinkBase::ACTION_PROGRAM == Macro::ACTION_TRANSITION) ? 1 : -1];
+
+inline void Panel::onLinkState(CanLinkBase::Action action, size_t program, size_t preview) {
+	//Las acciones del enlace siguen a ACTION_NONE en el orden de Macro::Action
+	linkApplying = true;
+	if(action != CanLinkBase::ACTION_NONE) {
+		applyRemoteAction(static_cast<Macro::Action>(action - CanLinkBase::ACTION_PROGRAM),
+			(action == CanLinkBase::ACTION_PROGRAM) ? program : preview, BlackBox::EVENT_LINK_PROGRAM);
+	}
+
+	//Si se partia de otro estado (p.e. otra senal fijada), imponer el resultado
+	if(toArg(mixer.getProgram()) != program || toArg(mixer.getPreview()) != preview) {
+		blackBox.recordEvent(BlackBox::EVENT_LINK_STATE, BlackBox::stateArg(toArg(program), toArg(preview)));
+		mixer.setState(program, preview);
+	}
+	linkApplying = false;
 }
 
-static void mixerCutCallback(void* usrPtr) {
-	assert(usrPtr);
-	static_cast<Serial*>(usrPtr)->printf("cut\n");
+inline void Panel::onAggregator(bool aggregator) {
+	events().writeLine("link", aggregator ? "agg" : "member", panelLink.getAggregator());
+
+	//El nuevo agregador anuncia el estado al host
+	if(aggregator) {
+#ifdef MIDI_OUTPUT
+		reportMidi(MidiLinkBase::ACTION_PROGRAM, mixer.getProgram());
+		reportMidi(MidiLinkBase::ACTION_PREVIEW, mixer.getPreview());
+#else
+		events().writeLine("pgm", mixer.getProgram());
+		events().writeLine("pvw", mixer.getPreview());
+#endif
+	}
 }
+#endif
 
-static void mixerTransCallback(void* usrPtr) {
-	assert(usrPtr);
-	static_cast<Serial*>(usrPtr)->printf("trans\n");
+#ifdef RS485_NODE_ID
+inline void Panel::onPollState(size_t program, size_t preview) {
+	//El estado del maestro ya incluye las acciones de este panel
+	if(toArg(mixer.getProgram()) != toArg(program) || toArg(mixer.getPreview()) != toArg(preview)) {
+		blackBox.recordEvent(BlackBox::EVENT_LINK_STATE, BlackBox::stateArg(toArg(program), toArg(preview)));
+		pollApplying = true;
+		mixer.setState(program, preview);
+		pollApplying = false;
+	}
+}
+#elif defined(RS485_NODES)
+typedef char PollActionCheck[(PollLinkBase::ACTION_TRANSITION - PollLinkBase::ACTION_PROGRAM == Macro::ACTION_TRANSITION) ? 1 : -1];
+
+inline void Panel::onPollEvent(uint8_t node, PollLinkBase::Action action, size_t sig) {
+	//Las acciones del bus siguen el orden de Macro::Action
+	(void)node;
+	pollApplying = true;
+	applyRemoteAction(static_cast<Macro::Action>(action), sig, BlackBox::EVENT_LINK_PROGRAM);
+	pollApplying = false;
+}
+#endif
+
+#ifdef MIDI_OUTPUT
+inline void Panel::onMidiTally(MidiLinkBase::Action action, size_t sig) {
+	//Los leds siguen al mezclador por software: se impone su estado
+	size_t program = mixer.getProgram();
+	size_t preview = mixer.getPreview();
+	if(action == MidiLinkBase::ACTION_PROGRAM) {
+		program = sig;
+	} else {
+		preview = sig;
+	}
+	if(toArg(program) != toArg(mixer.getProgram()) || toArg(preview) != toArg(mixer.getPreview())) {
+		blackBox.recordEvent(BlackBox::EVENT_LINK_STATE, BlackBox::stateArg(toArg(program), toArg(preview)));
+		midiApplying = true;
+		mixer.setState(program, preview);
+		midiApplying = false;
+	}
+}
+#endif
+
+#ifdef SWITCHER_LINK
+inline void Panel::onSwitcherFail(SwitcherLinkBase::Action action) {
+	events().writeLine("sw", "fail", action);
+}
+
+inline void Panel::onSwitcherResync() {
+	//Estado del mezclador desconocido: imponer el del panel
+	events().writeLine("sw resync");
+	switcherAction(SwitcherLinkBase::ACTION_PROGRAM, mixer.getProgram());
+	switcherAction(SwitcherLinkBase::ACTION_PREVIEW, mixer.getPreview());
+}
+#endif
+
+#ifdef TSL_TALLY
+inline void Panel::onTslTally(uint32_t program, uint32_t preview) {
+	//Los leds muestran lo que esta en el aire, no las pulsaciones
+	tallyLeds = Mixer::LedState((program << MixerControllerBase::LED_INDEX_PROGRAM0)
+		| (preview << MixerControllerBase::LED_INDEX_PREVIEW0));
+	tallyActive = true;
+	showLeds();
+#if SCAN_MODE == SCAN_MODE_TICK
+	//Sin esperar a la siguiente trama, que en reposo dura 50ms
+	serialIO.expediteOutput();
+#endif
+}
+#endif
+
+inline void Panel::onMacroPlay() {
+	//Una segunda pulsacion detiene la reproduccion
+	if(macro.isPlaying()) {
+		macro.stop();
+		events().writeLine("macro", "stop", 0);
+	} else if(!macro.isRecording() && macro.getStepCount() > 0) {
+		macro.play();
+		events().writeLine("macro", "play", macro.getStepCount());
+	}
 }
 
 
 
 int main(void) {
-	//Configura USART
-	pc.format(8, Serial::None, 1); //Bits, Parity, Stop bits
-	pc.baud(9600);
-
-	//Enlazar el controlador a la salida por usart
-	mixer.setProgramUserPointer(&pc);
-	mixer.setPreviewUserPointer(&pc);
-	mixer.setCutUserPointer(&pc);
-	mixer.setTransitionUserPointer(&pc);
-	mixer.setProgramCallback(mixerPgmCallback);
-	mixer.setPreviewCallback(mixerPvwCallback);
-	mixer.setCutCallback(mixerCutCallback);
-	mixer.setTransitionCallback(mixerTransCallback);
-	
-	//Enlazar el controlador con la interfaz de registros serie/paralelo
-	mixer.setLedUserPointer(&serialIO);
-	mixer.setLedCallback(mixerLedCallback);
-	
-	serialIO.setUserPointer(&mixer);
-	serialIO.setInputCallback(mixerButCallback);
-	
-	//Configurar el reloj
-	const uint32_t T_CLK = 1000; //1ms de periodod de reloj
-	serialIOClk.attach_us(serialIOClkEvent, T_CLK/2);
+	bootProbe.mark(BootProbe::BOOT_STAGE_MAIN);
+
+	//Con varios botones de un bus en la misma trama gana el de menor indice
+	mixer.setChordPolicy(MixerControllerBase::CHORD_LOWEST_WINS);
+
+	//Recuperar el ultimo estado antes de comenzar a leer los botones.
+	//Solo se actualizan los leds, ya que la USART aun no esta lista
+	FlashJournal::Record last;
+	const bool restored = journal.restore(last) && last.type == FlashJournal::RECORD_STATE;
+	if(restored) {
+		mixer.setState(last.a, last.b);
+	}
+	macro.load();
+	blackBox.start(0, mixerContext()); //Ningun boton pulsado, como el mezclador
+	bootProbe.mark(BootProbe::BOOT_STAGE_RESTORED);
+
+#if SCAN_MODE != SCAN_MODE_TIMER
+	serialIO.setChainCheck(CHAIN_CHECK_PERIOD, false);
+#endif
+
+	//Realizar la primera trama en rafaga, sin esperar al reloj de la E/S
+	//en serie: carga los leds recuperados y lee los botones
+#if SCAN_MODE == SCAN_MODE_TICK
+	serialIO.burst();
+#elif SCAN_MODE == SCAN_MODE_BCM
+	for(size_t i = 0; i < Dimmer::LED_COUNT; ++i) {
+		dimmer.setLevels(i, LED_LEVEL_LIVE, LED_LEVEL_AVAILABLE);
+	}
+	dimmer.update();
+	dimmer.start();
+#elif SCAN_MODE == SCAN_MODE_TIMER
+	serialIO.start(SystemCoreClock / (2 * F_CLK));
+	while(serialIO.getFrameCount() == 0); //Una trama dura 250us
+#endif
+	bootProbe.mark(BootProbe::BOOT_STAGE_FIRST_INPUT);
+
+	//Configurar la USART y los enlaces, y anunciar el estado recuperado
+#ifdef MIDI_OUTPUT
+	events().setMuted(true);
+	midi().start();
+#else
+	host().format(8, SerialBase::None, 1); //Bits, Parity, Stop bits
+	events().start();
+	host().attach(hostRxEvent, SerialBase::RxIrq);
+#endif
+	hostReady = true;
+#ifdef CAN_LINK
+	panelLink.start();
+#endif
+#ifdef SWITCHER_LINK
+	switcher.start();
+#endif
+#ifdef TSL_TALLY
+	tslTally.start();
+#endif
+#ifdef RS485_NODE_ID
+	pollSlave.start(RS485_BAUD);
+#elif defined(RS485_NODES)
+	pollMaster.setState(mixer.getProgram(), mixer.getPreview());
+	pollMaster.start(RS485_BAUD);
+	events().writeLine("poll", "cycle_us", pollMaster.getCycleUs());
+#endif
+
+	//Con todos los enlaces en marcha, para que el estado llegue a todos
+	if(restored) {
+		panel.onProgram(mixer.getProgram());
+		panel.onPreview(mixer.getPreview());
+	}
+	bootProbe.mark(BootProbe::BOOT_STAGE_HOST_READY);
+
+	//Configurar el resto de relojes
+	journalClk.attach_us(journalEvent, T_JOURNAL);
+	effectsClk.attach_us(effectsEvent, T_EFFECTS);
 	
-	//Bucle de atencion a los flags de las interrupciones
+#if SCAN_MODE == SCAN_MODE_TICK
+#ifdef SCAN_TIMING_REPORT
+	scanLast = CycleCounter::read();
+#endif
+	serialIOClk.attach_us(serialIOClkEvent, scanRate.getPeriodUs());
+#endif
+	bootProbe.mark(BootProbe::BOOT_STAGE_RUNNING);
+
+#ifdef BOOT_PROBE_REPORT
+	for(size_t i = 0; i < BootProbe::BOOT_STAGE_COUNT; ++i) {
+		const BootProbe::Stage stage = static_cast<BootProbe::Stage>(i);
+		events().writeLine("boot", BootProbe::getName(stage), bootProbe.getMicroseconds(stage));
+	}
+#endif
+
+	//Bucle de atencion a los flags de las interrupciones. En los modos BCM y
+	//TIMER la E/S en serie se refresca por si sola: solo hay que procesar las
+	//palabras leidas
 	for ever {
+#if SCAN_MODE == SCAN_MODE_TICK
 		//Atender al reloj del controlador SISO
 		if(serialIOClkEventFlag) {
+#ifdef SCAN_TIMING_REPORT
+			const uint32_t start = CycleCounter::read();
+			scanLatency.add(start - scanLast);
+			scanMonitor.onTick();
 			serialIO.tick();
+			scanWork.add(CycleCounter::read() - start);
+#else
+			serialIO.tick();
+#endif
 			serialIOClkEventFlag = false;
 		}
+#else
+		//Atender a las palabras leidas durante el refresco
+		if(inputEventFlag) {
+			__disable_irq();
+			const SerialInterface::InputData but = inputData;
+			inputEventFlag = false;
+			__enable_irq();
+			
+			processInput(but);
+		}
+#endif
+		
+		//Atender al reloj de los efectos
+		if(effectsEventFlag) {
+			effectsEventFlag = false;
+			gestures.age();
+			advanceEffects();
+#ifdef CAN_LINK
+			panelLink.tick();
+#endif
+		}
+		
+		//Atender a la macro en reproduccion
+		if(macro.isDue()) {
+			runMacroStep();
+		}
+		
+		//Atender a las tramas de los demas paneles
+		processLinks();
+		
+		//Atender al volcado de la caja negra
+		if(dumpRequestFlag) {
+			dumpRequestFlag = false;
+			startDump();
+		}
+		if(blackBox.isDumping()) {
+			pumpDump();
+		}
+#ifdef PIN_TRACE
+		if(traceRequestFlag && !PinTrace::isExporting()) {
+			PinTrace::startExport();
+		}
+		traceRequestFlag = false;
+		if(PinTrace::isExporting()) {
+			pumpTrace();
+		}
+#endif
+		
+		//Atender al reloj del diario
+		if(journalEventFlag) {
+			journalEventFlag = false;
+			flushJournal();
+			saveMacro();
+			reportChain();
+			checkButtons();
+#ifdef MIDI_OUTPUT
+			midi().tick();
+#endif
+#ifdef SCAN_TIMING_REPORT
+			reportScanTiming();
+#endif
+		}
 		
 		//Dormirse hasta la llegada de otra interrupcion.
 		//Cuidado con la seccion critica
 		__disable_irq();
-		if(!serialIOClkEventFlag) {
+#if SCAN_MODE == SCAN_MODE_TICK
+		const bool scanPending = serialIOClkEventFlag;
+#else
+		const bool scanPending = inputEventFlag;
+#endif
+		if(!scanPending && !effectsEventFlag && !journalEventFlag && !macro.isDue() && !dumpRequestFlag && !traceRequestFlag && !linkPending()) {
 			__WFI();
 		}
 		__enable_irq();
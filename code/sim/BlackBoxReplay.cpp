@@ -0,0 +1,66 @@
+/**
+ * \file
+ * \brief Reproduce en el ordenador los volcados de la caja negra recibidos
+ * del panel (BlackBoxReplay.h). Lee las lineas tal como llegan por la USART,
+ * por lo que admite el registro completo del host: las lineas que no son del
+ * volcado se ignoran.
+ *
+ * Desde el directorio del firmware (code/):
+ *   g++ -O2 -Isim -o blackbox-replay sim/BlackBoxReplay.cpp
+ *   ./blackbox-replay [-v] [fichero]
+ *     -v: Muestra cada trama y evento reproducidos
+ * Sin fichero lee la entrada estandar. Termina con 1 si alguna trama no
+ * reproduce lo grabado.
+ */
+
+#include "BlackBoxReplay.h"
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+	bool verbose = false;
+	int option;
+	while((option = getopt(argc, argv, "v")) != -1) {
+		switch(option) {
+			case 'v': verbose = true; break;
+			default:
+				std::fprintf(stderr, "uso: %s [-v] [fichero]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	FILE* file = stdin;
+	if(optind < argc) {
+		file = std::fopen(argv[optind], "r");
+		if(!file) {
+			std::fprintf(stderr, "no se puede abrir %s\n", argv[optind]);
+			return 2;
+		}
+	}
+
+	BlackBoxReplay replay(verbose);
+	std::string line;
+	int c;
+	while((c = std::fgetc(file)) != EOF) {
+		if(c == '\n') {
+			replay.onLine(line);
+			line.clear();
+		} else if(c != '\r') {
+			line += static_cast<char>(c);
+		}
+	}
+	if(file != stdin) {
+		std::fclose(file);
+	}
+
+	const BlackBoxReplay::Totals& totals = replay.getTotals();
+	std::printf("%u volcados, %u bloques, %u veces desde SYNC, %u tramas, %u comprobaciones, %u discrepancias\n",
+		totals.dumps, totals.blocks, totals.restores, totals.frames, totals.checked, totals.mismatches);
+	if(totals.mismatches) {
+		std::printf("primera: %s\n", replay.getFirstMismatch().c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,457 @@
+#ifndef BLACK_BOX_REPLAY_H_INCLUDED
+#define BLACK_BOX_REPLAY_H_INCLUDED
+
+#include "mbed.h"
+#include "../BlackBox.h"
+#include "../MixerController.h"
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Reproduce en el ordenador un volcado de la caja negra (las lineas
+ * "bb" que envia el firmware) a traves del MixerController real.
+ *
+ * Cada TOGGLE o FRAME se pasa a process() con los mismos gestos que vio el
+ * panel, y cada paso de macro (EVENT_MACRO_*) o accion de un enlace
+ * (EVENT_LINK_*) a su llamada. Los eventos que
+ * notifica el controlador deben coincidir, en orden y argumento, con los
+ * grabados, y el estado y el contexto de cada SYNC con los de la
+ * reproduccion. El contexto se sigue como en main.cpp: se actualiza en
+ * onLedState() y tras onPin().
+ *
+ * La reproduccion parte del SYNC del primer bloque, y vuelve a partir del de
+ * un bloque tras un hueco (bloques perdidos o volcados a medias), un
+ * reinicio (EVENT_BOOT) o una discrepancia. Los eventos grabados justo tras
+ * partir de un SYNC y antes de la primera trama son el final de una trama
+ * del bloque anterior: se aplican sin comprobarse.
+ *
+ * Los eventos de la cadena y de los botones averiados no cambian el
+ * mezclador y se ignoran.
+ */
+class BlackBoxReplay {
+	public:
+		///Resultado de la reproduccion
+		struct Totals {
+			uint32_t	dumps; ///<Volcados completos ("bb begin" a "bb end")
+			uint32_t	blocks;
+			uint32_t	restores; ///<Veces que se ha partido de un SYNC
+			uint32_t	frames; ///<Llamadas a process()
+			uint32_t	checked; ///<Eventos y SYNC comprobados
+			uint32_t	mismatches;
+		};
+
+		/**
+		 * \brief Constructor
+		 * \param verbose: Muestra cada registro y las discrepancias
+		 */
+		explicit BlackBoxReplay(bool verbose)
+			: m_mixer(m_sink)
+			, m_verbose(verbose)
+			, m_inDump(false)
+			, m_inBlock(false)
+			, m_sequence(0)
+			, m_lastSequence(0)
+			, m_lastComplete(false)
+			, m_held(0)
+			, m_lost(true)
+			, m_adopting(false)
+			, m_us(0)
+		{
+			//Como en main.cpp
+			m_mixer.setChordPolicy(MixerControllerBase::CHORD_LOWEST_WINS);
+			m_sink.mixer = &m_mixer;
+			m_totals = Totals();
+		}
+
+		/**
+		 * \brief Procesa una linea recibida del firmware. Las que no son del
+		 * volcado se ignoran
+		 */
+		void onLine(const std::string& line) {
+			if(line == "bb begin") {
+				m_inDump = true;
+				m_inBlock = false;
+				m_lost = true;
+			} else if(line == "bb end") {
+				if(m_inDump) {
+					finishBlock();
+					finishDump();
+					++m_totals.dumps;
+				}
+				m_inDump = false;
+			} else if(m_inDump && line.compare(0, 7, "bb blk ") == 0) {
+				finishBlock();
+				m_inBlock = true;
+				m_sequence = std::strtoul(line.c_str() + 7, 0, 10);
+				m_data.clear();
+			} else if(m_inBlock && line.compare(0, 3, "bb ") == 0) {
+				for(size_t i = 3; i + 1 < line.size(); i += 2) {
+					m_data.push_back(static_cast<uint8_t>(std::strtoul(line.substr(i, 2).c_str(), 0, 16)));
+				}
+			}
+		}
+
+		const Totals& getTotals() const {
+			return m_totals;
+		}
+
+		/**
+		 * \brief Devuelve la primera discrepancia. Vacia si no hay ninguna
+		 */
+		const std::string& getFirstMismatch() const {
+			return m_firstMismatch;
+		}
+
+
+
+	private:
+		class Sink;
+		typedef MixerController<Sink> Mixer;
+
+		///Evento que debe aparecer en la grabacion
+		struct Expected {
+			uint8_t		event;
+			uint8_t		arg;
+			uint32_t	context; ///<Contexto al grabarse, para el SYNC que lo preceda
+		};
+
+		///Destino de los eventos del controlador: los anota como esperados
+		class Sink {
+			public:
+				Sink()
+					: mixer(0)
+					, context(0)
+				{
+				}
+
+				void onLedState(const MixerControllerBase::LedState&, const MixerControllerBase::LedState&) {
+					context = getContext();
+				}
+				void onProgram(size_t sig) { expect(BlackBox::EVENT_PROGRAM, toArg(sig)); }
+				void onPreview(size_t sig) { expect(BlackBox::EVENT_PREVIEW, toArg(sig)); }
+				void onCut() { expect(BlackBox::EVENT_CUT, 0); }
+				void onTransition() { expect(BlackBox::EVENT_TRANSITION, 0); }
+				void onPin(size_t sig) {
+					expect(BlackBox::EVENT_PIN, toArg(sig));
+					context = getContext();
+				}
+				void onMacroRecord() {}
+				void onMacroPlay() {}
+
+				///Contexto de los SYNC, como mixerContext() en main.cpp
+				uint32_t getContext() const {
+					return toArg(mixer->getProgram()) | (toArg(mixer->getPreview()) << 8) | (toArg(mixer->getPinned()) << 16);
+				}
+
+				static uint8_t toArg(size_t sig) {
+					return static_cast<uint8_t>(sig < 0xFF ? sig : 0xFF);
+				}
+
+				const Mixer*					mixer;
+				uint32_t							context; ///<Contexto de los siguientes SYNC
+				std::deque<Expected>	expected;
+
+			private:
+				void expect(uint8_t event, uint8_t arg) {
+					Expected e;
+					e.event = event;
+					e.arg = arg;
+					e.context = context;
+					expected.push_back(e);
+				}
+		};
+
+		Sink									m_sink;
+		Mixer									m_mixer;
+		bool									m_verbose;
+		Totals								m_totals;
+		std::string						m_firstMismatch;
+
+		bool									m_inDump;
+		bool									m_inBlock;
+		uint32_t							m_sequence; ///<Bloque que se esta recibiendo
+		std::vector<uint8_t>	m_data; ///<Bytes recibidos del bloque
+		uint32_t							m_lastSequence; ///<Ultimo bloque reproducido
+		bool									m_lastComplete; ///<El ultimo bloque llego entero
+
+		uint32_t							m_held; ///<Botones de la ultima trama, activo alto
+		bool									m_lost; ///<Hay que partir del siguiente SYNC
+		bool									m_adopting; ///<Tras partir de un SYNC, hasta la primera trama
+		uint32_t							m_us; ///<Tiempo del ultimo registro
+
+		/**
+		 * \brief Reproduce el bloque recibido
+		 */
+		void finishBlock() {
+			if(!m_inBlock) {
+				return;
+			}
+			m_inBlock = false;
+			++m_totals.blocks;
+
+			//Decodificar antes, para ver si el SYNC va seguido de EVENT_BOOT
+			std::vector<BlackBox::Record> records;
+			BlackBox::Record record;
+			size_t offset = 0;
+			size_t length;
+			while((length = BlackBox::decode(&m_data[0] + offset, m_data.size() - offset, record)) != 0) {
+				records.push_back(record);
+				offset += length;
+			}
+			if(records.empty() || records[0].kind != BlackBox::KIND_SYNC) {
+				mismatch("bloque sin SYNC");
+				return;
+			}
+
+			const bool contiguous = m_lastComplete && m_sequence == m_lastSequence + 1;
+			const bool boot = records.size() > 1 && records[1].kind == BlackBox::KIND_EVENT &&
+				records[1].index == BlackBox::EVENT_BOOT;
+			if(m_lost || !contiguous || boot) {
+				restore(records[0]);
+			} else {
+				checkSync(records[0], records.size() > 1 ? &records[1] : 0);
+			}
+
+			for(size_t i = 1; i < records.size(); ++i) {
+				replay(records[i]);
+			}
+			m_lastSequence = m_sequence;
+			m_lastComplete = m_data.size() == BlackBox::BLOCK_SIZE;
+		}
+
+		/**
+		 * \brief Al terminar el volcado no debe quedar nada por grabar: el
+		 * firmware graba cada trama con sus eventos de una vez
+		 */
+		void finishDump() {
+			if(!m_lost && !m_sink.expected.empty()) {
+				mismatch("eventos sin grabar al final del volcado");
+			}
+			m_lastComplete = false;
+		}
+
+		/**
+		 * \brief Parte del estado de un SYNC
+		 */
+		void restore(const BlackBox::Record& sync) {
+			const uint32_t context = sync.context;
+			m_held = sync.value;
+			m_mixer.restore(m_held, context & 0xFF, (context >> 8) & 0xFF, (context >> 16) & 0xFF);
+			m_sink.context = context;
+			m_sink.expected.clear();
+			m_lost = false;
+			m_adopting = true;
+			m_us = sync.time;
+			++m_totals.restores;
+			if(m_verbose) {
+				std::printf("bb %u: desde SYNC, botones %08x, contexto %06x\n",
+					unsigned(sync.sequence), unsigned(m_held), unsigned(context));
+			}
+		}
+
+		/**
+		 * \brief Comprueba el SYNC de un bloque que sigue al anterior. Se
+		 * graba justo antes del siguiente registro, por lo que el contexto es
+		 * el que habia al grabarse este
+		 */
+		void checkSync(const BlackBox::Record& sync, const BlackBox::Record* next) {
+			++m_totals.checked;
+			m_us = sync.time;
+			const bool pending = next && next->kind == BlackBox::KIND_EVENT && !m_sink.expected.empty();
+			const uint32_t context = pending ? m_sink.expected.front().context : m_sink.context;
+			if(sync.value != m_held || sync.context != context) {
+				char text[96];
+				std::sprintf(text, "SYNC %u: botones %08x, contexto %06x. Esperado %08x, %06x",
+					unsigned(sync.sequence), unsigned(sync.value), unsigned(sync.context),
+					unsigned(m_held), unsigned(context));
+				mismatch(text);
+			} else if(m_verbose) {
+				std::printf("bb %u: SYNC ok\n", unsigned(sync.sequence));
+			}
+		}
+
+		/**
+		 * \brief Reproduce o comprueba un registro
+		 */
+		void replay(const BlackBox::Record& record) {
+			if(m_lost) {
+				return;
+			}
+			m_us += record.time;
+
+			switch(record.kind) {
+				case BlackBox::KIND_TOGGLE:
+					process(m_held ^ (1U << record.index), BlackBox::Gestures());
+					break;
+				case BlackBox::KIND_FRAME:
+					process(m_held ^ record.value, record.gestures);
+					break;
+				case BlackBox::KIND_EVENT:
+					replayEvent(record.index, static_cast<uint8_t>(record.value));
+					break;
+				default:
+					break;
+			}
+		}
+
+		/**
+		 * \brief Pasa una trama al controlador. Los eventos de la anterior ya
+		 * deben haberse grabado
+		 */
+		void process(uint32_t held, const BlackBox::Gestures& gestures) {
+			if(!checkDrained()) {
+				return;
+			}
+			if(m_verbose) {
+				std::printf("%10.3f ms  trama %08x%s\n", m_us / 1e3, unsigned(held),
+					(gestures.longPress | gestures.repeat | gestures.doubleTap) ? " con gestos" : "");
+			}
+			m_held = held;
+			m_adopting = false;
+			m_mixer.process(~Mixer::ButtonState(held), gestures);
+			++m_totals.frames;
+		}
+
+		void replayEvent(uint8_t event, uint8_t arg) {
+			if(m_verbose) {
+				std::printf("%10.3f ms  evento %u %u\n", m_us / 1e3, unsigned(event), unsigned(arg));
+			}
+			switch(event) {
+				case BlackBox::EVENT_PROGRAM:
+				case BlackBox::EVENT_PREVIEW:
+				case BlackBox::EVENT_CUT:
+				case BlackBox::EVENT_TRANSITION:
+				case BlackBox::EVENT_PIN:
+					if(m_sink.expected.empty() && m_adopting) {
+						adopt(event, arg);
+					} else {
+						check(event, arg);
+					}
+					break;
+
+				//Entradas: se graban antes de llamar al controlador
+				case BlackBox::EVENT_MACRO_PROGRAM:
+					if(checkDrained()) {
+						m_mixer.selectProgram(arg);
+					}
+					break;
+				case BlackBox::EVENT_MACRO_PREVIEW:
+					if(checkDrained()) {
+						m_mixer.selectPreview(arg);
+					}
+					break;
+				case BlackBox::EVENT_MACRO_CUT:
+					if(checkDrained()) {
+						m_mixer.cut();
+					}
+					break;
+				case BlackBox::EVENT_MACRO_TRANSITION:
+					if(checkDrained()) {
+						m_mixer.transition();
+					}
+					break;
+				case BlackBox::EVENT_LINK_PROGRAM:
+					if(checkDrained()) {
+						m_mixer.selectProgram(arg);
+					}
+					break;
+				case BlackBox::EVENT_LINK_PREVIEW:
+					if(checkDrained()) {
+						m_mixer.selectPreview(arg);
+					}
+					break;
+				case BlackBox::EVENT_LINK_CUT:
+					if(checkDrained()) {
+						m_mixer.cut();
+					}
+					break;
+				case BlackBox::EVENT_LINK_TRANSITION:
+					if(checkDrained()) {
+						m_mixer.transition();
+					}
+					break;
+				case BlackBox::EVENT_LINK_STATE:
+					if(checkDrained()) {
+						m_mixer.setState(arg & 0x0F, arg >> 4);
+					}
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		/**
+		 * \brief Comprueba un evento grabado con el siguiente esperado
+		 */
+		void check(uint8_t event, uint8_t arg) {
+			++m_totals.checked;
+			if(m_sink.expected.empty()) {
+				char text[64];
+				std::sprintf(text, "evento %u %u inesperado", unsigned(event), unsigned(arg));
+				mismatch(text);
+				return;
+			}
+			const Expected e = m_sink.expected.front();
+			m_sink.expected.pop_front();
+			if(e.event != event || e.arg != arg) {
+				char text[64];
+				std::sprintf(text, "evento %u %u. Esperado %u %u", unsigned(event), unsigned(arg),
+					unsigned(e.event), unsigned(e.arg));
+				mismatch(text);
+			}
+		}
+
+		/**
+		 * \brief Aplica un evento de una trama anterior al SYNC de partida
+		 */
+		void adopt(uint8_t event, uint8_t arg) {
+			size_t program = m_mixer.getProgram();
+			size_t preview = m_mixer.getPreview();
+			size_t pinned = m_mixer.getPinned();
+			switch(event) {
+				case BlackBox::EVENT_PROGRAM: program = arg; break;
+				case BlackBox::EVENT_PREVIEW: preview = arg; break;
+				case BlackBox::EVENT_PIN: pinned = arg; break;
+				default: std::swap(program, preview); break; //Corte o transicion
+			}
+			m_mixer.restore(m_held, program, preview, pinned);
+			m_sink.context = m_sink.getContext();
+		}
+
+		/**
+		 * \brief Comprueba que se han grabado todos los eventos esperados
+		 */
+		bool checkDrained() {
+			if(m_sink.expected.empty()) {
+				return true;
+			}
+			const Expected& e = m_sink.expected.front();
+			char text[64];
+			std::sprintf(text, "falta el evento %u %u", unsigned(e.event), unsigned(e.arg));
+			mismatch(text);
+			return false;
+		}
+
+		/**
+		 * \brief Anota una discrepancia. Se vuelve a partir del siguiente SYNC
+		 */
+		void mismatch(const char* text) {
+			++m_totals.mismatches;
+			if(m_firstMismatch.empty()) {
+				m_firstMismatch = text;
+			}
+			if(m_verbose) {
+				std::printf("bb %u: DISCREPANCIA: %s\n", unsigned(m_sequence), text);
+			}
+			m_lost = true;
+		}
+
+};
+
+#endif //BLACK_BOX_REPLAY_H_INCLUDED
@@ -0,0 +1,416 @@
+/**
+ * \file
+ * \brief Simulacion de varios paneles enlazados por CAN (CanLink), en tiempo
+ * virtual, para medir la convergencia del estado compartido, la eleccion del
+ * agregador y la ocupacion del bus.
+ *
+ * Cada nodo tiene su propio CanLink sobre el bus simulado (SimCanBus) y un
+ * mezclador reducido a programa y previo. Un operador guiado por una semilla
+ * realiza acciones en nodos al azar. El estado ha convergido cuando todos los
+ * nodos conectados tienen el mismo programa y previo; los leds lo muestran
+ * una trama de refresco despues.
+ *
+ * Desde el directorio del firmware (code/):
+ *   g++ -O2 -Isim -o can-sim sim/CanSimulation.cpp sim/SimCan.cpp \
+ *       sim/VirtualTime.cpp sim/mbed.cpp
+ *   ./can-sim [-n nodos] [-t segundos] [-s semilla] [-i ms] [-e perdidas] [-k segundo] [-v]
+ *     -n: Nodos en el bus (3 por defecto, hasta 16)
+ *     -t: Tiempo simulado (600 por defecto)
+ *     -s: Semilla del operador y de las perdidas (1 por defecto)
+ *     -i: Intervalo medio entre acciones en ms (500 por defecto)
+ *     -e: Probabilidad de que un receptor pierda una trama (0 por defecto)
+ *     -k: Desconecta el agregador en ese segundo y mide el relevo
+ *     -v: Muestra los cambios de agregador
+ */
+
+#include "mbed.h"
+#include "SimCanBus.h"
+#include "SimStats.h"
+#include "../CanLink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include <unistd.h>
+
+//Sin placa: ningun pin ni USART se usa
+void SimBoard::write(PinName, int) {}
+int SimBoard::read(PinName) { return 0; }
+void SimBoard::transmit(PinName, char) {}
+
+static const size_t SIGNAL_CNT = 8;
+static const uint32_t T_TICK = 10000; //Reloj de los efectos en main.cpp
+static const size_t HEARTBEAT_TICKS = 10;
+static const size_t TIMEOUT_TICKS = 35;
+static const uint32_t LOOP_US = 200; //Retraso del bucle principal tras una interrupcion
+
+static bool verbose;
+
+class Node;
+static std::vector<Node*> nodeList;
+static void checkConvergence();
+static void checkElection();
+
+
+
+/**
+ * \brief Panel simulado: el enlace, el reloj de tick() y el bucle principal,
+ * que aplica las tramas recibidas poco despues de la interrupcion
+ */
+class Node {
+	public:
+		explicit Node(uint8_t id)
+			: m_id(id)
+			, m_can(p30, p29)
+			, m_link(m_can, id, *this, HEARTBEAT_TICKS, TIMEOUT_TICKS)
+			, m_program(CanLinkBase::NO_SIGNAL)
+			, m_preview(CanLinkBase::NO_SIGNAL)
+		{
+			m_tick.node = this;
+			m_loop.node = this;
+		}
+
+		/**
+		 * \brief Arranca el panel
+		 * \param phaseUs: Desfase de su reloj respecto a los demas
+		 */
+		void start(uint32_t phaseUs) {
+			m_link.start();
+			//La interrupcion de recepcion ademas despierta al bucle principal
+			m_can.attach(callback(this, &Node::onReceive), CAN::RxIrq);
+			m_tick.schedule(VirtualTime::now() + phaseUs);
+		}
+
+		/**
+		 * \brief Apaga el panel
+		 */
+		void stop() {
+			m_can.setConnected(false);
+			m_tick.cancel();
+			m_loop.cancel();
+		}
+
+		bool isRunning() const {
+			return m_can.isConnected();
+		}
+
+		/**
+		 * \brief Accion local, como la haria MixerController
+		 */
+		void act(CanLinkBase::Action action, uint8_t sig) {
+			switch(action) {
+				case CanLinkBase::ACTION_PROGRAM:
+					m_program = sig;
+					break;
+				case CanLinkBase::ACTION_PREVIEW:
+					m_preview = sig;
+					break;
+				default:
+					std::swap(m_program, m_preview);
+					break;
+			}
+			m_link.publish(action, m_program, m_preview);
+			checkConvergence();
+		}
+
+		void onLinkState(CanLinkBase::Action, size_t program, size_t preview) {
+			m_program = static_cast<uint8_t>(program);
+			m_preview = static_cast<uint8_t>(preview);
+			checkConvergence();
+		}
+
+		void onAggregator(bool aggregator) {
+			if(verbose) {
+				std::printf("%10.6f nodo %u %s\n", VirtualTime::now() / 1e6, m_id, aggregator ? "agregador" : "deja de ser agregador");
+			}
+			checkElection();
+		}
+
+		uint8_t getId() const {
+			return m_id;
+		}
+
+		uint8_t getProgram() const {
+			return m_program;
+		}
+
+		uint8_t getPreview() const {
+			return m_preview;
+		}
+
+		const CanLink<Node>& getLink() const {
+			return m_link;
+		}
+
+		const CAN& getCan() const {
+			return m_can;
+		}
+
+	private:
+		class Tick : public TimerEvent {
+			public:
+				Node* node;
+			protected:
+				virtual void fire() {
+					schedule(getDeadline() + T_TICK);
+					node->m_link.tick();
+					checkElection();
+				}
+		};
+
+		class Loop : public TimerEvent {
+			public:
+				Node* node;
+			protected:
+				virtual void fire() {
+					node->m_link.process();
+				}
+		};
+
+		uint8_t					m_id;
+		CAN							m_can;
+		CanLink<Node>		m_link;
+		uint8_t					m_program;
+		uint8_t					m_preview;
+		Tick						m_tick;
+		Loop						m_loop;
+
+		void onReceive() {
+			m_link.onReceive();
+			if(!m_loop.isScheduled()) {
+				m_loop.schedule(VirtualTime::now() + LOOP_US);
+			}
+		}
+};
+
+
+
+//Medidas
+static Stats convergence; //Desde la accion hasta que todos coinciden
+static std::deque<uint64_t> pendingActions; //Instantes de las acciones sin converger
+static uint64_t divergedUs; //Tiempo total con estados distintos
+static uint64_t divergedSince;
+static bool diverged;
+static Stats failover; //Desde que cae el agregador hasta que los demas eligen otro
+static uint64_t killedUs;
+static bool killed;
+static uint64_t electedUs; //Primera eleccion completa
+static bool elected;
+
+static void checkConvergence() {
+	bool same = true;
+	const Node* first = 0;
+	for(size_t i = 0; i < nodeList.size() && same; ++i) {
+		const Node* node = nodeList[i];
+		if(!node->isRunning()) {
+			continue;
+		}
+		if(!first) {
+			first = node;
+		} else if(node->getProgram() != first->getProgram() || node->getPreview() != first->getPreview()) {
+			same = false;
+		}
+	}
+
+	const uint64_t now = VirtualTime::now();
+	if(same) {
+		while(!pendingActions.empty()) {
+			convergence.add(now - pendingActions.front());
+			pendingActions.pop_front();
+		}
+		if(diverged) {
+			divergedUs += now - divergedSince;
+			diverged = false;
+		}
+	} else if(!diverged) {
+		diverged = true;
+		divergedSince = now;
+	}
+}
+
+static void checkElection() {
+	//Todos los nodos vivos deben coincidir en el de menor numero
+	uint8_t expected = CanLinkBase::NODE_MAX;
+	for(size_t i = 0; i < nodeList.size(); ++i) {
+		if(nodeList[i]->isRunning()) {
+			expected = nodeList[i]->getId();
+			break;
+		}
+	}
+	for(size_t i = 0; i < nodeList.size(); ++i) {
+		if(nodeList[i]->isRunning() && nodeList[i]->getLink().getAggregator() != expected) {
+			return;
+		}
+	}
+
+	const uint64_t now = VirtualTime::now();
+	if(!elected) {
+		elected = true;
+		electedUs = now;
+	}
+	if(killed) {
+		killed = false;
+		failover.add(now - killedUs);
+	}
+}
+
+
+
+/**
+ * \brief Operador guiado por una semilla: cada accion la hace un nodo al azar
+ */
+class Operator : public TimerEvent {
+	public:
+		Operator(uint32_t seed, uint32_t intervalMs)
+			: m_seed(seed)
+			, m_intervalMs(intervalMs)
+			, m_actions(0)
+		{
+		}
+
+		void start() {
+			schedule(VirtualTime::now() + 1000000);
+		}
+
+		uint32_t getActions() const {
+			return m_actions;
+		}
+
+	protected:
+		virtual void fire() {
+			Node* node = nodeList[random(nodeList.size())];
+			if(node->isRunning()) {
+				const CanLinkBase::Action action = static_cast<CanLinkBase::Action>(CanLinkBase::ACTION_PROGRAM + random(4));
+				pendingActions.push_back(VirtualTime::now());
+				++m_actions;
+				node->act(action, static_cast<uint8_t>(random(SIGNAL_CNT)));
+			}
+			schedule(VirtualTime::now() + 1000ULL * (m_intervalMs / 2 + random(m_intervalMs + 1)));
+		}
+
+	private:
+		uint32_t	m_seed;
+		uint32_t	m_intervalMs;
+		uint32_t	m_actions;
+
+		uint32_t random(uint32_t n) {
+			m_seed = m_seed * 1664525U + 1013904223U;
+			return (m_seed >> 8) % n;
+		}
+};
+
+///Apagado del agregador
+class Kill : public TimerEvent {
+	protected:
+		virtual void fire() {
+			for(size_t i = 0; i < nodeList.size(); ++i) {
+				Node* node = nodeList[i];
+				if(node->isRunning() && node->getLink().isAggregator()) {
+					if(verbose) {
+						std::printf("%10.6f nodo %u apagado\n", VirtualTime::now() / 1e6, node->getId());
+					}
+					node->stop();
+					killed = true;
+					killedUs = VirtualTime::now();
+					return;
+				}
+			}
+		}
+};
+
+
+
+int main(int argc, char** argv) {
+	uint32_t nodes = 3;
+	uint32_t seconds = 600;
+	uint32_t seed = 1;
+	uint32_t intervalMs = 500;
+	double lossRate = 0;
+	long killSecond = -1;
+	int option;
+	while((option = getopt(argc, argv, "n:t:s:i:e:k:v")) != -1) {
+		switch(option) {
+			case 'n': nodes = std::strtoul(optarg, 0, 10); break;
+			case 't': seconds = std::strtoul(optarg, 0, 10); break;
+			case 's': seed = std::strtoul(optarg, 0, 10); break;
+			case 'i': intervalMs = std::strtoul(optarg, 0, 10); break;
+			case 'e': lossRate = std::strtod(optarg, 0); break;
+			case 'k': killSecond = std::strtol(optarg, 0, 10); break;
+			case 'v': verbose = true; break;
+			default:
+				std::fprintf(stderr, "uso: %s [-n nodos] [-t segundos] [-s semilla] [-i ms] [-e perdidas] [-k segundo] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(nodes < 1 || nodes > CanLinkBase::NODE_MAX || intervalMs < 1) {
+		std::fprintf(stderr, "entre 1 y %u nodos, intervalo de al menos 1ms\n", unsigned(CanLinkBase::NODE_MAX));
+		return 2;
+	}
+
+	SimCanBus::setLossRate(lossRate, seed);
+	for(uint32_t i = 0; i < nodes; ++i) {
+		nodeList.push_back(new Node(static_cast<uint8_t>(i)));
+	}
+	//Los paneles arrancan con sus relojes desfasados
+	for(size_t i = 0; i < nodeList.size(); ++i) {
+		nodeList[i]->start(static_cast<uint32_t>((i * 3137) % T_TICK));
+	}
+
+	Operator op(seed, intervalMs);
+	op.start();
+	Kill kill;
+	if(killSecond >= 0) {
+		kill.schedule(killSecond * 1000000ULL);
+	}
+
+	VirtualTime::setEnd(seconds * 1000000ULL);
+	const std::clock_t start = std::clock();
+	try {
+		for(;;) {
+			VirtualTime::waitForInterrupt();
+		}
+	} catch(const VirtualTime::End&) {
+	}
+	const double wall = double(std::clock() - start) / CLOCKS_PER_SEC;
+	if(diverged) {
+		divergedUs += VirtualTime::now() - divergedSince;
+	}
+
+	//Cota: las tramas en cola de todos los nodos mas el bucle, y con perdidas un latido
+	const CANMessage worst(CanLinkBase::ID_BASE, "\0\0\0\0\0\0", CanLinkBase::FRAME_LENGTH);
+	const uint32_t frameUs = SimCanBus::frameBits(worst) * 1000000ULL / CanLinkBase::BITRATE;
+	const uint32_t boundUs = nodes * frameUs + LOOP_US;
+
+	const double simulated = VirtualTime::now() / 1e6;
+	std::printf("Simulados %.0f s en %.2f s (x%.0f), %u nodos, semilla %u\n",
+		simulated, wall, wall > 0 ? simulated / wall : 0.0, nodes, seed);
+	std::printf("Bus (%u kbit/s):\n", unsigned(CanLinkBase::BITRATE / 1000));
+	std::printf("  %-24s %u (%.1f /s)\n", "tramas", SimCanBus::getFrames(), SimCanBus::getFrames() / simulated);
+	std::printf("  %-24s %.2f%%\n", "ocupacion", 100.0 * SimCanBus::getBusyUs() / VirtualTime::now());
+	SimCanBus::getTxDelay().print("espera para transmitir", "us");
+	uint32_t overruns = 0;
+	uint32_t dropped = 0;
+	for(size_t i = 0; i < nodeList.size(); ++i) {
+		overruns += nodeList[i]->getCan().getOverruns();
+		dropped += nodeList[i]->getLink().getDropped();
+	}
+	std::printf("  %-24s %u inyectadas, %u desbordes, %u en el anillo\n", "recepciones perdidas",
+		SimCanBus::getLost(), overruns, dropped);
+	std::printf("Estado compartido (%u acciones):\n", op.getActions());
+	convergence.print("convergencia", "us");
+	std::printf("  %-24s %u us sin perdidas, %u us con una trama perdida\n", "cota",
+		boundUs, unsigned(boundUs + HEARTBEAT_TICKS * T_TICK));
+	std::printf("  %-24s %.3f%% del tiempo\n", "estados distintos", 100.0 * divergedUs / VirtualTime::now());
+	std::printf("  %-24s %u\n", "sin converger al final", unsigned(pendingActions.size()));
+	std::printf("Agregador:\n");
+	if(elected) {
+		std::printf("  %-24s %llu us\n", "primera eleccion", (unsigned long long)electedUs);
+	} else {
+		std::printf("  %-24s -\n", "primera eleccion");
+	}
+	failover.print("relevo", "us");
+	return 0;
+}
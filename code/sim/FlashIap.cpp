@@ -0,0 +1,70 @@
+#include "../FlashIap.h"
+#include "SimFlash.h"
+#include "VirtualTime.h"
+
+#include <sys/mman.h>
+#include <cstring>
+
+uint32_t SimFlash::s_erases = 0;
+uint32_t SimFlash::s_pageWrites = 0;
+uint64_t SimFlash::s_stallUs = 0;
+
+static const uint32_t SECTOR_SIZE = 0x8000; //Sectores 16 a 29
+
+bool SimFlash::map() {
+	void* base = reinterpret_cast<void*>(BASE_ADDRESS);
+	void* mapped = mmap(base, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if(mapped != base) {
+		return false;
+	}
+	std::memset(mapped, 0xFF, SIZE);
+	return true;
+}
+
+uint8_t* SimFlash::sectorAt(uint32_t sector) {
+	const uint32_t address = 0x10000 + (sector - 16) * SECTOR_SIZE;
+	if(sector < 16 || address < BASE_ADDRESS || address + SECTOR_SIZE > BASE_ADDRESS + SIZE) {
+		return 0;
+	}
+	return reinterpret_cast<uint8_t*>(address);
+}
+
+
+
+bool FlashIap::eraseSector(uint32_t sector, bool& erased) {
+	erased = false;
+	uint8_t* data = SimFlash::sectorAt(sector);
+	if(!data) {
+		return false;
+	}
+
+	for(uint32_t i = 0; i < SECTOR_SIZE; ++i) {
+		if(data[i] != 0xFF) {
+			std::memset(data, 0xFF, SECTOR_SIZE);
+			VirtualTime::stall(SimFlash::ERASE_US);
+			SimFlash::s_stallUs += SimFlash::ERASE_US;
+			++SimFlash::s_erases;
+			erased = true;
+			break;
+		}
+	}
+	return true;
+}
+
+bool FlashIap::programPage(uint32_t sector, uint32_t address, const uint32_t* data) {
+	uint8_t* base = SimFlash::sectorAt(sector);
+	const uint32_t offset = address - static_cast<uint32_t>(reinterpret_cast<uintptr_t>(base));
+	if(!base || address % PAGE_SIZE || offset >= SECTOR_SIZE) {
+		return false;
+	}
+
+	//Programar solo pasa bits de 1 a 0
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	for(uint32_t i = 0; i < PAGE_SIZE; ++i) {
+		base[offset + i] &= bytes[i];
+	}
+	VirtualTime::stall(SimFlash::PROGRAM_US);
+	SimFlash::s_stallUs += SimFlash::PROGRAM_US;
+	++SimFlash::s_pageWrites;
+	return true;
+}
@@ -0,0 +1,164 @@
+/**
+ * \file
+ * \brief Prueba del controlador del mezclador con los gestos, en el
+ * ordenador. Cada caso parte del mismo estado (programa 0, previo 1), pulsa
+ * una secuencia de botones trama a trama, avanzando el reloj de los gestos
+ * entre ellas como el reloj de los efectos del firmware (10ms), y comprueba
+ * el programa y el previo finales y los cortes y transiciones notificados.
+ *
+ * No necesita el mbed.h simulado: el controlador y los gestos no dependen de
+ * la placa.
+ *
+ * Desde el directorio del firmware (code/):
+ *   g++ -O2 -o mixer-test sim/MixerTest.cpp
+ *   ./mixer-test
+ * Termina con 1 si falla algun caso.
+ */
+
+#include "../MixerController.h"
+
+#include <cstdio>
+
+
+
+///Destino de los eventos: solo cuenta los cambios de buses
+class TestSink {
+	public:
+		TestSink()
+			: cuts(0)
+			, transitions(0)
+			, pinned(MixerControllerBase::NO_SIGNAL)
+		{
+		}
+
+		void onLedState(const MixerControllerBase::LedState&, const MixerControllerBase::LedState&) {}
+		void onProgram(size_t) {}
+		void onPreview(size_t) {}
+		void onCut() { ++cuts; }
+		void onTransition() { ++transitions; }
+		void onPin(size_t sig) { pinned = sig; }
+		void onMacroRecord() {}
+		void onMacroPlay() {}
+
+		unsigned	cuts;
+		unsigned	transitions;
+		size_t		pinned;
+};
+
+typedef MixerController<TestSink> Mixer;
+
+//Tiempos de los gestos como en main.cpp, en pasos de 10ms: pulsacion larga
+//de 600ms, repeticion cada 200ms y doble pulsacion en menos de 300ms
+static const uint32_t LONG_TICKS = 60;
+static const uint32_t REPEAT_TICKS = 20;
+static const uint32_t DOUBLE_TAP_TICKS = 30;
+
+static const uint32_t CUT = 1U << MixerControllerBase::BUTTON_INDEX_CUT;
+static const uint32_t PVW2 = 1U << (MixerControllerBase::BUTTON_INDEX_PREVIEW0 + 2);
+
+
+
+///Panel de prueba: controlador, gestos y reloj
+class Bench {
+	public:
+		Bench()
+			: m_mixer(m_sink)
+			, m_gestures(LONG_TICKS, REPEAT_TICKS, DOUBLE_TAP_TICKS)
+		{
+			m_mixer.setState(0, 1);
+		}
+
+		/**
+		 * \brief Mantiene unos botones durante un tiempo, con una trama por paso
+		 * \param held: Botones pulsados, activo alto
+		 * \param ms: Duracion, en multiplos de 10ms
+		 */
+		void hold(uint32_t held, uint32_t ms) {
+			for(uint32_t t = 0; t < ms; t += 10) {
+				const Mixer::Gestures gestures = m_gestures.update(held);
+				m_mixer.process(~Mixer::ButtonState(held), gestures);
+				m_gestures.age();
+			}
+		}
+
+		/**
+		 * \brief Pulsa y suelta unos botones
+		 */
+		void tap(uint32_t buttons, uint32_t pressMs, uint32_t releaseMs) {
+			hold(buttons, pressMs);
+			hold(0, releaseMs);
+		}
+
+		const Mixer& mixer() const { return m_mixer; }
+		const TestSink& sink() const { return m_sink; }
+
+	private:
+		TestSink														m_sink;
+		Mixer																m_mixer;
+		GestureRecognizer<uint32_t>					m_gestures;
+};
+
+
+
+static unsigned failures;
+
+/**
+ * \brief Comprueba el estado final de un caso
+ */
+static void check(const char* name, const Bench& bench, size_t program, size_t preview, unsigned cuts, unsigned transitions) {
+	const Mixer& mixer = bench.mixer();
+	const TestSink& sink = bench.sink();
+	const bool ok = mixer.getProgram() == program && mixer.getPreview() == preview
+		&& sink.cuts == cuts && sink.transitions == transitions;
+	std::printf("%-32s %s (programa %u, previo %u, %u cortes, %u transiciones)\n", name, ok ? "ok" : "FALLO",
+		unsigned(mixer.getProgram()), unsigned(mixer.getPreview()), sink.cuts, sink.transitions);
+	if(!ok) {
+		std::printf("  %-30s programa %u, previo %u, %u cortes, %u transiciones\n", "esperado",
+			unsigned(program), unsigned(preview), cuts, transitions);
+		++failures;
+	}
+}
+
+int main() {
+	{
+		Bench bench;
+		bench.tap(CUT, 100, 500);
+		check("pulsacion de CUT", bench, 1, 0, 1, 0);
+	}
+	{
+		//La segunda llega 100ms despues de soltar la primera: otro corte
+		Bench bench;
+		bench.tap(CUT, 100, 100);
+		bench.tap(CUT, 100, 500);
+		check("doble pulsacion de CUT", bench, 0, 1, 2, 0);
+	}
+	{
+		Bench bench;
+		bench.tap(CUT, 100, 100);
+		bench.tap(CUT, 100, 100);
+		bench.tap(CUT, 100, 500);
+		check("triple pulsacion de CUT", bench, 1, 0, 3, 0);
+	}
+	{
+		//La segunda llega fuera de plazo: dos cortes
+		Bench bench;
+		bench.tap(CUT, 100, 400);
+		bench.tap(CUT, 100, 500);
+		check("dos pulsaciones lentas de CUT", bench, 0, 1, 2, 0);
+	}
+	{
+		//Fijar el previo 2 y cortar: pasa a programa, por lo que no vuelve a previo
+		Bench bench;
+		bench.tap(PVW2, 700, 500);
+		bench.tap(CUT, 100, 500);
+		const bool pinned = bench.sink().pinned == 2;
+		check("pulsacion larga de PVW2 y CUT", bench, 2, 0, 1, 0);
+		if(!pinned) {
+			std::printf("  %-30s fijado %u, esperado 2\n", "", unsigned(bench.sink().pinned));
+			++failures;
+		}
+	}
+
+	std::printf("%s\n", failures ? "FALLO" : "ok");
+	return failures ? 1 : 0;
+}
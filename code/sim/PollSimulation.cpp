@@ -0,0 +1,518 @@
+/**
+ * \file
+ * \brief Simulacion de un maestro y varios paneles esclavos sondeados por un
+ * bus RS-485 (PollLink), en tiempo virtual, para medir la latencia de las
+ * acciones, la convergencia de los leds y la ocupacion del bus.
+ *
+ * Cada placa tiene su propia USART y su pin DE sobre el bus simulado: un byte
+ * llega a todas las placas que no estan transmitiendo, y si dos transmiten a
+ * la vez se corrompe. Un operador guiado por una semilla realiza acciones en
+ * placas al azar; los leds han convergido cuando todos los esclavos muestran
+ * el estado del maestro.
+ *
+ * Desde el directorio del firmware (code/):
+ *   g++ -O2 -Isim -o poll-sim sim/PollSimulation.cpp sim/VirtualTime.cpp sim/mbed.cpp
+ *   ./poll-sim [-n esclavos] [-t segundos] [-s semilla] [-i ms] [-e ruido] [-b baudios] [-r segundo]
+ *     -n: Esclavos en el bus (16 por defecto, hasta 31)
+ *     -t: Tiempo simulado (600 por defecto)
+ *     -s: Semilla del operador y del ruido (1 por defecto)
+ *     -i: Intervalo medio entre acciones en ms (500 por defecto)
+ *     -e: Probabilidad de que el ruido corrompa un byte (0 por defecto)
+ *     -b: Velocidad del bus (115200 por defecto)
+ *     -r: Reinicia el maestro en ese segundo. Recupera el estado del
+ *         mezclador, como del diario, pero el enlace arranca de cero: las
+ *         acciones de los esclavos no deben perderse
+ */
+
+#include "mbed.h"
+#include "SimStats.h"
+#include "../PollLink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include <unistd.h>
+
+static const size_t SIGNAL_CNT = 8;
+static const uint32_t LOOP_US = 200; //Retraso del bucle principal tras una interrupcion
+static const size_t BOARD_MAX = (SIM_NODE_LAST - SIM_NODE0 + 1) / 2;
+
+/**
+ * \brief Placa conectada al bus: la 0 es el maestro, la n + 1 el esclavo n.
+ * Transmite por SIM_NODE0 + 2 * placa y controla el transceptor con el pin
+ * siguiente
+ */
+class Board {
+	public:
+		explicit Board(size_t index)
+			: m_serial(txPin(index), NC)
+		{
+			m_loop.board = this;
+		}
+
+		virtual ~Board() {
+		}
+
+		static PinName txPin(size_t index) {
+			return static_cast<PinName>(SIM_NODE0 + 2 * index);
+		}
+
+		static PinName dePin(size_t index) {
+			return static_cast<PinName>(SIM_NODE0 + 2 * index + 1);
+		}
+
+		/**
+		 * \brief Llega un byte del bus. La interrupcion ademas despierta al bucle principal
+		 */
+		void receive(char c) {
+			m_serial.receive(c);
+			if(!m_loop.isScheduled()) {
+				m_loop.schedule(VirtualTime::now() + LOOP_US);
+			}
+		}
+
+	protected:
+		RawSerial	m_serial;
+
+		///Una pasada del bucle principal
+		virtual void loop() = 0;
+
+	private:
+		class Loop : public TimerEvent {
+			public:
+				Board* board;
+			protected:
+				virtual void fire() {
+					board->loop();
+				}
+		};
+
+		Loop	m_loop;
+};
+
+static std::vector<Board*> boardList;
+
+
+
+//Modelo del bus
+static bool driving[BOARD_MAX]; //Pin DE de cada placa
+static uint32_t masterBytes;
+static uint32_t slaveBytes;
+static uint32_t collisions;
+static uint32_t undriven; //Bytes enviados sin habilitar el transmisor
+static uint32_t noisy;
+static double noiseRate;
+static uint32_t noiseSeed;
+
+static uint32_t noise(uint32_t n) {
+	noiseSeed = noiseSeed * 1103515245U + 12345U;
+	return (noiseSeed >> 8) % n;
+}
+
+static size_t driverCount() {
+	size_t count = 0;
+	for(size_t i = 0; i < boardList.size(); ++i) {
+		count += driving[i];
+	}
+	return count;
+}
+
+void SimBoard::write(PinName pin, int value) {
+	if(pin < SIM_NODE0 || pin > SIM_NODE_LAST || (pin - SIM_NODE0) % 2 == 0) {
+		return;
+	}
+	const size_t index = (pin - SIM_NODE0) / 2;
+	if(value && !driving[index] && driverCount()) {
+		++collisions;
+	}
+	driving[index] = value != 0;
+}
+
+int SimBoard::read(PinName) {
+	return 0;
+}
+
+void SimBoard::transmit(PinName tx, char c) {
+	const size_t index = (tx - SIM_NODE0) / 2;
+	(index ? slaveBytes : masterBytes)++;
+	if(!driving[index]) {
+		++undriven;
+		return;
+	}
+	if(driverCount() > 1) {
+		c ^= 0x5A;
+	}
+	if(noiseRate > 0 && noise(1000000) < noiseRate * 1000000) {
+		c ^= static_cast<char>(1 << noise(8));
+		++noisy;
+	}
+	//Con DE activo el receptor esta deshabilitado: no hay eco
+	for(size_t i = 0; i < boardList.size(); ++i) {
+		if(!driving[i]) {
+			boardList[i]->receive(c);
+		}
+	}
+}
+
+
+
+//Medidas
+static Stats eventLatency; //Desde la accion en un esclavo hasta que la aplica el maestro
+static Stats convergence; //Desde la accion hasta que todos los leds coinciden
+static std::deque<uint64_t> pendingActions; //Instantes de las acciones sin converger
+static void checkConvergence();
+
+///Estado reducido del mezclador: programa y previo
+struct Mixer {
+	uint8_t	program;
+	uint8_t	preview;
+
+	Mixer()
+		: program(PollLinkBase::NO_SIGNAL)
+		, preview(PollLinkBase::NO_SIGNAL)
+	{
+	}
+
+	void apply(PollLinkBase::Action action, size_t sig) {
+		switch(action) {
+			case PollLinkBase::ACTION_PROGRAM:
+				program = static_cast<uint8_t>(sig);
+				break;
+			case PollLinkBase::ACTION_PREVIEW:
+				preview = static_cast<uint8_t>(sig);
+				break;
+			default:
+				std::swap(program, preview);
+				break;
+		}
+	}
+};
+
+
+
+/**
+ * \brief Panel esclavo: aplica sus acciones al momento y muestra el estado
+ * que difunde el maestro
+ */
+class Slave : public Board {
+	public:
+		explicit Slave(uint8_t address)
+			: Board(address + 1)
+			, m_link(m_serial, dePin(address + 1), address, *this)
+		{
+		}
+
+		void start(int baud) {
+			m_link.start(baud);
+		}
+
+		void act(PollLinkBase::Action action, uint8_t sig) {
+			m_mixer.apply(action, sig);
+			if(m_link.queue(action, sig)) {
+				m_sent.push_back(VirtualTime::now());
+			}
+			checkConvergence();
+		}
+
+		void onPollState(size_t program, size_t preview) {
+			m_mixer.program = static_cast<uint8_t>(program);
+			m_mixer.preview = static_cast<uint8_t>(preview);
+			checkConvergence();
+		}
+
+		/**
+		 * \brief El maestro ha aplicado la accion mas antigua de este panel
+		 */
+		void onDelivered() {
+			if(!m_sent.empty()) {
+				eventLatency.add(VirtualTime::now() - m_sent.front());
+				m_sent.pop_front();
+			}
+		}
+
+		const Mixer& getMixer() const {
+			return m_mixer;
+		}
+
+		const PollSlave<Slave>& getLink() const {
+			return m_link;
+		}
+
+		/**
+		 * \brief Devuelve las acciones que el maestro aun no ha aplicado
+		 */
+		size_t getUndelivered() const {
+			return m_sent.size();
+		}
+
+	protected:
+		virtual void loop() {
+			if(m_link.hasState()) {
+				m_link.process();
+			}
+		}
+
+	private:
+		PollSlave<Slave>			m_link;
+		Mixer									m_mixer;
+		std::deque<uint64_t>	m_sent;
+};
+
+static std::vector<Slave*> slaveList;
+
+
+
+/**
+ * \brief Panel maestro: aplica sus acciones y las de los esclavos
+ */
+class Master : public Board {
+	public:
+		explicit Master(size_t slaves)
+			: Board(0)
+			, m_slaves(slaves)
+			, m_baud(0)
+			, m_link(new PollMaster<Master>(m_serial, dePin(0), slaves, *this))
+			, m_restarts(0)
+		{
+		}
+
+		~Master() {
+			delete m_link;
+		}
+
+		void start(int baud) {
+			m_baud = baud;
+			m_link->start(baud);
+		}
+
+		/**
+		 * \brief Reinicia la placa. Los lotes recibidos sin aplicar se pierden
+		 */
+		void restart() {
+			delete m_link;
+			m_link = new PollMaster<Master>(m_serial, dePin(0), m_slaves, *this);
+			m_link->setState(m_mixer.program, m_mixer.preview);
+			m_link->start(m_baud);
+			++m_restarts;
+		}
+
+		void act(PollLinkBase::Action action, uint8_t sig) {
+			m_mixer.apply(action, sig);
+			m_link->setState(m_mixer.program, m_mixer.preview);
+			checkConvergence();
+		}
+
+		void onPollEvent(uint8_t node, PollLinkBase::Action action, size_t sig) {
+			slaveList[node]->onDelivered();
+			act(action, static_cast<uint8_t>(sig));
+		}
+
+		const Mixer& getMixer() const {
+			return m_mixer;
+		}
+
+		const PollMaster<Master>& getLink() const {
+			return *m_link;
+		}
+
+		uint32_t getRestarts() const {
+			return m_restarts;
+		}
+
+	protected:
+		virtual void loop() {
+			if(m_link->hasEvents()) {
+				m_link->process();
+			}
+		}
+
+	private:
+		size_t							m_slaves;
+		int									m_baud;
+		PollMaster<Master>*	m_link; ///<Se crea de nuevo al reiniciar
+		Mixer								m_mixer;
+		uint32_t						m_restarts;
+};
+
+static Master* master;
+
+///Reinicio del maestro
+class Restart : public TimerEvent {
+	protected:
+		virtual void fire() {
+			master->restart();
+		}
+};
+
+static void checkConvergence() {
+	const Mixer& reference = master->getMixer();
+	for(size_t i = 0; i < slaveList.size(); ++i) {
+		const Mixer& mixer = slaveList[i]->getMixer();
+		if(mixer.program != reference.program || mixer.preview != reference.preview) {
+			return;
+		}
+	}
+
+	const uint64_t now = VirtualTime::now();
+	while(!pendingActions.empty()) {
+		convergence.add(now - pendingActions.front());
+		pendingActions.pop_front();
+	}
+}
+
+
+
+/**
+ * \brief Operador guiado por una semilla: cada accion la hace una placa al azar
+ */
+class Operator : public TimerEvent {
+	public:
+		Operator(uint32_t seed, uint32_t intervalMs)
+			: m_seed(seed)
+			, m_intervalMs(intervalMs)
+			, m_actions(0)
+		{
+		}
+
+		void start() {
+			schedule(VirtualTime::now() + 1000000);
+		}
+
+		uint32_t getActions() const {
+			return m_actions;
+		}
+
+	protected:
+		virtual void fire() {
+			const size_t panel = random(slaveList.size() + 1);
+			const PollLinkBase::Action action = static_cast<PollLinkBase::Action>(random(PollLinkBase::ACTION_COUNT));
+			const uint8_t sig = static_cast<uint8_t>(random(SIGNAL_CNT));
+			pendingActions.push_back(VirtualTime::now());
+			++m_actions;
+			if(panel) {
+				slaveList[panel - 1]->act(action, sig);
+			} else {
+				master->act(action, sig);
+			}
+			schedule(VirtualTime::now() + 1000ULL * (m_intervalMs / 2 + random(m_intervalMs + 1)));
+		}
+
+	private:
+		uint32_t	m_seed;
+		uint32_t	m_intervalMs;
+		uint32_t	m_actions;
+
+		uint32_t random(uint32_t n) {
+			m_seed = m_seed * 1664525U + 1013904223U;
+			return (m_seed >> 8) % n;
+		}
+};
+
+
+
+int main(int argc, char** argv) {
+	uint32_t slaves = 16;
+	uint32_t seconds = 600;
+	uint32_t seed = 1;
+	uint32_t intervalMs = 500;
+	int baud = 115200;
+	long restartSecond = -1;
+	int option;
+	while((option = getopt(argc, argv, "n:t:s:i:e:b:r:")) != -1) {
+		switch(option) {
+			case 'n': slaves = std::strtoul(optarg, 0, 10); break;
+			case 't': seconds = std::strtoul(optarg, 0, 10); break;
+			case 's': seed = std::strtoul(optarg, 0, 10); break;
+			case 'i': intervalMs = std::strtoul(optarg, 0, 10); break;
+			case 'e': noiseRate = std::strtod(optarg, 0); break;
+			case 'b': baud = std::atoi(optarg); break;
+			case 'r': restartSecond = std::strtol(optarg, 0, 10); break;
+			default:
+				std::fprintf(stderr, "uso: %s [-n esclavos] [-t segundos] [-s semilla] [-i ms] [-e ruido] [-b baudios] [-r segundo]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(slaves < 1 || slaves > PollLinkBase::ADDRESS_MAX || intervalMs < 1 || baud < 1200) {
+		std::fprintf(stderr, "entre 1 y %u esclavos, intervalo de al menos 1ms, al menos 1200 baudios\n",
+			unsigned(PollLinkBase::ADDRESS_MAX));
+		return 2;
+	}
+	noiseSeed = seed;
+
+	master = new Master(slaves);
+	boardList.push_back(master);
+	for(uint32_t i = 0; i < slaves; ++i) {
+		slaveList.push_back(new Slave(static_cast<uint8_t>(i)));
+		boardList.push_back(slaveList.back());
+	}
+	for(size_t i = 0; i < slaveList.size(); ++i) {
+		slaveList[i]->start(baud);
+	}
+	master->start(baud);
+
+	Operator op(seed, intervalMs);
+	op.start();
+	Restart restart;
+	if(restartSecond >= 0) {
+		restart.schedule(restartSecond * 1000000ULL);
+	}
+
+	VirtualTime::setEnd(seconds * 1000000ULL);
+	const std::clock_t start = std::clock();
+	try {
+		for(;;) {
+			VirtualTime::waitForInterrupt();
+		}
+	} catch(const VirtualTime::End&) {
+	}
+	const double wall = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+	const PollMaster<Master>& link = master->getLink();
+	const uint32_t byteUs = PollLinkBase::byteUs(baud);
+	const uint32_t eventBoundUs = link.getCycleUs() + link.getSlotUs() + LOOP_US;
+	const uint32_t ledBoundUs = eventBoundUs + link.getCycleUs() + LOOP_US;
+	uint32_t retries = 0;
+	uint32_t dropped = 0;
+	size_t undelivered = 0;
+	for(size_t i = 0; i < slaveList.size(); ++i) {
+		retries += slaveList[i]->getLink().getRetries();
+		dropped += slaveList[i]->getLink().getDropped();
+		undelivered += slaveList[i]->getUndelivered();
+	}
+
+	const double simulated = VirtualTime::now() / 1e6;
+	std::printf("Simulados %.0f s en %.2f s (x%.0f), %u esclavos, semilla %u\n",
+		simulated, wall, wall > 0 ? simulated / wall : 0.0, slaves, seed);
+	std::printf("Bus (%d baudios, %u us por byte):\n", baud, byteUs);
+	std::printf("  %-24s %u us, ciclo %u us (%u x ranura)\n", "ranura",
+		link.getSlotUs(), link.getCycleUs(), slaves);
+	std::printf("  %-24s %u (%u sin cambios, %u con acciones)\n", "sondeos",
+		link.getPolls(), link.getIdle(), link.getDeltas());
+	std::printf("  %-24s %.2f%% (sondeos %.2f%%, respuestas %.2f%%)\n", "ocupacion",
+		100.0 * (masterBytes + slaveBytes) * byteUs / VirtualTime::now(),
+		100.0 * masterBytes * byteUs / VirtualTime::now(),
+		100.0 * slaveBytes * byteUs / VirtualTime::now());
+	std::printf("  %-24s %u colisiones, %u sin transmisor, %u con ruido\n", "bytes",
+		collisions, undriven, noisy);
+	std::printf("  %-24s %u erroneas, %u sin respuesta, %u repeticiones\n", "respuestas",
+		link.getErrors(), link.getSilent(), retries);
+	std::printf("Acciones (%u, %u descartadas):\n", op.getActions(), dropped);
+	eventLatency.print("esclavo -> maestro", "us");
+	std::printf("  %-24s %u us (ciclo + ranura + bucle)\n", "cota", eventBoundUs);
+	convergence.print("convergencia de leds", "us");
+	std::printf("  %-24s %u us (y un ciclo mas)\n", "cota", ledBoundUs);
+	std::printf("  %-24s %u\n", "sin converger al final", unsigned(pendingActions.size()));
+	std::printf("  %-24s %u (%u reinicios del maestro)\n", "sin entregar al final", unsigned(undelivered),
+		master->getRestarts());
+
+	for(size_t i = 0; i < slaveList.size(); ++i) {
+		delete slaveList[i];
+	}
+	slaveList.clear();
+	boardList.clear();
+	delete master;
+	return 0;
+}
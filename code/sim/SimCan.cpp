@@ -0,0 +1,226 @@
+#include "SimCanBus.h"
+
+#include <algorithm>
+
+uint32_t SimCanBus::s_bitrate = 100000;
+CAN* SimCanBus::s_sender = 0;
+uint32_t SimCanBus::s_frames = 0;
+uint64_t SimCanBus::s_busyUs = 0;
+uint32_t SimCanBus::s_unacked = 0;
+uint32_t SimCanBus::s_lost = 0;
+double SimCanBus::s_lossRate = 0;
+uint32_t SimCanBus::s_seed = 1;
+Stats SimCanBus::s_txDelay;
+
+std::vector<CAN*>& SimCanBus::nodes() {
+	static std::vector<CAN*>* list = new std::vector<CAN*>();
+	return *list;
+}
+
+SimCanBus::Transmission& SimCanBus::transmission() {
+	static Transmission* event = new Transmission();
+	return *event;
+}
+
+void SimCanBus::setLossRate(double rate, uint32_t seed) {
+	s_lossRate = rate;
+	s_seed = seed;
+}
+
+void SimCanBus::setBitrate(int hz) {
+	s_bitrate = hz;
+}
+
+uint32_t SimCanBus::frameBits(const CAN_Message& msg) {
+	//Campos sujetos al relleno: SOF, arbitraje, control, datos y CRC
+	bool bits[160];
+	size_t count = 0;
+	bits[count++] = 0; //SOF
+	if(msg.format == CANExtended) {
+		for(int i = 28; i >= 18; --i) bits[count++] = (msg.id >> i) & 1;
+		bits[count++] = 1; //SRR
+		bits[count++] = 1; //IDE
+		for(int i = 17; i >= 0; --i) bits[count++] = (msg.id >> i) & 1;
+		bits[count++] = msg.type == CANRemote; //RTR
+		bits[count++] = 0; //r1
+	} else {
+		for(int i = 10; i >= 0; --i) bits[count++] = (msg.id >> i) & 1;
+		bits[count++] = msg.type == CANRemote; //RTR
+		bits[count++] = 0; //IDE
+	}
+	bits[count++] = 0; //r0
+	const size_t len = std::min<size_t>(msg.len, 8);
+	for(int i = 3; i >= 0; --i) bits[count++] = (len >> i) & 1;
+	if(msg.type == CANData) {
+		for(size_t j = 0; j < len; ++j) {
+			for(int i = 7; i >= 0; --i) bits[count++] = (msg.data[j] >> i) & 1;
+		}
+	}
+
+	//CRC-15 (x^15 + x^14 + x^10 + x^8 + x^7 + x^4 + x^3 + 1)
+	uint16_t crc = 0;
+	for(size_t i = 0; i < count; ++i) {
+		const bool next = bits[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7FFF;
+		if(next) {
+			crc ^= 0x4599;
+		}
+	}
+	for(int i = 14; i >= 0; --i) bits[count++] = (crc >> i) & 1;
+
+	//Tras 5 bits iguales se inserta uno contrario, que cuenta para la siguiente racha
+	uint32_t total = count;
+	size_t run = 1;
+	bool level = bits[0];
+	for(size_t i = 1; i < count; ++i) {
+		if(bits[i] == level) {
+			if(++run == 5) {
+				++total;
+				level = !level;
+				run = 1;
+			}
+		} else {
+			level = bits[i];
+			run = 1;
+		}
+	}
+
+	//Delimitador del CRC, ACK y su delimitador, EOF y espacio entre tramas
+	return total + 1 + 2 + 7 + 3;
+}
+
+bool SimCanBus::lose() {
+	if(s_lossRate <= 0) {
+		return false;
+	}
+	s_seed = s_seed * 1664525U + 1013904223U;
+	return (s_seed >> 8) < s_lossRate * (1U << 24);
+}
+
+void SimCanBus::arbitrate() {
+	if(s_sender) {
+		return;
+	}
+
+	const std::vector<CAN*>& list = nodes();
+	CAN* winner = 0;
+	for(size_t i = 0; i < list.size(); ++i) {
+		CAN* node = list[i];
+		if(node->m_connected && !node->m_tx.empty() && (!winner || node->m_tx.front().id < winner->m_tx.front().id)) {
+			winner = node;
+		}
+	}
+	if(!winner) {
+		return;
+	}
+
+	const uint32_t bits = frameBits(winner->m_tx.front());
+	const uint32_t us = (bits * 1000000ULL + s_bitrate - 1) / s_bitrate;
+	s_sender = winner;
+	s_busyUs += us;
+	transmission().schedule(VirtualTime::now() + us);
+}
+
+void SimCanBus::finish() {
+	CAN* sender = s_sender;
+	s_sender = 0;
+	if(!sender || sender->m_tx.empty()) {
+		arbitrate();
+		return;
+	}
+
+	const CANMessage msg = sender->m_tx.front();
+	sender->m_tx.pop_front();
+	s_txDelay.add(VirtualTime::now() - sender->m_txQueuedUs.front());
+	sender->m_txQueuedUs.pop_front();
+	++s_frames;
+
+	const std::vector<CAN*>& list = nodes();
+	size_t receivers = 0;
+	for(size_t i = 0; i < list.size(); ++i) {
+		CAN* node = list[i];
+		if(node == sender || !node->m_connected) {
+			continue;
+		}
+		++receivers;
+		if(lose()) {
+			++s_lost;
+		} else if(node->m_rxFull) {
+			++node->m_overruns;
+		} else {
+			node->m_rx = msg;
+			node->m_rxFull = true;
+			node->m_irq[CAN::RxIrq].raise();
+		}
+	}
+	if(!receivers) {
+		++s_unacked;
+	}
+
+	sender->m_irq[CAN::TxIrq].raise();
+	arbitrate();
+}
+
+
+
+CAN::CAN(PinName rd, PinName td)
+	: m_connected(true)
+	, m_rxFull(false)
+	, m_overruns(0)
+{
+	(void)rd;
+	(void)td;
+	SimCanBus::nodes().push_back(this);
+}
+
+CAN::~CAN() {
+	std::vector<CAN*>& list = SimCanBus::nodes();
+	list.erase(std::find(list.begin(), list.end(), this));
+	if(SimCanBus::s_sender == this) {
+		SimCanBus::s_sender = 0;
+	}
+}
+
+int CAN::frequency(int hz) {
+	SimCanBus::setBitrate(hz);
+	return 1;
+}
+
+int CAN::write(CANMessage msg) {
+	if(!m_connected || m_tx.size() >= TX_BUFFERS) {
+		return 0;
+	}
+	m_tx.push_back(msg);
+	m_txQueuedUs.push_back(VirtualTime::now());
+	SimCanBus::arbitrate();
+	return 1;
+}
+
+int CAN::read(CANMessage& msg, int handle) {
+	(void)handle;
+	if(!m_rxFull) {
+		return 0;
+	}
+	msg = m_rx;
+	m_rxFull = false;
+	return 1;
+}
+
+void CAN::attach(Callback<void()> function, IrqType type) {
+	m_irq[type].function = function;
+}
+
+void CAN::setConnected(bool connected) {
+	m_connected = connected;
+	if(!connected) {
+		//La trama en curso termina, pero no se repite
+		if(SimCanBus::s_sender != this) {
+			m_tx.clear();
+			m_txQueuedUs.clear();
+		} else {
+			m_tx.resize(1);
+			m_txQueuedUs.resize(1);
+		}
+		m_rxFull = false;
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef SIM_CAN_BUS_H_INCLUDED
+#define SIM_CAN_BUS_H_INCLUDED
+
+#include "mbed.h"
+#include "SimStats.h"
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * \brief Bus CAN simulado que comparten todos los objetos CAN del proceso.
+ * Cuando el bus queda libre gana el arbitraje la trama de menor identificador
+ * de todos los buffers de transmision, y ocupa el bus los bits que tendria en
+ * el cable: campos, CRC, bits de relleno, ACK, EOF y el espacio entre tramas.
+ * Al terminar se entrega a los demas nodos conectados.
+ *
+ * Simplificaciones: sin errores de bit ni reintentos; una trama que nadie
+ * puede reconocer (nodo solo en el bus) se descarta en lugar de repetirse, y
+ * las perdidas se inyectan en la recepcion con setLossRate().
+ */
+class SimCanBus {
+	public:
+		/**
+		 * \brief Fija la probabilidad de que un receptor pierda una trama
+		 * \param seed: Semilla de las perdidas
+		 */
+		static void setLossRate(double rate, uint32_t seed);
+
+		/**
+		 * \brief Devuelve los bits de una trama en el bus, incluidos los de relleno
+		 */
+		static uint32_t frameBits(const CAN_Message& msg);
+
+		static uint32_t getFrames() {
+			return s_frames;
+		}
+
+		/**
+		 * \brief Devuelve el tiempo con el bus ocupado
+		 */
+		static uint64_t getBusyUs() {
+			return s_busyUs;
+		}
+
+		/**
+		 * \brief Devuelve las tramas descartadas por no haber receptores
+		 */
+		static uint32_t getUnacked() {
+			return s_unacked;
+		}
+
+		/**
+		 * \brief Devuelve las recepciones perdidas por setLossRate()
+		 */
+		static uint32_t getLost() {
+			return s_lost;
+		}
+
+		/**
+		 * \brief Tiempo desde que una trama entra en el controlador hasta que
+		 * termina de transmitirse
+		 */
+		static const Stats& getTxDelay() {
+			return s_txDelay;
+		}
+
+	private:
+		friend class CAN;
+
+		///Fin de la trama que ocupa el bus
+		class Transmission : public TimerEvent {
+			protected:
+				virtual void fire() {
+					SimCanBus::finish();
+				}
+		};
+
+		static uint32_t		s_bitrate;
+		static CAN*				s_sender; ///<Nodo que ocupa el bus. 0 = libre
+		static uint32_t		s_frames;
+		static uint64_t		s_busyUs;
+		static uint32_t		s_unacked;
+		static uint32_t		s_lost;
+		static double			s_lossRate;
+		static uint32_t		s_seed;
+		static Stats			s_txDelay;
+
+		/**
+		 * \brief Nodos del bus. No se destruye, como la lista de sucesos
+		 */
+		static std::vector<CAN*>& nodes();
+
+		static Transmission& transmission();
+
+		static void setBitrate(int hz);
+
+		/**
+		 * \brief Comienza el arbitraje si el bus esta libre
+		 */
+		static void arbitrate();
+
+		/**
+		 * \brief Entrega la trama transmitida y libera el bus
+		 */
+		static void finish();
+
+		static bool lose();
+};
+
+#endif //SIM_CAN_BUS_H_INCLUDED
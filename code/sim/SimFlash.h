@@ -0,0 +1,54 @@
+#ifndef SIM_FLASH_H_INCLUDED
+#define SIM_FLASH_H_INCLUDED
+
+#include <stdint.h>
+
+/**
+ * \brief Flash simulada para FlashIap. FlashJournal y Macro leen la flash
+ * directamente por su direccion, por lo que los sectores que escriben
+ * (25-29, 0x58000-0x7FFFF) se mapean en la misma direccion del proceso.
+ * Borrar y programar bloquean el reloj virtual lo mismo que la ROM IAP.
+ */
+class SimFlash {
+	public:
+		static const uint32_t BASE_ADDRESS = 0x58000;
+		static const uint32_t SIZE = 0x28000;
+		static const uint32_t ERASE_US = 100000; ///<Borrado de un sector de 32KB
+		static const uint32_t PROGRAM_US = 1000; ///<Programacion de una pagina
+
+		/**
+		 * \brief Mapea los sectores en blanco. Llamar antes que el firmware
+		 * \returns false si la direccion no esta libre
+		 */
+		static bool map();
+
+		static uint32_t getErases() {
+			return s_erases;
+		}
+
+		static uint32_t getPageWrites() {
+			return s_pageWrites;
+		}
+
+		/**
+		 * \brief Devuelve el tiempo total con las interrupciones bloqueadas
+		 */
+		static uint64_t getStallUs() {
+			return s_stallUs;
+		}
+
+	private:
+		friend class FlashIap;
+
+		static uint32_t	s_erases;
+		static uint32_t	s_pageWrites;
+		static uint64_t	s_stallUs;
+
+		/**
+		 * \brief Devuelve la direccion de un sector, o 0 si no esta simulado
+		 */
+		static uint8_t* sectorAt(uint32_t sector);
+
+};
+
+#endif //SIM_FLASH_H_INCLUDED
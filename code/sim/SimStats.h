@@ -0,0 +1,44 @@
+#ifndef SIM_STATS_H_INCLUDED
+#define SIM_STATS_H_INCLUDED
+
+#include <stdint.h>
+#include <cstdio>
+
+/**
+ * \brief Minimo, maximo y media de una serie de medidas
+ */
+class Stats {
+	public:
+		Stats()
+			: m_min(~uint64_t(0))
+			, m_max(0)
+			, m_sum(0)
+			, m_count(0)
+		{
+		}
+
+		void add(uint64_t value) {
+			if(value < m_min) m_min = value;
+			if(value > m_max) m_max = value;
+			m_sum += value;
+			++m_count;
+		}
+
+		void print(const char* name, const char* unit) const {
+			if(m_count) {
+				std::printf("  %-24s min %llu, avg %llu, max %llu %s (%llu)\n", name,
+					(unsigned long long)m_min, (unsigned long long)(m_sum / m_count),
+					(unsigned long long)m_max, unit, (unsigned long long)m_count);
+			} else {
+				std::printf("  %-24s -\n", name);
+			}
+		}
+
+	private:
+		uint64_t	m_min;
+		uint64_t	m_max;
+		uint64_t	m_sum;
+		uint64_t	m_count;
+};
+
+#endif //SIM_STATS_H_INCLUDED
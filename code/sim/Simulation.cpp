@@ -0,0 +1,944 @@
+/**
+ * \file
+ * \brief Simulacion del firmware completo en el ordenador, en tiempo virtual.
+ *
+ * Se compila el main.cpp real (con main() renombrado) sobre el mbed.h de
+ * este directorio, junto a un modelo de la placa: la cadena de 74HC165 con
+ * los botones, la de 74HC595 con los leds, la flash y el host. Un operador
+ * guiado por una semilla pulsa los botones, y al final se informa del ritmo
+ * de refresco, la latencia de los eventos y la ocupacion de la USART. Una
+ * hora simulada tarda unos segundos, y el resultado solo depende de la
+ * semilla, por lo que sirve para comparar cambios de planificacion antes de
+ * grabar la placa. Termina con 1 si alguna pulsacion no llega al host o a
+ * los leds (eventos perdidos).
+ *
+ * Desde el directorio del firmware (code/):
+ *   g++ -O2 -Isim -o micro-mixer-sim sim/Simulation.cpp sim/VirtualTime.cpp \
+ *       sim/mbed.cpp sim/FlashIap.cpp sim/SimCan.cpp FlashJournal.cpp Macro.cpp \
+ *       PinTrace.cpp
+ *   ./micro-mixer-sim [-t segundos] [-s semilla] [-b us] [-d segundo] [-l segundo] [-v] [-w fichero]
+ *     -t: Tiempo simulado (3600 por defecto)
+ *     -s: Semilla del operador (1 por defecto)
+ *     -b: Rebote de los contactos al pulsar y al soltar (0 por defecto). Las
+ *         acciones que el firmware repite o cambia por los rebotes se cuentan
+ *         como eventos de mas
+ *     -d: Pide un volcado de la caja negra en ese segundo. El volcado se
+ *         reproduce a traves del MixerController (BlackBoxReplay.h) y se
+ *         comprueba que da los mismos eventos que el firmware. Termina con 1
+ *         si no coinciden
+ *     -l: Con -DMIDI_OUTPUT, envia en ese segundo una nota de previo (tally)
+ *         y mide cuanto tarda en llegar a los leds. Con -DTSL_TALLY, conecta
+ *         en ese segundo un mezclador de video que sigue las lineas del panel
+ *         y devuelve la senalizacion TSL de las fuentes que cambian. Con
+ *         -DCAN_LINK, otro panel del bus empieza en ese segundo a cambiar el
+ *         estado compartido cada pocos segundos; con -d posterior, el volcado
+ *         reproduce sus acciones (EVENT_LINK_*)
+ *     -v: Muestra las lineas que envia el firmware
+ *     -w: Con -DPIN_TRACE, guarda al final los ultimos flancos de la cadena en
+ *         VCD. El codigo se ejecuta en tiempo cero, asi que los flancos de una
+ *         misma interrupcion comparten instante: se ve el orden y la duracion
+ *         de las tramas, no los margenes de setup y hold
+ * Se admiten SCAN_MODE_TICK (por defecto) y SCAN_MODE_BCM (-DSCAN_MODE=1).
+ * SCAN_MODE_TIMER programa el TIMER2 directamente y no se simula.
+ * Con -DCAN_LINK el panel esta solo en el bus CAN simulado, salvo el panel
+ * de -l; los enlaces entre varios paneles se simulan con CanSimulation.cpp.
+ * Con -DMIDI_OUTPUT los mensajes MIDI se traducen a la linea de texto
+ * equivalente, por lo que la latencia y los bytes por evento se comparan
+ * directamente con los del protocolo de texto.
+ * Con -DTSL_TALLY y -l los leds muestran la senalizacion del mezclador de
+ * video, por lo que la latencia de los leds incluye la ida y vuelta por el.
+ */
+
+#include "mbed.h"
+#include "SimFlash.h"
+#include "SimStats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <unistd.h>
+
+#if defined(SCAN_MODE) && SCAN_MODE == 2
+	#error "SCAN_MODE_TIMER no se simula"
+#endif
+
+
+
+//Cableado de la cadena, como en main.cpp (SCAN_MODE_TICK y SCAN_MODE_BCM)
+static const PinName PIN_CLK = p14;
+static const PinName PIN_LATCH = p13;
+static const PinName PIN_LOAD = p8;
+static const PinName PIN_DIN = p11;
+static const PinName PIN_DOUT = p12;
+static const int TAIL_LEVEL = 0; //SER del ultimo 74HC165
+
+//Estado de la placa. Sin constructores: lo usan los objetos estaticos del firmware
+static int pinLevel[PIN_COUNT];
+static uint32_t buttons; //Pulsados, activo alto
+static uint32_t inShift; //74HC165
+static uint32_t outShift; //74HC595
+static uint32_t leds; //Salidas de los 74HC595
+static uint64_t lastFrameUs;
+static uint64_t lastLedChangeUs;
+static bool verbose;
+
+static Stats frameInterval;
+static Stats latencyLeds;
+static Stats latencyLine;
+static Stats latencyTally;
+static Stats backlog;
+static uint64_t bytesSent;
+static uint64_t eventBytes; //Bytes de los eventos del mezclador reconocidos
+static uint32_t eventCount;
+static uint32_t missedEvents;
+static uint32_t extraEvents; //Cortes y transiciones sin pulsacion que los pida
+static uint32_t maskedButtons;
+
+//Cadena antes de BOOT_STAGE_FIRST_INPUT
+static uint32_t bootShifts; //Bits de entrada desplazados tras la primera carga
+static uint32_t bootLoads;
+static uint32_t bootLatches;
+
+
+
+#define main firmwareMain
+#include "../main.cpp"
+#undef main
+
+#include "BlackBoxReplay.h"
+
+
+
+static const uint32_t IN_MASK = (1U << MixerControllerBase::BUTTON_INDEX_COUNT) - 1;
+static const uint32_t OUT_MASK = (1U << MixerControllerBase::LED_INDEX_COUNT) - 1;
+
+///Accion del operador pendiente de verse en el panel y en el host
+struct Expectation {
+	uint64_t		pressUs;
+	std::string	line; ///<Linea que debe enviar el firmware
+	bool				leds; ///<Deben cambiar los leds
+	bool				lineSeen;
+	bool				ledsSeen;
+};
+
+static std::deque<Expectation> expected;
+///Otro (tally o panel del bus) mueve tambien programa y previo: sus leds ya
+///no dependen solo del operador
+static bool remoteState;
+static BlackBoxReplay blackBoxReplay(false);
+static std::string txLine;
+static uint64_t tallyUs; //Senalizacion MIDI pendiente de verse en los leds
+static bool tallyPending;
+static void onTallyLeds();
+static void onSwitcherLine(const std::string& line);
+
+#ifdef MIDI_OUTPUT
+static const int HOST_BAUD = MidiLinkBase::BAUD;
+static uint8_t midiStatus; //Estado en curso de lo recibido
+static uint8_t midiData[2];
+static size_t midiCount;
+static size_t midiBytes; //Bytes del mensaje en curso, con el estado si lo lleva
+
+static size_t hostPending() {
+	return midi().getPending();
+}
+#else
+static const int HOST_BAUD = 9600;
+
+static size_t hostPending() {
+	return events().getPending();
+}
+#endif
+
+void SimBoard::write(PinName pin, int value) {
+	const int previous = pinLevel[pin];
+	pinLevel[pin] = value;
+	if(previous == value) {
+		return;
+	}
+
+	const bool booting = !bootProbe.isMarked(BootProbe::BOOT_STAGE_FIRST_INPUT);
+	if(pin == PIN_CLK && value) {
+		//El 74HC165 desplaza si no esta cargando; el 74HC595, siempre
+		if(pinLevel[PIN_LOAD]) {
+			inShift = (inShift << 1) | TAIL_LEVEL;
+			if(booting && bootLoads) {
+				++bootShifts;
+			}
+		}
+		outShift = ((outShift << 1) | pinLevel[PIN_DOUT]) & OUT_MASK;
+
+	} else if(pin == PIN_LOAD) {
+		//El 74HC165 toma las entradas paralelas mientras carga
+		inShift = ~buttons & IN_MASK;
+
+		//Comienzo de trama
+		if(!value) {
+			if(booting) {
+				++bootLoads;
+			}
+			const uint64_t now = VirtualTime::now();
+			if(lastFrameUs) {
+				frameInterval.add(now - lastFrameUs);
+			}
+			lastFrameUs = now;
+		}
+
+	} else if(pin == PIN_LATCH && value && booting) {
+		++bootLatches;
+		leds = outShift;
+
+	} else if(pin == PIN_LATCH && value && leds != outShift) {
+		leds = outShift;
+		lastLedChangeUs = VirtualTime::now();
+		onTallyLeds();
+		if(tallyPending) {
+			tallyPending = false;
+			latencyTally.add(lastLedChangeUs - tallyUs);
+			return;
+		}
+		for(size_t i = 0; i < expected.size(); ++i) {
+			if(expected[i].leds && !expected[i].ledsSeen) {
+				expected[i].ledsSeen = true;
+				latencyLeds.add(lastLedChangeUs - expected[i].pressUs);
+				break;
+			}
+		}
+	}
+}
+
+int SimBoard::read(PinName pin) {
+	if(pin != PIN_DIN) {
+		return pinLevel[pin];
+	}
+
+	//Cargando, la salida sigue a las entradas paralelas (activas a nivel bajo)
+	if(!pinLevel[PIN_LOAD]) {
+		inShift = ~buttons & IN_MASK;
+	}
+	return (inShift >> (MixerControllerBase::BUTTON_INDEX_COUNT - 1)) & 1;
+}
+
+/**
+ * \brief El host ha recibido una linea (o su equivalente MIDI) de bytes bytes
+ */
+static void onHostLine(const std::string& line, size_t bytes) {
+	if(verbose) {
+		std::printf("%10.6f %s\n", VirtualTime::now() / 1e6, line.c_str());
+	}
+	onSwitcherLine(line);
+	blackBoxReplay.onLine(line);
+	for(size_t i = 0; i < expected.size(); ++i) {
+		if(!expected[i].lineSeen && expected[i].line == line) {
+			expected[i].lineSeen = true;
+			latencyLine.add(VirtualTime::now() - expected[i].pressUs);
+			eventBytes += bytes;
+			++eventCount;
+			return;
+		}
+	}
+
+	//Cada corte o transicion responde a una sola pulsacion
+	if(line == "cut" || line == "trans") {
+		++extraEvents;
+	} else if(line.compare(0, 5, "mask ") == 0) {
+		++maskedButtons;
+	}
+}
+
+void SimBoard::transmit(PinName tx, char c) {
+	(void)tx;
+	++bytesSent;
+	backlog.add(hostPending());
+#ifdef MIDI_OUTPUT
+	//Mensajes de canal con estado en curso, traducidos a la linea de texto
+	const uint8_t byte = static_cast<uint8_t>(c);
+	++midiBytes;
+	if(byte & 0x80) {
+		midiStatus = byte;
+		midiCount = 0;
+		return;
+	}
+	midiData[midiCount++] = byte;
+	if(!midiStatus || midiCount < MidiLinkBase::dataLength(midiStatus)) {
+		return;
+	}
+	midiCount = 0;
+	static const char* const NAMES[MidiLinkBase::ACTION_COUNT] = {"pgm", "pvw", "cut", "trans"};
+	MidiLinkBase::Action action;
+	size_t sig;
+	if(MidiLinkBase::decode(midiStatus, midiData[0], midiData[1], action, sig)) {
+		std::string line = NAMES[action];
+		if(MidiLinkBase::getMapping(action).hasSignal) {
+			char number[12];
+			std::sprintf(number, " %u", static_cast<unsigned>(sig));
+			line += number;
+		}
+		onHostLine(line, midiBytes);
+	}
+	midiBytes = 0;
+#else
+	if(c != '\n') {
+		txLine += c;
+		return;
+	}
+	onHostLine(txLine, txLine.size() + 1);
+	txLine.clear();
+#endif
+}
+
+
+
+/**
+ * \brief Operador guiado por una semilla: elige una senal en previo, la pasa
+ * a programa con un corte o una transicion y a veces deja el panel en reposo
+ * un rato largo. Las pulsaciones duran menos que una pulsacion larga y estan
+ * separadas mas que una doble pulsacion, por lo que cada una produce un evento
+ */
+///Contactos de los botones pulsados por el operador
+class ContactBounce : public TimerEvent {
+	public:
+		ContactBounce()
+			: m_seed(1)
+			, m_bounceUs(0)
+			, m_target(0)
+			, m_bouncing(0)
+			, m_endUs(0)
+		{
+		}
+
+		/**
+		 * \brief Configura el rebote
+		 * \param bounceUs: Duracion del rebote. 0 para cambiar de una vez
+		 * \param seed: Semilla, distinta de la del operador
+		 */
+		void setup(uint32_t bounceUs, uint32_t seed) {
+			m_bounceUs = bounceUs;
+			m_seed = seed;
+		}
+
+		/**
+		 * \brief Lleva los botones a un estado. Los bits que cambian rebotan
+		 * durante bounceUs antes de quedarse en el valor final
+		 */
+		void set(uint32_t target) {
+			m_target = target;
+			if(!m_bounceUs) {
+				buttons = target;
+				return;
+			}
+			m_bouncing = buttons ^ target;
+			m_endUs = VirtualTime::now() + m_bounceUs;
+			fire();
+		}
+
+	protected:
+		virtual void fire() {
+			const uint64_t now = VirtualTime::now();
+			if(now >= m_endUs) {
+				buttons = m_target;
+				return;
+			}
+			buttons ^= m_bouncing;
+			const uint64_t next = now + 50 + random(450);
+			schedule(next < m_endUs ? next : m_endUs);
+		}
+
+	private:
+		uint32_t	m_seed;
+		uint32_t	m_bounceUs;
+		uint32_t	m_target;
+		uint32_t	m_bouncing;
+		uint64_t	m_endUs;
+
+		uint32_t random(uint32_t n) {
+			m_seed = m_seed * 1664525U + 1013904223U;
+			return (m_seed >> 8) % n;
+		}
+};
+
+static ContactBounce contacts;
+
+
+
+class Operator : public TimerEvent {
+	public:
+		explicit Operator(uint32_t seed)
+			: m_seed(seed)
+			, m_step(STEP_PREVIEW)
+			, m_pressed(false)
+			, m_program(MixerControllerBase::PROGRAM_CNT)
+			, m_preview(MixerControllerBase::PREVIEW_CNT)
+		{
+		}
+
+		void start() {
+			schedule(VirtualTime::now() + 100000);
+		}
+
+	protected:
+		virtual void fire() {
+			const uint64_t now = VirtualTime::now();
+
+			//Soltar el boton anterior
+			if(m_pressed) {
+				m_pressed = false;
+				contacts.set(0);
+				schedule(now + ms(300, 3000));
+				return;
+			}
+
+			//Si otro mueve tambien el estado, el operador mira el panel antes
+			//de elegir
+			if(remoteState) {
+				m_program = mixer.getProgram();
+				m_preview = mixer.getPreview();
+			}
+
+			switch(m_step) {
+				case STEP_PREVIEW: {
+					if(random(10) == 0) {
+						//Reposo largo: el refresco debe bajar de ritmo
+						schedule(now + ms(10000, 120000));
+						return;
+					}
+					size_t sig;
+					do {
+						sig = random(MixerControllerBase::PREVIEW_CNT);
+					} while(sig == m_preview);
+					m_preview = sig;
+					press(MixerControllerBase::BUTTON_INDEX_PREVIEW0 + sig, "pvw", sig, true);
+					m_step = STEP_TAKE;
+					break;
+				}
+
+				case STEP_TAKE: {
+					const bool cut = random(5) != 0;
+					const bool changes = m_program != m_preview;
+					std::swap(m_program, m_preview);
+					press(cut ? MixerControllerBase::BUTTON_INDEX_CUT : MixerControllerBase::BUTTON_INDEX_TRANSITION,
+								cut ? "cut" : "trans", NO_ARG, changes);
+					m_step = STEP_PREVIEW;
+					break;
+				}
+			}
+			schedule(now + ms(60, 200));
+		}
+
+	private:
+		enum Step {
+			STEP_PREVIEW,
+			STEP_TAKE
+		};
+
+		static const size_t NO_ARG = ~size_t(0);
+
+		uint32_t	m_seed;
+		Step			m_step;
+		bool			m_pressed;
+		size_t		m_program; ///<Lo que deberia haber en programa
+		size_t		m_preview; ///<Lo que deberia haber en previo
+
+		uint32_t random(uint32_t n) {
+			m_seed = m_seed * 1664525U + 1013904223U;
+			return (m_seed >> 8) % n;
+		}
+
+		uint64_t ms(uint32_t min, uint32_t max) {
+			return 1000ULL * (min + random(max - min + 1));
+		}
+
+		void press(size_t button, const char* name, size_t arg, bool ledsChange) {
+			//Lo que no se ha visto de la accion anterior se ha perdido
+			while(!expected.empty()) {
+				const Expectation& last = expected.front();
+				if(!last.lineSeen || (last.leds && !last.ledsSeen)) {
+					++missedEvents;
+				}
+				expected.pop_front();
+			}
+
+			Expectation e;
+			e.pressUs = VirtualTime::now();
+			e.line = name;
+			if(arg != NO_ARG) {
+				char number[12];
+				std::sprintf(number, " %u", static_cast<unsigned>(arg));
+				e.line += number;
+			}
+			//Con otro moviendo el estado, los leds de programa y previo siguen a
+			//su senalizacion y no a la pulsacion: solo se espera la linea
+			e.leds = ledsChange && !remoteState;
+			e.lineSeen = false;
+			e.ledsSeen = false;
+			expected.push_back(e);
+
+			m_pressed = true;
+			contacts.set(1U << button);
+		}
+};
+
+
+
+///Peticion de volcado de la caja negra desde el host
+class DumpRequest : public TimerEvent {
+	protected:
+		virtual void fire() {
+			host().receive('d');
+		}
+};
+
+///Senalizacion del mezclador por software: otra senal en previo
+class TallyNote : public TimerEvent {
+	protected:
+		virtual void fire() {
+#ifdef MIDI_OUTPUT
+			const size_t sig = (toArg(mixer.getPreview()) + 1) % MixerControllerBase::PREVIEW_CNT;
+			uint8_t message[MidiLinkBase::MESSAGE_MAX];
+			const size_t length = MidiLinkBase::encode(message, MidiLinkBase::ACTION_PREVIEW, sig, MIDI_CHANNEL - 1);
+			tallyUs = VirtualTime::now();
+			tallyPending = true;
+			remoteState = true;
+			for(size_t i = 0; i < length; ++i) {
+				host().receive(static_cast<char>(message[i]));
+			}
+#endif
+		}
+};
+
+#ifdef CAN_LINK
+/**
+ * \brief Otro panel del bus CAN. Cada PERIOD_US publica una accion sobre el
+ * estado del panel simulado, con una version mas: cambio de previo, corte y
+ * un estado distinto sin accion, que el panel debe imponer
+ */
+class LinkPeer : public TimerEvent {
+	public:
+		static const uint64_t PERIOD_US = 7000000;
+
+		LinkPeer()
+			: m_can(p30, p29)
+			, m_step(0)
+			, m_sent(0)
+		{
+		}
+
+		uint32_t getSent() const {
+			return m_sent;
+		}
+
+	protected:
+		virtual void fire() {
+			const uint8_t node = static_cast<uint8_t>((CAN_NODE_ID + 1) % CanLinkBase::NODE_MAX);
+			const uint16_t version = static_cast<uint16_t>(panelLink.getVersion() + 1);
+			uint8_t program = toArg(mixer.getProgram());
+			uint8_t preview = toArg(mixer.getPreview());
+			CanLinkBase::Action action = CanLinkBase::ACTION_NONE;
+			switch(m_step++ % 3) {
+				case 0:
+					action = CanLinkBase::ACTION_PREVIEW;
+					preview = static_cast<uint8_t>((preview + 1) % MixerControllerBase::PREVIEW_CNT);
+					break;
+				case 1:
+					action = CanLinkBase::ACTION_CUT;
+					std::swap(program, preview);
+					break;
+				default:
+					program = static_cast<uint8_t>((program + 3) % MixerControllerBase::PROGRAM_CNT);
+					break;
+			}
+
+			char data[CanLinkBase::FRAME_LENGTH];
+			data[CanLinkBase::FIELD_VERSION_LOW] = static_cast<char>(version & 0xFF);
+			data[CanLinkBase::FIELD_VERSION_HIGH] = static_cast<char>(version >> 8);
+			data[CanLinkBase::FIELD_ORIGIN] = static_cast<char>(node);
+			data[CanLinkBase::FIELD_PROGRAM] = static_cast<char>(program);
+			data[CanLinkBase::FIELD_PREVIEW] = static_cast<char>(preview);
+			data[CanLinkBase::FIELD_FLAGS] = static_cast<char>(action);
+			if(m_can.write(CANMessage(CanLinkBase::ID_BASE + node, data, CanLinkBase::FRAME_LENGTH))) {
+				++m_sent;
+				remoteState = true;
+			}
+			schedule(VirtualTime::now() + PERIOD_US);
+		}
+
+	private:
+		CAN				m_can;
+		uint32_t	m_step;
+		uint32_t	m_sent;
+};
+#endif
+
+#ifdef TSL_TALLY
+/**
+ * \brief Mezclador de video con senalizacion TSL. Sigue las lineas del panel
+ * y, tras su tiempo de proceso, envia un mensaje por cada fuente cuya
+ * senalizacion cambia. Al conectarse envia todas. Cada CUT_PERIOD_US hace
+ * ademas un corte por su cuenta, como si lo pulsara otro operador, que suele
+ * llegar con el panel en reposo y el refresco al ritmo lento
+ */
+class TslSwitcher : public TimerEvent {
+	public:
+		static const uint32_t PROCESS_US = 20000; //Un cuadro de video
+		static const uint64_t CUT_PERIOD_US = 37000000;
+
+		TslSwitcher()
+			: m_connected(false)
+			, m_program(NONE)
+			, m_preview(NONE)
+			, m_sentLeds(0)
+			, m_unmeasured(0)
+			, m_sent(0)
+		{
+		}
+
+		void connect() {
+			m_connected = true;
+			for(size_t i = 0; i < SOURCE_CNT; ++i) {
+				queue(i);
+			}
+			m_unmeasured = SOURCE_CNT;
+			startSending(VirtualTime::now());
+		}
+
+		void onLine(const std::string& line) {
+			unsigned sig;
+			const uint8_t program = m_program;
+			const uint8_t preview = m_preview;
+			if(std::sscanf(line.c_str(), "pgm %u", &sig) == 1) {
+				m_program = sig < SOURCE_CNT ? static_cast<uint8_t>(sig) : NONE;
+			} else if(std::sscanf(line.c_str(), "pvw %u", &sig) == 1) {
+				m_preview = sig < SOURCE_CNT ? static_cast<uint8_t>(sig) : NONE;
+			} else if(line == "cut" || line == "trans") {
+				std::swap(m_program, m_preview);
+			} else {
+				return;
+			}
+			if(!m_connected) {
+				return;
+			}
+			for(size_t i = 0; i < SOURCE_CNT; ++i) {
+				if(tallies(i, program, preview) != tallies(i, m_program, m_preview)) {
+					queue(i);
+				}
+			}
+			startSending(VirtualTime::now() + PROCESS_US);
+		}
+
+		/**
+		 * \brief Los leds han cambiado: se han visto los mensajes enviados
+		 * hasta el ultimo que coincide con ellos
+		 */
+		void onLeds(uint32_t word) {
+			for(size_t i = m_shown.size(); i > 0; --i) {
+				if(m_shown[i - 1].leds == word) {
+					for(size_t j = 0; j < i; ++j) {
+						latencyTally.add(VirtualTime::now() - m_shown.front().us);
+						m_shown.pop_front();
+					}
+					return;
+				}
+			}
+		}
+
+		uint32_t getSent() const {
+			return m_sent;
+		}
+
+		size_t getUnseen() const {
+			return m_shown.size();
+		}
+
+	protected:
+		///Siguiente byte por la linea
+		virtual void fire() {
+			const uint8_t c = m_tx.front();
+			m_tx.pop_front();
+			tslPort.receive(static_cast<char>(c));
+			if(m_tx.size() % TslTallyBase::MESSAGE_LENGTH == 0) {
+				onMessageSent();
+			}
+			if(!m_tx.empty()) {
+				schedule(VirtualTime::now() + BYTE_US);
+			}
+		}
+
+	private:
+		static const size_t SOURCE_CNT = MixerControllerBase::PROGRAM_CNT;
+		static const uint8_t NONE = 0xFF;
+		static const uint32_t BYTE_US = (TslTallyBase::BYTE_BITS * 1000000 + TslTallyBase::BAUD - 1) / TslTallyBase::BAUD;
+
+		///Leds que deben verse tras un mensaje
+		struct Shown {
+			uint64_t	us; ///<Ultimo byte del mensaje
+			uint32_t	leds;
+		};
+
+		bool							m_connected;
+		uint8_t						m_program;
+		uint8_t						m_preview;
+		std::deque<uint8_t>	m_tx;
+		std::deque<uint8_t>	m_txSources; ///<Fuente de cada mensaje en m_tx
+		uint32_t					m_sentLeds; ///<Leds de lo ya enviado
+		size_t						m_unmeasured; ///<Mensajes de la conexion: pueden no cambiar los leds
+		std::deque<Shown>	m_shown;
+		uint32_t					m_sent;
+
+		static uint8_t tallies(size_t source, uint8_t program, uint8_t preview) {
+			return static_cast<uint8_t>((source == program ? 1 << TslTallyBase::PROGRAM_TALLY : 0)
+				| (source == preview ? 1 << TslTallyBase::PREVIEW_TALLY : 0));
+		}
+
+		///Encola el mensaje de una fuente. Se codifica al enviarse el primer byte
+		void queue(size_t source) {
+			m_txSources.push_back(static_cast<uint8_t>(source));
+		}
+
+		void startSending(uint64_t us) {
+			if(!isScheduled() && m_tx.empty() && encodeNext()) {
+				schedule(us);
+			}
+		}
+
+		///Pasa el siguiente mensaje pendiente a la linea con el estado actual
+		bool encodeNext() {
+			if(m_txSources.empty()) {
+				return false;
+			}
+			const size_t source = m_txSources.front();
+			char text[TslTallyBase::DISPLAY_LENGTH + 1];
+			std::sprintf(text, "CAM %u", static_cast<unsigned>(source + 1));
+			uint8_t message[TslTallyBase::MESSAGE_LENGTH];
+			TslTallyBase::encode(message, static_cast<uint8_t>(TSL_ADDRESS + source),
+				tallies(source, m_program, m_preview), TslTallyBase::BRIGHTNESS_MAX, text);
+			m_tx.insert(m_tx.end(), message, message + TslTallyBase::MESSAGE_LENGTH);
+			return true;
+		}
+
+		void onMessageSent() {
+			const size_t source = m_txSources.front();
+			m_txSources.pop_front();
+			++m_sent;
+			const uint32_t program = LED_FRAME_BIT(MixerControllerBase::LED_INDEX_PROGRAM0 + source);
+			const uint32_t preview = LED_FRAME_BIT(MixerControllerBase::LED_INDEX_PREVIEW0 + source);
+			const uint8_t bits = tallies(source, m_program, m_preview);
+			m_sentLeds = (m_sentLeds & ~(program | preview))
+				| ((bits & (1 << TslTallyBase::PROGRAM_TALLY)) ? program : 0)
+				| ((bits & (1 << TslTallyBase::PREVIEW_TALLY)) ? preview : 0);
+			//Los mensajes que no cambian los leds no se miden
+			if(m_unmeasured) {
+				--m_unmeasured;
+			} else if(!m_shown.empty() || m_sentLeds != leds) {
+				Shown shown;
+				shown.us = VirtualTime::now();
+				shown.leds = m_sentLeds;
+				m_shown.push_back(shown);
+			}
+			encodeNext();
+		}
+};
+
+static TslSwitcher tslSwitcher;
+
+static void onTallyLeds() {
+	tslSwitcher.onLeds(leds);
+}
+
+static void onSwitcherLine(const std::string& line) {
+	tslSwitcher.onLine(line);
+}
+
+///Conexion del mezclador de video y sus cortes por su cuenta
+class TallyConnect : public TimerEvent {
+	public:
+		TallyConnect()
+			: m_connected(false)
+		{
+		}
+
+	protected:
+		virtual void fire() {
+			if(m_connected) {
+				tslSwitcher.onLine("cut");
+			} else {
+				tslSwitcher.connect();
+				m_connected = true;
+				remoteState = true;
+			}
+			schedule(VirtualTime::now() + TslSwitcher::CUT_PERIOD_US);
+		}
+
+	private:
+		bool	m_connected;
+};
+#else
+static void onTallyLeds() {
+}
+
+static void onSwitcherLine(const std::string&) {
+}
+#endif
+
+/**
+ * \brief Guarda en VCD los flancos registrados por PinTrace
+ */
+static bool writeTrace(const char* path) {
+#ifdef PIN_TRACE
+	FILE* file = std::fopen(path, "w");
+	if(!file) {
+		std::fprintf(stderr, "no se puede crear %s\n", path);
+		return false;
+	}
+	const size_t edges = PinTrace::getCount();
+	char line[PinTrace::LINE_LENGTH];
+	PinTrace::startExport();
+	while(PinTrace::readLine(line)) {
+		std::fprintf(file, "%s\n", line);
+	}
+	std::fclose(file);
+	std::printf("Flancos:\n");
+	std::printf("  %-24s %u en %s\n", "guardados", unsigned(edges), path);
+	return true;
+#else
+	(void)path;
+	std::fprintf(stderr, "-w necesita compilar con -DPIN_TRACE\n");
+	return false;
+#endif
+}
+
+int main(int argc, char** argv) {
+	uint32_t seconds = 3600;
+	uint32_t seed = 1;
+	uint32_t bounceUs = 0;
+	long dumpSecond = -1;
+	long tallySecond = -1;
+	const char* tracePath = 0;
+	int option;
+	while((option = getopt(argc, argv, "t:s:b:d:l:vw:")) != -1) {
+		switch(option) {
+			case 't': seconds = std::strtoul(optarg, 0, 10); break;
+			case 's': seed = std::strtoul(optarg, 0, 10); break;
+			case 'b': bounceUs = std::strtoul(optarg, 0, 10); break;
+			case 'd': dumpSecond = std::strtol(optarg, 0, 10); break;
+			case 'l': tallySecond = std::strtol(optarg, 0, 10); break;
+			case 'v': verbose = true; break;
+			case 'w': tracePath = optarg; break;
+			default:
+				std::fprintf(stderr, "uso: %s [-t segundos] [-s semilla] [-b us] [-d segundo] [-l segundo] [-v] [-w fichero]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if(!SimFlash::map()) {
+		std::fprintf(stderr, "no se puede mapear la flash en 0x%X\n", SimFlash::BASE_ADDRESS);
+		return 1;
+	}
+
+	contacts.setup(bounceUs, ~seed);
+	Operator op(seed);
+	op.start();
+	DumpRequest dump;
+	if(dumpSecond >= 0) {
+		dump.schedule(dumpSecond * 1000000ULL);
+	}
+#ifdef TSL_TALLY
+	TallyConnect tally;
+#elif defined(CAN_LINK) && !defined(MIDI_OUTPUT)
+	LinkPeer tally;
+#else
+	TallyNote tally;
+#endif
+	if(tallySecond >= 0) {
+#if !defined(MIDI_OUTPUT) && !defined(TSL_TALLY) && !defined(CAN_LINK)
+		std::fprintf(stderr, "-l necesita compilar con -DMIDI_OUTPUT, -DTSL_TALLY o -DCAN_LINK\n");
+		return 2;
+#endif
+		tally.schedule(tallySecond * 1000000ULL);
+	}
+
+	VirtualTime::setEnd(seconds * 1000000ULL);
+	const std::clock_t start = std::clock();
+	try {
+		firmwareMain();
+	} catch(const VirtualTime::End&) {
+	}
+	const double wall = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+	const double simulated = VirtualTime::now() / 1e6;
+	std::printf("Simulados %.0f s en %.2f s (x%.0f), SCAN_MODE %d, semilla %u\n",
+		simulated, wall, wall > 0 ? simulated / wall : 0.0, SCAN_MODE, seed);
+	//La primera palabra de botones esta entera tras BUTTON_INDEX_COUNT - 1
+	//desplazamientos: el primer bit sale al cargar
+	std::printf("Arranque (hasta BOOT_STAGE_FIRST_INPUT):\n");
+	std::printf("  %-24s %u cargas, %u bits desplazados (palabra %s)\n", "entrada", bootLoads, bootShifts,
+		bootShifts + 1 >= MixerControllerBase::BUTTON_INDEX_COUNT ? "completa" : "incompleta");
+	std::printf("  %-24s %u latch\n", "salida", bootLatches);
+	std::printf("Refresco:\n");
+	frameInterval.print("intervalo entre tramas", "us");
+	std::printf("  %-24s %.1f /s\n", "despertares", VirtualTime::getWakeups() / simulated);
+	std::printf("Latencia desde la pulsacion:\n");
+	latencyLeds.print("leds", "us");
+	latencyLine.print("linea en el host", "us");
+	std::printf("  %-24s %u\n", "eventos perdidos", missedEvents);
+	if(bounceUs) {
+		std::printf("Rebotes de %u us:\n", bounceUs);
+		std::printf("  %-24s %u\n", "eventos de mas", extraEvents);
+		std::printf("  %-24s %u\n", "botones enmascarados", maskedButtons);
+	}
+#ifdef TSL_TALLY
+	if(tallySecond >= 0) {
+		std::printf("Senalizacion TSL:\n");
+		std::printf("  %-24s %u enviados, %u recibidos, %u erroneos\n", "mensajes",
+			tslSwitcher.getSent(), tslTally.getMessages(), tslTally.getErrors());
+		latencyTally.print("ultimo byte a los leds", "us");
+		std::printf("  %-24s %u\n", "sin verse al final", unsigned(tslSwitcher.getUnseen()));
+	}
+#elif defined(CAN_LINK) && !defined(MIDI_OUTPUT)
+	if(tallySecond >= 0) {
+		std::printf("Enlace CAN:\n");
+		std::printf("  %-24s %u\n", "acciones de otro panel", tally.getSent());
+	}
+#else
+	if(tallySecond >= 0) {
+		latencyTally.print("tally MIDI a los leds", "us");
+	}
+#endif
+#ifdef MIDI_OUTPUT
+	std::printf("USART (MIDI, canal %d):\n", MIDI_CHANNEL);
+#else
+	std::printf("USART (texto):\n");
+#endif
+	backlog.print("pendiente al transmitir", "B");
+	std::printf("  %-24s %llu B (%.2f%% ocupada a %d baudios)\n", "enviados",
+		(unsigned long long)bytesSent, 100.0 * bytesSent * 10 / HOST_BAUD / simulated, HOST_BAUD);
+	std::printf("  %-24s %.2f B\n", "por evento del mezclador", eventCount ? double(eventBytes) / eventCount : 0.0);
+#ifdef MIDI_OUTPUT
+	std::printf("  %-24s %u\n", "mensajes descartados", midi().getDropped());
+#else
+	std::printf("  %-24s %u\n", "lineas descartadas", events().getDropped());
+#endif
+	std::printf("Flash:\n");
+	std::printf("  %-24s %u paginas, %u borrados, %llu ms bloqueada\n", "diario y macros",
+		SimFlash::getPageWrites(), SimFlash::getErases(), (unsigned long long)(SimFlash::getStallUs() / 1000));
+
+	const BlackBoxReplay::Totals& replayed = blackBoxReplay.getTotals();
+	if(dumpSecond >= 0) {
+		std::printf("Caja negra (reproducida):\n");
+		std::printf("  %-24s %u volcados, %u bloques, %u veces desde SYNC\n", "recibido",
+			replayed.dumps, replayed.blocks, replayed.restores);
+		std::printf("  %-24s %u tramas, %u comprobaciones\n", "reproducido", replayed.frames, replayed.checked);
+		std::printf("  %-24s %u\n", "discrepancias", replayed.mismatches);
+		if(replayed.mismatches) {
+			std::printf("  %-24s %s\n", "primera", blackBoxReplay.getFirstMismatch().c_str());
+		}
+	}
+
+	if(tracePath && !writeTrace(tracePath)) {
+		return 1;
+	}
+	return (replayed.mismatches || missedEvents) ? 1 : 0;
+}
@@ -0,0 +1,450 @@
+/**
+ * \file
+ * \brief Simulacion del enlace directo con el mezclador de video
+ * (SwitcherLink) frente a un emulador del mezclador, en tiempo virtual, para
+ * medir el tiempo de ida y vuelta de las ordenes y comprobar que el mezclador
+ * acaba en el mismo estado que el panel.
+ *
+ * El emulador separa las tramas por su longitud y, si una se queda a medias,
+ * por el silencio de la linea; comprueba la suma y responde con ACK o NAK
+ * tras un tiempo de proceso. El ruido corrompe bytes en ambos sentidos, lo
+ * que provoca NAK, respuestas perdidas y resincronizaciones. Un operador
+ * guiado por una semilla realiza acciones sueltas y, de vez en cuando,
+ * rafagas rapidas que llenan la cola.
+ *
+ * Desde el directorio del firmware (code/):
+ *   g++ -O2 -Isim -o switcher-sim sim/SwitcherSimulation.cpp sim/VirtualTime.cpp sim/mbed.cpp
+ *   ./switcher-sim [-t segundos] [-s semilla] [-i ms] [-p us] [-e ruido]
+ *     -t: Tiempo simulado (600 por defecto)
+ *     -s: Semilla del operador y del ruido (1 por defecto)
+ *     -i: Intervalo medio entre acciones en ms (400 por defecto)
+ *     -p: Tiempo de proceso del mezclador en us (1000 por defecto)
+ *     -e: Probabilidad de que el ruido corrompa un byte (0 por defecto)
+ */
+
+#include "mbed.h"
+#include "SimStats.h"
+#include "../SwitcherLink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include <unistd.h>
+
+static const size_t SIGNAL_CNT = 8;
+static const uint32_t LOOP_US = 200; //Periodo de las pasadas del bucle principal
+static const uint32_t GAP_US = 2000; //Silencio que separa tramas en el emulador
+static const size_t BURST_ACTIONS = 12;
+static const uint32_t BURST_GAP_US = 2000;
+static const PinName PANEL_TX = SIM_NODE0;
+static const PinName SWITCHER_TX = static_cast<PinName>(SIM_NODE0 + 1);
+
+typedef SwitcherLinkBase::Action Action;
+
+//Codigos de orden del emulador. Los de un mezclador real salen de su manual
+static const uint8_t CODES[SwitcherLinkBase::ACTION_COUNT] = {0xC1, 0xC2, 0xC5, 0xC6};
+
+
+
+//Modelo de la linea
+static uint32_t panelBytes;
+static uint32_t switcherBytes;
+static uint32_t noisy;
+static double noiseRate;
+static uint32_t noiseSeed;
+
+static uint32_t noise(uint32_t n) {
+	noiseSeed = noiseSeed * 1103515245U + 12345U;
+	return (noiseSeed >> 8) % n;
+}
+
+static char addNoise(char c) {
+	if(noiseRate > 0 && noise(1000000) < noiseRate * 1000000) {
+		c ^= static_cast<char>(1 << noise(8));
+		++noisy;
+	}
+	return c;
+}
+
+
+
+//Medidas
+static Stats roundTrip; //Desde el primer byte de la trama hasta el ACK
+static Stats convergence; //Desde la accion hasta que el mezclador coincide con el panel
+static std::deque<uint64_t> pendingActions; //Instantes de las acciones sin converger
+static void checkConvergence();
+
+///Estado reducido del mezclador: programa y preseleccion
+struct Mixer {
+	uint8_t	program;
+	uint8_t	preview;
+
+	Mixer()
+		: program(0)
+		, preview(1)
+	{
+	}
+
+	void apply(Action action, size_t sig) {
+		switch(action) {
+			case SwitcherLinkBase::ACTION_PROGRAM:
+				program = static_cast<uint8_t>(sig);
+				break;
+			case SwitcherLinkBase::ACTION_PREVIEW:
+				preview = static_cast<uint8_t>(sig);
+				break;
+			default:
+				std::swap(program, preview);
+				break;
+		}
+	}
+
+	bool operator==(const Mixer& other) const {
+		return program == other.program && preview == other.preview;
+	}
+};
+
+
+
+/**
+ * \brief Emulador del mezclador: recibe las tramas, las aplica y responde
+ */
+class Switcher : public TimerEvent {
+	public:
+		explicit Switcher(uint32_t processUs)
+			: m_serial(SWITCHER_TX, NC)
+			, m_processUs(processUs)
+			, m_length(0)
+			, m_lastUs(0)
+			, m_applied(0)
+			, m_naks(0)
+			, m_partial(0)
+			, m_junk(0)
+		{
+		}
+
+		void start() {
+			m_serial.baud(SwitcherLinkBase::BAUD);
+			m_serial.format(8, SerialBase::Odd, 1);
+		}
+
+		/**
+		 * \brief Llega un byte del panel
+		 */
+		void receive(uint8_t c) {
+			const uint64_t now = VirtualTime::now();
+			if(m_length && now - m_lastUs > GAP_US) {
+				++m_partial;
+				m_length = 0;
+			}
+			m_lastUs = now;
+			if(!m_length && (c < 3 || c > SwitcherLinkBase::COUNT_MAX)) {
+				++m_junk;
+				return;
+			}
+			m_frame[m_length++] = c;
+			if(m_length == size_t(m_frame[0]) + 1) {
+				m_received.push_back(std::vector<uint8_t>(m_frame, m_frame + m_length));
+				m_length = 0;
+				if(!isScheduled()) {
+					schedule(now + m_processUs);
+				}
+			}
+		}
+
+		const Mixer& getMixer() const {
+			return m_mixer;
+		}
+
+		uint32_t getApplied() const {
+			return m_applied;
+		}
+
+		uint32_t getNaks() const {
+			return m_naks;
+		}
+
+		uint32_t getPartial() const {
+			return m_partial;
+		}
+
+		uint32_t getJunk() const {
+			return m_junk;
+		}
+
+	protected:
+		///Fin del proceso de la trama mas antigua
+		virtual void fire() {
+			const std::vector<uint8_t>& frame = m_received.front();
+			uint8_t address;
+			Action action;
+			size_t source;
+			if(SwitcherLinkBase::decode(&frame[0], frame.size(), CODES, address, action, source)
+					&& address == SwitcherLinkBase::EFFECTS_ADDRESS) {
+				m_mixer.apply(action, source);
+				++m_applied;
+				m_serial.putc(SwitcherLinkBase::ACK);
+				checkConvergence();
+			} else {
+				++m_naks;
+				m_serial.putc(SwitcherLinkBase::NAK);
+			}
+			m_received.pop_front();
+			if(!m_received.empty()) {
+				schedule(VirtualTime::now() + m_processUs);
+			}
+		}
+
+	private:
+		RawSerial			m_serial;
+		const uint32_t	m_processUs;
+		Mixer					m_mixer;
+		uint8_t				m_frame[SwitcherLinkBase::FRAME_MAX];
+		size_t				m_length;
+		uint64_t			m_lastUs;
+		std::deque<std::vector<uint8_t> >	m_received;
+		uint32_t			m_applied;
+		uint32_t			m_naks;
+		uint32_t			m_partial; ///<Tramas cortadas por el silencio
+		uint32_t			m_junk; ///<Bytes descartados fuera de trama
+};
+
+static Switcher* switcher;
+
+
+
+/**
+ * \brief Panel: aplica sus acciones al momento y las envia al mezclador
+ */
+class Panel : public TimerEvent {
+	public:
+		Panel()
+			: m_serial(PANEL_TX, NC)
+			, m_link(m_serial, *this, CODES)
+			, m_acked(0)
+			, m_fails(0)
+		{
+		}
+
+		void start() {
+			m_link.start();
+			schedule(VirtualTime::now() + LOOP_US);
+		}
+
+		void receive(char c) {
+			m_serial.receive(c);
+		}
+
+		void act(Action action, uint8_t sig) {
+			m_mixer.apply(action, sig);
+			m_link.queue(action, sig);
+			checkConvergence();
+		}
+
+		void onSwitcherFail(Action) {
+			++m_fails;
+		}
+
+		void onSwitcherResync() {
+			m_link.queue(SwitcherLinkBase::ACTION_PROGRAM, m_mixer.program);
+			m_link.queue(SwitcherLinkBase::ACTION_PREVIEW, m_mixer.preview);
+		}
+
+		const Mixer& getMixer() const {
+			return m_mixer;
+		}
+
+		const SwitcherLink<RawSerial, Panel>& getLink() const {
+			return m_link;
+		}
+
+		uint32_t getFails() const {
+			return m_fails;
+		}
+
+	protected:
+		///Una pasada del bucle principal
+		virtual void fire() {
+			//Las tramas duran mas que LOOP_US: como mucho un ACK por pasada
+			if(m_link.getAcked() != m_acked) {
+				m_acked = m_link.getAcked();
+				roundTrip.add(m_link.getRoundTripUs());
+			}
+			if(m_link.hasEvents()) {
+				m_link.process();
+			}
+			schedule(getDeadline() + LOOP_US);
+		}
+
+	private:
+		RawSerial												m_serial;
+		SwitcherLink<RawSerial, Panel>	m_link;
+		Mixer														m_mixer;
+		uint32_t												m_acked;
+		uint32_t												m_fails;
+};
+
+static Panel* panel;
+
+static void checkConvergence() {
+	if(!(panel->getMixer() == switcher->getMixer())) {
+		return;
+	}
+	const uint64_t now = VirtualTime::now();
+	while(!pendingActions.empty()) {
+		convergence.add(now - pendingActions.front());
+		pendingActions.pop_front();
+	}
+}
+
+void SimBoard::write(PinName, int) {
+}
+
+int SimBoard::read(PinName) {
+	return 0;
+}
+
+void SimBoard::transmit(PinName tx, char c) {
+	if(tx == PANEL_TX) {
+		++panelBytes;
+		switcher->receive(static_cast<uint8_t>(addNoise(c)));
+	} else if(tx == SWITCHER_TX) {
+		++switcherBytes;
+		panel->receive(addNoise(c));
+	}
+}
+
+
+
+/**
+ * \brief Operador guiado por una semilla. De vez en cuando hace una rafaga
+ * de acciones seguidas, como al recorrer fuentes en la preseleccion
+ */
+class Operator : public TimerEvent {
+	public:
+		Operator(uint32_t seed, uint32_t intervalMs)
+			: m_seed(seed)
+			, m_intervalMs(intervalMs)
+			, m_burst(0)
+			, m_actions(0)
+			, m_bursts(0)
+		{
+		}
+
+		void start() {
+			schedule(VirtualTime::now() + 1000000);
+		}
+
+		uint32_t getActions() const {
+			return m_actions;
+		}
+
+		uint32_t getBursts() const {
+			return m_bursts;
+		}
+
+	protected:
+		virtual void fire() {
+			if(!m_burst && !random(8)) {
+				m_burst = BURST_ACTIONS;
+				++m_bursts;
+			}
+			const Action action = static_cast<Action>(random(SwitcherLinkBase::ACTION_COUNT));
+			const uint8_t sig = static_cast<uint8_t>(random(SIGNAL_CNT));
+			pendingActions.push_back(VirtualTime::now());
+			++m_actions;
+			panel->act(action, sig);
+			if(m_burst) {
+				--m_burst;
+				schedule(VirtualTime::now() + BURST_GAP_US);
+			} else {
+				schedule(VirtualTime::now() + 1000ULL * (m_intervalMs / 2 + random(m_intervalMs + 1)));
+			}
+		}
+
+	private:
+		uint32_t	m_seed;
+		uint32_t	m_intervalMs;
+		size_t		m_burst; ///<Acciones que quedan de la rafaga
+		uint32_t	m_actions;
+		uint32_t	m_bursts;
+
+		uint32_t random(uint32_t n) {
+			m_seed = m_seed * 1664525U + 1013904223U;
+			return (m_seed >> 8) % n;
+		}
+};
+
+
+
+int main(int argc, char** argv) {
+	uint32_t seconds = 600;
+	uint32_t seed = 1;
+	uint32_t intervalMs = 400;
+	uint32_t processUs = 1000;
+	int option;
+	while((option = getopt(argc, argv, "t:s:i:p:e:")) != -1) {
+		switch(option) {
+			case 't': seconds = std::strtoul(optarg, 0, 10); break;
+			case 's': seed = std::strtoul(optarg, 0, 10); break;
+			case 'i': intervalMs = std::strtoul(optarg, 0, 10); break;
+			case 'p': processUs = std::strtoul(optarg, 0, 10); break;
+			case 'e': noiseRate = std::strtod(optarg, 0); break;
+			default:
+				std::fprintf(stderr, "uso: %s [-t segundos] [-s semilla] [-i ms] [-p us] [-e ruido]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(intervalMs < 1) {
+		std::fprintf(stderr, "intervalo de al menos 1ms\n");
+		return 2;
+	}
+	noiseSeed = seed;
+
+	switcher = new Switcher(processUs);
+	panel = new Panel();
+	switcher->start();
+	panel->start();
+
+	Operator op(seed, intervalMs);
+	op.start();
+
+	VirtualTime::setEnd(seconds * 1000000ULL);
+	const std::clock_t start = std::clock();
+	try {
+		for(;;) {
+			VirtualTime::waitForInterrupt();
+		}
+	} catch(const VirtualTime::End&) {
+	}
+	const double wall = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+	typedef SwitcherLink<RawSerial, Panel> Link;
+	const Link& link = panel->getLink();
+	const uint32_t byteUs = SwitcherLinkBase::frameUs(1);
+	const uint32_t idealUs = SwitcherLinkBase::frameUs(SwitcherLinkBase::FRAME_MAX) + processUs + byteUs;
+	const double simulated = VirtualTime::now() / 1e6;
+	std::printf("Simulados %.0f s en %.2f s (x%.0f), semilla %u\n",
+		simulated, wall, wall > 0 ? simulated / wall : 0.0, seed);
+	std::printf("Linea (%d baudios 8O1, %u us por byte, proceso %u us):\n",
+		SwitcherLinkBase::BAUD, byteUs, processUs);
+	std::printf("  %-24s %u del panel, %u del mezclador, %u con ruido\n", "bytes",
+		panelBytes, switcherBytes, noisy);
+	std::printf("  %-24s %u confirmadas, %u repeticiones, %u NAK\n", "tramas",
+		link.getAcked(), link.getRetries(), switcher->getNaks());
+	std::printf("  %-24s %u cortadas, %u bytes fuera de trama\n", "sincronismo",
+		switcher->getPartial(), switcher->getJunk());
+	roundTrip.print("ida y vuelta", "us");
+	std::printf("  %-24s %u us (trama + proceso + ACK), maximo del enlace %u us\n", "ideal",
+		idealUs, link.getRoundTripMaxUs());
+	std::printf("Acciones (%u, %u rafagas):\n", op.getActions(), op.getBursts());
+	std::printf("  %-24s %u sustituidas, %u descartadas, %u fallidas, %u cortes sin ACK\n", "cola",
+		link.getCoalesced(), link.getDropped(), panel->getFails(), link.getResyncs());
+	convergence.print("convergencia", "us");
+	std::printf("  %-24s %u, estado final %s\n", "sin converger al final", unsigned(pendingActions.size()),
+		panel->getMixer() == switcher->getMixer() ? "igual" : "distinto");
+	return 0;
+}
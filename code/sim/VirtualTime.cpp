@@ -0,0 +1,117 @@
+#include "VirtualTime.h"
+
+#include <algorithm>
+
+uint64_t VirtualTime::s_now = 0;
+uint64_t VirtualTime::s_end = ~uint64_t(0);
+uint64_t VirtualTime::s_wakeups = 0;
+bool VirtualTime::s_masked = false;
+unsigned VirtualTime::s_critical = 0;
+bool VirtualTime::s_inInterrupt = false;
+
+std::vector<TimerEvent*>& VirtualTime::events() {
+	static std::vector<TimerEvent*>* list = new std::vector<TimerEvent*>();
+	return *list;
+}
+
+
+
+TimerEvent::TimerEvent()
+	: m_deadline(0)
+	, m_scheduled(false)
+{
+}
+
+TimerEvent::~TimerEvent() {
+	cancel();
+}
+
+void TimerEvent::schedule(uint64_t deadline) {
+	if(!m_scheduled) {
+		VirtualTime::events().push_back(this);
+	}
+	m_deadline = deadline;
+	m_scheduled = true;
+}
+
+void TimerEvent::cancel() {
+	if(m_scheduled) {
+		std::vector<TimerEvent*>& events = VirtualTime::events();
+		events.erase(std::find(events.begin(), events.end(), this));
+		m_scheduled = false;
+	}
+}
+
+
+
+void VirtualTime::setEnd(uint64_t end) {
+	s_end = end;
+}
+
+void VirtualTime::waitForInterrupt() {
+	//Con un suceso vencido el nucleo no llega a dormirse
+	if(!nextDue()) {
+		const std::vector<TimerEvent*>& list = events();
+		if(list.empty()) {
+			throw End();
+		}
+
+		uint64_t next = list[0]->m_deadline;
+		for(size_t i = 1; i < list.size(); ++i) {
+			next = std::min(next, list[i]->m_deadline);
+		}
+		if(next > s_end) {
+			s_now = s_end;
+			throw End();
+		}
+		s_now = next;
+		++s_wakeups;
+	}
+	dispatch();
+}
+
+void VirtualTime::stall(uint32_t us) {
+	s_now += us;
+}
+
+void VirtualTime::setMasked(bool masked) {
+	s_masked = masked;
+	dispatch();
+}
+
+void VirtualTime::enterCritical() {
+	++s_critical;
+}
+
+void VirtualTime::exitCritical() {
+	if(s_critical && --s_critical == 0) {
+		dispatch();
+	}
+}
+
+TimerEvent* VirtualTime::nextDue() {
+	const std::vector<TimerEvent*>& list = events();
+	TimerEvent* due = 0;
+	for(size_t i = 0; i < list.size(); ++i) {
+		TimerEvent* event = list[i];
+		if(event->m_deadline <= s_now && (!due || event->m_deadline < due->m_deadline)) {
+			due = event;
+		}
+	}
+	return due;
+}
+
+void VirtualTime::dispatch() {
+	while(isEnabled()) {
+		TimerEvent* event = nextDue();
+		if(!event) {
+			return;
+		}
+
+		//Los sucesos periodicos se vuelven a programar desde fire()
+		event->cancel();
+		s_inInterrupt = true;
+		event->fire();
+		s_inInterrupt = false;
+	}
+}
@@ -0,0 +1,134 @@
+#ifndef VIRTUAL_TIME_H_INCLUDED
+#define VIRTUAL_TIME_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * \brief Suceso programado en tiempo virtual: un Ticker, un Timeout, el fin
+ * de un byte de la USART o una accion del operador. fire() se ejecuta como
+ * una interrupcion
+ */
+class TimerEvent {
+	public:
+		TimerEvent();
+		virtual ~TimerEvent();
+
+		/**
+		 * \brief Programa el suceso. Sustituye a la programacion anterior
+		 * \param deadline: Instante absoluto en microsegundos
+		 */
+		void schedule(uint64_t deadline);
+
+		/**
+		 * \brief Cancela el suceso
+		 */
+		void cancel();
+
+		bool isScheduled() const {
+			return m_scheduled;
+		}
+
+		uint64_t getDeadline() const {
+			return m_deadline;
+		}
+
+	protected:
+		virtual void fire() = 0;
+
+	private:
+		friend class VirtualTime;
+
+		uint64_t	m_deadline;
+		bool			m_scheduled;
+
+};
+
+
+
+/**
+ * \brief Reloj virtual de la simulacion. El tiempo solo avanza cuando el
+ * firmware duerme (__WFI()) o se bloquea con las interrupciones deshabilitadas
+ * (stall(), p.e. al programar la flash), por lo que el codigo se ejecuta en
+ * tiempo cero y el resultado no depende del ordenador.
+ *
+ * Las interrupciones se modelan como en el Cortex-M: un suceso vencido se
+ * ejecuta en cuanto estan habilitadas, y si no queda pendiente hasta que se
+ * habilitan. No se anidan.
+ */
+class VirtualTime {
+	public:
+		///Se lanza desde __WFI() al llegar al final de la simulacion
+		struct End {};
+
+		/**
+		 * \brief Devuelve el instante actual en microsegundos
+		 */
+		static uint64_t now() {
+			return s_now;
+		}
+
+		/**
+		 * \brief Fija el final de la simulacion
+		 */
+		static void setEnd(uint64_t end);
+
+		/**
+		 * \brief Duerme hasta el siguiente suceso y lo ejecuta si las
+		 * interrupciones estan habilitadas (__WFI())
+		 */
+		static void waitForInterrupt();
+
+		/**
+		 * \brief Avanza el tiempo sin atender interrupciones
+		 */
+		static void stall(uint32_t us);
+
+		///PRIMASK (__disable_irq() / __enable_irq())
+		static void setMasked(bool masked);
+
+		///Secciones criticas anidadas de mbed
+		static void enterCritical();
+		static void exitCritical();
+
+		/**
+		 * \brief Devuelve el numero de veces que se ha dormido
+		 */
+		static uint64_t getWakeups() {
+			return s_wakeups;
+		}
+
+	private:
+		friend class TimerEvent;
+
+		static uint64_t									s_now;
+		static uint64_t									s_end;
+		static uint64_t									s_wakeups;
+		static bool											s_masked;
+		static unsigned									s_critical;
+		static bool											s_inInterrupt;
+
+		/**
+		 * \brief Sucesos programados. No se destruye, ya que los objetos
+		 * estaticos del firmware se cancelan al salir
+		 */
+		static std::vector<TimerEvent*>& events();
+
+		static bool isEnabled() {
+			return !s_masked && s_critical == 0 && !s_inInterrupt;
+		}
+
+		/**
+		 * \brief Devuelve el suceso vencido mas antiguo, o 0
+		 */
+		static TimerEvent* nextDue();
+
+		/**
+		 * \brief Ejecuta los sucesos vencidos, si las interrupciones lo permiten
+		 */
+		static void dispatch();
+
+};
+
+#endif //VIRTUAL_TIME_H_INCLUDED
@@ -0,0 +1,84 @@
+#include "mbed.h"
+
+uint32_t SystemCoreClock = 96000000;
+SimDwt simDwt;
+SimCoreDebug simCoreDebug;
+
+
+
+RawSerial::RawSerial(PinName tx, PinName rx, int baudrate)
+	: m_tx(tx)
+	, m_byteUs(0)
+	, m_bits(8)
+	, m_frameBits(10)
+	, m_shifting(0)
+{
+	(void)rx;
+	m_shifter.serial = this;
+	baud(baudrate);
+}
+
+void RawSerial::baud(int baudrate) {
+	m_byteUs = (1000000 * m_frameBits + baudrate - 1) / baudrate;
+}
+
+void RawSerial::format(int bits, Parity parity, int stopBits) {
+	const int baudrate = (1000000 * m_frameBits) / m_byteUs;
+	m_bits = bits;
+	m_frameBits = 1 + bits + (parity != None ? 1 : 0) + stopBits;
+	baud(baudrate);
+}
+
+int RawSerial::putc(int c) {
+	//Como el hardware, un byte con la FIFO llena se pierde
+	if(m_txFifo.size() < FIFO_SIZE) {
+		m_txFifo.push_back(static_cast<char>(c));
+	}
+	if(!m_shifter.isScheduled()) {
+		startShift();
+	}
+	return c;
+}
+
+int RawSerial::getc() {
+	//Como el hardware, getc() espera a que llegue un byte
+	while(m_rxFifo.empty()) {
+		VirtualTime::waitForInterrupt();
+	}
+	const char c = m_rxFifo.front();
+	m_rxFifo.pop_front();
+	return static_cast<unsigned char>(c);
+}
+
+int RawSerial::writeable() {
+	return m_txFifo.size() < FIFO_SIZE;
+}
+
+int RawSerial::readable() {
+	return !m_rxFifo.empty();
+}
+
+void RawSerial::attach(Callback<void()> function, IrqType type) {
+	m_irq[type].function = function;
+}
+
+void RawSerial::receive(char c) {
+	m_rxFifo.push_back(c);
+	m_irq[RxIrq].raise();
+}
+
+void RawSerial::startShift() {
+	m_shifting = m_txFifo.front();
+	m_txFifo.pop_front();
+	m_shifter.schedule(VirtualTime::now() + m_byteUs);
+	if(m_txFifo.empty()) {
+		m_irq[TxIrq].raise();
+	}
+}
+
+void RawSerial::onShifted() {
+	SimBoard::transmit(m_tx, m_shifting);
+	if(!m_txFifo.empty()) {
+		startShift();
+	}
+}
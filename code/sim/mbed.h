@@ -0,0 +1,475 @@
+#ifndef SIM_MBED_H_INCLUDED
+#define SIM_MBED_H_INCLUDED
+
+/**
+ * \file
+ * \brief Sustituto de mbed.h para la simulacion en el ordenador. Solo
+ * contiene lo que usa el firmware, sobre el reloj virtual (VirtualTime):
+ * Ticker y Timeout programan sucesos, __WFI() duerme hasta el siguiente,
+ * RawSerial transmite a la velocidad configurada, CAN se conecta a un bus
+ * compartido (SimCanBus) y los pines se conectan al modelo de la placa
+ * (SimBoard), que proporciona la simulacion.
+ */
+
+#include "VirtualTime.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+#include <deque>
+
+///Pines del LPC1768 que usa el firmware
+enum PinName {
+	p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20,
+	p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+	USBTX, USBRX,
+	LED1, LED2, LED3, LED4,
+	SIM_NODE0, ///<Pines de simulaciones con varias placas: SIM_NODE0 + n
+	SIM_NODE_LAST = SIM_NODE0 + 63,
+	PIN_COUNT,
+	NC = -1
+};
+
+/**
+ * \brief Modelo de la placa: registros de desplazamiento, operador y host.
+ * Lo implementa el programa de simulacion
+ */
+struct SimBoard {
+	static void write(PinName pin, int value);
+	static int read(PinName pin);
+	static void transmit(PinName tx, char c); ///<Fin de la transmision de un byte
+};
+
+
+
+template<typename F>
+class Callback;
+
+/**
+ * \brief Funcion o metodo sin argumentos, como mbed::Callback<void()>
+ */
+template<>
+class Callback<void()> {
+	public:
+		Callback()
+			: m_thunk(0)
+			, m_object(0)
+			, m_function(0)
+		{
+		}
+
+		Callback(void (*function)())
+			: m_thunk(function ? &callFunction : 0)
+			, m_object(0)
+			, m_function(function)
+		{
+		}
+
+		template<typename T>
+		Callback(T* object, void (T::*method)())
+			: m_thunk(&callMethod<T>)
+			, m_object(object)
+			, m_function(0)
+		{
+			typedef char MethodSizeCheck[(sizeof(method) <= sizeof(m_method)) ? 1 : -1];
+			(void)sizeof(MethodSizeCheck);
+			std::memcpy(m_method, &method, sizeof(method));
+		}
+
+		void call() const {
+			if(m_thunk) {
+				m_thunk(*this);
+			}
+		}
+
+		void operator()() const {
+			call();
+		}
+
+		operator bool() const {
+			return m_thunk != 0;
+		}
+
+	private:
+		void				(*m_thunk)(const Callback&);
+		void*				m_object;
+		void				(*m_function)();
+		char				m_method[2 * sizeof(void*)];
+
+		static void callFunction(const Callback& cb) {
+			cb.m_function();
+		}
+
+		template<typename T>
+		static void callMethod(const Callback& cb) {
+			void (T::*method)();
+			std::memcpy(&method, cb.m_method, sizeof(method));
+			(static_cast<T*>(cb.m_object)->*method)();
+		}
+};
+
+template<typename T>
+Callback<void()> callback(T* object, void (T::*method)()) {
+	return Callback<void()>(object, method);
+}
+
+inline Callback<void()> callback(void (*function)()) {
+	return Callback<void()>(function);
+}
+
+
+
+/**
+ * \brief Interrupcion periodica. Como en mbed, cada vencimiento se programa
+ * desde el anterior, por lo que no acumula deriva
+ */
+class Ticker : public TimerEvent {
+	public:
+		Ticker()
+			: m_periodUs(0)
+		{
+		}
+
+		void attach_us(Callback<void()> function, uint32_t us) {
+			m_function = function;
+			m_periodUs = us;
+			schedule(VirtualTime::now() + us);
+		}
+
+		void attach(Callback<void()> function, float seconds) {
+			attach_us(function, static_cast<uint32_t>(seconds * 1000000.0f));
+		}
+
+		void detach() {
+			cancel();
+		}
+
+	protected:
+		Callback<void()>	m_function;
+		uint32_t					m_periodUs;
+
+		virtual void fire() {
+			schedule(getDeadline() + m_periodUs);
+			m_function.call();
+		}
+};
+
+/**
+ * \brief Interrupcion unica
+ */
+class Timeout : public Ticker {
+	protected:
+		virtual void fire() {
+			m_function.call();
+		}
+};
+
+
+
+class DigitalOut {
+	public:
+		explicit DigitalOut(PinName pin, int value = 0)
+			: m_pin(pin)
+			, m_value(value)
+		{
+			SimBoard::write(m_pin, m_value);
+		}
+
+		void write(int value) {
+			m_value = value ? 1 : 0;
+			SimBoard::write(m_pin, m_value);
+		}
+
+		int read() const {
+			return m_value;
+		}
+
+		DigitalOut& operator=(int value) {
+			write(value);
+			return *this;
+		}
+
+		operator int() const {
+			return m_value;
+		}
+
+	private:
+		PinName	m_pin;
+		int			m_value;
+};
+
+class DigitalIn {
+	public:
+		explicit DigitalIn(PinName pin)
+			: m_pin(pin)
+		{
+		}
+
+		int read() const {
+			return SimBoard::read(m_pin);
+		}
+
+		operator int() const {
+			return read();
+		}
+
+	private:
+		PinName	m_pin;
+};
+
+
+
+class SerialBase {
+	public:
+		enum Parity {
+			None = 0,
+			Odd,
+			Even,
+			Forced1,
+			Forced0
+		};
+
+		enum IrqType {
+			RxIrq = 0,
+			TxIrq,
+
+			IrqCnt
+		};
+};
+
+/**
+ * \brief USART con FIFO de transmision de 16 bytes. La interrupcion de
+ * transmision (THRE) salta cuando la FIFO se vacia; el ultimo byte aun se
+ * esta desplazando
+ */
+class RawSerial : public SerialBase {
+	public:
+		RawSerial(PinName tx, PinName rx, int baud = 9600);
+
+		void baud(int baudrate);
+		void format(int bits = 8, Parity parity = None, int stopBits = 1);
+
+		int putc(int c);
+		int getc();
+		int writeable();
+		int readable();
+
+		void attach(Callback<void()> function, IrqType type = RxIrq);
+
+		/**
+		 * \brief Simulacion: llega un byte del host
+		 */
+		void receive(char c);
+
+	private:
+		static const size_t FIFO_SIZE = 16;
+
+		///Linea de interrupcion de la USART
+		class Irq : public TimerEvent {
+			public:
+				Callback<void()> function;
+				void raise() {
+					schedule(VirtualTime::now());
+				}
+			protected:
+				virtual void fire() {
+					function.call();
+				}
+		};
+
+		///Fin del byte que se esta desplazando
+		class Shifter : public TimerEvent {
+			public:
+				RawSerial* serial;
+			protected:
+				virtual void fire() {
+					serial->onShifted();
+				}
+		};
+
+		PinName						m_tx;
+		uint32_t					m_byteUs;
+		int								m_bits;
+		int								m_frameBits;
+		std::deque<char>	m_txFifo;
+		std::deque<char>	m_rxFifo;
+		char							m_shifting;
+		Shifter						m_shifter;
+		Irq								m_irq[IrqCnt];
+
+		void startShift();
+		void onShifted();
+};
+
+
+
+enum CANFormat {
+	CANStandard = 0,
+	CANExtended = 1,
+	CANAny = 2
+};
+
+enum CANType {
+	CANData = 0,
+	CANRemote = 1
+};
+
+struct CAN_Message {
+	unsigned int	id;
+	unsigned char	data[8];
+	unsigned char	len;
+	CANFormat			format;
+	CANType				type;
+};
+
+class CANMessage : public CAN_Message {
+	public:
+		CANMessage() {
+			len = 8;
+			type = CANData;
+			format = CANStandard;
+			id = 0;
+			std::memset(data, 0, 8);
+		}
+
+		CANMessage(int _id, const char* _data, char _len = 8, CANType _type = CANData, CANFormat _format = CANStandard) {
+			len = _len & 0xF;
+			type = _type;
+			format = _format;
+			id = _id;
+			std::memset(data, 0, 8);
+			std::memcpy(data, _data, len);
+		}
+};
+
+/**
+ * \brief Controlador CAN conectado al bus simulado (SimCanBus), con tres
+ * buffers de transmision y uno de recepcion como el del LPC1768: una trama
+ * que llega con el buffer lleno se pierde
+ */
+class CAN {
+	public:
+		enum IrqType {
+			RxIrq = 0,
+			TxIrq,
+
+			IrqCnt
+		};
+
+		CAN(PinName rd, PinName td);
+		~CAN();
+
+		int frequency(int hz);
+		int write(CANMessage msg);
+		int read(CANMessage& msg, int handle = 0);
+		void attach(Callback<void()> function, IrqType type = RxIrq);
+
+		/**
+		 * \brief Simulacion: conecta o desconecta el nodo del bus, p.e. para
+		 * simular que se apaga. Al desconectarlo se vacian sus buffers
+		 */
+		void setConnected(bool connected);
+
+		bool isConnected() const {
+			return m_connected;
+		}
+
+		/**
+		 * \brief Simulacion: tramas perdidas con el buffer de recepcion lleno
+		 */
+		uint32_t getOverruns() const {
+			return m_overruns;
+		}
+
+	private:
+		friend class SimCanBus;
+
+		static const size_t TX_BUFFERS = 3;
+
+		///Linea de interrupcion del controlador
+		class Irq : public TimerEvent {
+			public:
+				Callback<void()> function;
+				void raise() {
+					if(function) {
+						schedule(VirtualTime::now());
+					}
+				}
+			protected:
+				virtual void fire() {
+					function.call();
+				}
+		};
+
+		bool							m_connected;
+		std::deque<CANMessage>	m_tx;
+		std::deque<uint64_t>	m_txQueuedUs; ///<Instante en que entro cada trama
+		CANMessage				m_rx;
+		bool							m_rxFull;
+		uint32_t					m_overruns;
+		Irq								m_irq[IrqCnt];
+};
+
+
+
+inline uint32_t us_ticker_read() {
+	return static_cast<uint32_t>(VirtualTime::now());
+}
+
+inline void wait_us(int us) {
+	VirtualTime::stall(us);
+}
+
+inline void core_util_critical_section_enter() {
+	VirtualTime::enterCritical();
+}
+
+inline void core_util_critical_section_exit() {
+	VirtualTime::exitCritical();
+}
+
+inline void __disable_irq() {
+	VirtualTime::setMasked(true);
+}
+
+inline void __enable_irq() {
+	VirtualTime::setMasked(false);
+}
+
+inline void __WFI() {
+	VirtualTime::waitForInterrupt();
+}
+
+inline uint32_t __CLZ(uint32_t value) {
+	return value ? __builtin_clz(value) : 32;
+}
+
+
+
+extern uint32_t SystemCoreClock;
+
+///DWT->CYCCNT cuenta al ritmo del reloj virtual
+struct SimCycleCount {
+	operator uint32_t() const {
+		return static_cast<uint32_t>(VirtualTime::now() * (SystemCoreClock / 1000000));
+	}
+};
+
+struct SimDwt {
+	uint32_t			CTRL;
+	SimCycleCount	CYCCNT;
+};
+
+struct SimCoreDebug {
+	uint32_t	DEMCR;
+};
+
+extern SimDwt simDwt;
+extern SimCoreDebug simCoreDebug;
+
+#define DWT (&simDwt)
+#define CoreDebug (&simCoreDebug)
+#define DWT_CTRL_CYCCNTENA_Msk 1U
+#define CoreDebug_DEMCR_TRCENA_Msk (1U << 24)
+
+#endif //SIM_MBED_H_INCLUDED
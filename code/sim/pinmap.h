@@ -0,0 +1,44 @@
+#ifndef SIM_PINMAP_H_INCLUDED
+#define SIM_PINMAP_H_INCLUDED
+
+/**
+ * \file
+ * \brief Sustituto de pinmap.h y de los registros del LPC1768 que usa
+ * MatchSerialInSerialOut (SCAN_MODE_TIMER). Ese modo no se simula: solo se
+ * declaran para que main.cpp compile, y no se definen
+ */
+
+#include "mbed.h"
+
+#include <stdint.h>
+
+enum {
+	P0_6 = p8,
+	P0_7 = p7,
+	P0_8 = p6
+};
+
+enum IRQn_Type {
+	TIMER2_IRQn = 3
+};
+
+struct SimTimerRegisters {
+	uint32_t	IR, TCR, TC, PR, PC, MCR, MR0, MR1, MR2, MR3, CCR, CR0, CR1, EMR, CTCR;
+};
+
+struct SimSystemControlRegisters {
+	uint32_t	PCONP, PCLKSEL0, PCLKSEL1;
+};
+
+extern SimTimerRegisters simTimer2;
+extern SimSystemControlRegisters simSystemControl;
+
+#define LPC_TIM2 (&simTimer2)
+#define LPC_SC (&simSystemControl)
+
+void pin_function(int pin, int function);
+void NVIC_SetVector(IRQn_Type irq, uint32_t vector);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+
+#endif //SIM_PINMAP_H_INCLUDED